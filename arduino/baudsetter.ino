@@ -45,9 +45,10 @@ void setup() {
 
 void loop() {
     if(!configured) {
-        if(at_commander_set_baud(&config, 115200)) {
+        // Changes the baud, reboots the RN-42 and follows it to the new rate
+        if(at_commander_switch_baud(&config, 115200)) {
             configured = true;
-            at_commander_reboot(&config);
+            at_commander_exit_command_mode(&config);
         } else {
             delay(5000);
         }
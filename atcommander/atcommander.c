@@ -1,8 +1,21 @@
 #include "atcommander.h"
+#include "atprivate.h"
+#include "atscan.h"
 
 #include <stddef.h>
 #include <string.h>
+#include <stdlib.h>
+
+// Building with AT_COMMANDER_MINIMAL replaces vsnprintf with a tiny built-in
+// formatter (only %d and %s), writes formatted requests directly to the device
+// and compiles out all logging, so stdio isn't linked in at all.
+#ifdef AT_COMMANDER_MINIMAL
+#define at_commander_vsnprintf(buffer, length, format, args) \
+        at_commander_format_request(NULL, buffer, length, format, args)
+#else
 #include <stdio.h>
+#define at_commander_vsnprintf vsnprintf
+#endif
 
 // TODO hard coded max of 128 - I've never seen one anywhere near this
 // long so we're probably OK.
@@ -11,12 +24,57 @@
 #define AT_COMMANDER_RETRY_DELAY_MS 50
 #define AT_COMMANDER_MAX_RESPONSE_LENGTH 8
 #define AT_COMMANDER_MAX_RETRIES 3
+// The XBee accepts much longer lines, but stay well under its command buffer
+// so a long chain doesn't get silently truncated.
+#define AT_COMMANDER_XBEE_MAX_CHAINED_LINE_LENGTH 64
+#define AT_COMMANDER_RN42_DEFAULT_CONFIGURATION_TIMER_S 60
+// The RN-42 never leaves command mode with a configuration timer of 255.
+#define AT_COMMANDER_RN42_CONTINUOUS_CONFIGURATION 255
+#define AT_COMMANDER_XBEE_DEFAULT_COMMAND_MODE_TIMEOUT_S 10
+#define AT_COMMANDER_XBEE_DEFAULT_GUARD_TIME_MS 1000
+// Restart a command mode session if it's this close to expiring, instead of
+// risking the device timing out halfway through a command.
+#define AT_COMMANDER_SESSION_MARGIN_MS 500
+// The throughput check's pattern counts modulo a prime (so it doesn't line up
+// with byte boundaries), sent a chunk at a time. A byte up to MAX_GAP ahead of
+// the one expected is taken as the ones in between having been lost.
+#define AT_COMMANDER_THROUGHPUT_PERIOD 251
+#define AT_COMMANDER_THROUGHPUT_CHUNK_SIZE 32
+#define AT_COMMANDER_THROUGHPUT_MAX_GAP 16
+// How long after an inquiry's scan time to wait for the device to report the
+// end of the inquiry.
+#define AT_COMMANDER_INQUIRY_MARGIN_MS 2000
+// Link quality readings are a single byte.
+#define AT_COMMANDER_MAX_LINK_QUALITY 255
+// Requests in a row that get no response at all, beyond those of a single
+// request and its retries, before a session that seemed to be open is taken as
+// lost to a reset - one alone may be a dropped byte.
+#define AT_COMMANDER_RESET_SILENT_RESPONSES 1
+// How long a Hayes modem may take between the lines of a reply - most answer
+// at once, but e.g. a network registration query can take a while.
+#define AT_COMMANDER_HAYES_FINAL_RESULT_TIMEOUT_MS 1000
 
+#ifdef AT_COMMANDER_MINIMAL
+#define at_commander_debug(config, ...)
+#else
 #define at_commander_debug(config, ...) \
     if(config->log_function != NULL) { \
         config->log_function(__VA_ARGS__); \
         config->log_function("\r\n"); \
     }
+#endif
+
+// Depending on the firmware version, the RN-42 rejects a query with "ERR" or
+// just "?".
+static const char* const RN42_ERROR_RESPONSES[] = { "ERR*", "\\?", NULL };
+
+// Sent by the RN-42 as it restarts, depending on its status string setting.
+static const char* const RN42_RESET_SIGNATURES[] = { "REBOOT", "%REBOOT",
+    NULL };
+
+// What ends a line in a received chunk.
+static const AtCommanderScanner LINE_ENDINGS = { { '\r', '\n' }, 2,
+    { (1UL << '\r') | (1UL << '\n') } };
 
 const AtCommanderPlatform AT_PLATFORM_RN42 = {
     AT_COMMANDER_DEFAULT_RESPONSE_DELAY_MS,
@@ -29,235 +87,2464 @@ const AtCommanderPlatform AT_PLATFORM_RN42 = {
     { "R,1\r", "Reboot!" },
     { "SN,%s\r", "AOK" },
     { "S-,%s\r", "AOK" },
-    { "GN\r", NULL, "ERR" },
-    { "GB\r", NULL, "ERR" },
+    { "GN\r", NULL, "ERR", NULL, RN42_ERROR_RESPONSES },
+    { "GB\r", NULL, "ERR", NULL, RN42_ERROR_RESPONSES },
+    0,
+    AT_COMMANDER_RN42_DEFAULT_CONFIGURATION_TIMER_S,
+    false,
+    0,
+    { "D\r", NULL, "ERR", NULL, RN42_ERROR_RESPONSES },
+    { "E\r", NULL, "ERR", NULL, RN42_ERROR_RESPONSES },
+    { "V\r", NULL, "ERR", NULL, RN42_ERROR_RESPONSES },
+    { "IN,%d\r", "Inquiry Done", "ERR", NULL, RN42_ERROR_RESPONSES },
+    { "L\r", NULL, "ERR", NULL, RN42_ERROR_RESPONSES },
+    { "L\r", NULL },
+    RN42_RESET_SIGNATURES,
 };
 
 const AtCommanderPlatform AT_PLATFORM_XBEE = {
-    3000,
+    AT_COMMANDER_DEFAULT_RESPONSE_DELAY_MS,
     xbee_baud_rate_mapper,
     { "+++", "OK" },
-    { NULL, NULL },
+    { "ATCN\r\n", "OK" },
     { "ATBD %d\r\n", "OK" },
+    { NULL, NULL },
     { "ATWR\r\n", "OK" },
     { NULL, NULL },
     { NULL, NULL },
     { NULL, NULL },
     { NULL, NULL },
     { NULL, NULL },
+    AT_COMMANDER_XBEE_MAX_CHAINED_LINE_LENGTH,
+    AT_COMMANDER_XBEE_DEFAULT_COMMAND_MODE_TIMEOUT_S,
+    true,
+    AT_COMMANDER_XBEE_DEFAULT_GUARD_TIME_MS,
+    { NULL, NULL },
+    { NULL, NULL },
+    { "ATVR\r\n", NULL, "ERROR" },
+    { NULL, NULL },
+    { "ATDB\r\n", NULL, "ERROR" },
+    { NULL, NULL },
+};
+
+// Final result codes that end a Hayes modem's reply with a failure - from
+// V.250, 3GPP TS 27.007 (mobile equipment) and 27.005 (SMS) errors.
+static const char* const HAYES_ERROR_RESULT_CODES[] = { "ERROR",
+    "+CME ERROR*", "+CMS ERROR*", "NO CARRIER", "BUSY", "NO ANSWER",
+    "NO DIALTONE", NULL };
+
+// Printed as the modem finishes booting by the SIM800 and ESP8266.
+static const char* const HAYES_RESET_SIGNATURES[] = { "RDY", "ready", NULL };
+
+const AtCommanderPlatform AT_PLATFORM_HAYES = {
+    0,
+    hayes_baud_rate_mapper,
+    { "AT\r", "OK" },
+    { NULL, NULL },
+    { "AT+IPR=%d\r", "OK" },
+    { NULL, NULL },
+    { "AT&W\r", "OK" },
+    { NULL, NULL },
+    { NULL, NULL },
+    { NULL, NULL },
+    { NULL, NULL },
+    { "AT+CGSN\r", "OK" },
+    0,
+    0,
+    false,
+    0,
+    { NULL, NULL },
+    { NULL, NULL },
+    { "AT+GMR\r", "OK" },
+    { NULL, NULL },
+    { NULL, NULL },
+    { NULL, NULL },
+    HAYES_RESET_SIGNATURES,
+    HAYES_ERROR_RESULT_CODES,
+    AT_COMMANDER_HAYES_FINAL_RESULT_TIMEOUT_MS,
+    { "ATE0\r", "OK" },
 };
 
+const AtCommanderPlatform* const AT_PLATFORMS[] = { &AT_PLATFORM_RN42,
+    &AT_PLATFORM_XBEE };
+const int AT_PLATFORM_COUNT = sizeof(AT_PLATFORMS) /
+        sizeof(AtCommanderPlatform*);
+
+const int VALID_BAUD_RATES[] = {230400, 115200, 9600, 19200, 38400, 57600,
+    460800};
+const int VALID_BAUD_RATE_COUNT = sizeof(VALID_BAUD_RATES) / sizeof(int);
+
+void at_commander_lock(AtCommanderConfig* config) {
+    if(config->lock_function != NULL) {
+        config->lock_function(config->device);
+    }
+}
+
+void at_commander_unlock(AtCommanderConfig* config) {
+    if(config->unlock_function != NULL) {
+        config->unlock_function(config->device);
+    }
+}
+
+/** Private: If a millis function is available, return the current time in ms,
+ * otherwise 0.
+ */
+static unsigned long at_commander_millis(AtCommanderConfig* config) {
+    if(config->millis_function != NULL) {
+        return config->millis_function();
+    }
+    return 0;
+}
+
 /** Private: Send an array of bytes to the AT device.
  */
-void at_commander_write(AtCommanderConfig* config, const char* bytes, int size) {
+static void at_commander_write(AtCommanderConfig* config, const char* bytes,
+        int size) {
     int i;
     if(config->write_function != NULL) {
-        /* at_commander_debug(config, "tx: %s", bytes); */
         for(i = 0; i < size; i++) {
             config->write_function(config->device, bytes[i]);
         }
+        config->last_transmit_ms = at_commander_millis(config);
+    }
+}
+
+/** Private: at_commander_write_data, for when the config is already locked.
+ */
+static void write_data(AtCommanderConfig* config, const uint8_t* data,
+        int size) {
+    at_commander_write(config, (const char*)data, size);
+}
+
+void at_commander_write_data(AtCommanderConfig* config, const uint8_t* data,
+        int size) {
+    at_commander_lock(config);
+    write_data(config, data, size);
+    at_commander_unlock(config);
+}
+
+/** Private: Append one character of a formatted request to the buffer, or
+ * write it to the device if there is no buffer.
+ */
+static void format_output(AtCommanderConfig* config, char* buffer,
+        int buffer_length, int* length, char c) {
+    if(buffer == NULL) {
+        if(config->write_function != NULL) {
+            config->write_function(config->device, c);
+        }
+    } else if(*length < buffer_length - 1) {
+        buffer[*length] = c;
+    }
+    (*length)++;
+}
+
+/** Private: Format a request with a minimal subset of printf - only the %d
+ * and %s conversions (and %%) used by the command tables are supported.
+ *
+ * If buffer is NULL, the request is written directly to the device instead of
+ * being stored. Otherwise it is truncated to fit buffer_length, including the
+ * NULL terminator.
+ *
+ * Returns the length of the whole formatted request, like vsnprintf.
+ */
+int at_commander_format_request(AtCommanderConfig* config, char* buffer,
+        int buffer_length, const char* format, va_list args) {
+    int length = 0;
+    const char* c;
+    for(c = format; *c != '\0'; c++) {
+        if(*c != '%' || *(c + 1) == '\0') {
+            format_output(config, buffer, buffer_length, &length, *c);
+            continue;
+        }
+
+        c++;
+        if(*c == 'd') {
+            int value = va_arg(args, int);
+            unsigned int magnitude = value < 0 ? -(unsigned int)value :
+                    (unsigned int)value;
+            char digits[10];
+            int digit_count = 0;
+            if(value < 0) {
+                format_output(config, buffer, buffer_length, &length, '-');
+            }
+            do {
+                digits[digit_count++] = '0' + magnitude % 10;
+                magnitude /= 10;
+            } while(magnitude > 0);
+            while(digit_count > 0) {
+                format_output(config, buffer, buffer_length, &length,
+                        digits[--digit_count]);
+            }
+        } else if(*c == 's') {
+            const char* value = va_arg(args, const char*);
+            for(; value != NULL && *value != '\0'; value++) {
+                format_output(config, buffer, buffer_length, &length, *value);
+            }
+        } else {
+            format_output(config, buffer, buffer_length, &length, *c);
+        }
+    }
+
+    if(buffer == NULL) {
+        config->last_transmit_ms = at_commander_millis(config);
+    } else if(buffer_length > 0) {
+        buffer[length < buffer_length ? length : buffer_length - 1] = '\0';
+    }
+    return length;
+}
+
+/** Private: Format a request and send it to the device.
+ */
+static void write_request(AtCommanderConfig* config, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+#ifdef AT_COMMANDER_MINIMAL
+    at_commander_format_request(config, NULL, 0, format, args);
+#else
+    char request[AT_COMMANDER_MAX_REQUEST_LENGTH];
+    vsnprintf(request, AT_COMMANDER_MAX_REQUEST_LENGTH, format, args);
+    at_commander_write(config, request, strlen(request));
+#endif
+    va_end(args);
+}
+
+/** Private: Record that a command was just sent to the device.
+ */
+static void at_commander_touch(AtCommanderConfig* config) {
+    config->last_activity_ms = at_commander_millis(config);
+}
+
+/** Private: Returns true if the caller's deadline for the current operation
+ * has passed.
+ */
+bool at_commander_deadline_passed(AtCommanderConfig* config) {
+    return config->deadline_active && config->millis_function != NULL &&
+            (long)(at_commander_millis(config) - config->deadline_ms) >= 0;
+}
+
+/** Private: Check that the caller's deadline hasn't passed before starting a
+ * new request.
+ *
+ * Returns true if there's still time to send a request.
+ */
+static bool deadline_allows_request(AtCommanderConfig* config) {
+    if(at_commander_deadline_passed(config)) {
+        at_commander_debug(config, "Deadline passed, not sending request");
+        return false;
+    }
+    return true;
+}
+
+/** Private: at_commander_set_deadline, for when the config is already locked.
+ */
+static void set_deadline(AtCommanderConfig* config,
+        unsigned long timeout_ms) {
+    config->deadline_ms = at_commander_millis(config) + timeout_ms;
+    config->deadline_active = true;
+}
+
+void at_commander_set_deadline(AtCommanderConfig* config,
+        unsigned long timeout_ms) {
+    at_commander_lock(config);
+    set_deadline(config, timeout_ms);
+    at_commander_unlock(config);
+}
+
+/** Private: at_commander_clear_deadline, for when the config is already locked.
+ */
+static void clear_deadline(AtCommanderConfig* config) {
+    config->deadline_active = false;
+}
+
+void at_commander_clear_deadline(AtCommanderConfig* config) {
+    at_commander_lock(config);
+    clear_deadline(config);
+    at_commander_unlock(config);
+}
+
+/** Private: Returns the given time, cut short if the caller's deadline would
+ * pass first - 0 if it already has.
+ */
+static unsigned long within_deadline_ms(AtCommanderConfig* config,
+        unsigned long ms) {
+    if(config->deadline_active && config->millis_function != NULL) {
+        long remaining = (long)(config->deadline_ms -
+                at_commander_millis(config));
+        if(remaining <= 0) {
+            return 0;
+        } else if((unsigned long)remaining < ms) {
+            return remaining;
+        }
     }
+    return ms;
 }
 
 /** Private: If a delay function is available, delay the given time, otherwise
  * just continue.
+ *
+ * The delay is cut short if the caller's deadline would pass first.
  */
 void at_commander_delay_ms(AtCommanderConfig* config, unsigned long ms) {
     if(config->delay_function != NULL) {
-        config->delay_function(ms);
+        ms = within_deadline_ms(config, ms);
+        if(ms > 0) {
+            config->delay_function(ms);
+        }
+    }
+}
+
+/** Private: Wait up to the given time for received data, with the
+ * wait_function if there is one, otherwise delay the whole time.
+ */
+static void at_commander_wait_for_data(AtCommanderConfig* config,
+        unsigned long ms) {
+    if(config->wait_function != NULL) {
+        ms = within_deadline_ms(config, ms);
+        if(ms > 0) {
+            config->wait_function(config->device, ms);
+        }
+    } else {
+        at_commander_delay_ms(config, ms);
+    }
+}
+
+/** Private: Returns a pseudo-random number for jitter, from a per-config
+ * xorshift generator (so there's no shared state between devices).
+ */
+static uint32_t retry_random(AtCommanderConfig* config) {
+    uint32_t x = (uint32_t)config->retry_seed;
+    if(x == 0) {
+        x = (uint32_t)at_commander_millis(config) ^ 0x9e3779b9;
+    }
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    config->retry_seed = x;
+    return x;
+}
+
+/** Private: Decide whether to make another attempt at a failed request, and if
+ * so wait out the backoff first.
+ *
+ * attempts - the number of attempts made so far.
+ *
+ * Returns true if the request should be attempted again.
+ */
+static bool retry_after_backoff(AtCommanderConfig* config,
+        AtCommanderRetryClass retry_class, int attempts) {
+    const AtCommanderRetryPolicy* policy =
+            &config->retry_policies[retry_class];
+    if(attempts >= policy->max_attempts ||
+            at_commander_deadline_passed(config)) {
+        return false;
+    }
+
+    unsigned long backoff = policy->initial_backoff_ms;
+    int i;
+    for(i = 1; i < attempts && (policy->max_backoff_ms == 0 ||
+                backoff < policy->max_backoff_ms); i++) {
+        backoff *= 2;
+    }
+    if(policy->max_backoff_ms > 0 && backoff > policy->max_backoff_ms) {
+        backoff = policy->max_backoff_ms;
+    }
+    if(policy->jitter_percent > 0 && backoff > 0) {
+        unsigned long jitter = backoff * policy->jitter_percent / 100;
+        backoff -= retry_random(config) % (jitter + 1);
+    }
+
+    at_commander_debug(config, "Retrying in %lu ms (attempt %d of %d)",
+            backoff, attempts + 1, policy->max_attempts);
+    at_commander_delay_ms(config, backoff);
+    return true;
+}
+
+/** Private: Decide whether to retry a read that returned no data, and if so
+ * wait before the next attempt.
+ *
+ * With both a millis_function and a delay_function (or wait_function) the read
+ * times out once max_retries * AT_COMMANDER_RETRY_DELAY_MS have actually
+ * elapsed since it started, no matter how long each read or delay really took.
+ * Otherwise it falls back to counting retries. A max_retries of 0 retries
+ * forever (or until the deadline passes).
+ *
+ * With a wait_function and a clock, the wait is for the rest of the timeout,
+ * ending early when data arrives.
+ *
+ * Returns true if the read should be retried.
+ */
+static bool read_should_retry(AtCommanderConfig* config,
+        unsigned long started_ms, int* retries, int max_retries) {
+    if(at_commander_deadline_passed(config)) {
+        return false;
+    }
+
+    unsigned long wait_ms = AT_COMMANDER_RETRY_DELAY_MS;
+    if(max_retries > 0) {
+        if(config->millis_function != NULL && (config->delay_function != NULL
+                    || config->wait_function != NULL)) {
+            unsigned long elapsed_ms = at_commander_millis(config) -
+                    started_ms;
+            unsigned long timeout_ms = (unsigned long)max_retries *
+                    AT_COMMANDER_RETRY_DELAY_MS;
+            if(elapsed_ms >= timeout_ms) {
+                return false;
+            } else if(config->wait_function != NULL) {
+                wait_ms = timeout_ms - elapsed_ms;
+            }
+        } else if(*retries >= max_retries) {
+            return false;
+        }
+    }
+
+    at_commander_wait_for_data(config, wait_ms);
+    (*retries)++;
+    return true;
+}
+
+/** Private: Copy what has already arrived, up to the next line ending, into
+ * the buffer with the transport's bulk receive, and consume it and the line
+ * ending.
+ *
+ * Returns the line ending, 0 if the buffer filled up before one, or -1 if
+ * nothing has arrived.
+ */
+static int read_chunk(AtCommanderConfig* config, char* buffer, int size,
+        int* bytes_read) {
+    int length;
+    const uint8_t* chunk = config->peek_function(config->device, &length);
+    if(chunk == NULL || length <= 0) {
+        return -1;
+    }
+
+    int room = size - *bytes_read;
+    int end = at_commander_scan_copy(&LINE_ENDINGS, chunk, length,
+            buffer + *bytes_read, room);
+    int copied = end < room ? end : room;
+    *bytes_read += copied;
+    if(copied < end || end == length) {
+        config->consume_function(config->device, copied);
+        return 0;
+    }
+    config->consume_function(config->device, end + 1);
+    return chunk[end];
+}
+
+/** Private: Read multiple bytes from Serial into the buffer.
+ *
+ * Continues to try and read each byte from Serial until a maximum number of
+ * retries (or the equivalent time, if a clock is available) or the deadline.
+ *
+ * Returns the number of bytes actually read - may be less than size.
+ */
+int at_commander_read(AtCommanderConfig* config, char* buffer, int size,
+        int max_retries) {
+    int bytes_read = 0;
+    int retries = 0;
+    unsigned long started_ms = at_commander_millis(config);
+    bool sawCarraigeReturn = false;
+    while(bytes_read < size) {
+        int byte;
+        if(config->peek_function != NULL) {
+            byte = read_chunk(config, buffer, size, &bytes_read);
+            if(byte == 0) {
+                continue;
+            }
+        } else {
+            byte = config->read_function(config->device);
+            if(byte != -1 && byte != '\r' && byte != '\n') {
+                buffer[bytes_read++] = byte;
+            }
+        }
+
+        if(byte == -1) {
+            if(!read_should_retry(config, started_ms, &retries,
+                        max_retries)) {
+                break;
+            }
+        }
+
+        if(bytes_read > 1) {
+            if(byte == '\r') {
+                sawCarraigeReturn = true;
+            } else if(sawCarraigeReturn && byte == '\n') {
+                break;
+            }
+        }
+    }
+    return bytes_read;
+}
+
+/** Private: Read a single line from Serial into the buffer, stopping at the
+ * first carriage return or newline after some content.
+ *
+ * Unlike at_commander_read, a lone '\r' ends the line - the XBee terminates
+ * each reply of a chained command with just a carriage return.
+ *
+ * Returns the number of bytes actually read, not including the line ending.
+ */
+int at_commander_read_line(AtCommanderConfig* config, char* buffer, int size,
+        int max_retries) {
+    int bytes_read = 0;
+    int retries = 0;
+    unsigned long started_ms = at_commander_millis(config);
+    while(bytes_read < size) {
+        int byte;
+        if(config->peek_function != NULL) {
+            byte = read_chunk(config, buffer, size, &bytes_read);
+        } else {
+            byte = config->read_function(config->device);
+            if(byte != -1 && byte != '\r' && byte != '\n') {
+                buffer[bytes_read++] = byte;
+                continue;
+            }
+        }
+
+        if(byte == -1) {
+            if(!read_should_retry(config, started_ms, &retries,
+                        max_retries)) {
+                break;
+            }
+        } else if((byte == '\r' || byte == '\n') && bytes_read > 0) {
+            break;
+        }
+    }
+    return bytes_read;
+}
+
+/** Private: Follow any '*' in the pattern from the positions in state - a '*'
+ * may match nothing, so the position after it is reachable too.
+ */
+static uint32_t pattern_closure(const AtCommanderPattern* pattern,
+        uint32_t state) {
+    uint32_t previous;
+    do {
+        previous = state;
+        state |= (state & pattern->star_mask) << 1;
+    } while(state != previous);
+    return state;
+}
+
+/** Private: Add a pattern to a matcher.
+ *
+ * prefix - if true, the pattern matches any line that starts with it.
+ *
+ * Returns false if the matcher is full or the pattern is too long.
+ */
+static bool compile_pattern(AtCommanderMatcher* matcher, const char* pattern,
+        bool error, bool prefix) {
+    if(pattern == NULL) {
+        return true;
+    }
+
+    int length = strlen(pattern);
+    if(matcher->count >= AT_COMMANDER_MAX_PATTERNS ||
+            length > AT_COMMANDER_MAX_PATTERN_LENGTH) {
+        return false;
+    }
+
+    AtCommanderPattern* compiled = &matcher->patterns[matcher->count++];
+    compiled->pattern = pattern;
+    compiled->length = length;
+    compiled->error = error;
+    compiled->star_mask = 0;
+    int i;
+    for(i = 0; i < length; i++) {
+        if(pattern[i] == '\\') {
+            // The next character is literal, so can't be a '*'
+            i++;
+        } else if(pattern[i] == '*') {
+            compiled->star_mask |= (uint32_t)1 << i;
+        }
+    }
+
+    if(prefix) {
+        // Anything may follow a prefix - as if it ended with a '*'
+        compiled->star_mask |= (uint32_t)1 << length;
+    }
+    return true;
+}
+
+/** Private: Compile a NULL terminated list of patterns into a matcher.
+ */
+static bool compile_patterns(AtCommanderMatcher* matcher,
+        const char* const* patterns, bool error) {
+    for(; patterns != NULL && *patterns != NULL; patterns++) {
+        if(!compile_pattern(matcher, *patterns, error, false)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool at_commander_compile_matcher(AtCommanderMatcher* matcher,
+        const AtCommand* command) {
+    matcher->count = 0;
+    bool success = compile_patterns(matcher, command->error_responses, true)
+            && compile_pattern(matcher, command->error_response, true, true)
+            && compile_patterns(matcher, command->success_responses, false)
+            && compile_pattern(matcher, command->expected_response, false,
+                false);
+    at_commander_reset_matcher(matcher);
+    return success;
+}
+
+void at_commander_reset_matcher(AtCommanderMatcher* matcher) {
+    int i;
+    for(i = 0; i < matcher->count; i++) {
+        matcher->states[i] = pattern_closure(&matcher->patterns[i], 1);
+    }
+}
+
+/** Private: Returns true if the pattern has matched, no matter what else
+ * follows on the line.
+ */
+static bool pattern_matched_early(const AtCommanderPattern* pattern,
+        uint32_t state) {
+    uint32_t end = (uint32_t)1 << pattern->length;
+    return (state & end) && (pattern->star_mask & (end | end >> 1));
+}
+
+int at_commander_matcher_feed(AtCommanderMatcher* matcher, char byte) {
+    bool alive = false;
+    bool success = false;
+    bool error = false;
+    int i;
+    for(i = 0; i < matcher->count; i++) {
+        const AtCommanderPattern* pattern = &matcher->patterns[i];
+        uint32_t state = matcher->states[i];
+        uint32_t next = 0;
+        int position;
+        for(position = 0; state != 0 && position <= pattern->length;
+                position++, state >>= 1) {
+            if(!(state & 1)) {
+                continue;
+            }
+
+            uint32_t bit = (uint32_t)1 << position;
+            if(pattern->star_mask & bit) {
+                next |= bit;
+            } else if(position >= pattern->length) {
+                continue;
+            } else if(pattern->pattern[position] == '\\') {
+                // An escaped character takes up two positions of the pattern
+                if(position + 1 < pattern->length &&
+                        pattern->pattern[position + 1] == byte) {
+                    next |= bit << 2;
+                }
+            } else if(pattern->pattern[position] == '?' ||
+                    pattern->pattern[position] == byte) {
+                next |= bit << 1;
+            }
+        }
+
+        matcher->states[i] = next = pattern_closure(pattern, next);
+        if(next != 0) {
+            alive = true;
+            if(pattern_matched_early(pattern, next)) {
+                if(pattern->error) {
+                    error = true;
+                } else {
+                    success = true;
+                }
+            }
+        }
+    }
+
+    if(error) {
+        return AT_COMMANDER_MATCH_ERROR;
+    } else if(success) {
+        return AT_COMMANDER_MATCH_SUCCESS;
+    } else if(!alive) {
+        return AT_COMMANDER_MATCH_NONE;
+    }
+    return AT_COMMANDER_MATCH_PENDING;
+}
+
+int at_commander_matcher_finish(AtCommanderMatcher* matcher) {
+    int result = AT_COMMANDER_MATCH_NONE;
+    int i;
+    for(i = 0; i < matcher->count; i++) {
+        const AtCommanderPattern* pattern = &matcher->patterns[i];
+        if(matcher->states[i] & ((uint32_t)1 << pattern->length)) {
+            if(pattern->error) {
+                return AT_COMMANDER_MATCH_ERROR;
+            }
+            result = AT_COMMANDER_MATCH_SUCCESS;
+        }
+    }
+    return result;
+}
+
+/** Private: Returns true if the command lists alternative responses, and so
+ * should be checked with a matcher.
+ */
+static bool command_has_patterns(const AtCommand* command) {
+    return command->success_responses != NULL ||
+            command->error_responses != NULL;
+}
+
+/** Private: Read a response line, feeding each byte to a matcher as it
+ * arrives (and storing it in the buffer, if there is one).
+ *
+ * The matcher may have a verdict before the end of the line, but the rest is
+ * still read (waiting for it as for any other byte) - it's part of the reply,
+ * and would otherwise be left to confuse the next command.
+ *
+ * length - set to the number of bytes stored in the buffer.
+ *
+ * Returns the verdict, or AT_COMMANDER_MATCH_NONE if nothing was received.
+ */
+static int read_matched_line(AtCommanderConfig* config,
+        AtCommanderMatcher* matcher, char* buffer, int size, int* length) {
+    int bytes_read = 0;
+    int retries = 0;
+    unsigned long started_ms = at_commander_millis(config);
+    int verdict = AT_COMMANDER_MATCH_PENDING;
+
+    at_commander_reset_matcher(matcher);
+    while(true) {
+        int byte = config->read_function(config->device);
+        if(byte == -1) {
+            if(!read_should_retry(config, started_ms, &retries,
+                        AT_COMMANDER_MAX_RETRIES)) {
+                break;
+            }
+        } else if(byte == '\r' || byte == '\n') {
+            if(bytes_read > 0) {
+                break;
+            }
+        } else {
+            if(buffer != NULL && bytes_read < size) {
+                buffer[bytes_read] = byte;
+            }
+            bytes_read++;
+            if(verdict == AT_COMMANDER_MATCH_PENDING) {
+                verdict = at_commander_matcher_feed(matcher, byte);
+            }
+        }
+    }
+
+    if(verdict == AT_COMMANDER_MATCH_PENDING) {
+        verdict = bytes_read > 0 ? at_commander_matcher_finish(matcher) :
+                AT_COMMANDER_MATCH_NONE;
+    }
+
+    *length = bytes_read < size ? bytes_read : size;
+    return verdict;
+}
+
+/** Private: Compare a response received from a device with some expected
+ *      output.
+ *
+ * Returns true if the reponse matches content and length, otherwise false.
+ */
+bool at_commander_check_response(AtCommanderConfig* config,
+        const char* response, int response_length, const char* expected,
+        int expected_length) {
+    if(response_length == expected_length && !strncmp(response, expected,
+                expected_length)) {
+        return true;
+    }
+
+    if(response_length != expected_length) {
+        at_commander_debug(config,
+                "Expected %d bytes in response but received %d",
+                expected_length, response_length);
+    }
+
+    if(response_length > 0) {
+        at_commander_debug(config, "Expected \"%s\" (%d bytes) in response "
+                "but got \"%s\" (%d bytes)", expected, expected_length,
+                response, response_length);
+    }
+    return false;
+}
+
+/** Private: Feed a whole line to a matcher.
+ *
+ * complete - if false, the line may go on, so a verdict may still be pending.
+ *
+ * Returns the verdict.
+ */
+static int match_line(AtCommanderMatcher* matcher, const char* line, int length,
+        bool complete) {
+    at_commander_reset_matcher(matcher);
+    int verdict = AT_COMMANDER_MATCH_PENDING;
+    int i;
+    for(i = 0; i < length && verdict == AT_COMMANDER_MATCH_PENDING; i++) {
+        verdict = at_commander_matcher_feed(matcher, line[i]);
+    }
+    if(verdict == AT_COMMANDER_MATCH_PENDING && complete) {
+        verdict = at_commander_matcher_finish(matcher);
+    }
+    return verdict;
+}
+
+/** Private: Match a line, or the start of one, against the platform's reset
+ * signatures.
+ *
+ * Returns AT_COMMANDER_MATCH_SUCCESS if it's a signature, or
+ * AT_COMMANDER_MATCH_PENDING if the rest of the line could still make it one.
+ */
+static int match_reset_signature(AtCommanderConfig* config, const char* line,
+        int length, bool complete) {
+    const char* const* signatures = config->platform.reset_signatures;
+    if(signatures == NULL) {
+        return AT_COMMANDER_MATCH_NONE;
+    } else if(config->reset_matcher_signatures != signatures) {
+        AtCommand command = { NULL, NULL, NULL, signatures, NULL };
+        if(!at_commander_compile_matcher(&config->reset_matcher, &command)) {
+            // Signatures that don't fit never match
+            config->reset_matcher.count = 0;
+        }
+        config->reset_matcher_signatures = signatures;
+    }
+
+    return match_line(&config->reset_matcher, line, length, complete);
+}
+
+/** Private: Record that the device has reset and left command mode, so the
+ * next command restores the session first.
+ */
+static void mark_reset(AtCommanderConfig* config) {
+    config->connected = false;
+    config->silent_responses = 0;
+    if(!config->restore_pending) {
+        config->restore_pending = true;
+        config->resets++;
+        config->reset_detected_ms = at_commander_millis(config);
+    }
+}
+
+/** Private: Returns how many requests in a row may get no response before
+ * it's taken as a reset - more than a single request and its retries.
+ */
+static int silent_response_limit(AtCommanderConfig* config) {
+    int attempts = 1;
+    int retry_class;
+    for(retry_class = AT_COMMANDER_RETRY_SET;
+            retry_class <= AT_COMMANDER_RETRY_GET; retry_class++) {
+        if(config->retry_policies[retry_class].max_attempts > attempts) {
+            attempts = config->retry_policies[retry_class].max_attempts;
+        }
+    }
+    return attempts + AT_COMMANDER_RESET_SILENT_RESPONSES;
+}
+
+/** Private: Check the response to a request made in command mode for the
+ * signs of a reset: a reset signature, bytes garbled as if at the wrong baud
+ * rate, or no response to several requests in a row.
+ *
+ * Returns true if the device has reset.
+ */
+static bool response_shows_reset(AtCommanderConfig* config,
+        const char* response, int length) {
+    if(!config->connected) {
+        return false;
+    } else if(length == 0) {
+        if(++config->silent_responses < silent_response_limit(config)) {
+            return false;
+        }
+        at_commander_debug(config, "No response to %d requests, device reset",
+                config->silent_responses);
+        mark_reset(config);
+        return true;
+    }
+
+    config->silent_responses = 0;
+    int i;
+    for(i = 0; i < length; i++) {
+        if((uint8_t)response[i] < ' ' || (uint8_t)response[i] > '~') {
+            at_commander_debug(config, "Garbled response, device reset");
+            mark_reset(config);
+            return true;
+        }
+    }
+    if(match_reset_signature(config, response, length, true) ==
+            AT_COMMANDER_MATCH_SUCCESS) {
+        at_commander_debug(config, "Reset signature in response, device "
+                "reset");
+        mark_reset(config);
+        return true;
+    }
+    return false;
+}
+
+/** Private: at_commander_detect_reset, for when the config is already locked.
+ */
+static bool detect_reset(AtCommanderConfig* config, const char* line) {
+    if(match_reset_signature(config, line, strlen(line), true) !=
+            AT_COMMANDER_MATCH_SUCCESS) {
+        return false;
+    }
+    at_commander_debug(config, "Device reset: %s", line);
+    mark_reset(config);
+    return true;
+}
+
+bool at_commander_detect_reset(AtCommanderConfig* config, const char* line) {
+    at_commander_lock(config);
+    bool reset = detect_reset(config, line);
+    at_commander_unlock(config);
+    return reset;
+}
+
+/** Private: Returns true if the platform's replies end with a final result
+ * code.
+ */
+static bool has_final_result_codes(AtCommanderConfig* config) {
+    return config->platform.error_result_codes != NULL;
+}
+
+/** Private: Compile the patterns that end a reply with a final result code -
+ * the command's own, and the platform's error result codes.
+ *
+ * expected_response - the success result code, if not the command's.
+ */
+static bool compile_final_result_codes(AtCommanderConfig* config,
+        AtCommanderMatcher* matcher, const AtCommand* command,
+        const char* expected_response) {
+    AtCommand final_result = { NULL, expected_response, NULL, NULL, NULL };
+    if(command != NULL) {
+        final_result = *command;
+    }
+    if(!at_commander_compile_matcher(matcher, &final_result) ||
+            !compile_patterns(matcher, config->platform.error_result_codes,
+                true)) {
+        at_commander_debug(config, "Unable to compile final result codes");
+        return false;
+    }
+    return true;
+}
+
+/** Private: Returns true if a line is the device echoing a request back.
+ *
+ * Only the part of the request before any arguments is compared, as a minimal
+ * build doesn't keep the formatted request.
+ */
+static bool is_echo(const char* request, const char* line) {
+    int length = strcspn(request, "%\r\n");
+    return length > 0 && !strncmp(line, request, length);
+}
+
+/** Private: Read a reply line by line up to its final result code, skipping
+ * the echo of the request.
+ *
+ * Each line is awaited for up to the platform's final_result_timeout_ms, so
+ * the reply is complete as soon as the final result code arrives.
+ *
+ * request - the request just sent, to recognize its echo.
+ * line_callback - if not NULL, called with each information line before the
+ *      final result code, its length and the context.
+ * line_count - set to the number of information lines.
+ *
+ * Returns AT_COMMANDER_MATCH_SUCCESS or AT_COMMANDER_MATCH_ERROR depending on
+ * the final result code, or AT_COMMANDER_MATCH_NONE if there wasn't one.
+ */
+static int read_final_result(AtCommanderConfig* config,
+        AtCommanderMatcher* matcher, const char* request,
+        void (*line_callback)(const char* line, int length, void* context),
+        void* context, int* line_count) {
+    int retries = config->platform.final_result_timeout_ms /
+            AT_COMMANDER_RETRY_DELAY_MS + 1;
+    char line[AT_COMMANDER_MAX_LINE_LENGTH];
+    int length;
+    bool first = true;
+    *line_count = 0;
+    while((length = at_commander_read_line(config, line, sizeof(line) - 1,
+                    retries)) > 0) {
+        line[length] = '\0';
+        if(first && is_echo(request, line)) {
+            first = false;
+            continue;
+        }
+        first = false;
+
+        int verdict = match_line(matcher, line, length, true);
+        if(verdict == AT_COMMANDER_MATCH_SUCCESS ||
+                verdict == AT_COMMANDER_MATCH_ERROR) {
+            config->silent_responses = 0;
+            return verdict;
+        } else if(response_shows_reset(config, line, length)) {
+            return AT_COMMANDER_MATCH_NONE;
+        }
+
+        if(line_callback != NULL) {
+            line_callback(line, length, context);
+        }
+        (*line_count)++;
+    }
+
+    at_commander_debug(config, "No final result code in reply");
+    if(first) {
+        response_shows_reset(config, line, 0);
+    }
+    return AT_COMMANDER_MATCH_NONE;
+}
+
+/** Private: The buffer that the first information line of a reply is copied
+ * to.
+ */
+typedef struct {
+    char* buffer;
+    int size;
+    int length;
+    bool copied;
+} FirstLine;
+
+/** Private: A read_final_result line callback, copying the first line.
+ */
+static void copy_first_line(const char* line, int length, void* context) {
+    FirstLine* first_line = (FirstLine*) context;
+    if(!first_line->copied) {
+        first_line->length = length < first_line->size - 1 ? length :
+                first_line->size - 1;
+        memcpy(first_line->buffer, line, first_line->length);
+        first_line->buffer[first_line->length] = '\0';
+        first_line->copied = true;
+    }
+}
+
+/** Private: at_commander_get_request_once, on platforms with final result
+ * codes.
+ */
+static int get_final_result_request(AtCommanderConfig* config,
+        AtCommand* command, char* response_buffer, int response_buffer_length) {
+    response_buffer[0] = '\0';
+    AtCommanderMatcher matcher;
+    if(!compile_final_result_codes(config, &matcher, command, NULL)) {
+        return -1;
+    }
+
+    FirstLine first_line = { response_buffer, response_buffer_length, 0,
+        false };
+    int line_count;
+    if(read_final_result(config, &matcher, command->request_format,
+                copy_first_line, &first_line, &line_count) !=
+            AT_COMMANDER_MATCH_SUCCESS) {
+        return -1;
+    }
+    return first_line.length;
+}
+
+/** Private: Send an AT "get" query once, read a response, and verify it
+ * doesn't match any known errors.
+ *
+ * Returns true if the response isn't a known error state.
+ */
+int at_commander_get_request_once(AtCommanderConfig* config,
+        AtCommand* command, char* response_buffer,
+        int response_buffer_length) {
+    if(!deadline_allows_request(config)) {
+        return -1;
+    }
+
+    at_commander_write(config, command->request_format,
+            strlen(command->request_format));
+    at_commander_touch(config);
+    at_commander_wait_for_data(config, config->platform.response_delay_ms);
+
+    int bytes_read;
+    if(has_final_result_codes(config)) {
+        return get_final_result_request(config, command, response_buffer,
+                response_buffer_length);
+    } else if(command_has_patterns(command)) {
+        AtCommanderMatcher matcher;
+        if(!at_commander_compile_matcher(&matcher, command)) {
+            at_commander_debug(config, "Unable to compile response patterns");
+            return -1;
+        }
+
+        int verdict = read_matched_line(config, &matcher, response_buffer,
+                response_buffer_length - 1, &bytes_read);
+        response_buffer[bytes_read] = '\0';
+        if(response_shows_reset(config, response_buffer, bytes_read)) {
+            return -1;
+        }
+        return verdict == AT_COMMANDER_MATCH_ERROR ? -1 : bytes_read;
+    }
+
+    bytes_read = at_commander_read(config, response_buffer,
+            response_buffer_length - 1, AT_COMMANDER_MAX_RETRIES);
+    response_buffer[bytes_read] = '\0';
+
+    if(response_shows_reset(config, response_buffer, bytes_read)) {
+        return -1;
+    } else if(command->error_response == NULL || strncmp(response_buffer,
+                command->error_response, strlen(command->error_response))) {
+        return bytes_read;
+    }
+    return -1;
+}
+
+/** Private: Before retrying a request, get command mode back if a reset was
+ * detected.
+ *
+ * Returns true if in command mode.
+ */
+static bool resume_session(AtCommanderConfig* config) {
+    return config->connected || at_commander_enter_command_mode(config);
+}
+
+/** Private: Like at_commander_get_request_once, but retried according to the
+ * config's AT_COMMANDER_RETRY_GET policy if there's an error or no response.
+ *
+ * Returns the length of the response, or -1 if it was an error.
+ */
+static int get_request(AtCommanderConfig* config, AtCommand* command,
+        char* response_buffer, int response_buffer_length) {
+    int bytes_read;
+    int attempts = 0;
+    do {
+        bytes_read = at_commander_get_request_once(config, command,
+                response_buffer, response_buffer_length);
+    } while(bytes_read <= 0 && retry_after_backoff(config,
+                AT_COMMANDER_RETRY_GET, ++attempts) &&
+            resume_session(config));
+    return bytes_read;
+}
+
+/** Private: Read the response to an AT command that has just been sent, and
+ * verify it matches the expected value.
+ *
+ * Returns true if the response matches the expected.
+ */
+static bool read_set_response(AtCommanderConfig* config, const char* request,
+        const char* expected_response) {
+    at_commander_touch(config);
+    at_commander_wait_for_data(config, config->platform.response_delay_ms);
+
+    if(has_final_result_codes(config)) {
+        AtCommanderMatcher matcher;
+        int line_count;
+        return compile_final_result_codes(config, &matcher, NULL,
+                    expected_response) &&
+                read_final_result(config, &matcher, request, NULL, NULL,
+                    &line_count) == AT_COMMANDER_MATCH_SUCCESS;
+    }
+
+    // Long enough for the expected response, or a reset signature
+    char response[AT_COMMANDER_MAX_PATTERN_LENGTH + 1];
+    int bytes_read = at_commander_read(config, response, strlen(expected_response),
+            AT_COMMANDER_MAX_RETRIES);
+
+    if(at_commander_check_response(config, response, bytes_read,
+            expected_response, strlen(expected_response))) {
+        config->silent_responses = 0;
+        return true;
+    }
+
+    // Only as much as the expected response was read - if it could be the
+    // start of a reset signature, read the rest of the line too
+    if(bytes_read > 0 && match_reset_signature(config, response, bytes_read,
+                false) == AT_COMMANDER_MATCH_PENDING) {
+        bytes_read += at_commander_read_line(config, response + bytes_read,
+                sizeof(response) - 1 - bytes_read, AT_COMMANDER_MAX_RETRIES);
+    }
+    response_shows_reset(config, response, bytes_read);
+    return false;
+}
+
+/** Private: Send an AT command, read a response, and verify it matches the
+ * expected value.
+ *
+ * Returns true if the response matches the expected.
+ */
+static bool set_request(AtCommanderConfig* config, const char* command,
+        const char* expected_response) {
+    if(!deadline_allows_request(config)) {
+        return false;
+    }
+
+    at_commander_write(config, command, strlen(command));
+    return read_set_response(config, command, expected_response);
+}
+
+/** Private: Format an AT command with the given arguments, send it once, and
+ * verify the response matches the expected value.
+ *
+ * In a minimal build the request is formatted straight to the device, without
+ * an intermediate buffer.
+ *
+ * Returns true if the response matches the expected.
+ */
+static bool vset_request_once(AtCommanderConfig* config, AtCommand* command,
+        va_list args) {
+    if(!deadline_allows_request(config)) {
+        return false;
+    }
+
+#ifdef AT_COMMANDER_MINIMAL
+    at_commander_format_request(config, NULL, 0, command->request_format, args);
+#else
+    char request[AT_COMMANDER_MAX_REQUEST_LENGTH];
+    vsnprintf(request, AT_COMMANDER_MAX_REQUEST_LENGTH,
+            command->request_format, args);
+    at_commander_write(config, request, strlen(request));
+#endif
+
+    if(!command_has_patterns(command)) {
+        return read_set_response(config, command->request_format,
+                command->expected_response);
+    }
+
+    at_commander_touch(config);
+    at_commander_wait_for_data(config, config->platform.response_delay_ms);
+
+    AtCommanderMatcher matcher;
+    if(has_final_result_codes(config)) {
+        int line_count;
+        return compile_final_result_codes(config, &matcher, command, NULL) &&
+                read_final_result(config, &matcher, command->request_format,
+                    NULL, NULL, &line_count) == AT_COMMANDER_MATCH_SUCCESS;
+    } else if(!at_commander_compile_matcher(&matcher, command)) {
+        at_commander_debug(config, "Unable to compile response patterns");
+        return false;
+    }
+
+    char response[AT_COMMANDER_MAX_PATTERN_LENGTH + 1];
+    int length;
+    if(read_matched_line(config, &matcher, response, sizeof(response),
+                &length) == AT_COMMANDER_MATCH_SUCCESS) {
+        config->silent_responses = 0;
+        return true;
+    }
+    response_shows_reset(config, response, length);
+    return false;
+}
+
+/** Private: Like vset_request_once, but retried according to the config's
+ * AT_COMMANDER_RETRY_SET policy.
+ */
+static bool vset_request(AtCommanderConfig* config, AtCommand* command,
+        va_list args) {
+    bool success;
+    int attempts = 0;
+    do {
+        va_list attempt_args;
+        va_copy(attempt_args, args);
+        success = vset_request_once(config, command, attempt_args);
+        va_end(attempt_args);
+    } while(!success && retry_after_backoff(config, AT_COMMANDER_RETRY_SET,
+                ++attempts) && resume_session(config));
+    return success;
+}
+
+/** Private: Like vset_request, but with the arguments passed directly.
+ */
+static bool format_set_request(AtCommanderConfig* config, AtCommand* command,
+        ...) {
+    va_list args;
+    va_start(args, command);
+    bool success = vset_request(config, command, args);
+    va_end(args);
+    return success;
+}
+
+bool at_commander_store_settings(AtCommanderConfig* config) {
+    if(config->platform.store_settings_command.request_format != NULL
+            && config->platform.store_settings_command.expected_response
+                != NULL) {
+        if(set_request(config,
+                config->platform.store_settings_command.request_format,
+                config->platform.store_settings_command.expected_response)) {
+            at_commander_debug(config, "Stored settings into flash memory");
+            config->snapshot.unstored = 0;
+            return true;
+        }
+
+        at_commander_debug(config, "Unable to store settings in flash memory");
+        return false;
+    }
+    return false;
+}
+
+/** Private: at_commander_set, for when the config is already locked.
+ *
+ * stored - set to true if the setting was then stored in flash memory, or the
+ *      platform stores settings as they're set (it has no store command).
+ */
+static bool vset_setting(AtCommanderConfig* config, AtCommand* command,
+        bool* stored, va_list args) {
+    *stored = false;
+    if(!at_commander_enter_command_mode(config)) {
+        at_commander_debug(config,
+                "Unable to enter command mode, can't make set request");
+        return false;
+    } else if(!vset_request(config, command, args)) {
+        return false;
+    }
+
+    *stored = at_commander_store_settings(config) ||
+            config->platform.store_settings_command.request_format == NULL;
+    return true;
+}
+
+/** Private: Like vset_setting, but with the arguments passed directly.
+ */
+static bool set_setting(AtCommanderConfig* config, AtCommand* command,
+        bool* stored, ...) {
+    va_list args;
+    va_start(args, stored);
+    bool success = vset_setting(config, command, stored, args);
+    va_end(args);
+    return success;
+}
+
+bool at_commander_set(AtCommanderConfig* config, AtCommand* command, ...) {
+    bool stored;
+    at_commander_lock(config);
+    va_list args;
+    va_start(args, command);
+    bool success = vset_setting(config, command, &stored, args);
+    va_end(args);
+    at_commander_unlock(config);
+    return success;
+}
+
+int at_commander_get(AtCommanderConfig* config, AtCommand* command,
+        char* response_buffer, int response_buffer_length) {
+    if(response_buffer == NULL || response_buffer_length <= 0) {
+        at_commander_debug(config, "Buffer for query response is invalid");
+        return -1;
+    }
+
+    int bytes_read = -1;
+    at_commander_lock(config);
+    if(at_commander_enter_command_mode(config)) {
+        bytes_read = get_request(config, command, response_buffer,
+                response_buffer_length);
+    } else {
+        at_commander_debug(config,
+                "Unable to enter command mode, can't get device name");
+    }
+    at_commander_unlock(config);
+    return bytes_read;
+}
+
+void at_commander_batch_init(AtCommanderBatch* batch) {
+    batch->length = 0;
+    batch->count = 0;
+}
+
+bool at_commander_batch_add(AtCommanderBatch* batch, AtCommand* command, ...) {
+    if(command->request_format == NULL ||
+            command->expected_response == NULL ||
+            batch->count >= AT_COMMANDER_MAX_BATCH_SIZE) {
+        return false;
+    }
+
+    // Format straight into the batch, it's only kept if it fits
+    int available = AT_COMMANDER_MAX_BATCH_LENGTH - batch->length;
+    va_list args;
+    va_start(args, command);
+    int length = at_commander_vsnprintf(&batch->requests[batch->length],
+            available, command->request_format, args);
+    va_end(args);
+
+    if(length < 0 || length >= available) {
+        return false;
+    }
+
+    batch->offsets[batch->count] = batch->length;
+    batch->expected_responses[batch->count] = command->expected_response;
+    batch->results[batch->count] = false;
+    batch->length += length + 1;
+    batch->count++;
+    return true;
+}
+
+/** Private: Find the part of a request that goes into a chained line, i.e.
+ * without the "AT" prefix and trailing line ending.
+ *
+ * Returns the length of the body, and sets body to point at its start.
+ */
+static int batch_request_body(const char* request, const char** body) {
+    if(!strncmp(request, "AT", 2)) {
+        request += 2;
+    }
+    int length = strlen(request);
+    while(length > 0 && (request[length - 1] == '\r'
+                || request[length - 1] == '\n')) {
+        length--;
+    }
+    *body = request;
+    return length;
+}
+
+/** Private: Send the batched commands from first up to (not including) last
+ * as a single chained line, and match each reply to its command.
+ *
+ * Returns true if every command in the line was acknowledged.
+ */
+static bool batch_send_line(AtCommanderConfig* config, AtCommanderBatch* batch,
+        int first, int last) {
+    if(!deadline_allows_request(config)) {
+        return false;
+    }
+
+    int i;
+    at_commander_write(config, "AT", 2);
+    for(i = first; i < last; i++) {
+        const char* body;
+        int body_length = batch_request_body(
+                &batch->requests[batch->offsets[i]], &body);
+        if(i > first) {
+            at_commander_write(config, ",", 1);
+        }
+        at_commander_write(config, body, body_length);
+    }
+    at_commander_write(config, "\r", 1);
+    at_commander_touch(config);
+    at_commander_wait_for_data(config, config->platform.response_delay_ms);
+
+    bool success = true;
+    for(i = first; i < last; i++) {
+        char response[AT_COMMANDER_MAX_RESPONSE_LENGTH];
+        int bytes_read = at_commander_read_line(config, response,
+                sizeof(response), AT_COMMANDER_MAX_RETRIES);
+        const char* expected = batch->expected_responses[i];
+        batch->results[i] = at_commander_check_response(config, response,
+                bytes_read, expected, strlen(expected));
+        if(!batch->results[i]) {
+            // The device stops processing the line at the first error, so
+            // there won't be any more replies to match up
+            success = false;
+            break;
+        }
+    }
+    return success;
+}
+
+/** Private: Find how many of the batched commands starting at first fit in a
+ * single chained line.
+ */
+static int batch_line_end(AtCommanderBatch* batch, int first,
+        int max_line_length) {
+    // "AT" prefix and the carriage return
+    int length = 3;
+    int last;
+    for(last = first; last < batch->count; last++) {
+        const char* body;
+        int body_length = batch_request_body(
+                &batch->requests[batch->offsets[last]], &body);
+        if(last > first) {
+            body_length++;
+        }
+
+        if(last > first && length + body_length > max_line_length) {
+            break;
+        }
+        length += body_length;
+    }
+    return last;
+}
+
+/** Private: Send the commands in a batch, already in command mode - chained
+ * into as few lines as possible if the platform supports it.
+ *
+ * Returns true if every command was acknowledged.
+ */
+static bool send_batch_lines(AtCommanderConfig* config,
+        AtCommanderBatch* batch) {
+    int max_line_length = config->platform.max_chained_line_length;
+
+    bool success = true;
+    int first = 0;
+    while(success && first < batch->count) {
+        if(max_line_length > 0) {
+            int last = batch_line_end(batch, first, max_line_length);
+            success = batch_send_line(config, batch, first, last);
+            first = last;
+        } else {
+            batch->results[first] = set_request(config,
+                    &batch->requests[batch->offsets[first]],
+                    batch->expected_responses[first]);
+            success = batch->results[first];
+            first++;
+        }
+    }
+    return success;
+}
+
+/** Private: Append the store and exit commands if wanted, enter command mode
+ * and send the batch.
+ */
+static bool send_batch_with(AtCommanderConfig* config,
+        AtCommanderBatch* batch, bool store, bool exit) {
+    if(store && config->platform.store_settings_command.request_format != NULL
+            && !at_commander_batch_add(batch,
+                &config->platform.store_settings_command)) {
+        at_commander_debug(config, "Unable to add store command to batch");
+        return false;
+    }
+
+    int exit_index = -1;
+    if(exit && config->platform.exit_command_mode_command.request_format
+            != NULL) {
+        if(!at_commander_batch_add(batch,
+                    &config->platform.exit_command_mode_command)) {
+            at_commander_debug(config, "Unable to add exit command to batch");
+            return false;
+        }
+        exit_index = batch->count - 1;
+    }
+
+    if(!at_commander_enter_command_mode(config)) {
+        at_commander_debug(config,
+                "Unable to enter command mode, can't send batch");
+        return false;
+    }
+
+    bool success = send_batch_lines(config, batch);
+    if(exit_index >= 0 && batch->results[exit_index]) {
+        at_commander_debug(config, "Switched back to data mode");
+        config->connected = false;
+    }
+
+    if(!success) {
+        at_commander_debug(config, "Unable to send all batched commands");
+    }
+    return success;
+}
+
+/** Private: at_commander_batch_send, for when the config is already locked.
+ *
+ * The store and exit commands are only appended for this send, so the batch
+ * is left as the caller built it - whether or not the send succeeded - and can
+ * be sent again.
+ */
+static bool batch_send(AtCommanderConfig* config,
+        AtCommanderBatch* batch, bool store, bool exit) {
+    int count = batch->count;
+    int length = batch->length;
+    bool success = send_batch_with(config, batch, store, exit);
+    batch->count = count;
+    batch->length = length;
+    return success;
+}
+
+bool at_commander_batch_send(AtCommanderConfig* config,
+        AtCommanderBatch* batch, bool store, bool exit) {
+    at_commander_lock(config);
+    bool success = batch_send(config, batch, store, exit);
+    at_commander_unlock(config);
+    return success;
+}
+
+/** Private: Returns true if a complete response line matches one of the
+ * command's error responses.
+ */
+static bool line_is_error(const AtCommand* command, const char* line) {
+    if(!command_has_patterns(command)) {
+        return command->error_response != NULL && !strncmp(line,
+                command->error_response, strlen(command->error_response));
+    }
+
+    AtCommanderMatcher matcher;
+    at_commander_compile_matcher(&matcher, command);
+    int verdict = AT_COMMANDER_MATCH_PENDING;
+    for(; *line != '\0' && verdict == AT_COMMANDER_MATCH_PENDING; line++) {
+        verdict = at_commander_matcher_feed(&matcher, *line);
+    }
+
+    if(verdict == AT_COMMANDER_MATCH_PENDING) {
+        verdict = at_commander_matcher_finish(&matcher);
+    }
+    return verdict == AT_COMMANDER_MATCH_ERROR;
+}
+
+/** Private: at_commander_get_lines, for when the config is already locked.
+ */
+static int get_lines(AtCommanderConfig* config, AtCommand* command,
+        void (*line_callback)(const char* line, int length, void* context),
+        void* context) {
+    if(command->request_format == NULL) {
+        at_commander_debug(config, "Command not supported by this platform");
+        return -1;
+    }
+
+    if(!at_commander_enter_command_mode(config)) {
+        at_commander_debug(config,
+                "Unable to enter command mode, can't make multi-line query");
+        return -1;
+    }
+
+    if(!deadline_allows_request(config)) {
+        return -1;
+    }
+
+    at_commander_write(config, command->request_format,
+            strlen(command->request_format));
+    at_commander_touch(config);
+    at_commander_wait_for_data(config, config->platform.response_delay_ms);
+
+    int line_count = 0;
+    if(has_final_result_codes(config)) {
+        AtCommanderMatcher matcher;
+        if(!compile_final_result_codes(config, &matcher, command, NULL) ||
+                read_final_result(config, &matcher, command->request_format,
+                    line_callback, context, &line_count) !=
+                AT_COMMANDER_MATCH_SUCCESS) {
+            return -1;
+        }
+        return line_count;
+    }
+
+    char line[AT_COMMANDER_MAX_LINE_LENGTH];
+    int length;
+    while((length = at_commander_read_line(config, line, sizeof(line) - 1,
+                    AT_COMMANDER_MAX_RETRIES)) > 0) {
+        line[length] = '\0';
+        if(line_count == 0 && line_is_error(command, line)) {
+            return -1;
+        } else if(command->expected_response != NULL &&
+                !strcmp(line, command->expected_response)) {
+            break;
+        }
+
+        if(line_callback != NULL) {
+            line_callback(line, length, context);
+        }
+        line_count++;
+    }
+    return line_count;
+}
+
+int at_commander_get_lines(AtCommanderConfig* config, AtCommand* command,
+        void (*line_callback)(const char* line, int length, void* context),
+        void* context) {
+    at_commander_lock(config);
+    int result = get_lines(config, command, line_callback, context);
+    at_commander_unlock(config);
+    return result;
+}
+
+/** Private: Copy a settings value into a fixed size field, truncating it if
+ * necessary.
+ */
+static void copy_setting(char* destination, int destination_length,
+        const char* value) {
+    strncpy(destination, value, destination_length - 1);
+    destination[destination_length - 1] = '\0';
+}
+
+/** Private: Convert a baud rate as reported in a settings dump (e.g. "115K",
+ * "57.6", "9600") to a number.
+ *
+ * Returns the baud rate, or 0 if it isn't recognized.
+ */
+static int parse_baud_setting(const char* value) {
+    int baud = 0;
+    int fraction_digits = -1;
+    const char* c;
+    for(c = value; *c != '\0'; c++) {
+        if(*c >= '0' && *c <= '9') {
+            baud = baud * 10 + *c - '0';
+            if(fraction_digits >= 0) {
+                fraction_digits++;
+            }
+        } else if(*c == '.') {
+            fraction_digits = 0;
+        } else if(*c == 'K' || *c == 'k') {
+            baud *= 1000;
+            break;
+        } else {
+            break;
+        }
+    }
+
+    if(fraction_digits >= 0) {
+        // "57.6" is 57.6K
+        for(; fraction_digits < 3; fraction_digits++) {
+            baud *= 10;
+        }
+    }
+
+    // The abbreviated rates are truncated, so match them up with the real ones
+    // ("115K" is 115200, "921K" is 921600)
+    static const int standard_baud_rates[] = {1200, 2400, 4800, 9600, 19200,
+        38400, 57600, 115200, 230400, 460800, 921600};
+    static const int standard_baud_rate_count = sizeof(standard_baud_rates) /
+            sizeof(int);
+    int i;
+    for(i = 0; i < standard_baud_rate_count; i++) {
+        if(standard_baud_rates[i] / 1000 == baud / 1000) {
+            return standard_baud_rates[i];
+        }
+    }
+    return baud;
+}
+
+/** Private: Parse one "key=value" line from a settings dump into a snapshot.
+ *
+ * The keys are as the RN-42 prints them, abbreviated to fit its columns (e.g.
+ * "CfgTimr", not "CfgTimer").
+ */
+static void parse_setting_line(const char* line, int length, void* context) {
+    AtCommanderSettings* settings = (AtCommanderSettings*) context;
+    const char* separator = (const char*) memchr(line, '=', length);
+    if(separator == NULL) {
+        return;
+    }
+
+    int key_length = separator - line;
+    while(key_length > 0 && line[key_length - 1] == ' ') {
+        key_length--;
+    }
+    const char* value = separator + 1;
+
+    if(key_length == 3 && !strncmp(line, "BTA", key_length)) {
+        copy_setting(settings->device_id, sizeof(settings->device_id), value);
+    } else if(key_length == 6 && !strncmp(line, "BTName", key_length)) {
+        copy_setting(settings->name, sizeof(settings->name), value);
+    } else if(!strncmp(line, "Baudrt", 6)) {
+        settings->baud = parse_baud_setting(value);
+    } else if(key_length == 4 && !strncmp(line, "Mode", key_length)) {
+        copy_setting(settings->mode, sizeof(settings->mode), value);
+    } else if(key_length == 6 && !strncmp(line, "Authen", key_length)) {
+        settings->authentication = atoi(value);
+    } else if(key_length == 7 && !strncmp(line, "CfgTimr", key_length)) {
+        settings->configuration_timer_s = atoi(value);
+    }
+}
+
+/** Private: at_commander_get_settings, for when the config is already locked.
+ */
+static bool get_settings(AtCommanderConfig* config,
+        AtCommanderSettings* settings) {
+    memset(settings, 0, sizeof(AtCommanderSettings));
+    if(at_commander_get_lines(config, &config->platform.get_settings_command,
+                parse_setting_line, settings) <= 0) {
+        at_commander_debug(config, "Unable to retrieve device settings");
+        return false;
+    }
+
+    if(config->platform.get_extended_settings_command.request_format != NULL
+            && at_commander_get_lines(config,
+                &config->platform.get_extended_settings_command,
+                parse_setting_line, settings) <= 0) {
+        at_commander_debug(config,
+                "Unable to retrieve extended device settings");
+        return false;
+    }
+    return true;
+}
+
+bool at_commander_get_settings(AtCommanderConfig* config,
+        AtCommanderSettings* settings) {
+    at_commander_lock(config);
+    bool success = get_settings(config, settings);
+    at_commander_unlock(config);
+    return success;
+}
+
+void at_commander_inquiry_init(AtCommanderInquiry* inquiry,
+        AtCommanderInquiryResult* results, int capacity, int max_results) {
+    memset(inquiry, 0, sizeof(AtCommanderInquiry));
+    inquiry->results = results;
+    inquiry->capacity = capacity;
+    inquiry->max_results = max_results;
+}
+
+/** Private: Returns the value of a field of 1 to 8 hex digits, or -1 if it
+ * isn't one.
+ */
+static long parse_hex_field(const char* field, int length) {
+    if(length < 1 || length > 8) {
+        return -1;
+    }
+
+    long value = 0;
+    int i;
+    for(i = 0; i < length; i++) {
+        char c = field[i];
+        int digit;
+        if(c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if(c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else if(c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else {
+            return -1;
+        }
+        value = value * 16 + digit;
+    }
+    return value;
+}
+
+/** Private: Returns true if the field is a negative number of dBm.
+ */
+static bool is_rssi_field(const char* field, int length) {
+    int i;
+    if(length < 2 || field[0] != '-') {
+        return false;
+    }
+    for(i = 1; i < length; i++) {
+        if(field[i] < '0' || field[i] > '9') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Private: Find the result for an address, adding it if there's room.
+ *
+ * Returns the result, or NULL if the table is full.
+ */
+static AtCommanderInquiryResult* inquiry_result(AtCommanderInquiry* inquiry,
+        const char* address) {
+    int i;
+    for(i = 0; i < inquiry->count; i++) {
+        if(!strncmp(inquiry->results[i].address, address, 12)) {
+            return &inquiry->results[i];
+        }
+    }
+
+    if(inquiry->count == inquiry->capacity) {
+        inquiry->dropped++;
+        return NULL;
+    }
+    AtCommanderInquiryResult* result = &inquiry->results[inquiry->count++];
+    memset(result, 0, sizeof(AtCommanderInquiryResult));
+    memcpy(result->address, address, 12);
+    return result;
+}
+
+bool at_commander_inquiry_parse_line(AtCommanderInquiry* inquiry,
+        const char* line) {
+    if(!strcmp(line, "Inquiry Done")) {
+        inquiry->complete = true;
+        return false;
+    }
+
+    // Split into at most 4 fields, the first being the address
+    const char* fields[4];
+    int lengths[4];
+    int field_count = 0;
+    const char* start = line;
+    while(field_count < 4) {
+        const char* end = strchr(start, ',');
+        fields[field_count] = start;
+        lengths[field_count] = end != NULL ? end - start : (int)strlen(start);
+        field_count++;
+        if(end == NULL) {
+            break;
+        }
+        start = end + 1;
+    }
+
+    int i;
+    if(lengths[0] != 12) {
+        return false;
+    }
+    for(i = 0; i < 12; i++) {
+        if(parse_hex_field(&line[i], 1) < 0) {
+            return false;
+        }
+    }
+
+    // The signal strength, if there is one, is last, after the class of
+    // device, which is after the name.
+    int rssi = 0;
+    int last = field_count - 1;
+    if(last > 0 && is_rssi_field(fields[last], lengths[last])) {
+        rssi = atoi(fields[last]);
+        last--;
+    }
+    long class_of_device = -1;
+    if(last > 0) {
+        class_of_device = parse_hex_field(fields[last], lengths[last]);
+        if(class_of_device >= 0 || last > 1) {
+            last--;
+        }
+    }
+
+    AtCommanderInquiryResult* result = inquiry_result(inquiry, line);
+    if(result == NULL) {
+        return true;
+    }
+    if(last > 0 && lengths[1] > 0) {
+        int name_length = lengths[1] < (int)sizeof(result->name) - 1 ?
+                lengths[1] : (int)sizeof(result->name) - 1;
+        memcpy(result->name, fields[1], name_length);
+        result->name[name_length] = '\0';
+    }
+    if(class_of_device > 0) {
+        result->class_of_device = class_of_device;
+    }
+    if(rssi != 0 && (result->rssi == 0 || rssi > result->rssi)) {
+        result->rssi = rssi;
+    }
+    return true;
+}
+
+/** Private: at_commander_inquiry, for when the config is already locked.
+ */
+static int run_inquiry(AtCommanderConfig* config, int duration_s,
+        AtCommanderInquiry* inquiry) {
+    AtCommand* command = &config->platform.inquiry_command;
+    if(command->request_format == NULL) {
+        at_commander_debug(config, "Command not supported by this platform");
+        return -1;
+    } else if(!at_commander_enter_command_mode(config)) {
+        at_commander_debug(config,
+                "Unable to enter command mode, can't start inquiry");
+        return -1;
+    } else if(!deadline_allows_request(config)) {
+        return -1;
+    }
+
+    write_request(config, command->request_format, duration_s);
+    at_commander_touch(config);
+
+    // Wait for each line up to the end of the scan, plus some slack for the
+    // device to report it.
+    unsigned long started_ms = at_commander_millis(config);
+    unsigned long scan_ms = duration_s * 1000UL + AT_COMMANDER_INQUIRY_MARGIN_MS;
+    int retries = scan_ms / AT_COMMANDER_RETRY_DELAY_MS + 1;
+    char line[AT_COMMANDER_MAX_LINE_LENGTH];
+    int length;
+    bool first = true;
+    while(!inquiry->complete && (inquiry->max_results <= 0 ||
+                inquiry->count < inquiry->max_results)) {
+        if(config->millis_function != NULL) {
+            unsigned long elapsed = at_commander_millis(config) - started_ms;
+            if(elapsed >= scan_ms) {
+                break;
+            }
+            retries = (scan_ms - elapsed) / AT_COMMANDER_RETRY_DELAY_MS + 1;
+        }
+
+        length = at_commander_read_line(config, line, sizeof(line) - 1,
+                retries);
+        if(length <= 0) {
+            break;
+        }
+        line[length] = '\0';
+        if(first && line_is_error(command, line)) {
+            at_commander_debug(config, "Inquiry rejected: %s", line);
+            return -1;
+        }
+        first = false;
+        at_commander_inquiry_parse_line(inquiry, line);
+    }
+
+    if(!inquiry->complete) {
+        inquiry->busy_until_ms = started_ms + duration_s * 1000UL;
+        at_commander_debug(config, "Ended inquiry early with %d devices",
+                inquiry->count);
+    }
+    at_commander_touch(config);
+    return inquiry->count;
+}
+
+int at_commander_inquiry(AtCommanderConfig* config, int duration_s,
+        AtCommanderInquiry* inquiry) {
+    at_commander_lock(config);
+    int count = run_inquiry(config, duration_s, inquiry);
+    at_commander_unlock(config);
+    return count;
+}
+
+/** Private: Change the baud rate of the UART interface and update the config
+ * accordingly.
+ *
+ * This function does *not* attempt to change anything on the AT-command set
+ * supporting device, it just changes the host interface.
+ */
+static bool initialize_baud(AtCommanderConfig* config, int baud) {
+    if(config->baud_rate_initializer != NULL) {
+        at_commander_debug(config, "Initializing at baud %d", baud);
+        config->baud_rate_initializer(config->device, baud);
+        config->baud = baud;
+        return true;
+    }
+    at_commander_debug(config,
+            "No baud rate initializer set, can't change baud - trying anyway");
+    return false;
+}
+
+/** Private: Find how long the current command mode session has left before
+ * the device leaves command mode on its own.
+ *
+ * Returns the remaining time in ms (<= 0 if already expired), or
+ * AT_COMMANDER_SESSION_MARGIN_MS if there's no clock or the device doesn't time
+ * out.
+ */
+static long session_remaining_ms(AtCommanderConfig* config) {
+    int timeout_s = config->command_mode_timeout_s;
+    if(timeout_s <= 0) {
+        timeout_s = config->platform.command_mode_timeout_s;
+    }
+
+    if(config->millis_function == NULL || timeout_s <= 0 ||
+            (!config->platform.command_mode_timeout_idle &&
+                timeout_s >= AT_COMMANDER_RN42_CONTINUOUS_CONFIGURATION)) {
+        return AT_COMMANDER_SESSION_MARGIN_MS;
+    }
+
+    unsigned long since = config->platform.command_mode_timeout_idle ?
+            config->last_activity_ms : config->session_started_ms;
+    unsigned long elapsed = at_commander_millis(config) - since;
+    return (long)(timeout_s * 1000UL) - (long)elapsed;
+}
+
+/** Private: at_commander_guard_time_remaining_ms, for when the config is
+ * already locked.
+ */
+static unsigned long guard_time_remaining_ms(AtCommanderConfig* config) {
+    unsigned long guard_time = config->platform.guard_time_ms;
+    if(config->millis_function == NULL) {
+        return guard_time;
+    }
+
+    unsigned long quiet = at_commander_millis(config) -
+            config->last_transmit_ms;
+    return quiet >= guard_time ? 0 : guard_time - quiet;
+}
+
+unsigned long at_commander_guard_time_remaining_ms(AtCommanderConfig* config) {
+    at_commander_lock(config);
+    unsigned long remaining = guard_time_remaining_ms(config);
+    at_commander_unlock(config);
+    return remaining;
+}
+
+/** Private: Send the escape sequence to enter command mode, respecting the
+ * platform's guard time, and verify the response.
+ *
+ * Only the part of the guard time not already spent idle is waited before the
+ * escape sequence. The device doesn't reply until a full guard time after it,
+ * so that is always waited in place of the usual response delay.
+ *
+ * Returns true if the response matches the expected.
+ */
+static bool escape_request(AtCommanderConfig* config) {
+    AtCommand* command = &config->platform.enter_command_mode_command;
+    if(!deadline_allows_request(config)) {
+        return false;
+    } else if(config->platform.guard_time_ms <= 0) {
+        return set_request(config, command->request_format,
+                command->expected_response);
+    }
+
+    at_commander_delay_ms(config, guard_time_remaining_ms(config));
+    at_commander_write(config, command->request_format,
+            strlen(command->request_format));
+    at_commander_touch(config);
+    at_commander_delay_ms(config, config->platform.guard_time_ms);
+
+    char response[AT_COMMANDER_MAX_RESPONSE_LENGTH];
+    int bytes_read = at_commander_read(config, response,
+            strlen(command->expected_response), AT_COMMANDER_MAX_RETRIES);
+    return at_commander_check_response(config, response, bytes_read,
+            command->expected_response, strlen(command->expected_response));
+}
+
+/** Private: Start a command mode session once the device has answered the
+ * escape sequence, turning off echo if the platform has a command for it.
+ */
+static void start_session(AtCommanderConfig* config) {
+    config->connected = true;
+    config->silent_responses = 0;
+    config->session_started_ms = at_commander_millis(config);
+    config->last_activity_ms = config->session_started_ms;
+
+    AtCommand* echo_command = &config->platform.disable_echo_command;
+    if(echo_command->request_format != NULL && !set_request(config,
+                echo_command->request_format,
+                echo_command->expected_response)) {
+        at_commander_debug(config, "Unable to turn off echo");
+    }
+}
+
+/** Private: Try to enter command mode at the given baud rate.
+ *
+ * Returns true if the device responded to the command mode request.
+ */
+static bool attempt_command_mode(AtCommanderConfig* config, int baud) {
+    initialize_baud(config, baud);
+    at_commander_debug(config, "Attempting to enter command mode");
+
+    if(escape_request(config)) {
+        start_session(config);
+    }
+    return config->connected;
+}
+
+/** Private: at_commander_check_session, for when the config is already locked.
+ */
+static bool check_session(AtCommanderConfig* config) {
+    if(config->connected) {
+        if(session_remaining_ms(config) <= 0) {
+            at_commander_debug(config, "Command mode session timed out");
+            config->connected = false;
+        } else if(config->idle_exit_ms > 0 && config->millis_function != NULL
+                && at_commander_millis(config) - config->last_activity_ms >=
+                    config->idle_exit_ms) {
+            at_commander_debug(config, "Command mode session idle, leaving");
+            at_commander_exit_command_mode(config);
+        }
+    }
+    return config->connected;
+}
+
+bool at_commander_check_session(AtCommanderConfig* config) {
+    at_commander_lock(config);
+    bool success = check_session(config);
+    at_commander_unlock(config);
+    return success;
+}
+
+void at_commander_link_sampler_init(AtCommanderLinkSampler* sampler,
+        AtCommanderLinkSample* samples, int capacity,
+        unsigned long interval_ms, int budget_percent) {
+    memset(sampler, 0, sizeof(AtCommanderLinkSampler));
+    sampler->samples = samples;
+    sampler->capacity = capacity;
+    sampler->interval_ms = interval_ms;
+    sampler->budget_percent = budget_percent;
+}
+
+/** Private: Parse a link quality reading, e.g. the XBee's "28" or the RN-42's
+ * "RSSI=ff,ff" (the current quality, then the lowest since connecting).
+ *
+ * Returns the reading, or -1 if the response isn't one.
+ */
+static int parse_link_quality(const char* response) {
+    const char* value = strchr(response, '=');
+    value = value != NULL ? value + 1 : response;
+    const char* end = strchr(value, ',');
+    long quality = parse_hex_field(value, end != NULL ? end - value :
+            (int)strlen(value));
+    return quality <= AT_COMMANDER_MAX_LINK_QUALITY ? (int)quality : -1;
+}
+
+/** Private: Send the platform's stop command for continuous link quality
+ * reports, if it has one, and discard any reports already on their way.
+ *
+ * A wait_function returns as soon as the first report arrives, so the reports
+ * are drained for the whole response delay, not just until the first gap.
+ */
+static void stop_link_quality(AtCommanderConfig* config) {
+    AtCommand* command = &config->platform.stop_link_quality_command;
+    if(command->request_format == NULL) {
+        return;
+    }
+
+    unsigned long stopped_ms = at_commander_millis(config);
+    at_commander_write(config, command->request_format,
+            strlen(command->request_format));
+    at_commander_wait_for_data(config, config->platform.response_delay_ms);
+    char line[AT_COMMANDER_MAX_LINE_LENGTH];
+    while(at_commander_read_line(config, line, sizeof(line) - 1, 1) > 0 ||
+            (config->wait_function != NULL &&
+                config->millis_function != NULL &&
+                !at_commander_deadline_passed(config) &&
+                at_commander_millis(config) - stopped_ms <
+                    (unsigned long)config->platform.response_delay_ms));
+}
+
+/** Private: Returns true if a sample is due and there's the time for it, in
+ * the budget and in the current command mode session.
+ */
+static bool link_sample_allowed(AtCommanderConfig* config,
+        AtCommanderLinkSampler* sampler) {
+    unsigned long now = at_commander_millis(config);
+    if(sampler->cost_ms == 0) {
+        sampler->cost_ms = config->platform.response_delay_ms;
+        if(config->platform.stop_link_quality_command.request_format != NULL) {
+            sampler->cost_ms *= 2;
+        }
+    }
+
+    // Earn the budget's share of the time passed, but only enough for one
+    // sample, so a quiet spell doesn't pay for a burst of them.
+    unsigned long full = sampler->cost_ms * 100;
+    if(!sampler->started) {
+        sampler->started = true;
+        sampler->credit = full;
+    } else {
+        unsigned long elapsed = now - sampler->credited_ms;
+        if(elapsed > full) {
+            elapsed = full;
+        }
+        sampler->credit += elapsed * (sampler->budget_percent > 0 ?
+                sampler->budget_percent : 100);
+        if(sampler->credit > full) {
+            sampler->credit = full;
+        }
+        if(sampler->count + sampler->failures > 0 &&
+                now - sampler->last_sample_ms < sampler->interval_ms) {
+            sampler->credited_ms = now;
+            return false;
+        }
+    }
+    sampler->credited_ms = now;
+
+    return sampler->credit >= full && check_session(config) &&
+            session_remaining_ms(config) >= AT_COMMANDER_SESSION_MARGIN_MS &&
+            deadline_allows_request(config);
+}
+
+/** Private: at_commander_sample_link, for when the config is already locked.
+ */
+static bool sample_link(AtCommanderConfig* config,
+        AtCommanderLinkSampler* sampler) {
+    AtCommand* command = &config->platform.get_link_quality_command;
+    if(config->millis_function == NULL || command->request_format == NULL ||
+            sampler->capacity <= 0 || !link_sample_allowed(config, sampler)) {
+        return false;
+    }
+
+    unsigned long started_ms = at_commander_millis(config);
+    char response[AT_COMMANDER_MAX_LINE_LENGTH];
+    int bytes_read = at_commander_get_request_once(config, command, response,
+            sizeof(response));
+    stop_link_quality(config);
+    at_commander_touch(config);
+
+    unsigned long cost = at_commander_millis(config) - started_ms;
+    sampler->cost_ms = cost > 0 ? cost : 1;
+    sampler->credit = sampler->credit > sampler->cost_ms * 100 ?
+            sampler->credit - sampler->cost_ms * 100 : 0;
+    sampler->last_sample_ms = started_ms;
+
+    int value = bytes_read > 0 ? parse_link_quality(response) : -1;
+    if(value < 0) {
+        at_commander_debug(config, "No link quality reading in response");
+        sampler->failures++;
+        return false;
     }
+
+    AtCommanderLinkSample* sample = &sampler->samples[sampler->next];
+    sample->time_s = (uint16_t)(started_ms / 1000);
+    sample->value = (uint8_t)value;
+    sampler->next = (sampler->next + 1) % sampler->capacity;
+    if(sampler->count < sampler->capacity) {
+        sampler->count++;
+    }
+    return true;
 }
 
-/** Private: Read multiple bytes from Serial into the buffer.
- *
- * Continues to try and read each byte from Serial until a maximum number of
- * retries.
- *
- * Returns the number of bytes actually read - may be less than size.
- */
-int at_commander_read(AtCommanderConfig* config, char* buffer, int size,
-        int max_retries) {
-    int bytes_read = 0;
-    int retries = 0;
-    bool sawCarraigeReturn = false;
-    while(bytes_read < size && (max_retries == 0 || retries < max_retries)) {
-        int byte = config->read_function(config->device);
-        if(byte == -1) {
-            at_commander_delay_ms(config, AT_COMMANDER_RETRY_DELAY_MS);
-            retries++;
-        } else if(byte != '\r' && byte != '\n') {
-            buffer[bytes_read++] = byte;
-        }
+bool at_commander_sample_link(AtCommanderConfig* config,
+        AtCommanderLinkSampler* sampler) {
+    at_commander_lock(config);
+    bool success = sample_link(config, sampler);
+    at_commander_unlock(config);
+    return success;
+}
 
-        if(bytes_read > 1) {
-            if(byte == '\r') {
-                sawCarraigeReturn = true;
-            } else if(sawCarraigeReturn && byte == '\n') {
-                break;
-            }
+bool at_commander_link_stats(const AtCommanderLinkSampler* sampler,
+        int window, AtCommanderLinkStats* stats) {
+    memset(stats, 0, sizeof(AtCommanderLinkStats));
+    if(window <= 0 || window > sampler->count) {
+        window = sampler->count;
+    }
+
+    unsigned long sum = 0;
+    int i;
+    for(i = 0; i < window; i++) {
+        // Newest first
+        int index = (sampler->next - 1 - i + sampler->capacity) %
+                sampler->capacity;
+        int value = sampler->samples[index].value;
+        if(i == 0) {
+            stats->latest = stats->min = stats->max = value;
+        } else if(value < stats->min) {
+            stats->min = value;
+        } else if(value > stats->max) {
+            stats->max = value;
         }
+        sum += value;
     }
-    /* if(bytes_read > 0) { */
-        /* at_commander_debug(config, "rx: %s", buffer); */
-    /* } */
-    return bytes_read;
+    stats->count = window;
+    if(window > 0) {
+        stats->mean = (sum + window / 2) / window;
+    }
+    return window > 0;
 }
 
-/** Private: Compare a response received from a device with some expected
- *      output.
+/** Private: Scan for the device, starting with the last known baud rate.
  *
- * Returns true if the reponse matches content and length, otherwise false.
+ * Returns true if the device answered at one of them.
  */
-bool check_response(AtCommanderConfig* config, const char* response,
-        int response_length, const char* expected, int expected_length) {
-    if(response_length == expected_length && !strncmp(response, expected,
-                expected_length)) {
+static bool scan_for_device(AtCommanderConfig* config) {
+    // The device is most likely still at the baud rate we last used
+    int last_baud = config->baud;
+    if(last_baud > 0 && attempt_command_mode(config, last_baud)) {
         return true;
     }
 
-    if(response_length != expected_length) {
-        at_commander_debug(config,
-                "Expected %d bytes in response but received %d",
-                expected_length, response_length);
-    }
-
-    if(response_length > 0) {
-        at_commander_debug(config, "Expected \"%s\" (%d bytes) in response "
-                "but got \"%s\" (%d bytes)", expected, expected_length,
-                response, response_length);
+    int baud_index;
+    for(baud_index = 0; baud_index < VALID_BAUD_RATE_COUNT; baud_index++) {
+        if(at_commander_deadline_passed(config)) {
+            break;
+        } else if(VALID_BAUD_RATES[baud_index] != last_baud &&
+                attempt_command_mode(config, VALID_BAUD_RATES[baud_index])) {
+            return true;
+        }
     }
     return false;
 }
 
-/** Private: Send an AT "get" query, read a response, and verify it doesn't match
- * any known errors.
- *
- * Returns true if the response isn't a known error state.
+/** Private: Update the circuit breaker with the result of trying to reach the
+ * device.
  */
-int get_request(AtCommanderConfig* config, AtCommand* command,
-        char* response_buffer, int response_buffer_length) {
-    at_commander_write(config, command->request_format,
-            strlen(command->request_format));
-    at_commander_delay_ms(config, config->platform.response_delay_ms);
-
-    int bytes_read = at_commander_read(config, response_buffer,
-            response_buffer_length - 1, AT_COMMANDER_MAX_RETRIES);
-    response_buffer[bytes_read] = '\0';
-
-    if(strncmp(response_buffer, command->error_response, strlen(command->error_response))) {
-        return bytes_read;
+static void breaker_record(AtCommanderConfig* config, bool success) {
+    if(success) {
+        config->breaker_failures = 0;
+        config->breaker_open = false;
+    } else if(config->breaker_threshold > 0 &&
+            config->millis_function != NULL &&
+            ++config->breaker_failures >= config->breaker_threshold) {
+        if(!config->breaker_open) {
+            at_commander_debug(config, "Device unreachable, failing fast "
+                    "for %lu ms", config->breaker_cool_down_ms);
+        }
+        config->breaker_open = true;
+        config->breaker_opened_ms = at_commander_millis(config);
     }
-    return -1;
 }
 
-
-/** Private: Send an AT command, read a response, and verify it matches the
- * expected value.
- *
- * Returns true if the response matches the expected.
+/** Private: Returns true if the breaker is open and still cooling down.
  */
-bool set_request(AtCommanderConfig* config, const char* command, const char* expected_response) {
-    at_commander_write(config, command, strlen(command));
-    at_commander_delay_ms(config, config->platform.response_delay_ms);
-
-    char response[AT_COMMANDER_MAX_RESPONSE_LENGTH];
-    int bytes_read = at_commander_read(config, response, strlen(expected_response),
-            AT_COMMANDER_MAX_RETRIES);
+static bool breaker_cooling_down(AtCommanderConfig* config) {
+    return config->breaker_open && at_commander_millis(config) -
+            config->breaker_opened_ms < config->breaker_cool_down_ms;
+}
 
-    return check_response(config, response, bytes_read, expected_response,
-            strlen(expected_response));
+bool at_commander_circuit_open(AtCommanderConfig* config) {
+    at_commander_lock(config);
+    bool open = breaker_cooling_down(config);
+    at_commander_unlock(config);
+    return open;
 }
 
-bool at_commander_store_settings(AtCommanderConfig* config) {
-    if(config->platform.store_settings_command.request_format != NULL
-            && config->platform.store_settings_command.expected_response
-                != NULL) {
-        if(set_request(config,
-                config->platform.store_settings_command.request_format,
-                config->platform.store_settings_command.expected_response)) {
-            at_commander_debug(config, "Stored settings into flash memory");
-            return true;
-        }
+/** Private: Restart the device so a baud rate change takes effect (or leave
+ * command mode, on platforms without a reboot command), then move the UART to
+ * the new rate and confirm it with a single escape sequence.
+ *
+ * Returns true if the device answered at the new rate.
+ */
+static bool restart_at_baud(AtCommanderConfig* config, int baud) {
+    // Whether or not the restart was acknowledged, the probe tells if it worked
+    AtCommand* reboot_command = &config->platform.reboot_command;
+    if(reboot_command->request_format != NULL) {
+        set_request(config, reboot_command->request_format,
+                reboot_command->expected_response);
+    } else {
+        at_commander_exit_command_mode(config);
+    }
+    config->connected = false;
+    at_commander_delay_ms(config, AT_COMMANDER_REBOOT_WINDOW_MS);
 
-        at_commander_debug(config, "Unable to store settings in flash memory");
-        return false;
+    if(attempt_command_mode(config, baud)) {
+        at_commander_debug(config, "Confirmed device at baud %d", baud);
+        return true;
     }
+    at_commander_debug(config, "Device didn't answer at new baud %d", baud);
     return false;
 }
 
-bool at_commander_set(AtCommanderConfig* config, AtCommand* command, ...) {
-    if(at_commander_enter_command_mode(config)) {
-        va_list args;
-        va_start(args, command);
-
-        char request[AT_COMMANDER_MAX_REQUEST_LENGTH];
-        vsnprintf(request, AT_COMMANDER_MAX_REQUEST_LENGTH, command->request_format, args);
+/** Private: Put config->snapshot back after a reset, with as few commands as
+ * possible - only what the reset lost, chained where the platform allows -
+ * and record how long the device was out of action.
+ *
+ * Returns true if everything was put back, otherwise the restore is tried
+ * again with the next command.
+ */
+static bool restore_snapshot(AtCommanderConfig* config) {
+    AtCommanderSnapshot* snapshot = &config->snapshot;
+    config->restore_pending = false;
 
-        va_end(args);
+    AtCommanderBatch batch;
+    at_commander_batch_init(&batch);
+    if(snapshot->unstored & AT_COMMANDER_SNAPSHOT_NAME) {
+        at_commander_batch_add(&batch, snapshot->name_serialized ?
+                &config->platform.set_serialized_name_command :
+                &config->platform.set_name_command, snapshot->name);
+    }
+    if(snapshot->unstored & AT_COMMANDER_SNAPSHOT_CONFIGURATION_TIMER) {
+        at_commander_batch_add(&batch,
+                &config->platform.set_configuration_timer_command,
+                snapshot->configuration_timer_s);
+    }
 
-        if(set_request(config, request, command->expected_response)) {
-            at_commander_store_settings(config);
-            return true;
-        } else {
-            return false;
+    // A baud rate change has to be stored to survive the restart that makes
+    // it take effect
+    bool moved = snapshot->baud > 0 && snapshot->baud != config->baud;
+    if(moved) {
+        at_commander_debug(config, "Device came back at baud %d, moving it "
+                "back to %d", config->baud, snapshot->baud);
+        at_commander_batch_add(&batch,
+                &config->platform.set_baud_rate_command,
+                config->platform.baud_rate_mapper(snapshot->baud));
+        if(config->platform.store_settings_command.request_format != NULL) {
+            at_commander_batch_add(&batch,
+                    &config->platform.store_settings_command);
         }
-    } else {
-        at_commander_debug(config,
-                "Unable to enter command mode, can't make set request");
-        return false;
     }
-}
 
-int at_commander_get(AtCommanderConfig* config, AtCommand* command,
-        char* response_buffer, int response_buffer_length) {
-    if(response_buffer == NULL || response_buffer_length <= 0) {
-        at_commander_debug(config, "Buffer for query response is invalid");
-        return -1;
+    bool success = send_batch_lines(config, &batch);
+    if(success && moved) {
+        success = restart_at_baud(config, snapshot->baud);
     }
 
-    int bytes_read = -1;
-    if(at_commander_enter_command_mode(config)) {
-        bytes_read = get_request(config, command, response_buffer,
-                response_buffer_length);
-    } else {
-        at_commander_debug(config,
-                "Unable to enter command mode, can't get device name");
+    if(!success) {
+        at_commander_debug(config, "Unable to restore settings after reset");
+        config->restore_pending = true;
+        return false;
     }
-    return bytes_read;
+
+    config->last_restore_ms = at_commander_millis(config) -
+            config->reset_detected_ms;
+    if(config->last_restore_ms > config->max_restore_ms) {
+        config->max_restore_ms = config->last_restore_ms;
+    }
+    at_commander_debug(config, "Restored session %lu ms after reset",
+            config->last_restore_ms);
+    return true;
 }
 
-/** Private: Change the baud rate of the UART interface and update the config
- * accordingly.
- *
- * This function does *not* attempt to change anything on the AT-command set
- * supporting device, it just changes the host interface.
+/** Private: at_commander_enter_command_mode, for when the config is
+ * already locked.
  */
-bool initialize_baud(AtCommanderConfig* config, int baud) {
-    if(config->baud_rate_initializer != NULL) {
-        at_commander_debug(config, "Initializing at baud %d", baud);
-        config->baud_rate_initializer(config->device, baud);
-        config->baud = baud;
-        return true;
+static bool enter_command_mode(AtCommanderConfig* config) {
+    if(config->connected) {
+        long remaining = session_remaining_ms(config);
+        if(remaining <= 0) {
+            at_commander_debug(config, "Command mode session timed out");
+            config->connected = false;
+        } else if(remaining < AT_COMMANDER_SESSION_MARGIN_MS) {
+            at_commander_debug(config,
+                    "Command mode session about to time out, restarting it");
+            if(!at_commander_exit_command_mode(config)) {
+                config->connected = false;
+            }
+        }
     }
-    at_commander_debug(config,
-            "No baud rate initializer set, can't change baud - trying anyway");
-    return false;
-}
 
-bool at_commander_enter_command_mode(AtCommanderConfig* config) {
-    int baud_index;
     if(!config->connected) {
-        for(baud_index = 0; baud_index < sizeof(VALID_BAUD_RATES) /
-                sizeof(int); baud_index++) {
-            initialize_baud(config, VALID_BAUD_RATES[baud_index]);
-            at_commander_debug(config, "Attempting to enter command mode");
-
-            if(set_request(config,
-                    config->platform.enter_command_mode_command.request_format,
-                    config->platform.enter_command_mode_command.expected_response)) {
-                config->connected = true;
-                break;
-            }
+        if(breaker_cooling_down(config)) {
+            at_commander_debug(config, "Device unreachable, failing fast");
+            return false;
+        } else if(config->breaker_open) {
+            // A single cheap health probe before risking a full scan again
+            at_commander_debug(config, "Probing device after cool down");
+            breaker_record(config, config->baud > 0 &&
+                    attempt_command_mode(config, config->baud));
+        } else {
+            bool found;
+            int attempts = 0;
+            do {
+                found = scan_for_device(config);
+            } while(!found && retry_after_backoff(config,
+                        AT_COMMANDER_RETRY_ENTER, ++attempts));
+            breaker_record(config, found);
         }
 
         if(config->connected) {
@@ -268,11 +2555,120 @@ bool at_commander_enter_command_mode(AtCommanderConfig* config) {
                     "Unable to enter command mode at any baud rate");
         }
     }
+
+    if(config->connected && config->restore_pending) {
+        restore_snapshot(config);
+    }
     return config->connected;
 }
 
-bool at_commander_exit_command_mode(AtCommanderConfig* config) {
-    if(config->connected) {
+bool at_commander_enter_command_mode(AtCommanderConfig* config) {
+    at_commander_lock(config);
+    bool success = enter_command_mode(config);
+    at_commander_unlock(config);
+    return success;
+}
+
+/** Private: Try each candidate platform's escape sequence at one baud rate,
+ * initializing the UART only once.
+ *
+ * Returns the platform that answered, or NULL if none did.
+ */
+static const AtCommanderPlatform* probe_platforms(AtCommanderConfig* config,
+        int baud, const AtCommanderPlatform* const* candidates,
+        int candidate_count) {
+    int i;
+    initialize_baud(config, baud);
+    for(i = 0; i < candidate_count; i++) {
+        if(at_commander_deadline_passed(config)) {
+            break;
+        }
+
+        config->platform = *candidates[i];
+        at_commander_debug(config, "Probing for %s",
+                config->platform.enter_command_mode_command.request_format);
+        if(escape_request(config)) {
+            return candidates[i];
+        }
+    }
+    return NULL;
+}
+
+/** Private: at_commander_detect_platform, for when the config is already
+ * locked.
+ */
+static bool detect_platform(AtCommanderConfig* config,
+        const AtCommanderPlatform* const* candidates, int candidate_count,
+        char* version, int version_length) {
+    AtCommanderPlatform original = config->platform;
+    const AtCommanderPlatform* detected = NULL;
+    if(candidates == NULL) {
+        candidates = AT_PLATFORMS;
+        candidate_count = AT_PLATFORM_COUNT;
+    }
+
+    config->connected = false;
+    int last_baud = config->baud;
+    if(last_baud > 0) {
+        detected = probe_platforms(config, last_baud, candidates,
+                candidate_count);
+    }
+
+    int baud_index;
+    for(baud_index = 0; detected == NULL &&
+            baud_index < VALID_BAUD_RATE_COUNT &&
+            !at_commander_deadline_passed(config); baud_index++) {
+        if(VALID_BAUD_RATES[baud_index] != last_baud) {
+            detected = probe_platforms(config, VALID_BAUD_RATES[baud_index],
+                    candidates, candidate_count);
+        }
+    }
+
+    if(version != NULL && version_length > 0) {
+        version[0] = '\0';
+    }
+
+    if(detected == NULL) {
+        at_commander_debug(config, "Unable to detect the device's platform");
+        config->platform = original;
+        return false;
+    }
+
+    config->platform = *detected;
+    at_commander_debug(config, "Detected platform answering %s at baud %d",
+            config->platform.enter_command_mode_command.expected_response,
+            config->baud);
+    start_session(config);
+
+    if(version != NULL && version_length > 0 &&
+            config->platform.get_version_command.request_format != NULL &&
+            get_request(config, &config->platform.get_version_command,
+                version, version_length) < 0) {
+        version[0] = '\0';
+    }
+    return true;
+}
+
+bool at_commander_detect_platform(AtCommanderConfig* config,
+        const AtCommanderPlatform* const* candidates, int candidate_count,
+        char* version, int version_length) {
+    at_commander_lock(config);
+    bool success = detect_platform(config, candidates, candidate_count,
+            version, version_length);
+    at_commander_unlock(config);
+    return success;
+}
+
+/** Private: at_commander_exit_command_mode, for when the config is
+ * already locked.
+ */
+static bool exit_command_mode(AtCommanderConfig* config) {
+    if(config->connected &&
+            config->platform.exit_command_mode_command.request_format == NULL) {
+        // Nothing to switch - the next command just checks it still answers
+        config->connected = false;
+        return true;
+    } else if(config->connected) {
         if(set_request(config,
                 config->platform.exit_command_mode_command.request_format,
                 config->platform.exit_command_mode_command.expected_response)) {
@@ -289,7 +2685,16 @@ bool at_commander_exit_command_mode(AtCommanderConfig* config) {
     }
 }
 
-bool at_commander_reboot(AtCommanderConfig* config) {
+bool at_commander_exit_command_mode(AtCommanderConfig* config) {
+    at_commander_lock(config);
+    bool success = exit_command_mode(config);
+    at_commander_unlock(config);
+    return success;
+}
+
+/** Private: at_commander_reboot, for when the config is already locked.
+ */
+static bool reboot(AtCommanderConfig* config) {
     if(at_commander_enter_command_mode(config)) {
         if(set_request(config,
                 config->platform.reboot_command.request_format,
@@ -306,18 +2711,33 @@ bool at_commander_reboot(AtCommanderConfig* config) {
     }
 }
 
-bool at_commander_set_configuration_timer(AtCommanderConfig* config,
+bool at_commander_reboot(AtCommanderConfig* config) {
+    at_commander_lock(config);
+    bool success = reboot(config);
+    at_commander_unlock(config);
+    return success;
+}
+
+/** Private: at_commander_set_configuration_timer, for when the config is
+ * already locked.
+ */
+static bool set_configuration_timer(AtCommanderConfig* config,
         int timeout_s) {
     if(at_commander_enter_command_mode(config)) {
-        char command[6];
-        sprintf(command,
-                config->platform.set_configuration_timer_command.request_format,
-                timeout_s);
-        if(set_request(config, command,
-                config->platform.set_configuration_timer_command.expected_response)) {
+        if(format_set_request(config,
+                &config->platform.set_configuration_timer_command,
+                timeout_s)) {
             at_commander_debug(config, "Changed configuration timer to %d",
                     timeout_s);
-            at_commander_store_settings(config);
+            if(timeout_s > 0) {
+                config->command_mode_timeout_s = timeout_s;
+            }
+            config->snapshot.configuration_timer_s = timeout_s;
+            if(!at_commander_store_settings(config) && config->platform.
+                    store_settings_command.request_format != NULL) {
+                config->snapshot.unstored |=
+                        AT_COMMANDER_SNAPSHOT_CONFIGURATION_TIMER;
+            }
             return true;
         } else {
             at_commander_debug(config, "Unable to change configuration timer");
@@ -330,12 +2750,23 @@ bool at_commander_set_configuration_timer(AtCommanderConfig* config,
     }
 }
 
-bool at_commander_set_baud(AtCommanderConfig* config, int baud) {
+bool at_commander_set_configuration_timer(AtCommanderConfig* config,
+        int timeout_s) {
+    at_commander_lock(config);
+    bool success = set_configuration_timer(config, timeout_s);
+    at_commander_unlock(config);
+    return success;
+}
+
+/** Private: at_commander_set_baud, for when the config is already locked.
+ */
+static bool set_baud(AtCommanderConfig* config, int baud) {
     int (*baud_rate_mapper)(int) = config->platform.baud_rate_mapper;
     if(at_commander_set(config, &config->platform.set_baud_rate_command,
                 baud_rate_mapper(baud))) {
         at_commander_debug(config, "Changed device baud rate to %d", baud);
         config->device_baud = baud;
+        config->snapshot.baud = baud;
         return true;
     } else {
         at_commander_debug(config, "Unable to change device baud rate");
@@ -343,7 +2774,128 @@ bool at_commander_set_baud(AtCommanderConfig* config, int baud) {
     }
 }
 
-bool at_commander_set_name(AtCommanderConfig* config, const char* name,
+bool at_commander_set_baud(AtCommanderConfig* config, int baud) {
+    at_commander_lock(config);
+    bool success = set_baud(config, baud);
+    at_commander_unlock(config);
+    return success;
+}
+
+/** Private: at_commander_switch_baud, for when the config is already locked.
+ */
+static bool switch_baud(AtCommanderConfig* config, int baud) {
+    return set_baud(config, baud) && restart_at_baud(config, baud);
+}
+
+bool at_commander_switch_baud(AtCommanderConfig* config, int baud) {
+    at_commander_lock(config);
+    bool success = switch_baud(config, baud);
+    at_commander_unlock(config);
+    return success;
+}
+
+/** Private: Account for one echoed byte of the throughput check's pattern.
+ *
+ * The pattern counts modulo a prime, so a byte a little ahead of the one
+ * expected means the bytes in between were lost - the check resynchronizes
+ * rather than counting everything after a lost byte as an error.
+ */
+static void throughput_receive(AtCommanderThroughput* result, int* expected,
+        uint8_t byte) {
+    int gap = (byte - *expected % AT_COMMANDER_THROUGHPUT_PERIOD +
+            AT_COMMANDER_THROUGHPUT_PERIOD) % AT_COMMANDER_THROUGHPUT_PERIOD;
+    result->bytes_received++;
+    if(*expected >= result->bytes_sent) {
+        // More came back than was sent
+        result->errors++;
+    } else if(gap == 0) {
+        (*expected)++;
+    } else if(gap < AT_COMMANDER_THROUGHPUT_MAX_GAP &&
+            *expected + gap < result->bytes_sent) {
+        result->errors += gap;
+        *expected += gap + 1;
+    } else {
+        result->errors++;
+        (*expected)++;
+    }
+}
+
+/** Private: at_commander_check_throughput, for when the config is already
+ * locked.
+ */
+static bool check_throughput(AtCommanderConfig* config, int length,
+        unsigned long timeout_ms, AtCommanderThroughput* result) {
+    memset(result, 0, sizeof(*result));
+    if(config->millis_function == NULL || length <= 0) {
+        at_commander_debug(config, "Throughput check needs a clock");
+        return false;
+    } else if(config->connected && !exit_command_mode(config)) {
+        at_commander_debug(config,
+                "Unable to leave command mode for throughput check");
+        return false;
+    }
+
+    uint8_t chunk[AT_COMMANDER_THROUGHPUT_CHUNK_SIZE];
+    int expected = 0;
+    unsigned long started_ms = at_commander_millis(config);
+    unsigned long last_received_ms = started_ms;
+    unsigned long progress_ms = started_ms;
+    while(result->bytes_sent < length || expected < length) {
+        if(result->bytes_sent < length) {
+            int count = length - result->bytes_sent;
+            if(count > (int)sizeof(chunk)) {
+                count = sizeof(chunk);
+            }
+            int i;
+            for(i = 0; i < count; i++) {
+                chunk[i] = (result->bytes_sent + i) %
+                        AT_COMMANDER_THROUGHPUT_PERIOD;
+            }
+            write_data(config, chunk, count);
+            result->bytes_sent += count;
+            progress_ms = at_commander_millis(config);
+        }
+
+        int byte;
+        bool received = false;
+        while((byte = config->read_function(config->device)) != -1) {
+            throughput_receive(result, &expected, byte);
+            received = true;
+        }
+
+        if(received) {
+            last_received_ms = progress_ms = at_commander_millis(config);
+        } else if(result->bytes_sent == length) {
+            if(at_commander_millis(config) - progress_ms >= timeout_ms) {
+                break;
+            }
+            at_commander_wait_for_data(config, 1);
+        }
+    }
+
+    if(expected < length) {
+        result->errors += length - expected;
+    }
+    result->elapsed_ms = last_received_ms - started_ms;
+    result->bytes_per_second = result->bytes_received * 1000UL /
+            (result->elapsed_ms > 0 ? result->elapsed_ms : 1);
+    at_commander_debug(config, "Sent %d bytes, %d came back in %lu ms with "
+            "%d errors", result->bytes_sent, result->bytes_received,
+            result->elapsed_ms, result->errors);
+    return true;
+}
+
+bool at_commander_check_throughput(AtCommanderConfig* config, int length,
+        unsigned long timeout_ms, AtCommanderThroughput* result) {
+    at_commander_lock(config);
+    bool success = check_throughput(config, length, timeout_ms, result);
+    at_commander_unlock(config);
+    return success;
+}
+
+/** Private: at_commander_set_name, for when the config is already locked.
+ */
+static bool set_device_name(AtCommanderConfig* config, const char* name,
         bool serialized) {
     AtCommand* command = &config->platform.set_name_command;
     if(serialized) {
@@ -351,12 +2903,30 @@ bool at_commander_set_name(AtCommanderConfig* config, const char* name,
                 "Appending unique serial number to end of name");
         command = &config->platform.set_serialized_name_command;
     }
-    if(at_commander_set(config, command, name)) {
-        at_commander_debug(config, "Changed device name successfully to %s",
-                name);
-        return true;
+
+    bool stored;
+    if(!set_setting(config, command, &stored, name)) {
+        return false;
     }
-    return false;
+    at_commander_debug(config, "Changed device name successfully to %s",
+            name);
+
+    AtCommanderSnapshot* snapshot = &config->snapshot;
+    strncpy(snapshot->name, name, sizeof(snapshot->name) - 1);
+    snapshot->name[sizeof(snapshot->name) - 1] = '\0';
+    snapshot->name_serialized = serialized;
+    if(!stored) {
+        snapshot->unstored |= AT_COMMANDER_SNAPSHOT_NAME;
+    }
+    return true;
+}
+
+bool at_commander_set_name(AtCommanderConfig* config, const char* name,
+        bool serialized) {
+    at_commander_lock(config);
+    bool success = set_device_name(config, name, serialized);
+    at_commander_unlock(config);
+    return success;
 }
 
 int at_commander_get_device_id(AtCommanderConfig* config, char* buffer,
@@ -371,8 +2941,18 @@ int at_commander_get_name(AtCommanderConfig* config, char* buffer,
             buffer, buflen);
 }
 
+int at_commander_get_version(AtCommanderConfig* config, char* buffer,
+        int buflen) {
+    if(config->platform.get_version_command.request_format == NULL) {
+        at_commander_debug(config, "Command not supported by this platform");
+        return -1;
+    }
+    return at_commander_get(config, &config->platform.get_version_command,
+            buffer, buflen);
+}
+
 int rn42_baud_rate_mapper(int baud) {
-    int value;
+    int value = -1;
     switch(baud) {
         case 1200:
             value = 12;
@@ -412,7 +2992,7 @@ int rn42_baud_rate_mapper(int baud) {
 }
 
 int xbee_baud_rate_mapper(int baud) {
-    int value;
+    int value = -1;
     switch(baud) {
         case 1200:
             value = 0;
@@ -441,3 +3021,7 @@ int xbee_baud_rate_mapper(int baud) {
     }
     return value;
 }
+
+int hayes_baud_rate_mapper(int baud) {
+    return baud;
+}
@@ -12,15 +12,70 @@
 extern "C" {
 #endif
 
-static const int VALID_BAUD_RATES[] = {230400, 115200, 9600, 19200, 38400,
-    57600, 460800};
+/** Public: The baud rates tried (in order) when looking for the device.
+ */
+extern const int VALID_BAUD_RATES[];
+extern const int VALID_BAUD_RATE_COUNT;
 
+/** Public: An AT command and the responses it may get.
+ *
+ * request_format - the request, optionally with printf style arguments.
+ * expected_response - for "set" commands, the exact successful response.
+ * error_response - for "get" commands, the prefix of an error response.
+ * success_responses - optional NULL terminated list of patterns that each mean
+ *      success, in addition to expected_response.
+ * error_responses - optional NULL terminated list of patterns that each mean
+ *      failure, in addition to error_response.
+ *
+ * Patterns match a whole line of the response. A '?' matches any one
+ * character and a '*' any run of characters, so "AOK" is a literal, "ERR*" a
+ * prefix and "*rror*" a simple wildcard. A '\\' makes the next character
+ * literal, e.g. "\\?" for a reply of just a question mark. If either list is
+ * given, the response is matched incrementally as each byte arrives, and the
+ * verdict is known as soon as the last byte that matters has been read.
+ */
 typedef struct {
     const char* request_format;
     const char* expected_response;
     const char* error_response;
+    const char* const* success_responses;
+    const char* const* error_responses;
 } AtCommand;
 
+#ifndef AT_COMMANDER_MAX_PATTERNS
+#define AT_COMMANDER_MAX_PATTERNS 8
+#endif
+
+// Patterns are tracked with one bit per position, so they're limited to 31
+// characters.
+#define AT_COMMANDER_MAX_PATTERN_LENGTH 31
+
+#define AT_COMMANDER_MATCH_PENDING 0
+#define AT_COMMANDER_MATCH_SUCCESS 1
+#define AT_COMMANDER_MATCH_ERROR 2
+#define AT_COMMANDER_MATCH_NONE 3
+
+typedef struct {
+    const char* pattern;
+    uint8_t length;
+    bool error;
+    // Positions in the pattern that are '*'
+    uint32_t star_mask;
+} AtCommanderPattern;
+
+/** Public: The success and error patterns of an AtCommand compiled into an
+ * automaton that is fed one byte at a time.
+ *
+ * The state of each pattern is the set of positions it could have reached so
+ * far, one bit each, so advancing on a byte is a few shifts and masks with no
+ * backtracking.
+ */
+typedef struct {
+    AtCommanderPattern patterns[AT_COMMANDER_MAX_PATTERNS];
+    uint32_t states[AT_COMMANDER_MAX_PATTERNS];
+    int count;
+} AtCommanderMatcher;
+
 typedef struct {
     int response_delay_ms;
     int (*baud_rate_mapper)(int baud);
@@ -34,34 +89,467 @@ typedef struct {
     AtCommand set_serialized_name_command;
     AtCommand get_name_command;
     AtCommand get_device_id_command;
+    // Longest line the device will accept when several commands are chained
+    // together (e.g. "ATBD7,WR,CN\r"), or 0 if chaining isn't supported.
+    int max_chained_line_length;
+    // How long the device stays in command mode on its own, in seconds, or 0
+    // if it never leaves by itself. If command_mode_timeout_idle is true the
+    // timer restarts with each command (XBee), otherwise it runs from when
+    // command mode was entered (RN-42 configuration timer).
+    int command_mode_timeout_s;
+    bool command_mode_timeout_idle;
+    // Silence required on the line before and after the enter command mode
+    // escape sequence (e.g. the XBee's "GT" guard time), or 0 if none.
+    int guard_time_ms;
+    // Commands that dump many settings at once, one "key=value" per line.
+    AtCommand get_settings_command;
+    AtCommand get_extended_settings_command;
+    // Reports the firmware version, e.g. to tell firmware variants apart.
+    AtCommand get_version_command;
+    // Discovers nearby devices for a number of seconds, streaming one line
+    // per device. The expected response marks the end of the inquiry.
+    AtCommand inquiry_command;
+    // Reads the quality of the wireless link. If the device then keeps on
+    // reporting it (the RN-42), the stop command turns that off again.
+    AtCommand get_link_quality_command;
+    AtCommand stop_link_quality_command;
+    // Optional NULL terminated list of patterns for lines the device sends
+    // when it has just restarted, e.g. the RN-42's "%REBOOT" status string.
+    const char* const* reset_signatures;
+    // For Hayes style devices, whose every reply ends with a final result
+    // code - the NULL terminated patterns of those that mean failure (e.g.
+    // "ERROR", "+CME ERROR*"). If set, a reply is read line by line, skipping
+    // the echo of the request and collecting the information lines, until a
+    // line matches the command's expected response or one of these - so a
+    // request completes as soon as the device does, rather than after
+    // response_delay_ms. final_result_timeout_ms limits the wait for each line.
+    const char* const* error_result_codes;
+    unsigned long final_result_timeout_ms;
+    // Optional - sent after entering command mode to stop the device echoing
+    // requests back (e.g. "ATE0").
+    AtCommand disable_echo_command;
 } AtCommanderPlatform;
 
 extern const AtCommanderPlatform AT_PLATFORM_RN42;
 extern const AtCommanderPlatform AT_PLATFORM_XBEE;
+/** Public: A generic Hayes / 3GPP TS 27.007 modem, e.g. a SIM800 or an
+ * ESP8266 with the AT firmware. Expected to be in command mode already, as
+ * these modems are when they aren't carrying a call or a transparent link -
+ * command mode is "entered" by checking the modem answers AT.
+ */
+extern const AtCommanderPlatform AT_PLATFORM_HAYES;
+
+/** Public: The platforms at_commander_detect_platform tries by default, in
+ * order - those without a guard time first, as they're the quickest to rule
+ * out.
+ */
+extern const AtCommanderPlatform* const AT_PLATFORMS[];
+extern const int AT_PLATFORM_COUNT;
+
+/** Public: The classes of request that can each have their own retry policy.
+ */
+typedef enum {
+    AT_COMMANDER_RETRY_ENTER,
+    AT_COMMANDER_RETRY_SET,
+    AT_COMMANDER_RETRY_GET,
+    AT_COMMANDER_RETRY_CLASS_COUNT
+} AtCommanderRetryClass;
+
+/** Public: How a failed request is retried.
+ *
+ * A zeroed policy (the default) makes a single attempt.
+ *
+ * max_attempts - the total number of attempts, including the first.
+ * initial_backoff_ms - the wait before the first retry, doubled for each
+ *      retry after that.
+ * max_backoff_ms - the longest wait between attempts, or 0 for no limit.
+ * jitter_percent - up to this percentage of each wait is randomly taken off,
+ *      so devices that failed together don't all retry in lockstep.
+ */
+typedef struct {
+    int max_attempts;
+    unsigned long initial_backoff_ms;
+    unsigned long max_backoff_ms;
+    int jitter_percent;
+} AtCommanderRetryPolicy;
+
+#define AT_COMMANDER_SNAPSHOT_NAME 1
+#define AT_COMMANDER_SNAPSHOT_CONFIGURATION_TIMER 2
+
+/** Public: The settings last applied with the library's set functions, to put
+ * back after the device resets.
+ *
+ * Settings stored in the device's flash memory survive a reset, so only those
+ * applied since the last store are put back. Fill it in by hand to restore
+ * settings applied before the program started.
+ *
+ * baud - the device's baud rate last set, or 0 - if the device comes back at
+ *      another rate, it's moved back to this one.
+ * name - the name last set.
+ * name_serialized - true if the name was set with a serial number appended.
+ * configuration_timer_s - the configuration timer last set.
+ * unstored - an AT_COMMANDER_SNAPSHOT_* bit for each setting applied but not
+ *      yet stored.
+ */
+typedef struct {
+    int baud;
+    char name[21];
+    bool name_serialized;
+    int configuration_timer_s;
+    uint8_t unstored;
+} AtCommanderSnapshot;
 
 typedef struct {
     AtCommanderPlatform platform;
     void (*baud_rate_initializer)(void* device, int);
     void (*write_function)(void* device, uint8_t);
     int (*read_function)(void* device);
+    // Optional - bulk receive, for transports that get data in chunks. Returns
+    // the bytes that have already arrived (without waiting) and sets length,
+    // or returns NULL if there are none. Lines are then found with a
+    // vectorized scan (see atscan.h) instead of a read_function call per byte,
+    // and the bytes used are released with consume_function. Both must be
+    // set, and agree with read_function, which is still used for matching.
+    const uint8_t* (*peek_function)(void* device, int* length);
+    void (*consume_function)(void* device, int count);
     void (*delay_function)(unsigned long);
     void (*log_function)(const char*, ...);
+    // Optional - a monotonic millisecond clock, e.g. millis() on Arduino.
+    // Without it the library can't tell when command mode has timed out.
+    unsigned long (*millis_function)(void);
+    // Optional - to share a device between threads, lock and unlock a
+    // per-device mutex. The lock must be recursive (the same thread may take
+    // it again), e.g. a pthread mutex with PTHREAD_MUTEX_RECURSIVE.
+    void (*lock_function)(void* device);
+    void (*unlock_function)(void* device);
+    // Optional - wait up to ms for received data, returning at once if some
+    // is already waiting, or as soon as any arrives (returning early without
+    // any is harmless). Used in place of delay_function while waiting for a
+    // reply, so the wait can sleep rather than spin, and ends with the reply
+    // rather than after a worst-case delay.
+    void (*wait_function)(void* device, unsigned long ms);
 
     bool connected;
     int baud;
     int device_baud;
     void* device;
+
+    // If non-zero, overrides the platform's command mode timeout - updated
+    // automatically by at_commander_set_configuration_timer.
+    int command_mode_timeout_s;
+    // If non-zero, at_commander_check_session leaves command mode after this
+    // many ms without a command.
+    unsigned long idle_exit_ms;
+    unsigned long session_started_ms;
+    unsigned long last_activity_ms;
+    // When the last byte was sent to the device, command or data.
+    unsigned long last_transmit_ms;
+    // Set with at_commander_set_deadline.
+    unsigned long deadline_ms;
+    bool deadline_active;
+
+    // Optional - how to retry each class of request, indexed by
+    // AtCommanderRetryClass. AT_COMMANDER_RETRY_ENTER retries the whole baud
+    // rate scan.
+    AtCommanderRetryPolicy retry_policies[AT_COMMANDER_RETRY_CLASS_COUNT];
+    unsigned long retry_seed;
+    // Optional (needs a millis_function) - after this many consecutive
+    // failures to reach the device, fail fast for breaker_cool_down_ms and
+    // then try a single escape sequence at the last known baud rate before
+    // scanning again. 0 disables the breaker.
+    int breaker_threshold;
+    unsigned long breaker_cool_down_ms;
+    int breaker_failures;
+    unsigned long breaker_opened_ms;
+    bool breaker_open;
+
+    // Reset detection (see at_commander_detect_reset) - once a reset is
+    // detected, the next command re-enters command mode and puts the snapshot
+    // back first. resets counts the resets detected, and last_restore_ms and
+    // max_restore_ms are how long from detection until restored.
+    AtCommanderSnapshot snapshot;
+    bool restore_pending;
+    int silent_responses;
+    unsigned long reset_detected_ms;
+    unsigned long resets;
+    unsigned long last_restore_ms;
+    unsigned long max_restore_ms;
+    // The platform's reset signatures, compiled when first needed and again
+    // if platform.reset_signatures is changed to another list.
+    AtCommanderMatcher reset_matcher;
+    const char* const* reset_matcher_signatures;
 } AtCommanderConfig;
 
+#ifndef AT_COMMANDER_MAX_LINE_LENGTH
+#define AT_COMMANDER_MAX_LINE_LENGTH 64
+#endif
+
+/** Public: A snapshot of the device's settings, parsed from the settings dump
+ * commands by at_commander_get_settings. Fields the device didn't report are
+ * left empty (or 0).
+ */
+typedef struct {
+    char name[21];
+    char device_id[13];
+    int baud;
+    char mode[8];
+    int authentication;
+    int configuration_timer_s;
+} AtCommanderSettings;
+
+/** Public: A device found by an inquiry.
+ *
+ * address - the Bluetooth address, as 12 hex digits.
+ * name - the device's name, or empty if the inquiry didn't ask for names.
+ * class_of_device - the device's class, or 0 if it wasn't reported.
+ * rssi - the strongest signal seen from the device in dBm, or 0 if it wasn't
+ *      reported.
+ */
+typedef struct {
+    char address[13];
+    char name[21];
+    uint32_t class_of_device;
+    int rssi;
+} AtCommanderInquiryResult;
+
+/** Public: The state of an inquiry, parsed into a table the caller provides so
+ * memory use is fixed no matter how many devices answer. Initialize with
+ * at_commander_inquiry_init.
+ *
+ * count - the distinct devices in the table, merged by address.
+ * dropped - the result lines dropped because their device didn't fit in the
+ *      table. A device reported more than once is counted each time.
+ * max_results - end the inquiry once this many distinct devices are found, or
+ *      0 to carry on to the end.
+ * complete - true once the device has reported the end of the inquiry.
+ * busy_until_ms - if the inquiry ended early, when the device will be done
+ *      scanning and answering commands again.
+ */
+typedef struct {
+    AtCommanderInquiryResult* results;
+    int capacity;
+    int count;
+    int dropped;
+    int max_results;
+    bool complete;
+    unsigned long busy_until_ms;
+} AtCommanderInquiry;
+
+/** Public: One link quality sample, packed into 4 bytes.
+ *
+ * time_s - when it was taken, as the low 16 bits of the millis_function clock
+ *      in seconds.
+ * value - the platform's raw reading: on the XBee the RSSI of the last packet
+ *      in -dBm (higher is weaker), on the RN-42 the link quality from 0 to 255
+ *      (higher is stronger).
+ */
+typedef struct {
+    uint16_t time_s;
+    uint8_t value;
+} AtCommanderLinkSample;
+
+/** Public: Samples the link quality now and then, in command mode sessions
+ * that are already open, into a ring the caller provides. Initialize with
+ * at_commander_link_sampler_init.
+ *
+ * count - the samples in the ring, up to capacity.
+ * next - where the next sample goes in the ring.
+ * interval_ms - the least time between samples.
+ * budget_percent - the most of the link's time that sampling may take, or 0
+ *      for no limit.
+ * cost_ms - how long the last sample took, the estimate for the next one.
+ * credit - the sampling time earned and not yet spent, in 1/100 ms.
+ * failures - queries the device didn't answer with a reading.
+ */
+typedef struct {
+    AtCommanderLinkSample* samples;
+    int capacity;
+    int count;
+    int next;
+    unsigned long interval_ms;
+    int budget_percent;
+    unsigned long cost_ms;
+    unsigned long credit;
+    unsigned long credited_ms;
+    unsigned long last_sample_ms;
+    bool started;
+    int failures;
+} AtCommanderLinkSampler;
+
+/** Public: The aggregate of the latest link quality samples, in the units of
+ * AtCommanderLinkSample's value.
+ */
+typedef struct {
+    int count;
+    int min;
+    int max;
+    int mean;
+    int latest;
+} AtCommanderLinkStats;
+
+#ifndef AT_COMMANDER_MAX_BATCH_SIZE
+#define AT_COMMANDER_MAX_BATCH_SIZE 8
+#endif
+
+#ifndef AT_COMMANDER_MAX_BATCH_LENGTH
+#define AT_COMMANDER_MAX_BATCH_LENGTH 64
+#endif
+
+/** Public: A sequence of "set" commands to be sent together.
+ *
+ * On platforms that support it, the commands are chained into as few lines as
+ * possible (e.g. "ATBD7,WR,CN\r") and the replies are matched back up with the
+ * originating command. Initialize with at_commander_batch_init.
+ *
+ * requests - the formatted requests, each NULL terminated, back to back.
+ * offsets - the start of each request in requests.
+ * expected_responses - the expected response for each request.
+ * results - after sending, true for each command that was acknowledged.
+ */
+typedef struct {
+    char requests[AT_COMMANDER_MAX_BATCH_LENGTH];
+    int length;
+    int offsets[AT_COMMANDER_MAX_BATCH_SIZE];
+    const char* expected_responses[AT_COMMANDER_MAX_BATCH_SIZE];
+    bool results[AT_COMMANDER_MAX_BATCH_SIZE];
+    int count;
+} AtCommanderBatch;
+
+/** Thread safety
+ *
+ * The library has no global mutable state, so separate devices (each with its
+ * own AtCommanderConfig) can always be driven from separate threads at once.
+ *
+ * To share one device between threads, set the config's lock_function and
+ * unlock_function. Every public function that talks to the device or changes
+ * the config then holds the lock for the whole operation, so e.g. concurrent
+ * at_commander_get_name and at_commander_set_baud calls are serialized rather
+ * than interleaved on the wire. Use at_commander_lock and at_commander_unlock
+ * to make a sequence of calls atomic - for example setting a deadline, running
+ * an operation and clearing it again.
+ *
+ * Batches, settings snapshots, inquiries and link samplers belong to the
+ * caller and aren't locked.
+ */
+
+/** Public: Take the device's lock, if it has one, to group several calls into
+ * one atomic sequence. Must be paired with at_commander_unlock.
+ */
+void at_commander_lock(AtCommanderConfig* config);
+
+/** Public: Release the lock taken with at_commander_lock.
+ */
+void at_commander_unlock(AtCommanderConfig* config);
+
+/** Public: Set an absolute deadline for the following operations.
+ *
+ * Requires a millis_function. Every operation started before the deadline is
+ * cleared - including the nested requests of e.g. at_commander_set_baud, which
+ * enters command mode, scans baud rates, sends the change and stores it - gives
+ * up as soon as the deadline passes, instead of running all of its retries.
+ * Read timeouts are also measured with the clock rather than by counting
+ * retries, so they don't drift with the real cost of each read.
+ *
+ * To configure a module within 500ms:
+ *
+ *      at_commander_set_deadline(&config, 500);
+ *      bool success = at_commander_set_baud(&config, 115200);
+ *      at_commander_clear_deadline(&config);
+ *
+ * timeout_ms - the deadline, in ms from now.
+ */
+void at_commander_set_deadline(AtCommanderConfig* config,
+        unsigned long timeout_ms);
+
+/** Public: Remove any deadline set with at_commander_set_deadline.
+ */
+void at_commander_clear_deadline(AtCommanderConfig* config);
+
 /** Public: Switch to command mode.
  *
- * If unable to determine the current baud rate and enter command mode, returns
+ * The last known baud rate is tried first, before scanning all valid rates. If
+ * unable to determine the current baud rate and enter command mode, returns
  * false.
  *
+ * If a millis_function is available and the current session has expired (or
+ * is about to), command mode is re-entered before returning.
+ *
  * Returns true if successful, or if already in command mode.
  */
 bool at_commander_enter_command_mode(AtCommanderConfig* config);
 
+/** Public: Find out which platform the attached device is, and its baud rate,
+ * then switch to command mode.
+ *
+ * At each baud rate (the last known one first, then VALID_BAUD_RATES in order)
+ * the UART is initialized once and each candidate's escape sequence is tried in
+ * turn, so the whole platform x baud matrix is covered in a single pass. A
+ * probe that gets no reply leaves the line quiet, which also counts towards
+ * the guard time of the next candidate's escape sequence.
+ *
+ *  candidates - the platforms to try, most likely first, or NULL for
+ *      AT_PLATFORMS.
+ *  candidate_count - the number of candidates.
+ *  version - if not NULL, a buffer for the response to the detected platform's
+ *      get_version_command, to tell firmware variants apart. Left empty if the
+ *      platform has none.
+ *  version_length - the length of the version buffer.
+ *
+ *  Returns true if a device answered, with config->platform set to the
+ *  platform it answered as. Otherwise the config's platform is unchanged.
+ */
+bool at_commander_detect_platform(AtCommanderConfig* config,
+        const AtCommanderPlatform* const* candidates, int candidate_count,
+        char* version, int version_length);
+
+/** Public: Returns true if the circuit breaker has tripped and calls that need
+ * the device are failing fast, until the cool down ends.
+ */
+bool at_commander_circuit_open(AtCommanderConfig* config);
+
+/** Public: Check the age of the current command mode session.
+ *
+ * Call this periodically (e.g. from the main loop) when using a
+ * millis_function. If the device has left command mode on its own because its
+ * timer expired, the config is updated to match. If idle_exit_ms is set and no
+ * command has been sent for that long, switches back to data mode.
+ *
+ * Returns true if still in command mode.
+ */
+bool at_commander_check_session(AtCommanderConfig* config);
+
+/** Public: Check a line the device sent in data mode (e.g. read by the
+ * application) for the platform's reset signatures.
+ *
+ * Resets are also detected while in command mode: a response that is one of
+ * the signatures, one garbled as if at the wrong baud rate, or no response at
+ * all to several requests in a row means the device has restarted and left
+ * command mode. Either way the session is marked lost, and the next command
+ * re-enters command mode at the last known baud rate and puts back
+ * config->snapshot before carrying on.
+ *
+ *  line - the line, without its line ending.
+ *
+ *  Returns true if the line means the device has reset.
+ */
+bool at_commander_detect_reset(AtCommanderConfig* config, const char* line);
+
+/** Public: Send data mode bytes to the device, recording when they were sent.
+ *
+ * Using this rather than writing to the device directly lets the library wait
+ * only for the remainder of the guard time when next entering command mode.
+ */
+void at_commander_write_data(AtCommanderConfig* config, const uint8_t* data,
+        int size);
+
+/** Public: Find how long until the command mode escape sequence may be sent.
+ *
+ * Returns the number of ms the line must stay quiet before the escape
+ * sequence, or 0 if it can be sent now. Without a millis_function the full
+ * guard time is always returned.
+ */
+unsigned long at_commander_guard_time_remaining_ms(AtCommanderConfig* config);
+
 /** Public: Switch to data mode (from command mode).
  *
  * Returns true if the device was successfully switched to data mode.
@@ -90,6 +578,55 @@ bool at_commander_reboot(AtCommanderConfig* config);
  */
 bool at_commander_set_baud(AtCommanderConfig* config, int baud);
 
+#ifndef AT_COMMANDER_REBOOT_WINDOW_MS
+#define AT_COMMANDER_REBOOT_WINDOW_MS 500
+#endif
+
+/** Public: Change the baud rate of the attached AT device and follow it.
+ *
+ *  Like at_commander_set_baud, but then restarts the device so the new rate
+ *  takes effect (exiting command mode instead on platforms without a reboot
+ *  command, e.g. the XBee), waits AT_COMMANDER_REBOOT_WINDOW_MS, and moves the
+ *  UART straight to the new rate, confirming it with a single escape sequence.
+ *  The next operation doesn't have to scan for the device.
+ *
+ *      baud - the desired baud rate.
+ *
+ *  Returns true if the device answered at the new rate (leaving it in command
+ *  mode). If the rate was changed but the device didn't answer, config->baud
+ *  is still the new rate, so the next scan tries it first.
+ */
+bool at_commander_switch_baud(AtCommanderConfig* config, int baud);
+
+/** Public: The result of a link throughput check.
+ *
+ * errors - bytes that came back corrupted or never came back.
+ * elapsed_ms - from the first byte sent to the last one received.
+ */
+typedef struct {
+    int bytes_sent;
+    int bytes_received;
+    int errors;
+    unsigned long elapsed_ms;
+    unsigned long bytes_per_second;
+} AtCommanderThroughput;
+
+/** Public: Measure the data mode link by pushing a known pattern through it.
+ *
+ *  The far end must echo what it receives (e.g. a loopback on the peer's
+ *  UART). Leaves command mode first if necessary. Requires a millis_function.
+ *
+ *      length - the number of bytes to send.
+ *      timeout_ms - how long to wait for the echo to make progress before
+ *          counting the rest as lost.
+ *      result - filled in with the measurements.
+ *
+ *  Returns false if the check couldn't be run, otherwise true (check
+ *  result->errors for the link's quality).
+ */
+bool at_commander_check_throughput(AtCommanderConfig* config, int length,
+        unsigned long timeout_ms, AtCommanderThroughput* result);
+
 /** Public: Change the configuration timeout of the attached AT device.
  *
  *  Attempts to automatically determine the current baud rate in order to enter
@@ -144,14 +681,137 @@ int at_commander_get_name(AtCommanderConfig* config, char* buffer,
 int at_commander_get_name(AtCommanderConfig* config, char* buffer,
         int buflen);
 
+/** Public: Retrieve the attached AT device's firmware version.
+ *
+ *  buffer - a string buffer to store the retrieved version.
+ *  buflen - the length of the buffer.
+ *
+ *  Returns the length of the response, or -1 if an error occurred (or the
+ *  platform has no version command).
+ */
+int at_commander_get_version(AtCommanderConfig* config, char* buffer,
+        int buflen);
+
 /** Public: Send an AT "get" query, read a response, and verify it doesn't match
  * any known errors.
  *
+ * On platforms with final result codes, the response is the first
+ * information line (e.g. "+CSQ: 20,0"), or empty if there was none.
+ *
  *  Returns the length of the response, or -1 if an error occurred.
  */
 int at_commander_get(AtCommanderConfig* config, AtCommand* command,
         char* response_buffer, int response_buffer_length);
 
+/** Public: Send an AT query with a multi-line response, passing each line to a
+ * callback as it arrives.
+ *
+ * The response is considered complete when the device goes quiet, or when a
+ * line matches the command's expected_response (if it has one), which is used
+ * as an end marker. Blank lines are skipped. Lines longer than
+ * AT_COMMANDER_MAX_LINE_LENGTH are split.
+ *
+ * On platforms with final result codes (see AtCommanderPlatform), the
+ * callback gets each information line, the response ends at the final result
+ * code, and an error result code fails the query.
+ *
+ *  line_callback - called with each line (NULL terminated), its length and the
+ *      context.
+ *  context - passed through to the callback.
+ *
+ *  Returns the number of lines received, or -1 if an error occurred.
+ */
+int at_commander_get_lines(AtCommanderConfig* config, AtCommand* command,
+        void (*line_callback)(const char* line, int length, void* context),
+        void* context);
+
+/** Public: Read all of the device's settings at once with the platform's
+ * settings dump commands, rather than one query per value.
+ *
+ *  settings - the snapshot to fill in.
+ *
+ *  Returns true if the settings were retrieved.
+ */
+bool at_commander_get_settings(AtCommanderConfig* config,
+        AtCommanderSettings* settings);
+
+/** Public: Start an empty inquiry.
+ *
+ *  results - the table for the devices found.
+ *  capacity - the number of entries in the table.
+ *  max_results - end the inquiry once this many devices are found, or 0 to
+ *      wait for the device to finish.
+ */
+void at_commander_inquiry_init(AtCommanderInquiry* inquiry,
+        AtCommanderInquiryResult* results, int capacity, int max_results);
+
+/** Public: Parse one line of inquiry output into the results, merging it with
+ * any earlier result for the same address.
+ *
+ * Understands the RN-42's "address,name,class" and "address,class,rssi"
+ * result lines. Other lines (e.g. "Found 3") are ignored, and the end marker
+ * marks the inquiry complete.
+ *
+ *  Returns true if the line was a result.
+ */
+bool at_commander_inquiry_parse_line(AtCommanderInquiry* inquiry,
+        const char* line);
+
+/** Public: Discover nearby devices with the platform's inquiry command.
+ *
+ * Results are parsed as each line arrives. The inquiry ends when the device
+ * reports it's done, when max_results distinct devices have been found, when
+ * the deadline (see at_commander_set_deadline) passes, or a little after
+ * duration_s if the device never reports the end. If it ends early the device
+ * carries on scanning until inquiry->busy_until_ms and won't take commands
+ * until then.
+ *
+ *  duration_s - how long the device should scan for.
+ *  inquiry - initialized with at_commander_inquiry_init.
+ *
+ *  Returns the number of distinct devices in the table, or -1 if the inquiry
+ *  couldn't be started.
+ */
+int at_commander_inquiry(AtCommanderConfig* config, int duration_s,
+        AtCommanderInquiry* inquiry);
+
+/** Public: Start a link quality sampler with an empty ring.
+ *
+ *  samples - the ring for the samples.
+ *  capacity - the number of entries in the ring.
+ *  interval_ms - the least time between samples.
+ *  budget_percent - the most of the link's time that sampling may take away
+ *      from data traffic, or 0 for no limit.
+ */
+void at_commander_link_sampler_init(AtCommanderLinkSampler* sampler,
+        AtCommanderLinkSample* samples, int capacity,
+        unsigned long interval_ms, int budget_percent);
+
+/** Public: Take a link quality sample, if one is due.
+ *
+ * Call this whenever convenient, e.g. from the main loop or right after other
+ * commands. A sample is only taken if the device is already in command mode
+ * with enough of its session left, so sampling never costs a guard time or an
+ * escape sequence of its own. Each sample's time is charged against the
+ * budget, which earns budget_percent of the time passed - so in the long run
+ * sampling takes no more than that share of the link. Requires a
+ * millis_function.
+ *
+ *  Returns true if a sample was added to the ring.
+ */
+bool at_commander_sample_link(AtCommanderConfig* config,
+        AtCommanderLinkSampler* sampler);
+
+/** Public: Aggregate the latest samples in a sampler's ring.
+ *
+ *  window - how many of the latest samples to include, or 0 for all of them.
+ *  stats - filled in with the aggregate.
+ *
+ *  Returns false if there are no samples.
+ */
+bool at_commander_link_stats(const AtCommanderLinkSampler* sampler,
+        int window, AtCommanderLinkStats* stats);
+
 /** Public: Send an AT command, read a response, and verify it matches the
  * expected value.
  *
@@ -160,8 +820,67 @@ int at_commander_get(AtCommanderConfig* config, AtCommand* command,
 bool at_commander_set(AtCommanderConfig* config, AtCommand* command,
         ...);
 
+/** Public: Compile a command's success and error patterns (including the
+ * plain expected_response and error_response) into a matcher, ready for the
+ * first byte of a response.
+ *
+ * Returns false if there are too many patterns or one is too long.
+ */
+bool at_commander_compile_matcher(AtCommanderMatcher* matcher,
+        const AtCommand* command);
+
+/** Public: Reset a compiled matcher for a new response.
+ */
+void at_commander_reset_matcher(AtCommanderMatcher* matcher);
+
+/** Public: Feed the next byte of a response line to a matcher.
+ *
+ * Returns AT_COMMANDER_MATCH_SUCCESS or AT_COMMANDER_MATCH_ERROR as soon as a
+ * pattern matches no matter what follows (e.g. a prefix), or
+ * AT_COMMANDER_MATCH_NONE once no pattern can match any more. Otherwise
+ * returns AT_COMMANDER_MATCH_PENDING. Error patterns take priority.
+ */
+int at_commander_matcher_feed(AtCommanderMatcher* matcher, char byte);
+
+/** Public: Tell the matcher the response line has ended.
+ *
+ * Returns AT_COMMANDER_MATCH_SUCCESS or AT_COMMANDER_MATCH_ERROR if a pattern
+ * matches the whole line, otherwise AT_COMMANDER_MATCH_NONE.
+ */
+int at_commander_matcher_finish(AtCommanderMatcher* matcher);
+
+/** Public: Reset a batch so it contains no commands.
+ */
+void at_commander_batch_init(AtCommanderBatch* batch);
+
+/** Public: Format an AT command and append it to a batch, without sending it.
+ *
+ * Returns true if the command was added, or false if the batch is full.
+ */
+bool at_commander_batch_add(AtCommanderBatch* batch, AtCommand* command, ...);
+
+/** Public: Send all of the commands in a batch, optionally followed by the
+ * platform's store settings and exit command mode commands.
+ *
+ * If the platform supports chaining, the commands are sent in as few lines as
+ * the device's maximum line length allows - a baud change plus store plus exit
+ * is a single round trip on the XBee. Otherwise each command is sent
+ * separately. The result of each command is stored in batch->results.
+ *
+ * The store and exit commands aren't left in the batch afterwards, so the same
+ * batch can be sent again.
+ *
+ * store - if true, append the store settings command.
+ * exit - if true, append the exit command mode command.
+ *
+ * Returns true if every command in the batch was acknowledged.
+ */
+bool at_commander_batch_send(AtCommanderConfig* config,
+        AtCommanderBatch* batch, bool store, bool exit);
+
 int rn42_baud_rate_mapper(int baud);
 int xbee_baud_rate_mapper(int baud);
+int hayes_baud_rate_mapper(int baud);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,137 @@
+#include "atdma.h"
+
+#include <string.h>
+
+#define AT_DMA_RX_MASK (AT_DMA_RX_BUFFER_SIZE - 1)
+
+void at_commander_dma_uart_init(AtCommanderDmaUart* uart,
+        void (*start_transmit)(void* context, const uint8_t* data, int length),
+        int (*receive_remaining)(void* context), void* context,
+        int idle_polls) {
+    memset(uart, 0, sizeof(*uart));
+    uart->start_transmit = start_transmit;
+    uart->receive_remaining = receive_remaining;
+    uart->context = context;
+    uart->rx_idle_polls = idle_polls > 0 ? idle_polls : 1;
+}
+
+/** Private: Hand the buffer being filled to DMA, and start filling the other.
+ */
+static void dma_start_filled_buffer(AtCommanderDmaUart* uart) {
+    int sending = uart->tx_filling;
+    uart->tx_filling = !sending;
+    uart->tx_lengths[uart->tx_filling] = 0;
+    uart->tx_busy = true;
+    uart->tx_transfers++;
+    uart->start_transmit(uart->context, uart->tx_buffers[sending],
+            uart->tx_lengths[sending]);
+}
+
+bool at_commander_dma_write(AtCommanderDmaUart* uart, uint8_t byte) {
+    return at_commander_dma_write_data(uart, &byte, 1) == 1;
+}
+
+int at_commander_dma_write_data(AtCommanderDmaUart* uart, const uint8_t* data,
+        int length) {
+    int written = 0;
+    while(written < length) {
+        int* filled = &uart->tx_lengths[uart->tx_filling];
+        int count = AT_DMA_TX_BUFFER_SIZE - *filled;
+        if(count > length - written) {
+            count = length - written;
+        } else if(count == 0) {
+            break;
+        }
+        memcpy(uart->tx_buffers[uart->tx_filling] + *filled, data + written,
+                count);
+        *filled += count;
+        written += count;
+
+        // Start sending at once if idle, and carry on filling the other buffer
+        if(!uart->tx_busy) {
+            dma_start_filled_buffer(uart);
+        }
+    }
+    return written;
+}
+
+void at_commander_dma_transmit_complete(AtCommanderDmaUart* uart) {
+    uart->tx_busy = false;
+    if(uart->tx_lengths[uart->tx_filling] > 0) {
+        dma_start_filled_buffer(uart);
+    }
+}
+
+bool at_commander_dma_transmit_idle(AtCommanderDmaUart* uart) {
+    return !uart->tx_busy && uart->tx_lengths[uart->tx_filling] == 0;
+}
+
+/** Private: Catch up with how far DMA has got through the receive buffer.
+ *
+ * Only the position in the buffer is known, so a position behind the last one
+ * means DMA wrapped around since. If it lapped unread bytes, the oldest are
+ * dropped - they've been overwritten.
+ */
+static void dma_update_received(AtCommanderDmaUart* uart) {
+    unsigned long position = (AT_DMA_RX_BUFFER_SIZE -
+            uart->receive_remaining(uart->context)) & AT_DMA_RX_MASK;
+    unsigned long received = (uart->rx_received & ~(unsigned long)
+            AT_DMA_RX_MASK) + position;
+    if(received < uart->rx_received) {
+        received += AT_DMA_RX_BUFFER_SIZE;
+    }
+    uart->rx_received = received;
+
+    if(uart->rx_received - uart->rx_consumed > AT_DMA_RX_BUFFER_SIZE) {
+        uart->rx_consumed = uart->rx_received - AT_DMA_RX_BUFFER_SIZE;
+        uart->rx_overruns++;
+    }
+}
+
+int at_commander_dma_available(AtCommanderDmaUart* uart) {
+    dma_update_received(uart);
+    return uart->rx_received - uart->rx_consumed;
+}
+
+int at_commander_dma_read(AtCommanderDmaUart* uart) {
+    if(at_commander_dma_available(uart) == 0) {
+        return -1;
+    }
+    return uart->rx_buffer[uart->rx_consumed++ & AT_DMA_RX_MASK];
+}
+
+const uint8_t* at_commander_dma_peek(AtCommanderDmaUart* uart, int* length) {
+    *length = at_commander_dma_available(uart);
+    if(*length == 0) {
+        return NULL;
+    }
+
+    int start = uart->rx_consumed & AT_DMA_RX_MASK;
+    if(*length > AT_DMA_RX_BUFFER_SIZE - start) {
+        *length = AT_DMA_RX_BUFFER_SIZE - start;
+    }
+    return uart->rx_buffer + start;
+}
+
+void at_commander_dma_consume(AtCommanderDmaUart* uart, int count) {
+    uart->rx_consumed += count;
+}
+
+void at_commander_dma_poll(AtCommanderDmaUart* uart) {
+    dma_update_received(uart);
+    if(uart->rx_received != uart->rx_last_polled) {
+        uart->rx_last_polled = uart->rx_received;
+        uart->rx_active = true;
+        uart->rx_quiet_polls = 0;
+    } else if(uart->rx_active &&
+            ++uart->rx_quiet_polls >= uart->rx_idle_polls) {
+        uart->rx_active = false;
+        uart->rx_idle = true;
+    }
+}
+
+bool at_commander_dma_take_idle(AtCommanderDmaUart* uart) {
+    bool idle = uart->rx_idle;
+    uart->rx_idle = false;
+    return idle;
+}
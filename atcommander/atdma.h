@@ -0,0 +1,152 @@
+#ifndef _ATDMA_H_
+#define _ATDMA_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* DMA UART transport
+ *
+ * The hardware independent core of a UART driver that moves bytes with DMA
+ * rather than the CPU - the buffer management and state machines, leaving
+ * only the register programming to the firmware (e.g. lpc17xx/uartdma.c).
+ *
+ * Transmit is double buffered: while DMA sends one buffer, writes fill the
+ * other, which is handed to DMA as soon as the first transfer completes. A
+ * write to an idle transmitter starts a transfer at once, so single commands
+ * aren't held back, and bulk data naturally batches into full buffers.
+ *
+ * Receive is a circular buffer that DMA writes into endlessly. The core reads
+ * the DMA channel's remaining transfer count to find how far it has got, so
+ * the CPU only touches received bytes when they're read. A periodic poll (e.g.
+ * from a 1ms tick) tracks that position to detect an idle line - the end of a
+ * burst of data - so data mode forwarding can flush a partial burst promptly.
+ *
+ * None of the functions are safe to call concurrently: the firmware must mask
+ * the DMA completion and tick interrupts around calls from its main loop.
+ */
+
+// Must be a power of 2. DMA wraps around the receive buffer, so it has to be
+// polled at least once in the time it takes to receive this many bytes.
+#ifndef AT_DMA_RX_BUFFER_SIZE
+#define AT_DMA_RX_BUFFER_SIZE 1024
+#endif
+
+#ifndef AT_DMA_TX_BUFFER_SIZE
+#define AT_DMA_TX_BUFFER_SIZE 128
+#endif
+
+#if AT_DMA_RX_BUFFER_SIZE & (AT_DMA_RX_BUFFER_SIZE - 1)
+#error AT_DMA_RX_BUFFER_SIZE must be a power of 2
+#endif
+
+/** Public: The state of a DMA driven UART. Initialize with
+ * at_commander_dma_uart_init.
+ *
+ * start_transmit - starts a DMA transfer of the bytes to the UART. The
+ *      firmware calls at_commander_dma_transmit_complete once it's done.
+ * receive_remaining - returns the receive channel's remaining transfer count,
+ *      counting down from AT_DMA_RX_BUFFER_SIZE as DMA fills the buffer.
+ * tx_filling - the index of the transmit buffer being filled; the other is
+ *      being sent while tx_busy.
+ * rx_received, rx_consumed - the bytes received and read since init, so the
+ *      bytes waiting are the difference.
+ * rx_overruns - the times DMA lapped unread bytes, which were dropped.
+ * rx_quiet_polls - polls in a row without new bytes while receiving.
+ */
+typedef struct {
+    void (*start_transmit)(void* context, const uint8_t* data, int length);
+    int (*receive_remaining)(void* context);
+    void* context;
+
+    uint8_t tx_buffers[2][AT_DMA_TX_BUFFER_SIZE];
+    int tx_lengths[2];
+    int tx_filling;
+    bool tx_busy;
+    unsigned long tx_transfers;
+
+    uint8_t rx_buffer[AT_DMA_RX_BUFFER_SIZE];
+    unsigned long rx_received;
+    unsigned long rx_consumed;
+    unsigned long rx_overruns;
+    unsigned long rx_last_polled;
+    int rx_idle_polls;
+    int rx_quiet_polls;
+    bool rx_active;
+    bool rx_idle;
+} AtCommanderDmaUart;
+
+/** Public: Reset a DMA UART, with both directions idle and the receive
+ * channel at the start of rx_buffer.
+ *
+ *  idle_polls - the number of polls in a row without new bytes that mark the
+ *      end of a burst, e.g. 2 for a 1ms tick (at least a whole character time
+ *      at any baud rate).
+ */
+void at_commander_dma_uart_init(AtCommanderDmaUart* uart,
+        void (*start_transmit)(void* context, const uint8_t* data, int length),
+        int (*receive_remaining)(void* context), void* context,
+        int idle_polls);
+
+/** Public: Queue a byte to transmit.
+ *
+ *  Returns false if both buffers are full - try again after the current
+ *  transfer completes.
+ */
+bool at_commander_dma_write(AtCommanderDmaUart* uart, uint8_t byte);
+
+/** Public: Queue as many of the bytes to transmit as there's room for.
+ *
+ *  Returns the number of bytes queued.
+ */
+int at_commander_dma_write_data(AtCommanderDmaUart* uart, const uint8_t* data,
+        int length);
+
+/** Public: Call from the DMA interrupt when a transmit transfer completes, to
+ * start sending the other buffer if anything was written to it.
+ */
+void at_commander_dma_transmit_complete(AtCommanderDmaUart* uart);
+
+/** Public: Returns true if nothing is being sent or waiting to be sent.
+ */
+bool at_commander_dma_transmit_idle(AtCommanderDmaUart* uart);
+
+/** Public: Returns the number of received bytes waiting to be read.
+ */
+int at_commander_dma_available(AtCommanderDmaUart* uart);
+
+/** Public: Read a received byte, as a config's read_function.
+ *
+ *  Returns the byte, or -1 if there are none waiting.
+ */
+int at_commander_dma_read(AtCommanderDmaUart* uart);
+
+/** Public: The received bytes waiting, as a config's peek_function - up to
+ * the end of rx_buffer if they wrap around it.
+ *
+ *  Returns the bytes and sets length, or NULL if there are none.
+ */
+const uint8_t* at_commander_dma_peek(AtCommanderDmaUart* uart, int* length);
+
+/** Public: Release bytes returned by at_commander_dma_peek, as a config's
+ * consume_function.
+ */
+void at_commander_dma_consume(AtCommanderDmaUart* uart, int count);
+
+/** Public: Call periodically (e.g. from a 1ms tick interrupt) to keep track of
+ * the receive channel, and detect when the line goes idle.
+ */
+void at_commander_dma_poll(AtCommanderDmaUart* uart);
+
+/** Public: Returns true once for each burst of received data, after the line
+ * has been idle for idle_polls polls.
+ */
+bool at_commander_dma_take_idle(AtCommanderDmaUart* uart);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATDMA_H_
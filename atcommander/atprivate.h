@@ -0,0 +1,75 @@
+#ifndef _ATPRIVATE_H_
+#define _ATPRIVATE_H_
+
+#include "atcommander.h"
+
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Private functions of atcommander.c shared with the rest of the library (and
+ * its benchmarks), not part of the public API. None of them lock the config -
+ * the caller must already hold the lock, or not need it.
+ */
+
+/** Private: If a delay function is available, delay the given time (cut short
+ * by the caller's deadline), otherwise just continue.
+ */
+void at_commander_delay_ms(AtCommanderConfig* config, unsigned long ms);
+
+/** Private: Returns true if the caller's deadline for the current operation
+ * has passed.
+ */
+bool at_commander_deadline_passed(AtCommanderConfig* config);
+
+/** Private: Send the platform's command to store the settings in flash memory.
+ *
+ *  Returns true if the device acknowledged it.
+ */
+bool at_commander_store_settings(AtCommanderConfig* config);
+
+/** Private: Read multiple bytes into the buffer, retrying up to max_retries
+ * times (or the equivalent time, if a clock is available).
+ *
+ *  Returns the number of bytes actually read - may be less than size.
+ */
+int at_commander_read(AtCommanderConfig* config, char* buffer, int size,
+        int max_retries);
+
+/** Private: Read a single line into the buffer, stopping at the first line
+ * ending after some content.
+ *
+ *  Returns the number of bytes read, not including the line ending.
+ */
+int at_commander_read_line(AtCommanderConfig* config, char* buffer, int size,
+        int max_retries);
+
+/** Private: Format a request with the built-in subset of printf (%d, %s and
+ * %%) into the buffer, or straight to the device if the buffer is NULL.
+ *
+ *  Returns the length of the whole formatted request, like vsnprintf.
+ */
+int at_commander_format_request(AtCommanderConfig* config, char* buffer,
+        int buffer_length, const char* format, va_list args);
+
+/** Private: Returns true if the response matches the expected value.
+ */
+bool at_commander_check_response(AtCommanderConfig* config,
+        const char* response, int response_length, const char* expected,
+        int expected_length);
+
+/** Private: Send a command once and read its response into the buffer.
+ *
+ *  Returns the number of bytes read, or -1 if the device returned an error.
+ */
+int at_commander_get_request_once(AtCommanderConfig* config,
+        AtCommand* command, char* response_buffer,
+        int response_buffer_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATPRIVATE_H_
@@ -0,0 +1,261 @@
+#include "atscan.h"
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// Where there's a vectorized scan, the host has fast 64 bit arithmetic for
+// checking short runs a word at a time.
+#if (defined(__AVX2__) || defined(__SSE2__) || defined(__ARM_NEON) || \
+        defined(__ARM_NEON__)) && defined(__BYTE_ORDER__) && \
+        __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define AT_SCAN_WORDS
+#define WORD_ONES 0x0101010101010101ULL
+#define WORD_HIGHS 0x8080808080808080ULL
+#endif
+
+void at_commander_scanner_init(AtCommanderScanner* scanner) {
+    int i;
+    scanner->count = 0;
+    for(i = 0; i < 8; i++) {
+        scanner->table[i] = 0;
+    }
+    at_commander_scanner_add(scanner, '\r');
+    at_commander_scanner_add(scanner, '\n');
+}
+
+bool at_commander_scanner_add(AtCommanderScanner* scanner, uint8_t byte) {
+    if(scanner->table[byte >> 5] & (1UL << (byte & 31))) {
+        return true;
+    } else if(scanner->count == AT_SCAN_MAX_BYTES) {
+        return false;
+    }
+    scanner->bytes[scanner->count++] = byte;
+    scanner->table[byte >> 5] |= 1UL << (byte & 31);
+    return true;
+}
+
+/** Private: Add the first byte of a response, if there is one.
+ */
+static bool scanner_add_response(AtCommanderScanner* scanner,
+        const char* response) {
+    if(response == NULL || response[0] == '\0') {
+        return true;
+    } else if(response[0] == '*' || response[0] == '?') {
+        return false;
+    } else if(response[0] == '\\' && response[1] != '\0') {
+        return at_commander_scanner_add(scanner, response[1]);
+    }
+    return at_commander_scanner_add(scanner, response[0]);
+}
+
+static bool scanner_add_responses(AtCommanderScanner* scanner,
+        const char* const* responses) {
+    for(; responses != NULL && *responses != NULL; responses++) {
+        if(!scanner_add_response(scanner, *responses)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool at_commander_scanner_add_command(AtCommanderScanner* scanner,
+        const AtCommand* command) {
+    return scanner_add_response(scanner, command->expected_response) &&
+            scanner_add_response(scanner, command->error_response) &&
+            scanner_add_responses(scanner, command->success_responses) &&
+            scanner_add_responses(scanner, command->error_responses);
+}
+
+int at_commander_scan_portable(const AtCommanderScanner* scanner,
+        const uint8_t* chunk, int length) {
+    int i;
+    for(i = 0; i < length; i++) {
+        uint8_t byte = chunk[i];
+        if(scanner->table[byte >> 5] & (1UL << (byte & 31))) {
+            break;
+        }
+    }
+    return i;
+}
+
+/* Each vectorized scan compares whole blocks from offset onwards, leaving the
+ * rest to the next narrower scan. They return true if a block had a stop byte,
+ * with offset set to it, otherwise false with offset set after the last block.
+ */
+
+#if defined(__AVX2__)
+static bool scan_avx2(const AtCommanderScanner* scanner, const uint8_t* chunk,
+        int length, int* offset) {
+    __m256i needles[AT_SCAN_MAX_BYTES];
+    int i;
+    for(i = 0; i < scanner->count; i++) {
+        needles[i] = _mm256_set1_epi8(scanner->bytes[i]);
+    }
+    for(; *offset + 32 <= length; *offset += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(chunk + *offset));
+        __m256i hits = _mm256_setzero_si256();
+        for(i = 0; i < scanner->count; i++) {
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, needles[i]));
+        }
+        uint32_t mask = _mm256_movemask_epi8(hits);
+        if(mask != 0) {
+            *offset += __builtin_ctz(mask);
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+#if defined(__SSE2__)
+static bool scan_sse2(const AtCommanderScanner* scanner, const uint8_t* chunk,
+        int length, int* offset) {
+    __m128i needles[AT_SCAN_MAX_BYTES];
+    int i;
+    for(i = 0; i < scanner->count; i++) {
+        needles[i] = _mm_set1_epi8(scanner->bytes[i]);
+    }
+    for(; *offset + 16 <= length; *offset += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(chunk + *offset));
+        __m128i hits = _mm_setzero_si128();
+        for(i = 0; i < scanner->count; i++) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[i]));
+        }
+        uint32_t mask = _mm_movemask_epi8(hits);
+        if(mask != 0) {
+            *offset += __builtin_ctz(mask);
+            return true;
+        }
+    }
+    return false;
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+static bool scan_neon(const AtCommanderScanner* scanner, const uint8_t* chunk,
+        int length, int* offset) {
+    uint8x16_t needles[AT_SCAN_MAX_BYTES];
+    int i;
+    for(i = 0; i < scanner->count; i++) {
+        needles[i] = vdupq_n_u8(scanner->bytes[i]);
+    }
+    for(; *offset + 16 <= length; *offset += 16) {
+        uint8x16_t block = vld1q_u8(chunk + *offset);
+        uint8x16_t hits = vdupq_n_u8(0);
+        for(i = 0; i < scanner->count; i++) {
+            hits = vorrq_u8(hits, vceqq_u8(block, needles[i]));
+        }
+        // Narrow each byte of the comparison to 4 bits, giving a 64 bit mask
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(
+                        vreinterpretq_u16_u8(hits), 4)), 0);
+        if(mask != 0) {
+            *offset += __builtin_ctzll(mask) >> 2;
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+int at_commander_scan(const AtCommanderScanner* scanner, const uint8_t* chunk,
+        int length) {
+    int offset = 0;
+#if defined(__AVX2__)
+    if(scan_avx2(scanner, chunk, length, &offset)) {
+        return offset;
+    }
+#endif
+#if defined(__SSE2__)
+    if(scan_sse2(scanner, chunk, length, &offset)) {
+        return offset;
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    if(scan_neon(scanner, chunk, length, &offset)) {
+        return offset;
+    }
+#endif
+    return offset + at_commander_scan_portable(scanner, chunk + offset,
+            length - offset);
+}
+
+#ifdef AT_SCAN_WORDS
+/** Private: Copy the bytes from start to end of the chunk into the same place
+ * in the buffer, one at a time, but only as far as size.
+ */
+static void scan_copy_bytes(char* buffer, int size, const uint8_t* chunk,
+        int start, int end) {
+    for(; start < end && start < size; start++) {
+        buffer[start] = chunk[start];
+    }
+}
+
+/* Checks 8 bytes at a time with plain 64 bit arithmetic, copying each word
+ * without a stop byte whole - much cheaper to start than a vectorized scan.
+ * Returns as the vectorized scans do, having copied everything before offset.
+ */
+static bool scan_copy_words(const AtCommanderScanner* scanner,
+        const uint8_t* chunk, int length, char* buffer, int size, int* offset) {
+    uint64_t needles[AT_SCAN_MAX_BYTES];
+    int i;
+    for(i = 0; i < scanner->count; i++) {
+        needles[i] = WORD_ONES * scanner->bytes[i];
+    }
+    for(; *offset + 8 <= length; *offset += 8) {
+        uint64_t word;
+        memcpy(&word, chunk + *offset, sizeof(word));
+        uint64_t hits = 0;
+        for(i = 0; i < scanner->count; i++) {
+            // Sets the high bit of the first byte equal to the needle - later
+            // bytes may be set too, but never an earlier one
+            uint64_t difference = word ^ needles[i];
+            hits |= (difference - WORD_ONES) & ~difference & WORD_HIGHS;
+        }
+        if(hits != 0) {
+            int start = *offset;
+            *offset += __builtin_ctzll(hits) >> 3;
+            scan_copy_bytes(buffer, size, chunk, start, *offset);
+            return true;
+        } else if(*offset + 8 <= size) {
+            memcpy(buffer + *offset, &word, sizeof(word));
+        } else {
+            scan_copy_bytes(buffer, size, chunk, *offset, *offset + 8);
+        }
+    }
+    return false;
+}
+#endif
+
+int at_commander_scan_copy(const AtCommanderScanner* scanner,
+        const uint8_t* chunk, int length, char* buffer, int size) {
+    int short_length = length < AT_SCAN_SHORT_LENGTH ? length :
+            AT_SCAN_SHORT_LENGTH;
+    int end = 0;
+#ifdef AT_SCAN_WORDS
+    if(scan_copy_words(scanner, chunk, short_length, buffer, size, &end)) {
+        return end;
+    }
+#endif
+    for(; end < short_length; end++) {
+        uint8_t byte = chunk[end];
+        if(scanner->table[byte >> 5] & (1UL << (byte & 31))) {
+            return end;
+        } else if(end < size) {
+            buffer[end] = byte;
+        }
+    }
+
+    if(end < length) {
+        int start = end;
+        end += at_commander_scan(scanner, chunk + end, length - end);
+        int copied = end < size ? end : size;
+        if(copied > start) {
+            memcpy(buffer + start, chunk + start, copied - start);
+        }
+    }
+    return end;
+}
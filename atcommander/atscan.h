@@ -0,0 +1,91 @@
+#ifndef _ATSCAN_H_
+#define _ATSCAN_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Chunk scanning
+ *
+ * Finds the first interesting byte in a chunk of received data - a line
+ * ending, or the first byte of an expected or error response - comparing 16
+ * or 32 bytes at a time with SSE2 or AVX2 on x86 and NEON on ARM, whichever
+ * the build targets. Elsewhere (e.g. on a Cortex-M) it falls back to a
+ * portable loop with a 256 bit lookup table, one test per byte.
+ */
+
+#ifndef AT_SCAN_MAX_BYTES
+#define AT_SCAN_MAX_BYTES 8
+#endif
+
+// at_commander_scan_copy checks and copies this many bytes a word or a byte at
+// a time before switching to a vectorized scan and bulk copy, which only pay
+// for their setup on longer runs (measured with bench/scan.c).
+#ifndef AT_SCAN_SHORT_LENGTH
+#define AT_SCAN_SHORT_LENGTH 32
+#endif
+
+/** Public: The set of bytes a scan stops at. Initialize with
+ * at_commander_scanner_init.
+ *
+ * table - the same bytes as a bitmap, for the portable loop.
+ */
+typedef struct {
+    uint8_t bytes[AT_SCAN_MAX_BYTES];
+    int count;
+    uint32_t table[8];
+} AtCommanderScanner;
+
+/** Public: Reset a scanner to stop at line endings ('\r' and '\n') only.
+ */
+void at_commander_scanner_init(AtCommanderScanner* scanner);
+
+/** Public: Also stop at a byte.
+ *
+ *  Returns false if the scanner already has AT_SCAN_MAX_BYTES bytes.
+ */
+bool at_commander_scanner_add(AtCommanderScanner* scanner, uint8_t byte);
+
+/** Public: Also stop at the first byte of each of a command's expected and
+ * error responses.
+ *
+ *  Returns false if there are too many bytes, or a response starts with a
+ *  '*' or '?' wildcard (which could start with anything).
+ */
+bool at_commander_scanner_add_command(AtCommanderScanner* scanner,
+        const AtCommand* command);
+
+/** Public: Find the first byte in the chunk that the scanner stops at.
+ *
+ *  Returns its offset, or length if there isn't one.
+ */
+int at_commander_scan(const AtCommanderScanner* scanner, const uint8_t* chunk,
+        int length);
+
+/** Public: Find the first byte in the chunk that the scanner stops at, and
+ * copy the bytes before it into the buffer.
+ *
+ * Short runs, like most replies and the lines of a settings dump, are checked
+ * and copied a word or a byte at a time; longer ones are scanned and copied in
+ * bulk.
+ *
+ *  size - the most bytes to copy into the buffer.
+ *
+ *  Returns the offset of the byte, or length if there isn't one. Only the
+ *  first size bytes before it are copied.
+ */
+int at_commander_scan_copy(const AtCommanderScanner* scanner,
+        const uint8_t* chunk, int length, char* buffer, int size);
+
+/** Public: The same as at_commander_scan, but always with the portable loop.
+ */
+int at_commander_scan_portable(const AtCommanderScanner* scanner,
+        const uint8_t* chunk, int length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATSCAN_H_
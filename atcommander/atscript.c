@@ -0,0 +1,747 @@
+#include "atscript.h"
+#include "atprivate.h"
+
+#include <string.h>
+
+#ifdef AT_COMMANDER_MINIMAL
+#define at_script_debug(config, ...)
+#else
+#define at_script_debug(config, ...) \
+    if(config->log_function != NULL) { \
+        config->log_function(__VA_ARGS__); \
+        config->log_function("\r\n"); \
+    }
+#endif
+
+/* Bytecode format
+ *
+ * A 4 byte header ("ATS" and AT_SCRIPT_VERSION), then one instruction after
+ * another. Each instruction is an opcode byte, a retry count if the opcode has
+ * AT_SCRIPT_FLAG_RETRY, then its operands:
+ *
+ *      number - an unsigned LEB128 varint (a baud rate fits in 3 bytes).
+ *      variable - a byte, the variable's slot.
+ *      string - a byte; with the high bit set the low bits are a variable's
+ *          slot, otherwise it's the length of the literal bytes that follow.
+ *      target - a 2 byte little endian offset into the bytecode.
+ */
+#define AT_SCRIPT_HEADER_LENGTH 4
+#define AT_SCRIPT_FLAG_TRY 0x80
+#define AT_SCRIPT_FLAG_RETRY 0x40
+#define AT_SCRIPT_OPCODE_MASK 0x3f
+#define AT_SCRIPT_STRING_VARIABLE 0x80
+
+typedef enum {
+    AT_SCRIPT_OP_ENTER = 1,
+    AT_SCRIPT_OP_EXIT,
+    AT_SCRIPT_OP_REBOOT,
+    AT_SCRIPT_OP_STORE,
+    AT_SCRIPT_OP_SET_BAUD,
+    AT_SCRIPT_OP_SET_TIMER,
+    AT_SCRIPT_OP_SET_NAME,
+    AT_SCRIPT_OP_SET_NAME_SERIALIZED,
+    AT_SCRIPT_OP_GET_NAME,
+    AT_SCRIPT_OP_GET_ID,
+    AT_SCRIPT_OP_DELAY,
+    AT_SCRIPT_OP_GOTO,
+    AT_SCRIPT_OP_IF_OK,
+    AT_SCRIPT_OP_IF_FAIL,
+    AT_SCRIPT_OP_IF_EQUAL,
+    AT_SCRIPT_OP_DONE,
+    AT_SCRIPT_OP_FAIL,
+} AtScriptOpcode;
+
+/** Private: A statement keyword, its opcode and the operands that follow it.
+ *
+ * operands - 'n' for a number, 's' for a string, 'v' for a variable.
+ * command - true if the statement talks to the device, and so can be prefixed
+ *      with "try" or "retry".
+ */
+typedef struct {
+    const char* keyword;
+    AtScriptOpcode opcode;
+    const char* operands;
+    bool command;
+} AtScriptStatement;
+
+static const AtScriptStatement AT_SCRIPT_STATEMENTS[] = {
+    { "enter", AT_SCRIPT_OP_ENTER, "", true },
+    { "exit", AT_SCRIPT_OP_EXIT, "", true },
+    { "reboot", AT_SCRIPT_OP_REBOOT, "", true },
+    { "store", AT_SCRIPT_OP_STORE, "", true },
+    { "set_baud", AT_SCRIPT_OP_SET_BAUD, "n", true },
+    { "set_timer", AT_SCRIPT_OP_SET_TIMER, "n", true },
+    { "set_name", AT_SCRIPT_OP_SET_NAME, "s", true },
+    { "get_name", AT_SCRIPT_OP_GET_NAME, "v", true },
+    { "get_id", AT_SCRIPT_OP_GET_ID, "v", true },
+    { "delay", AT_SCRIPT_OP_DELAY, "n", false },
+    { "done", AT_SCRIPT_OP_DONE, "", false },
+    { "fail", AT_SCRIPT_OP_FAIL, "", false },
+};
+
+#define AT_SCRIPT_STATEMENT_COUNT \
+    (int)(sizeof(AT_SCRIPT_STATEMENTS) / sizeof(AtScriptStatement))
+
+typedef struct {
+    const char* name;
+    int length;
+    int offset;
+} AtScriptLabel;
+
+typedef struct {
+    const char* name;
+    int length;
+} AtScriptName;
+
+/** Private: The compiler's state. Labels are resolved by recording each jump
+ * to a label that isn't defined yet, and patching them all at the end.
+ */
+typedef struct {
+    uint8_t* bytecode;
+    int capacity;
+    int length;
+    AtScriptLabel labels[AT_SCRIPT_MAX_LABELS];
+    int label_count;
+    AtScriptLabel jumps[AT_SCRIPT_MAX_LABELS];
+    int jump_count;
+    AtScriptName variables[AT_SCRIPT_MAX_VARIABLES];
+    int variable_count;
+    const char* message;
+} AtScriptCompiler;
+
+/** Private: A token from a line of a script.
+ */
+typedef struct {
+    const char* start;
+    int length;
+    bool quoted;
+} AtScriptToken;
+
+#define AT_SCRIPT_MAX_TOKENS 8
+
+static bool token_is(const AtScriptToken* token, const char* word) {
+    return !token->quoted && (int)strlen(word) == token->length &&
+            !strncmp(token->start, word, token->length);
+}
+
+/** Private: Split one line of a script into tokens, stopping at the end of the
+ * line or a comment.
+ *
+ * Returns the number of tokens, or -1 if the line couldn't be split.
+ */
+static int tokenize_line(const char** cursor, AtScriptToken* tokens,
+        const char** message) {
+    const char* p = *cursor;
+    int count = 0;
+    bool valid = true;
+    while(*p != '\0' && *p != '\n') {
+        if(*p == ' ' || *p == '\t' || *p == '\r') {
+            p++;
+            continue;
+        }
+
+        if(*p == '#') {
+            while(*p != '\0' && *p != '\n') {
+                p++;
+            }
+            break;
+        }
+
+        if(count == AT_SCRIPT_MAX_TOKENS) {
+            *message = "Too many words on one line";
+            valid = false;
+            break;
+        }
+
+        AtScriptToken* token = &tokens[count++];
+        token->quoted = *p == '"';
+        if(token->quoted) {
+            token->start = ++p;
+            while(*p != '"' && *p != '\0' && *p != '\n') {
+                p++;
+            }
+            if(*p != '"') {
+                *message = "Unterminated string";
+                valid = false;
+                break;
+            }
+            token->length = p++ - token->start;
+        } else {
+            token->start = p;
+            while(*p != '\0' && *p != '\n' && *p != ' ' && *p != '\t'
+                    && *p != '\r' && *p != '#') {
+                p++;
+            }
+            token->length = p - token->start;
+        }
+    }
+
+    while(*p != '\0' && *p != '\n') {
+        p++;
+    }
+    *cursor = *p == '\n' ? p + 1 : p;
+    return valid ? count : -1;
+}
+
+static bool emit_byte(AtScriptCompiler* compiler, int byte) {
+    if(compiler->length >= compiler->capacity) {
+        compiler->message = "Bytecode buffer is too small";
+        return false;
+    }
+    compiler->bytecode[compiler->length++] = (uint8_t)byte;
+    return true;
+}
+
+static bool emit_number(AtScriptCompiler* compiler,
+        const AtScriptToken* token) {
+    unsigned long value = 0;
+    int i;
+    if(token->quoted || token->length == 0) {
+        compiler->message = "Expected a number";
+        return false;
+    }
+    for(i = 0; i < token->length; i++) {
+        if(token->start[i] < '0' || token->start[i] > '9') {
+            compiler->message = "Expected a number";
+            return false;
+        }
+        value = value * 10 + (token->start[i] - '0');
+        if(value > 0x7fffffff) {
+            compiler->message = "Number is too large";
+            return false;
+        }
+    }
+
+    do {
+        int byte = value & 0x7f;
+        value >>= 7;
+        if(!emit_byte(compiler, value != 0 ? byte | 0x80 : byte)) {
+            return false;
+        }
+    } while(value != 0);
+    return true;
+}
+
+/** Private: Find a variable's slot, allocating one the first time it's seen.
+ *
+ * Returns the slot, or -1 if the token isn't a variable or there are too many.
+ */
+static int variable_slot(AtScriptCompiler* compiler,
+        const AtScriptToken* token) {
+    int i;
+    if(token->quoted || token->length < 2 || token->start[0] != '$') {
+        compiler->message = "Expected a variable";
+        return -1;
+    }
+
+    for(i = 0; i < compiler->variable_count; i++) {
+        if(compiler->variables[i].length == token->length - 1 &&
+                !strncmp(compiler->variables[i].name, token->start + 1,
+                    token->length - 1)) {
+            return i;
+        }
+    }
+
+    if(compiler->variable_count == AT_SCRIPT_MAX_VARIABLES) {
+        compiler->message = "Too many variables";
+        return -1;
+    }
+    compiler->variables[i].name = token->start + 1;
+    compiler->variables[i].length = token->length - 1;
+    return compiler->variable_count++;
+}
+
+static bool emit_string(AtScriptCompiler* compiler,
+        const AtScriptToken* token) {
+    if(!token->quoted) {
+        int slot = variable_slot(compiler, token);
+        return slot >= 0 && emit_byte(compiler,
+                AT_SCRIPT_STRING_VARIABLE | slot);
+    }
+
+    if(token->length >= AT_SCRIPT_MAX_VARIABLE_LENGTH) {
+        compiler->message = "String is too long";
+        return false;
+    }
+
+    int i;
+    if(!emit_byte(compiler, token->length)) {
+        return false;
+    }
+    for(i = 0; i < token->length; i++) {
+        if(!emit_byte(compiler, token->start[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Private: Emit a jump target, to be patched once all labels are known.
+ */
+static bool emit_target(AtScriptCompiler* compiler,
+        const AtScriptToken* token) {
+    if(token->quoted) {
+        compiler->message = "Expected a label";
+        return false;
+    }
+    if(compiler->jump_count == AT_SCRIPT_MAX_LABELS) {
+        compiler->message = "Too many jumps";
+        return false;
+    }
+
+    AtScriptLabel* jump = &compiler->jumps[compiler->jump_count++];
+    jump->name = token->start;
+    jump->length = token->length;
+    jump->offset = compiler->length;
+    return emit_byte(compiler, 0) && emit_byte(compiler, 0);
+}
+
+static bool define_label(AtScriptCompiler* compiler,
+        const AtScriptToken* token) {
+    int i;
+    for(i = 0; i < compiler->label_count; i++) {
+        if(compiler->labels[i].length == token->length - 1 &&
+                !strncmp(compiler->labels[i].name, token->start,
+                    token->length - 1)) {
+            compiler->message = "Label is defined twice";
+            return false;
+        }
+    }
+    if(compiler->label_count == AT_SCRIPT_MAX_LABELS) {
+        compiler->message = "Too many labels";
+        return false;
+    }
+
+    AtScriptLabel* label = &compiler->labels[compiler->label_count++];
+    label->name = token->start;
+    label->length = token->length - 1;
+    label->offset = compiler->length;
+    return true;
+}
+
+static bool patch_jumps(AtScriptCompiler* compiler) {
+    int i, j;
+    for(i = 0; i < compiler->jump_count; i++) {
+        AtScriptLabel* jump = &compiler->jumps[i];
+        for(j = 0; j < compiler->label_count; j++) {
+            if(compiler->labels[j].length == jump->length &&
+                    !strncmp(compiler->labels[j].name, jump->name,
+                        jump->length)) {
+                break;
+            }
+        }
+        if(j == compiler->label_count) {
+            compiler->message = "Jump to an undefined label";
+            return false;
+        }
+        compiler->bytecode[jump->offset] = compiler->labels[j].offset & 0xff;
+        compiler->bytecode[jump->offset + 1] =
+                (compiler->labels[j].offset >> 8) & 0xff;
+    }
+    return true;
+}
+
+/** Private: Compile the conditional statements - "if ok goto L",
+ * "if fail goto L" and "ifeq $var "value" goto L".
+ */
+static bool compile_conditional(AtScriptCompiler* compiler,
+        const AtScriptToken* tokens, int count) {
+    if(token_is(&tokens[0], "if")) {
+        if(count != 4 || !token_is(&tokens[2], "goto") ||
+                !(token_is(&tokens[1], "ok") || token_is(&tokens[1], "fail"))) {
+            compiler->message = "Expected \"if ok|fail goto label\"";
+            return false;
+        }
+        return emit_byte(compiler, token_is(&tokens[1], "ok") ?
+                    AT_SCRIPT_OP_IF_OK : AT_SCRIPT_OP_IF_FAIL) &&
+                emit_target(compiler, &tokens[3]);
+    }
+
+    if(count != 5 || !token_is(&tokens[3], "goto")) {
+        compiler->message = "Expected \"ifeq $variable value goto label\"";
+        return false;
+    }
+    int slot = variable_slot(compiler, &tokens[1]);
+    return slot >= 0 && emit_byte(compiler, AT_SCRIPT_OP_IF_EQUAL) &&
+            emit_byte(compiler, slot) &&
+            emit_string(compiler, &tokens[2]) &&
+            emit_target(compiler, &tokens[4]);
+}
+
+/** Private: Compile one statement, with any "try" or "retry N" prefix.
+ */
+static bool compile_statement(AtScriptCompiler* compiler, AtScriptToken* tokens,
+        int count) {
+    if(count == 1 && !tokens[0].quoted && tokens[0].length > 1 &&
+            tokens[0].start[tokens[0].length - 1] == ':') {
+        return define_label(compiler, &tokens[0]);
+    }
+
+    if(token_is(&tokens[0], "goto")) {
+        if(count != 2) {
+            compiler->message = "Expected \"goto label\"";
+            return false;
+        }
+        return emit_byte(compiler, AT_SCRIPT_OP_GOTO) &&
+                emit_target(compiler, &tokens[1]);
+    }
+
+    if(token_is(&tokens[0], "if") || token_is(&tokens[0], "ifeq")) {
+        return compile_conditional(compiler, tokens, count);
+    }
+
+    int flags = 0;
+    int retries = 0;
+    int first = 0;
+    if(token_is(&tokens[0], "try")) {
+        flags = AT_SCRIPT_FLAG_TRY;
+        first = 1;
+    } else if(token_is(&tokens[0], "retry")) {
+        int i;
+        flags = AT_SCRIPT_FLAG_RETRY;
+        first = 2;
+        if(count < 3 || tokens[1].quoted || tokens[1].length == 0 ||
+                tokens[1].length > 3) {
+            compiler->message = "Expected \"retry N command\"";
+            return false;
+        }
+        for(i = 0; i < tokens[1].length; i++) {
+            if(tokens[1].start[i] < '0' || tokens[1].start[i] > '9') {
+                compiler->message = "Expected \"retry N command\"";
+                return false;
+            }
+            retries = retries * 10 + tokens[1].start[i] - '0';
+        }
+        if(retries < 1 || retries > 255) {
+            compiler->message = "Retry count must be between 1 and 255";
+            return false;
+        }
+    }
+
+    if(first >= count) {
+        compiler->message = "Expected a command";
+        return false;
+    }
+
+    const AtScriptStatement* statement = NULL;
+    int i;
+    for(i = 0; i < AT_SCRIPT_STATEMENT_COUNT; i++) {
+        if(token_is(&tokens[first], AT_SCRIPT_STATEMENTS[i].keyword)) {
+            statement = &AT_SCRIPT_STATEMENTS[i];
+            break;
+        }
+    }
+
+    if(statement == NULL) {
+        compiler->message = "Unknown statement";
+        return false;
+    }
+    if(flags != 0 && !statement->command) {
+        compiler->message = "Only device commands can be tried or retried";
+        return false;
+    }
+
+    int operand_count = strlen(statement->operands);
+    int opcode = statement->opcode;
+    if(opcode == AT_SCRIPT_OP_SET_NAME && count == first + 3 &&
+            token_is(&tokens[first + 2], "serialized")) {
+        opcode = AT_SCRIPT_OP_SET_NAME_SERIALIZED;
+        count--;
+    }
+    if(count - first - 1 != operand_count) {
+        compiler->message = "Wrong number of arguments";
+        return false;
+    }
+
+    if(!emit_byte(compiler, opcode | flags)) {
+        return false;
+    }
+    if(flags == AT_SCRIPT_FLAG_RETRY && !emit_byte(compiler, retries)) {
+        return false;
+    }
+
+    for(i = 0; i < operand_count; i++) {
+        const AtScriptToken* token = &tokens[first + 1 + i];
+        bool emitted;
+        if(statement->operands[i] == 'n') {
+            emitted = emit_number(compiler, token);
+        } else if(statement->operands[i] == 's') {
+            emitted = emit_string(compiler, token);
+        } else {
+            int slot = variable_slot(compiler, token);
+            emitted = slot >= 0 && emit_byte(compiler, slot);
+        }
+        if(!emitted) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int at_commander_compile_script(const char* source, uint8_t* bytecode,
+        int bytecode_length, AtCommanderScriptError* error) {
+    AtScriptCompiler compiler;
+    AtScriptToken tokens[AT_SCRIPT_MAX_TOKENS];
+    const char* cursor = source;
+    int line = 0;
+    bool compiled = true;
+
+    memset(&compiler, 0, sizeof(compiler));
+    compiler.bytecode = bytecode;
+    compiler.capacity = bytecode_length;
+    compiled = emit_byte(&compiler, 'A') && emit_byte(&compiler, 'T') &&
+            emit_byte(&compiler, 'S') &&
+            emit_byte(&compiler, AT_SCRIPT_VERSION);
+
+    while(compiled && *cursor != '\0') {
+        line++;
+        int count = tokenize_line(&cursor, tokens, &compiler.message);
+        if(count < 0) {
+            compiled = false;
+        } else if(count > 0) {
+            compiled = compile_statement(&compiler, tokens, count);
+        }
+    }
+
+    if(compiled && compiler.length > 0xffff) {
+        compiler.message = "Script is too long";
+        compiled = false;
+    }
+
+    if(compiled) {
+        line = 0;
+        compiled = patch_jumps(&compiler);
+    }
+
+    if(error != NULL) {
+        error->line = compiled ? 0 : line;
+        error->message = compiled ? NULL : compiler.message;
+    }
+    return compiled ? compiler.length : -1;
+}
+
+/** Private: Bounds checked reads of a script's bytecode, which may have come
+ * from a file and so can't be trusted.
+ */
+typedef struct {
+    const uint8_t* bytecode;
+    int length;
+    int position;
+    bool valid;
+} AtScriptReader;
+
+static int read_byte(AtScriptReader* reader) {
+    if(reader->position >= reader->length) {
+        reader->valid = false;
+        return 0;
+    }
+    return reader->bytecode[reader->position++];
+}
+
+static unsigned long read_number(AtScriptReader* reader) {
+    unsigned long value = 0;
+    int shift = 0;
+    int byte;
+    do {
+        byte = read_byte(reader);
+        value |= (unsigned long)(byte & 0x7f) << shift;
+        shift += 7;
+    } while(reader->valid && (byte & 0x80) && shift < 32);
+    return value;
+}
+
+static int read_variable(AtScriptReader* reader) {
+    int slot = read_byte(reader);
+    if(slot >= AT_SCRIPT_MAX_VARIABLES) {
+        reader->valid = false;
+        return 0;
+    }
+    return slot;
+}
+
+/** Private: Read a string operand - a variable's value, or a literal copied
+ * into the buffer (which must be AT_SCRIPT_MAX_VARIABLE_LENGTH long).
+ */
+static const char* read_string(AtScriptReader* reader,
+        AtCommanderScriptContext* context, char* buffer) {
+    int header = read_byte(reader);
+    if(header & AT_SCRIPT_STRING_VARIABLE) {
+        int slot = header & ~AT_SCRIPT_STRING_VARIABLE;
+        if(slot >= AT_SCRIPT_MAX_VARIABLES) {
+            reader->valid = false;
+            return "";
+        }
+        return context->variables[slot];
+    }
+
+    if(header >= AT_SCRIPT_MAX_VARIABLE_LENGTH ||
+            reader->position + header > reader->length) {
+        reader->valid = false;
+        return "";
+    }
+    memcpy(buffer, reader->bytecode + reader->position, header);
+    buffer[header] = '\0';
+    reader->position += header;
+    return buffer;
+}
+
+static int read_target(AtScriptReader* reader) {
+    int target = read_byte(reader);
+    target |= read_byte(reader) << 8;
+    if(target < AT_SCRIPT_HEADER_LENGTH || target > reader->length) {
+        reader->valid = false;
+    }
+    return target;
+}
+
+/** Private: Run one device command from a script.
+ *
+ * Returns true if the command succeeded.
+ */
+static bool run_command(AtCommanderConfig* config, int opcode,
+        unsigned long number, const char* string, char* variable) {
+    switch(opcode) {
+        case AT_SCRIPT_OP_ENTER:
+            return at_commander_enter_command_mode(config);
+        case AT_SCRIPT_OP_EXIT:
+            return at_commander_exit_command_mode(config);
+        case AT_SCRIPT_OP_REBOOT:
+            return at_commander_reboot(config);
+        case AT_SCRIPT_OP_STORE:
+            return at_commander_store_settings(config);
+        case AT_SCRIPT_OP_SET_BAUD:
+            return at_commander_set_baud(config, number);
+        case AT_SCRIPT_OP_SET_TIMER:
+            return at_commander_set_configuration_timer(config, number);
+        case AT_SCRIPT_OP_SET_NAME:
+        case AT_SCRIPT_OP_SET_NAME_SERIALIZED:
+            return at_commander_set_name(config, string,
+                    opcode == AT_SCRIPT_OP_SET_NAME_SERIALIZED);
+        case AT_SCRIPT_OP_GET_NAME:
+            return at_commander_get_name(config, variable,
+                    AT_SCRIPT_MAX_VARIABLE_LENGTH) > 0;
+        case AT_SCRIPT_OP_GET_ID:
+            return at_commander_get_device_id(config, variable,
+                    AT_SCRIPT_MAX_VARIABLE_LENGTH) > 0;
+    }
+    return false;
+}
+
+bool at_commander_run_script(AtCommanderConfig* config,
+        const uint8_t* bytecode, int length,
+        AtCommanderScriptContext* context) {
+    AtScriptReader reader = { bytecode, length, AT_SCRIPT_HEADER_LENGTH,
+        true };
+    char literal[AT_SCRIPT_MAX_VARIABLE_LENGTH];
+    char compared[AT_SCRIPT_MAX_VARIABLE_LENGTH];
+    bool last_ok = true;
+    bool finished = false;
+    bool succeeded = true;
+    int instruction = AT_SCRIPT_HEADER_LENGTH;
+
+    memset(context, 0, sizeof(*context));
+    context->failed_at = -1;
+    if(length < AT_SCRIPT_HEADER_LENGTH || bytecode[0] != 'A' ||
+            bytecode[1] != 'T' || bytecode[2] != 'S' ||
+            bytecode[3] != AT_SCRIPT_VERSION) {
+        at_script_debug(config, "Not a provisioning script, or wrong version");
+        return false;
+    }
+
+    at_commander_lock(config);
+    while(!finished && reader.position < length) {
+        if(at_commander_deadline_passed(config)) {
+            at_script_debug(config, "Deadline passed, stopping script");
+            succeeded = false;
+            break;
+        }
+
+        instruction = reader.position;
+        int op = read_byte(&reader);
+        int opcode = op & AT_SCRIPT_OPCODE_MASK;
+        int attempts = op & AT_SCRIPT_FLAG_RETRY ? read_byte(&reader) : 1;
+        unsigned long number = 0;
+        const char* string = NULL;
+        char* variable = NULL;
+        int target;
+        context->instructions++;
+
+        switch(opcode) {
+            case AT_SCRIPT_OP_SET_BAUD:
+            case AT_SCRIPT_OP_SET_TIMER:
+                number = read_number(&reader);
+                break;
+            case AT_SCRIPT_OP_SET_NAME:
+            case AT_SCRIPT_OP_SET_NAME_SERIALIZED:
+                string = read_string(&reader, context, literal);
+                break;
+            case AT_SCRIPT_OP_GET_NAME:
+            case AT_SCRIPT_OP_GET_ID:
+                variable = context->variables[read_variable(&reader)];
+                break;
+            case AT_SCRIPT_OP_ENTER:
+            case AT_SCRIPT_OP_EXIT:
+            case AT_SCRIPT_OP_REBOOT:
+            case AT_SCRIPT_OP_STORE:
+                break;
+            case AT_SCRIPT_OP_DELAY:
+                at_commander_delay_ms(config, read_number(&reader));
+                continue;
+            case AT_SCRIPT_OP_GOTO:
+            case AT_SCRIPT_OP_IF_OK:
+            case AT_SCRIPT_OP_IF_FAIL:
+                target = read_target(&reader);
+                if(reader.valid && (opcode == AT_SCRIPT_OP_GOTO ||
+                        (opcode == AT_SCRIPT_OP_IF_OK) == last_ok)) {
+                    reader.position = target;
+                }
+                continue;
+            case AT_SCRIPT_OP_IF_EQUAL:
+                variable = context->variables[read_variable(&reader)];
+                string = read_string(&reader, context, compared);
+                target = read_target(&reader);
+                if(reader.valid && !strcmp(variable, string)) {
+                    reader.position = target;
+                }
+                continue;
+            case AT_SCRIPT_OP_DONE:
+                finished = true;
+                continue;
+            case AT_SCRIPT_OP_FAIL:
+                finished = true;
+                succeeded = false;
+                continue;
+            default:
+                reader.valid = false;
+                break;
+        }
+
+        if(!reader.valid) {
+            break;
+        }
+
+        do {
+            last_ok = run_command(config, opcode, number, string, variable);
+        } while(!last_ok && --attempts > 0);
+
+        if(!last_ok && !(op & AT_SCRIPT_FLAG_TRY)) {
+            succeeded = false;
+            finished = true;
+        }
+    }
+    at_commander_unlock(config);
+
+    if(!reader.valid) {
+        at_script_debug(config, "Provisioning script is corrupt at offset %d",
+                instruction);
+        succeeded = false;
+    } else if(!succeeded) {
+        at_script_debug(config, "Provisioning script failed at offset %d",
+                instruction);
+    }
+
+    if(!succeeded) {
+        context->failed_at = instruction;
+    }
+    return succeeded;
+}
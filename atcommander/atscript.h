@@ -0,0 +1,121 @@
+#ifndef _ATSCRIPT_H_
+#define _ATSCRIPT_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Provisioning scripts
+ *
+ * A provisioning flow (enter command mode, set the baud rate, name the device,
+ * store, reboot...) can be written as a small script, compiled once to a
+ * compact bytecode and then run by at_commander_run_script. The bytecode is
+ * read in place, so it can live in flash or be loaded from a file, and running
+ * it needs only an AtCommanderScriptContext - no allocation, no matter how
+ * long the script is.
+ *
+ * One statement per line, '#' starts a comment:
+ *
+ *      enter                   enter command mode
+ *      exit                    switch back to data mode
+ *      store                   store settings in flash
+ *      reboot                  reboot the device
+ *      set_baud 115200         change the device's baud rate
+ *      set_timer 60            change the configuration timer
+ *      set_name "FOO"          change the name (a string or a variable)
+ *      set_name $id serialized change the name, appending a serial number
+ *      get_name $name          read the name into a variable
+ *      get_id $id              read the device ID into a variable
+ *      delay 500               wait, in ms
+ *      done                    stop, successfully
+ *      fail                    stop, unsuccessfully
+ *      label:                  mark a place to jump to
+ *      goto label
+ *      if ok goto label        jump if the last command succeeded
+ *      if fail goto label      jump if the last command failed
+ *      ifeq $name "FOO" goto label
+ *
+ * A command that fails stops the script, unless it is prefixed with "try"
+ * (which only records the result for a following "if"), or with "retry N",
+ * which attempts it up to N times before giving up. Reaching the end of the
+ * script counts as success.
+ *
+ *      retry 3 set_baud 115200
+ *      get_id $id
+ *      try get_name $name
+ *      ifeq $name "AT-Commander" goto named
+ *      set_name "AT-Commander" serialized
+ *      named:
+ *      reboot
+ */
+
+#ifndef AT_SCRIPT_MAX_VARIABLES
+#define AT_SCRIPT_MAX_VARIABLES 4
+#endif
+
+#ifndef AT_SCRIPT_MAX_VARIABLE_LENGTH
+#define AT_SCRIPT_MAX_VARIABLE_LENGTH 24
+#endif
+
+#ifndef AT_SCRIPT_MAX_LABELS
+#define AT_SCRIPT_MAX_LABELS 16
+#endif
+
+#define AT_SCRIPT_VERSION 1
+
+/** Public: Where a script failed to compile.
+ *
+ * line - the line number (starting at 1) of the error.
+ * message - a description of the error.
+ */
+typedef struct {
+    int line;
+    const char* message;
+} AtCommanderScriptError;
+
+/** Public: The state of a running script, and its variables afterwards.
+ *
+ * variables - the value of each variable, in the order they first appear in
+ *      the script.
+ * failed_at - if the script failed, the bytecode offset of the instruction
+ *      that failed.
+ * instructions - the number of instructions executed.
+ */
+typedef struct {
+    char variables[AT_SCRIPT_MAX_VARIABLES][AT_SCRIPT_MAX_VARIABLE_LENGTH];
+    int failed_at;
+    int instructions;
+} AtCommanderScriptContext;
+
+/** Public: Compile the text of a provisioning script to bytecode.
+ *
+ *  source - the NULL terminated script.
+ *  bytecode - a buffer for the compiled script.
+ *  bytecode_length - the size of the buffer.
+ *  error - if not NULL, set to the location of any compile error.
+ *
+ *  Returns the length of the bytecode, or -1 if the script couldn't be
+ *  compiled.
+ */
+int at_commander_compile_script(const char* source, uint8_t* bytecode,
+        int bytecode_length, AtCommanderScriptError* error);
+
+/** Public: Run a compiled provisioning script against a device.
+ *
+ *  bytecode - the compiled script, e.g. in flash or read from a file.
+ *  length - the length of the bytecode.
+ *  context - holds the script's variables while it runs, and afterwards.
+ *
+ *  Returns true if the script ran to completion (or a "done").
+ */
+bool at_commander_run_script(AtCommanderConfig* config,
+        const uint8_t* bytecode, int length,
+        AtCommanderScriptContext* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATSCRIPT_H_
@@ -0,0 +1,367 @@
+#include "attrace.h"
+
+#include <string.h>
+
+// The largest record header - a type byte and two 5 byte varints.
+#define AT_TRACE_MAX_RECORD_HEADER 11
+
+/** Private: Append an unsigned LEB128 varint to the buffer.
+ *
+ * Returns the number of bytes written.
+ */
+static int encode_varint(uint8_t* buffer, unsigned long value) {
+    int length = 0;
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        buffer[length++] = value != 0 ? byte | 0x80 : byte;
+    } while(value != 0 && length < 5);
+    return length;
+}
+
+/** Private: Read an unsigned LEB128 varint from the trace.
+ *
+ * Returns the offset after the varint, or -1 if it runs past the end.
+ */
+static int decode_varint(const uint8_t* trace, int length, int offset,
+        unsigned long* value) {
+    int shift = 0;
+    *value = 0;
+    while(offset < length && shift < 35) {
+        uint8_t byte = trace[offset++];
+        *value |= (unsigned long)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) {
+            return offset;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+static unsigned long trace_millis(AtCommanderTraceRecorder* recorder) {
+    if(recorder->millis_function != NULL) {
+        return recorder->millis_function();
+    }
+    return 0;
+}
+
+/** Private: Write a record header, and the payload if there is one, to the
+ * sink.
+ */
+static void write_record(AtCommanderTraceRecorder* recorder, int type,
+        unsigned long time_ms, unsigned long value, const uint8_t* payload,
+        int payload_length) {
+    uint8_t header[AT_TRACE_MAX_RECORD_HEADER];
+    int length = 0;
+    header[length++] = type;
+    length += encode_varint(header + length,
+            time_ms - recorder->last_record_ms);
+    length += encode_varint(header + length, value);
+    recorder->last_record_ms = time_ms;
+
+    recorder->sink(recorder->sink_context, header, length);
+    if(payload_length > 0) {
+        recorder->sink(recorder->sink_context, payload, payload_length);
+    }
+}
+
+void at_commander_trace_flush(AtCommanderTraceRecorder* recorder) {
+    if(recorder->run_length > 0) {
+        write_record(recorder, recorder->run_type, recorder->run_started_ms,
+                recorder->run_length, recorder->run, recorder->run_length);
+        recorder->run_length = 0;
+    }
+}
+
+/** Private: Add a byte to the current run, starting a new record if the
+ * direction changed or the run is full.
+ */
+static void record_byte(AtCommanderTraceRecorder* recorder, int type,
+        uint8_t byte) {
+    if(recorder->run_length == AT_TRACE_MAX_RUN_LENGTH ||
+            (recorder->run_length > 0 && recorder->run_type != type)) {
+        at_commander_trace_flush(recorder);
+    }
+    if(recorder->run_length == 0) {
+        recorder->run_type = type;
+        recorder->run_started_ms = trace_millis(recorder);
+    }
+    recorder->run[recorder->run_length++] = byte;
+}
+
+static void trace_write(void* device, uint8_t byte) {
+    AtCommanderTraceRecorder* recorder = (AtCommanderTraceRecorder*) device;
+    record_byte(recorder, AT_TRACE_TX, byte);
+    recorder->write_function(recorder->device, byte);
+}
+
+static int trace_read(void* device) {
+    AtCommanderTraceRecorder* recorder = (AtCommanderTraceRecorder*) device;
+    int byte = recorder->read_function(recorder->device);
+    if(byte != -1) {
+        record_byte(recorder, AT_TRACE_RX, byte);
+    }
+    return byte;
+}
+
+static const uint8_t* trace_peek(void* device, int* length) {
+    AtCommanderTraceRecorder* recorder = (AtCommanderTraceRecorder*) device;
+    recorder->peeked = recorder->peek_function(recorder->device, length);
+    return recorder->peeked;
+}
+
+static void trace_consume(void* device, int count) {
+    AtCommanderTraceRecorder* recorder = (AtCommanderTraceRecorder*) device;
+    int i;
+    for(i = 0; i < count; i++) {
+        record_byte(recorder, AT_TRACE_RX, recorder->peeked[i]);
+    }
+    recorder->consume_function(recorder->device, count);
+}
+
+static void trace_baud_rate_initializer(void* device, int baud) {
+    AtCommanderTraceRecorder* recorder = (AtCommanderTraceRecorder*) device;
+    at_commander_trace_flush(recorder);
+    write_record(recorder, AT_TRACE_BAUD, trace_millis(recorder), baud, NULL,
+            0);
+    if(recorder->baud_rate_initializer != NULL) {
+        recorder->baud_rate_initializer(recorder->device, baud);
+    }
+}
+
+static void trace_lock(void* device) {
+    AtCommanderTraceRecorder* recorder = (AtCommanderTraceRecorder*) device;
+    if(recorder->lock_function != NULL) {
+        recorder->lock_function(recorder->device);
+    }
+}
+
+static void trace_unlock(void* device) {
+    AtCommanderTraceRecorder* recorder = (AtCommanderTraceRecorder*) device;
+    if(recorder->unlock_function != NULL) {
+        recorder->unlock_function(recorder->device);
+    }
+}
+
+static void trace_wait(void* device, unsigned long ms) {
+    AtCommanderTraceRecorder* recorder = (AtCommanderTraceRecorder*) device;
+    recorder->wait_function(recorder->device, ms);
+}
+
+void at_commander_trace_start(AtCommanderConfig* config,
+        AtCommanderTraceRecorder* recorder, AtCommanderTraceSink sink,
+        void* context) {
+    static const uint8_t header[AT_TRACE_HEADER_LENGTH] = { 'A', 'T', 'T',
+        AT_TRACE_VERSION };
+
+    at_commander_lock(config);
+    recorder->device = config->device;
+    recorder->baud_rate_initializer = config->baud_rate_initializer;
+    recorder->write_function = config->write_function;
+    recorder->read_function = config->read_function;
+    recorder->peek_function = config->peek_function;
+    recorder->consume_function = config->consume_function;
+    recorder->lock_function = config->lock_function;
+    recorder->unlock_function = config->unlock_function;
+    recorder->wait_function = config->wait_function;
+    recorder->millis_function = config->millis_function;
+    recorder->sink = sink;
+    recorder->sink_context = context;
+    recorder->run_length = 0;
+    recorder->last_record_ms = trace_millis(recorder);
+    sink(context, header, sizeof(header));
+
+    config->device = recorder;
+    config->baud_rate_initializer = trace_baud_rate_initializer;
+    config->write_function = trace_write;
+    config->read_function = trace_read;
+    if(config->peek_function != NULL) {
+        config->peek_function = trace_peek;
+        config->consume_function = trace_consume;
+    }
+    config->lock_function = trace_lock;
+    config->unlock_function = trace_unlock;
+    if(config->wait_function != NULL) {
+        config->wait_function = trace_wait;
+    }
+    // Locked through the recorder from here on, so unlock the same way.
+    trace_unlock(recorder);
+}
+
+void at_commander_trace_stop(AtCommanderConfig* config,
+        AtCommanderTraceRecorder* recorder) {
+    at_commander_lock(config);
+    at_commander_trace_flush(recorder);
+    config->device = recorder->device;
+    config->baud_rate_initializer = recorder->baud_rate_initializer;
+    config->write_function = recorder->write_function;
+    config->read_function = recorder->read_function;
+    config->peek_function = recorder->peek_function;
+    config->consume_function = recorder->consume_function;
+    config->lock_function = recorder->lock_function;
+    config->unlock_function = recorder->unlock_function;
+    config->wait_function = recorder->wait_function;
+    at_commander_unlock(config);
+}
+
+/** Private: Find the next record at or after offset whose type is accepted.
+ *
+ * tx_stream - if true, look for TX and baud records, otherwise RX records.
+ * payload - set to the offset of the record's payload (TX and RX records).
+ * value - set to the payload length, or the baud rate.
+ *
+ * Returns the offset of the record, or the trace length if there are no more.
+ */
+static int next_record(const AtCommanderTraceReplay* replay, int offset,
+        bool tx_stream, int* payload, unsigned long* value) {
+    while(offset < replay->length) {
+        unsigned long delta_ms;
+        int type = replay->trace[offset];
+        int cursor = decode_varint(replay->trace, replay->length, offset + 1,
+                &delta_ms);
+        if(cursor < 0 || (cursor = decode_varint(replay->trace,
+                        replay->length, cursor, value)) < 0) {
+            break;
+        }
+
+        int end = cursor;
+        if(type == AT_TRACE_TX || type == AT_TRACE_RX) {
+            if(*value > (unsigned long)(replay->length - cursor)) {
+                break;
+            }
+            end += *value;
+        }
+
+        if((tx_stream && type != AT_TRACE_RX) ||
+                (!tx_stream && type == AT_TRACE_RX)) {
+            *payload = cursor;
+            return offset;
+        }
+        offset = end;
+    }
+    return replay->length;
+}
+
+static void replay_write(void* device, uint8_t byte) {
+    AtCommanderTraceReplay* replay = (AtCommanderTraceReplay*) device;
+    int payload;
+    unsigned long length;
+    replay->tx_offset = next_record(replay, replay->tx_offset, true, &payload,
+            &length);
+    if(replay->tx_offset == replay->length ||
+            replay->trace[replay->tx_offset] != AT_TRACE_TX) {
+        replay->mismatches++;
+        return;
+    }
+
+    if(replay->trace[payload + replay->tx_index] != byte) {
+        replay->mismatches++;
+    }
+    if(++replay->tx_index == (int)length) {
+        replay->tx_offset = payload + length;
+        replay->tx_index = 0;
+    }
+}
+
+/** Private: Find the received bytes that have "arrived" - the rest of the
+ * current RX record, once the requests before it have been sent.
+ *
+ * Returns the number of bytes, setting payload to the offset of the first.
+ */
+static int replay_available(AtCommanderTraceReplay* replay, int* payload) {
+    int record_payload, tx_payload;
+    unsigned long length, tx_value;
+    replay->rx_offset = next_record(replay, replay->rx_offset, false,
+            &record_payload, &length);
+    if(replay->rx_offset == replay->length ||
+            replay->rx_offset > next_record(replay, replay->tx_offset, true,
+                &tx_payload, &tx_value)) {
+        return 0;
+    }
+    *payload = record_payload + replay->rx_index;
+    return length - replay->rx_index;
+}
+
+static void replay_consume(void* device, int count) {
+    AtCommanderTraceReplay* replay = (AtCommanderTraceReplay*) device;
+    int payload;
+    int available = replay_available(replay, &payload);
+    if(count >= available) {
+        replay->rx_offset = payload + available;
+        replay->rx_index = 0;
+    } else {
+        replay->rx_index += count;
+    }
+}
+
+static const uint8_t* replay_peek(void* device, int* length) {
+    AtCommanderTraceReplay* replay = (AtCommanderTraceReplay*) device;
+    int payload;
+    *length = replay_available(replay, &payload);
+    return *length > 0 ? &replay->trace[payload] : NULL;
+}
+
+static int replay_read(void* device) {
+    AtCommanderTraceReplay* replay = (AtCommanderTraceReplay*) device;
+    int payload;
+    if(replay_available(replay, &payload) == 0) {
+        return -1;
+    }
+
+    int byte = replay->trace[payload];
+    replay_consume(replay, 1);
+    return byte;
+}
+
+static void replay_baud_rate_initializer(void* device, int baud) {
+    AtCommanderTraceReplay* replay = (AtCommanderTraceReplay*) device;
+    int payload;
+    unsigned long recorded_baud;
+    replay->tx_offset = next_record(replay, replay->tx_offset, true, &payload,
+            &recorded_baud);
+    if(replay->tx_offset == replay->length || replay->tx_index != 0 ||
+            replay->trace[replay->tx_offset] != AT_TRACE_BAUD ||
+            recorded_baud != (unsigned long)baud) {
+        replay->mismatches++;
+        return;
+    }
+    // A baud change has no payload, it ends after the baud rate.
+    replay->tx_offset = payload;
+}
+
+bool at_commander_replay_start(AtCommanderConfig* config,
+        AtCommanderTraceReplay* replay, const uint8_t* trace, int length) {
+    if(length < AT_TRACE_HEADER_LENGTH || trace[0] != 'A' || trace[1] != 'T'
+            || trace[2] != 'T' || trace[3] != AT_TRACE_VERSION) {
+        return false;
+    }
+
+    memset(replay, 0, sizeof(*replay));
+    replay->trace = trace;
+    replay->length = length;
+    replay->tx_offset = AT_TRACE_HEADER_LENGTH;
+    replay->rx_offset = AT_TRACE_HEADER_LENGTH;
+
+    config->device = replay;
+    config->baud_rate_initializer = replay_baud_rate_initializer;
+    config->write_function = replay_write;
+    config->read_function = replay_read;
+    config->peek_function = replay_peek;
+    config->consume_function = replay_consume;
+    config->lock_function = NULL;
+    config->unlock_function = NULL;
+    // Everything recorded is already there, so there's never anything to wait
+    // for - and the device's own wait would be handed the replay.
+    config->wait_function = NULL;
+    return true;
+}
+
+bool at_commander_replay_complete(AtCommanderTraceReplay* replay) {
+    int payload;
+    unsigned long value;
+    return replay->mismatches == 0 &&
+            next_record(replay, replay->tx_offset, true, &payload, &value)
+                == replay->length &&
+            next_record(replay, replay->rx_offset, false, &payload, &value)
+                == replay->length;
+}
@@ -0,0 +1,130 @@
+#ifndef _ATTRACE_H_
+#define _ATTRACE_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Session traces
+ *
+ * A recorder wraps a config's transport callbacks and writes everything that
+ * goes over the wire - runs of transmitted and received bytes, and baud rate
+ * changes, each with a timestamp - to a compact, append-only binary trace. A
+ * replay feeds a trace back into the library in place of the device, so a
+ * session captured in the field can be re-run deterministically as a
+ * regression or performance test.
+ *
+ * The trace is a 4 byte header ("ATT" and AT_TRACE_VERSION) followed by
+ * records. Each record is a type byte, the ms since the previous record as an
+ * unsigned LEB128 varint, then for TX and RX a varint length and the bytes, or
+ * for a baud change the baud rate as a varint.
+ */
+
+#define AT_TRACE_VERSION 1
+#define AT_TRACE_HEADER_LENGTH 4
+
+#define AT_TRACE_TX 1
+#define AT_TRACE_RX 2
+#define AT_TRACE_BAUD 3
+
+// Bytes in the same direction are buffered into one record, up to this many.
+#ifndef AT_TRACE_MAX_RUN_LENGTH
+#define AT_TRACE_MAX_RUN_LENGTH 64
+#endif
+
+/** Public: Receives the trace as it's written, e.g. to append it to a file or
+ * a region of flash.
+ */
+typedef void (*AtCommanderTraceSink)(void* context, const uint8_t* bytes,
+        int length);
+
+/** Public: Records a device's session. Start with at_commander_trace_start.
+ *
+ * While recording, the config's callbacks and device point at the recorder,
+ * which holds the originals.
+ */
+typedef struct {
+    void* device;
+    void (*baud_rate_initializer)(void* device, int);
+    void (*write_function)(void* device, uint8_t);
+    int (*read_function)(void* device);
+    const uint8_t* (*peek_function)(void* device, int* length);
+    void (*consume_function)(void* device, int count);
+    void (*lock_function)(void* device);
+    void (*unlock_function)(void* device);
+    void (*wait_function)(void* device, unsigned long ms);
+    unsigned long (*millis_function)(void);
+    const uint8_t* peeked;
+
+    AtCommanderTraceSink sink;
+    void* sink_context;
+    unsigned long last_record_ms;
+    uint8_t run[AT_TRACE_MAX_RUN_LENGTH];
+    int run_length;
+    int run_type;
+    unsigned long run_started_ms;
+} AtCommanderTraceRecorder;
+
+/** Public: Plays a trace back in place of the device. Start with
+ * at_commander_replay_start.
+ *
+ * Received bytes are read back in order, but only once everything transmitted
+ * before them in the trace has been written - just like a device answering a
+ * request. Every transmitted byte and baud change is checked against the
+ * trace.
+ *
+ * mismatches - the number of writes and baud changes that didn't match the
+ *      trace.
+ */
+typedef struct {
+    const uint8_t* trace;
+    int length;
+    int tx_offset;
+    int tx_index;
+    int rx_offset;
+    int rx_index;
+    int mismatches;
+} AtCommanderTraceReplay;
+
+/** Public: Start recording everything sent to and received from the device.
+ *
+ *  recorder - holds the recording state; must outlive the recording.
+ *  sink - called with each part of the trace as it's written, starting with
+ *      the header.
+ *  context - passed to the sink.
+ */
+void at_commander_trace_start(AtCommanderConfig* config,
+        AtCommanderTraceRecorder* recorder, AtCommanderTraceSink sink,
+        void* context);
+
+/** Public: Write any buffered bytes to the sink.
+ */
+void at_commander_trace_flush(AtCommanderTraceRecorder* recorder);
+
+/** Public: Flush the trace and restore the config's original transport.
+ */
+void at_commander_trace_stop(AtCommanderConfig* config,
+        AtCommanderTraceRecorder* recorder);
+
+/** Public: Replace the config's transport with a replay of a trace.
+ *
+ *  trace - the recorded trace, which must outlive the replay.
+ *  length - the length of the trace.
+ *
+ *  Returns false if the trace doesn't have a valid header.
+ */
+bool at_commander_replay_start(AtCommanderConfig* config,
+        AtCommanderTraceReplay* replay, const uint8_t* trace, int length);
+
+/** Public: Returns true if everything in the trace was replayed, and nothing
+ * written differed from the recording.
+ */
+bool at_commander_replay_complete(AtCommanderTraceReplay* replay);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATTRACE_H_
@@ -0,0 +1,93 @@
+/* Measure the sustained throughput of the data mode bridge, from a host socket
+ * to a module's tty, at each supported baud rate.
+ *
+ * The "module" is the other end of a pseudo terminal, which doesn't throttle to
+ * the configured baud rate, so this is the bridge's own ceiling - compare it
+ * with the line rate to see the headroom at each baud.
+ */
+#include "atcommander.h"
+#include "atbridge.h"
+#include "attty.h"
+
+#include <fcntl.h>
+#include <pty.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BYTES_PER_BAUD (16 * 1024 * 1024)
+
+static uint8_t chunk[AT_BRIDGE_BUFFER_SIZE];
+
+static double measure(int baud) {
+    int host[2], module, tty_fd;
+    struct termios raw;
+    memset(&raw, 0, sizeof(raw));
+    cfmakeraw(&raw);
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, host) < 0 ||
+            openpty(&module, &tty_fd, NULL, &raw, NULL) < 0) {
+        perror("Unable to create the bridge's fds");
+        return -1;
+    }
+    fcntl(host[0], F_SETFL, O_NONBLOCK);
+    fcntl(module, F_SETFL, O_NONBLOCK);
+
+    AtCommanderConfig config;
+    AtCommanderTty tty = { tty_fd };
+    AtCommanderBridge bridge;
+    memset(&config, 0, sizeof(config));
+    config.platform = AT_PLATFORM_RN42;
+    at_commander_tty_config(&config, &tty);
+    config.baud_rate_initializer(config.device, baud);
+    at_commander_bridge_init(&bridge, &config, host[1], tty_fd);
+
+    long long sent = 0, received = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while(received < BYTES_PER_BAUD) {
+        if(sent < BYTES_PER_BAUD) {
+            ssize_t bytes = write(host[0], chunk, sizeof(chunk));
+            if(bytes > 0) {
+                sent += bytes;
+            }
+        }
+        if(at_commander_bridge_poll(&bridge, 0) < 0) {
+            perror("Bridge failed");
+            return -1;
+        }
+        ssize_t bytes = read(module, chunk, sizeof(chunk));
+        if(bytes > 0) {
+            received += bytes;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    at_commander_bridge_close(&bridge);
+    close(host[0]);
+    close(host[1]);
+    close(module);
+    close(tty_fd);
+    return received / ((end.tv_sec - start.tv_sec) +
+            (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main() {
+    int i;
+    printf("%8s %14s %14s %10s\n", "baud", "line B/s", "bridge B/s",
+            "headroom");
+    for(i = 0; i < VALID_BAUD_RATE_COUNT; i++) {
+        int baud = VALID_BAUD_RATES[i];
+        double throughput = measure(baud);
+        if(throughput < 0) {
+            return 1;
+        }
+        // 8N1 - 10 bits on the wire per byte
+        double line_rate = baud / 10.0;
+        printf("%8d %14.0f %14.0f %9.0fx\n", baud, line_rate, throughput,
+                throughput / line_rate);
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+/* Microbenchmarks of the library's parsing and formatting hot paths, each
+ * against an in-memory transport that answers instantly.
+ *
+ * Run with --json for machine-readable results, e.g. make bench-json to diff
+ * between library versions.
+ */
+#include "atcommander.h"
+// Private functions of the library are measured directly
+#include "atprivate.h"
+#include "microbench.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static AtCommanderConfig config;
+static const char* response = "";
+static int response_index;
+static int response_length;
+static char buffer[128];
+static volatile int sink;
+
+static void memory_write(void* device, uint8_t byte) {
+    sink = byte;
+}
+
+static int memory_read(void* device) {
+    if(response_index == response_length) {
+        return -1;
+    }
+    return (uint8_t) response[response_index++];
+}
+
+static const uint8_t* memory_peek(void* device, int* length) {
+    *length = response_length - response_index;
+    return *length > 0 ? (const uint8_t*) response + response_index : NULL;
+}
+
+static void memory_consume(void* device, int count) {
+    response_index += count;
+}
+
+static void respond(const char* text) {
+    response = text;
+    response_index = 0;
+    response_length = strlen(text);
+}
+
+static void memory_config(const AtCommanderPlatform* platform, bool chunked) {
+    memset(&config, 0, sizeof(config));
+    config.platform = *platform;
+    config.baud = 9600;
+    config.device_baud = 9600;
+    config.connected = true;
+    config.write_function = memory_write;
+    config.read_function = memory_read;
+    if(chunked) {
+        config.peek_function = memory_peek;
+        config.consume_function = memory_consume;
+    }
+}
+
+static int format_with_vsnprintf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return length;
+}
+
+static int format_with_format_request(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = at_commander_format_request(&config, buffer, sizeof(buffer),
+            format, args);
+    va_end(args);
+    return length;
+}
+
+static void bench_format_vsnprintf() {
+    sink = format_with_vsnprintf("SN,%s\r", "AT-Commander");
+    sink = format_with_vsnprintf("ATBD %d\r\n", 115200);
+}
+
+static void bench_format_request() {
+    sink = format_with_format_request("SN,%s\r", "AT-Commander");
+    sink = format_with_format_request("ATBD %d\r\n", 115200);
+}
+
+static void bench_read() {
+    respond("00066646C2AF\r\n");
+    sink = at_commander_read(&config, buffer, sizeof(buffer) - 1, 0);
+}
+
+static void bench_read_line() {
+    respond("BTName=FOO-C2AF\r\n");
+    sink = at_commander_read_line(&config, buffer, sizeof(buffer) - 1, 0);
+}
+
+static void bench_check_response_match() {
+    sink = at_commander_check_response(&config, "AOK", 3, "AOK", 3);
+}
+
+static void bench_check_response_mismatch() {
+    sink = at_commander_check_response(&config, "ERR", 3, "AOK", 3);
+}
+
+static void bench_get_request() {
+    respond("10A5\r\n");
+    sink = at_commander_get_request_once(&config,
+            &config.platform.get_version_command, buffer, sizeof(buffer));
+}
+
+static void bench_get_request_error() {
+    respond("ERROR\r\n");
+    sink = at_commander_get_request_once(&config,
+            &config.platform.get_version_command, buffer, sizeof(buffer));
+}
+
+static void bench_get_request_patterns() {
+    respond("FOO-C2AF\r\n");
+    sink = at_commander_get_request_once(&config,
+            &config.platform.get_name_command, buffer, sizeof(buffer));
+}
+
+static void bench_get_request_patterns_error() {
+    respond("ERR: unknown\r\n");
+    sink = at_commander_get_request_once(&config,
+            &config.platform.get_name_command, buffer, sizeof(buffer));
+}
+
+int main(int argc, char** argv) {
+    microbench_init(argc, argv);
+
+    memory_config(&AT_PLATFORM_RN42, false);
+    microbench_run("format_vsnprintf", bench_format_vsnprintf);
+    microbench_run("format_request", bench_format_request);
+    microbench_run("check_response_match", bench_check_response_match);
+    microbench_run("check_response_mismatch", bench_check_response_mismatch);
+    microbench_run("read", bench_read);
+    microbench_run("read_line", bench_read_line);
+    microbench_run("get_request_patterns", bench_get_request_patterns);
+    microbench_run("get_request_patterns_error",
+            bench_get_request_patterns_error);
+
+    memory_config(&AT_PLATFORM_RN42, true);
+    microbench_run("read_chunked", bench_read);
+    microbench_run("read_line_chunked", bench_read_line);
+
+    memory_config(&AT_PLATFORM_XBEE, false);
+    microbench_run("get_request", bench_get_request);
+    microbench_run("get_request_error", bench_get_request_error);
+
+    microbench_report("hotpaths");
+    return 0;
+}
@@ -0,0 +1,207 @@
+#ifndef _MICROBENCH_H_
+#define _MICROBENCH_H_
+
+/* A tiny microbenchmark harness: each benchmark is warmed up, calibrated to a
+ * batch size that runs for at least MICROBENCH_MIN_BATCH_NS, then timed over
+ * a number of repetitions. Results are printed as a table, or as JSON (one
+ * benchmark per line, in a fixed order) to diff between library versions.
+ *
+ * Allocations are counted by wrapping malloc, calloc and realloc, on glibc
+ * only - elsewhere they're reported as -1.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MICROBENCH_MAX_RESULTS 32
+#define MICROBENCH_WARMUP_NS 20000000.0
+#define MICROBENCH_MIN_BATCH_NS 2000000.0
+#define MICROBENCH_DEFAULT_REPETITIONS 15
+#define MICROBENCH_MAX_REPETITIONS 101
+
+typedef struct {
+    const char* name;
+    long iterations;
+    int repetitions;
+    double min_ns;
+    double median_ns;
+    double max_ns;
+    double allocations;
+} MicrobenchResult;
+
+static MicrobenchResult microbench_results[MICROBENCH_MAX_RESULTS];
+static int microbench_result_count;
+static int microbench_repetitions = MICROBENCH_DEFAULT_REPETITIONS;
+static bool microbench_json;
+static const char* microbench_label = "";
+static bool microbench_counting;
+static unsigned long microbench_allocations;
+
+#ifdef __GLIBC__
+#define MICROBENCH_COUNTS_ALLOCATIONS 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+
+void* malloc(size_t size) {
+    if(microbench_counting) {
+        microbench_allocations++;
+    }
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    if(microbench_counting) {
+        microbench_allocations++;
+    }
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    if(microbench_counting) {
+        microbench_allocations++;
+    }
+    return __libc_realloc(pointer, size);
+}
+#ifdef __cplusplus
+}
+#endif
+#else
+#define MICROBENCH_COUNTS_ALLOCATIONS 0
+#endif
+
+static double microbench_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static double microbench_batch_ns(void (*operation)(void), long iterations) {
+    long i;
+    double start = microbench_now_ns();
+    for(i = 0; i < iterations; i++) {
+        operation();
+    }
+    return microbench_now_ns() - start;
+}
+
+static int microbench_compare_doubles(const void* a, const void* b) {
+    double difference = *(const double*) a - *(const double*) b;
+    return difference < 0 ? -1 : difference > 0;
+}
+
+/* Parse the harness's options: --json, --repetitions N and --label TEXT (e.g.
+ * the library version, included in the JSON).
+ */
+static void microbench_init(int argc, char** argv) {
+    int i;
+    for(i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--json")) {
+            microbench_json = true;
+        } else if(!strcmp(argv[i], "--repetitions") && i + 1 < argc) {
+            microbench_repetitions = atoi(argv[++i]);
+        } else if(!strcmp(argv[i], "--label") && i + 1 < argc) {
+            microbench_label = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--json] [--repetitions N] "
+                    "[--label TEXT]\n", argv[0]);
+            exit(2);
+        }
+    }
+    if(microbench_repetitions < 1) {
+        microbench_repetitions = 1;
+    } else if(microbench_repetitions > MICROBENCH_MAX_REPETITIONS) {
+        microbench_repetitions = MICROBENCH_MAX_REPETITIONS;
+    }
+}
+
+static void microbench_run(const char* name, void (*operation)(void)) {
+    if(microbench_result_count == MICROBENCH_MAX_RESULTS) {
+        fprintf(stderr, "Too many benchmarks, skipping %s\n", name);
+        return;
+    }
+
+    // Warm up, doubling the batch until it's long enough to time reliably
+    long iterations = 1;
+    double warmed_ns = 0;
+    for(;;) {
+        double batch_ns = microbench_batch_ns(operation, iterations);
+        warmed_ns += batch_ns;
+        if(batch_ns >= MICROBENCH_MIN_BATCH_NS &&
+                warmed_ns >= MICROBENCH_WARMUP_NS) {
+            break;
+        } else if(batch_ns < MICROBENCH_MIN_BATCH_NS) {
+            iterations *= 2;
+        }
+    }
+
+    double per_op_ns[MICROBENCH_MAX_REPETITIONS];
+    int i;
+    microbench_allocations = 0;
+    for(i = 0; i < microbench_repetitions; i++) {
+        microbench_counting = true;
+        double batch_ns = microbench_batch_ns(operation, iterations);
+        microbench_counting = false;
+        per_op_ns[i] = batch_ns / iterations;
+    }
+    qsort(per_op_ns, microbench_repetitions, sizeof(double),
+            microbench_compare_doubles);
+
+    MicrobenchResult* result = &microbench_results[microbench_result_count++];
+    result->name = name;
+    result->iterations = iterations;
+    result->repetitions = microbench_repetitions;
+    result->min_ns = per_op_ns[0];
+    result->median_ns = per_op_ns[microbench_repetitions / 2];
+    result->max_ns = per_op_ns[microbench_repetitions - 1];
+    result->allocations = MICROBENCH_COUNTS_ALLOCATIONS ?
+            (double) microbench_allocations /
+            ((double) iterations * microbench_repetitions) : -1;
+}
+
+/* Print the results, as a table or JSON depending on the options.
+ */
+static void microbench_report(const char* suite) {
+    int i;
+    if(!microbench_json) {
+        printf("%-28s %10s %10s %10s %10s\n", "benchmark", "ns/op",
+                "min", "max", "allocs/op");
+        for(i = 0; i < microbench_result_count; i++) {
+            const MicrobenchResult* result = &microbench_results[i];
+            printf("%-28s %10.1f %10.1f %10.1f %10.2f\n", result->name,
+                    result->median_ns, result->min_ns, result->max_ns,
+                    result->allocations);
+        }
+        return;
+    }
+
+    printf("{\n  \"suite\": \"%s\",\n  \"label\": \"", suite);
+    const char* c;
+    for(c = microbench_label; *c != '\0'; c++) {
+        if(*c == '"' || *c == '\\') {
+            putchar('\\');
+        }
+        if((unsigned char) *c >= ' ') {
+            putchar(*c);
+        }
+    }
+    printf("\",\n  \"results\": [\n");
+    for(i = 0; i < microbench_result_count; i++) {
+        const MicrobenchResult* result = &microbench_results[i];
+        printf("    {\"name\": \"%s\", \"ns_per_op\": %.2f, "
+                "\"min_ns_per_op\": %.2f, \"max_ns_per_op\": %.2f, "
+                "\"allocs_per_op\": %.2f, \"iterations\": %ld, "
+                "\"repetitions\": %d}%s\n", result->name, result->median_ns,
+                result->min_ns, result->max_ns, result->allocations,
+                result->iterations, result->repetitions,
+                i + 1 < microbench_result_count ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+#endif // _MICROBENCH_H_
@@ -0,0 +1,178 @@
+/* Measure splitting received data into lines with the vectorized chunk
+ * scanner, against a byte at a time loop like at_commander_read_line's, on a
+ * settings dump (short lines) and on bulk data with long lines. The speedup is
+ * for at_commander_scan_copy, which read_chunk uses.
+ *
+ * Rates are in bytes per TSC cycle on x86, otherwise bytes per ns. Build with
+ * e.g. make bench HOST_ARCH_FLAGS=-mavx2 to measure the AVX2 scanner.
+ */
+#include "atscan.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define DATA_LENGTH (1024 * 1024)
+#define MAX_LINE_LENGTH 8192
+#define ITERATIONS 50
+
+static uint8_t data[DATA_LENGTH];
+static char line[MAX_LINE_LENGTH];
+static volatile int sink;
+
+static const char* const DUMP_LINES[] = { "***Settings***", "BTA=00066646C2AF",
+    "BTName=FOO-C2AF", "Baudrt(SW4)=115K", "Mode  =Slav", "Authen=1",
+    "PinCod=1234", "Bonded=0", "Rem=NONE SET", "***ADVANCED Settings***",
+    "SrvName= SPP", "SrvClass=0000", "DevClass=1F00", "InqWindw=0100",
+    "PagWindw=0100", "CfgTimr=120", "StatuStr=NULL" };
+
+static int fill_dump() {
+    int length = 0;
+    int i = 0;
+    while(length < DATA_LENGTH - 64) {
+        const char* entry = DUMP_LINES[i++ % (sizeof(DUMP_LINES) /
+                sizeof(DUMP_LINES[0]))];
+        length += sprintf((char*) data + length, "%s\r\n", entry);
+    }
+    return length;
+}
+
+static int fill_bulk() {
+    int length = 0;
+    int i = 0;
+    while(length + 4096 + 2 < DATA_LENGTH) {
+        int line_length = 1024 + (i++ * 997) % 3072;
+        int j;
+        for(j = 0; j < line_length; j++) {
+            data[length++] = 'A' + (j * 7 + i) % 26;
+        }
+        data[length++] = '\r';
+        data[length++] = '\n';
+    }
+    return length;
+}
+
+/* The byte at a time loop, as at_commander_read_line reads each byte. */
+static int split_by_byte(const uint8_t* chunk, int length) {
+    int lines = 0;
+    int bytes_read = 0;
+    int i;
+    for(i = 0; i < length; i++) {
+        int byte = chunk[i];
+        if(byte == '\r' || byte == '\n') {
+            if(bytes_read > 0) {
+                lines++;
+                bytes_read = 0;
+            }
+        } else {
+            line[bytes_read++] = byte;
+            if(bytes_read == MAX_LINE_LENGTH) {
+                lines++;
+                bytes_read = 0;
+            }
+        }
+    }
+    return lines;
+}
+
+/* A scan for each line, then a bulk copy - or with neither scan, the copying
+ * scan as read_chunk uses it.
+ */
+static int split_by_scan(const AtCommanderScanner* scanner,
+        int (*scan)(const AtCommanderScanner*, const uint8_t*, int),
+        const uint8_t* chunk, int length) {
+    int lines = 0;
+    int offset = 0;
+    while(offset < length) {
+        int end;
+        if(scan != NULL) {
+            end = offset + scan(scanner, chunk + offset, length - offset);
+        } else {
+            end = offset + at_commander_scan_copy(scanner, chunk + offset,
+                    length - offset, line, MAX_LINE_LENGTH);
+        }
+        int line_length = end - offset;
+        if(line_length > MAX_LINE_LENGTH) {
+            line_length = MAX_LINE_LENGTH;
+            end = offset + line_length - 1;
+        }
+        if(line_length > 0) {
+            if(scan != NULL) {
+                memcpy(line, chunk + offset, line_length);
+            }
+            lines++;
+        }
+        // Skip the rest of the line ending rather than scanning an empty line
+        for(offset = end + 1; offset < length && (chunk[offset] == '\r' ||
+                    chunk[offset] == '\n'); offset++);
+    }
+    return lines;
+}
+
+static unsigned long long cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+static double measure(const char* name, int length, int method,
+        const AtCommanderScanner* scanner) {
+    int i;
+    int lines = 0;
+    unsigned long long start = cycles();
+    for(i = 0; i < ITERATIONS; i++) {
+        if(method == 0) {
+            lines = split_by_byte(data, length);
+        } else {
+            lines = split_by_scan(scanner, method == 1 ?
+                    at_commander_scan_portable : method == 2 ?
+                    at_commander_scan : NULL, data, length);
+        }
+        sink = lines;
+    }
+    double rate = (double) length * ITERATIONS / (cycles() - start);
+    printf("  %-14s %6.2f bytes/%s (%d lines)\n", name, rate,
+#if defined(__x86_64__) || defined(__i386__)
+            "cycle",
+#else
+            "ns",
+#endif
+            lines);
+    return rate;
+}
+
+static void compare(const char* workload, int length) {
+    AtCommanderScanner scanner;
+    at_commander_scanner_init(&scanner);
+
+    printf("%s, %d bytes:\n", workload, length);
+    double by_byte = measure("byte loop", length, 0, &scanner);
+    measure("portable scan", length, 1, &scanner);
+    measure("scan", length, 2, &scanner);
+    double scanned = measure("scan_copy", length, 3, &scanner);
+    printf("  speedup        %6.1fx\n", scanned / by_byte);
+}
+
+int main() {
+    printf("scanner: %s\n",
+#if defined(__AVX2__)
+            "AVX2"
+#elif defined(__SSE2__)
+            "SSE2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+            "NEON"
+#else
+            "portable"
+#endif
+            );
+    compare("settings dump", fill_dump());
+    compare("bulk data", fill_bulk());
+    return 0;
+}
@@ -0,0 +1,83 @@
+/* Measure the overhead of running a provisioning flow as a compiled script,
+ * compared to the same flow written by hand in C, against a simulated RN-42
+ * that answers instantly - so the difference is all library time.
+ */
+#include "atcommander.h"
+#include "atscript.h"
+#include "simulated_rn42.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define ITERATIONS 20000
+
+static const char PROVISIONING_SCRIPT[] =
+    "enter\n"
+    "get_id $id\n"
+    "try get_name $name\n"
+    "ifeq $name \"AT-Commander\" goto named\n"
+    "set_name \"AT-Commander\" serialized\n"
+    "named:\n"
+    "reboot\n";
+
+static bool provision_by_hand(AtCommanderConfig* config) {
+    char id[AT_SCRIPT_MAX_VARIABLE_LENGTH];
+    char name[AT_SCRIPT_MAX_VARIABLE_LENGTH];
+    if(!at_commander_enter_command_mode(config) ||
+            at_commander_get_device_id(config, id, sizeof(id)) <= 0) {
+        return false;
+    }
+    if(at_commander_get_name(config, name, sizeof(name)) <= 0 ||
+            strcmp(name, "AT-Commander")) {
+        if(!at_commander_set_name(config, "AT-Commander", true)) {
+            return false;
+        }
+    }
+    return at_commander_reboot(config);
+}
+
+int main() {
+    AtCommanderConfig config;
+    AtCommanderScriptContext context;
+    uint8_t bytecode[64];
+    struct timespec start;
+    int i;
+
+    simulated_rn42_config(&config);
+
+    int length = at_commander_compile_script(PROVISIONING_SCRIPT, bytecode,
+            sizeof(bytecode), NULL);
+    if(length < 0) {
+        fprintf(stderr, "Unable to compile the provisioning script\n");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < ITERATIONS; i++) {
+        config.connected = false;
+        if(!provision_by_hand(&config)) {
+            fprintf(stderr, "Hand written provisioning failed\n");
+            return 1;
+        }
+    }
+    double by_hand_ns = elapsed_ns(&start) / ITERATIONS;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < ITERATIONS; i++) {
+        config.connected = false;
+        if(!at_commander_run_script(&config, bytecode, length, &context)) {
+            fprintf(stderr, "Scripted provisioning failed\n");
+            return 1;
+        }
+    }
+    double scripted_ns = elapsed_ns(&start) / ITERATIONS;
+
+    printf("bytecode:       %d bytes (%d instructions run)\n", length,
+            context.instructions);
+    printf("context:        %d bytes\n", (int)sizeof(context));
+    printf("hand written:   %.0f ns/run\n", by_hand_ns);
+    printf("script:         %.0f ns/run\n", scripted_ns);
+    printf("overhead:       %.0f ns/run (%.1f%%)\n", scripted_ns - by_hand_ns,
+            (scripted_ns - by_hand_ns) * 100 / by_hand_ns);
+    return 0;
+}
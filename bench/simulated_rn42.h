@@ -0,0 +1,69 @@
+#ifndef _SIMULATED_RN42_H_
+#define _SIMULATED_RN42_H_
+
+/* A simulated RN-42 for the benchmarks, answering every request instantly
+ * so the time measured is all spent in the library.
+ */
+#include "atcommander.h"
+
+#include <string.h>
+#include <time.h>
+
+static char simulated_request[64];
+static int simulated_request_length;
+static const char* simulated_response = "";
+static int simulated_response_index;
+
+static void simulated_write(void* device, uint8_t byte) {
+    if(simulated_request_length < (int)sizeof(simulated_request) - 1) {
+        simulated_request[simulated_request_length++] = byte;
+        simulated_request[simulated_request_length] = '\0';
+    }
+
+    if(!strcmp(simulated_request, "$$$")) {
+        simulated_response = "CMD\r\n";
+    } else if(byte == '\r') {
+        if(!strcmp(simulated_request, "GB\r")) {
+            simulated_response = "00066646C2AF\r\n";
+        } else if(!strcmp(simulated_request, "GN\r")) {
+            simulated_response = "FOO\r\n";
+        } else if(!strcmp(simulated_request, "R,1\r")) {
+            simulated_response = "Reboot!\r\n";
+        } else {
+            simulated_response = "AOK\r\n";
+        }
+    } else {
+        return;
+    }
+    simulated_response_index = 0;
+    simulated_request_length = 0;
+}
+
+static int simulated_read(void* device) {
+    if(simulated_response[simulated_response_index] == '\0') {
+        return -1;
+    }
+    return simulated_response[simulated_response_index++];
+}
+
+static void simulated_initializer(void* device, int baud) {
+}
+
+static void simulated_rn42_config(AtCommanderConfig* config) {
+    memset(config, 0, sizeof(*config));
+    config->platform = AT_PLATFORM_RN42;
+    config->baud = 9600;
+    config->device_baud = 9600;
+    config->baud_rate_initializer = simulated_initializer;
+    config->write_function = simulated_write;
+    config->read_function = simulated_read;
+}
+
+static double elapsed_ns(const struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9 +
+            (end.tv_nsec - start->tv_nsec);
+}
+
+#endif // _SIMULATED_RN42_H_
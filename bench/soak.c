@@ -0,0 +1,542 @@
+/* Soak the library against a simulated RN-42 with injected faults - dropped
+ * and corrupted bytes, delayed responses, unsolicited lines, spontaneous
+ * resets and resets that come back at another baud rate (brownouts) - running
+ * randomized public API calls in simulated time.
+ *
+ * The device and the library share a virtual clock advanced by the delay
+ * function and the time each byte takes on the wire, so hours of device time
+ * run in seconds and a run is reproducible from its seed. Reports the success
+ * rate, how long the library takes to get a working command mode back after
+ * each reset, and operation latency, and can fail when those regress:
+ *
+ *      soak --hours 72 --max-recovery-p99-ms 5000 --min-success-rate 95
+ */
+#include "atcommander.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SOAK_QUEUE_SIZE 1024
+#define SOAK_MAX_LINE_LENGTH 64
+#define SOAK_BOOT_MS 500
+#define SOAK_PROCESSING_US 2000
+#define SOAK_COMMAND_MODE_TIMEOUT_S 60
+#define SOAK_DEVICE_ID "00066646C2AF"
+#define SOAK_VERSION "Ver 6.15 04/26/2013"
+
+/* Fault rates - bytes in either direction, responses, or events per hour of
+ * simulated time.
+ */
+typedef struct {
+    double drop_per_byte;
+    double corrupt_per_byte;
+    double spike_per_response;
+    unsigned long spike_ms;
+    double unsolicited_per_hour;
+    double resets_per_hour;
+    double brownouts_per_hour;
+} SoakFaults;
+
+typedef struct {
+    unsigned long operations;
+    unsigned long successes;
+    unsigned long wrong_answers;
+    unsigned long bytes_dropped;
+    unsigned long bytes_corrupted;
+    unsigned long spikes;
+    unsigned long unsolicited;
+    unsigned long resets;
+    unsigned long brownouts;
+    unsigned long unrecovered;
+    double* latencies_ms;
+    double* recoveries_ms;
+    unsigned long recovery_count;
+    unsigned long capacity;
+} SoakStats;
+
+typedef struct {
+    uint8_t byte;
+    unsigned long long ready_us;
+} SoakByte;
+
+typedef struct {
+    int baud;
+    int host_baud;
+    bool command_mode;
+    unsigned long long command_mode_since_us;
+    unsigned long long booted_us;
+    int escapes;
+    char line[SOAK_MAX_LINE_LENGTH];
+    int line_length;
+    char name[SOAK_MAX_LINE_LENGTH];
+    SoakByte queue[SOAK_QUEUE_SIZE];
+    int queue_head;
+    int queue_count;
+} SoakDevice;
+
+static unsigned long long now_us;
+static unsigned long long random_state;
+static SoakFaults faults;
+static SoakStats stats;
+static SoakDevice device;
+static unsigned long long next_unsolicited_us;
+static unsigned long long next_reset_us;
+static unsigned long long next_brownout_us;
+static bool recovering;
+static unsigned long long fault_us;
+
+static unsigned long long soak_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static double soak_uniform() {
+    return (soak_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool soak_chance(double probability) {
+    return probability > 0 && soak_uniform() < probability;
+}
+
+/* When the next event of a Poisson process happens, or never at a rate of 0.
+ */
+static unsigned long long soak_next_event(double per_hour) {
+    if(per_hour <= 0) {
+        return ~0ULL;
+    }
+    return now_us + (unsigned long long)(-log(1 - soak_uniform()) /
+            per_hour * 3600e6);
+}
+
+static unsigned long long byte_time_us(int baud) {
+    return 10000000ULL / baud;
+}
+
+static void enqueue(const char* text, unsigned long long ready_us) {
+    unsigned long long byte_us = byte_time_us(device.baud);
+    if(device.queue_count > 0) {
+        unsigned long long last = device.queue[(device.queue_head +
+                device.queue_count - 1) % SOAK_QUEUE_SIZE].ready_us;
+        if(ready_us < last) {
+            ready_us = last;
+        }
+    }
+    for(; *text != '\0' && device.queue_count < SOAK_QUEUE_SIZE; text++) {
+        ready_us += byte_us;
+        SoakByte* entry = &device.queue[(device.queue_head +
+                device.queue_count++) % SOAK_QUEUE_SIZE];
+        entry->byte = *text;
+        entry->ready_us = ready_us;
+    }
+}
+
+static void respond(const char* response) {
+    unsigned long long ready_us = now_us + SOAK_PROCESSING_US;
+    if(soak_chance(faults.spike_per_response)) {
+        stats.spikes++;
+        ready_us += (unsigned long long)(faults.spike_ms * 1000 *
+                (0.5 + soak_uniform()));
+    }
+    enqueue(response, ready_us);
+    enqueue("\r\n", ready_us);
+}
+
+static void device_reset(int baud) {
+    device.baud = baud;
+    device.command_mode = false;
+    device.escapes = 0;
+    device.line_length = 0;
+    device.queue_count = 0;
+    device.booted_us = now_us + SOAK_BOOT_MS * 1000ULL;
+    if(!recovering) {
+        recovering = true;
+        fault_us = now_us;
+    }
+}
+
+/* Fire any scheduled faults that are due.
+ */
+static void inject_faults() {
+    if(now_us >= next_unsolicited_us) {
+        stats.unsolicited++;
+        enqueue(soak_random() % 2 ? "%CONNECT,0006664E0A7B,0\r\n" :
+                "%DISCONNECT\r\n", now_us);
+        next_unsolicited_us = soak_next_event(faults.unsolicited_per_hour);
+    }
+    if(now_us >= next_reset_us) {
+        stats.resets++;
+        device_reset(device.baud);
+        next_reset_us = soak_next_event(faults.resets_per_hour);
+    }
+    if(now_us >= next_brownout_us) {
+        stats.brownouts++;
+        device_reset(VALID_BAUD_RATES[soak_random() % VALID_BAUD_RATE_COUNT]);
+        next_brownout_us = soak_next_event(faults.brownouts_per_hour);
+    }
+}
+
+/* Line noise, applied to each byte in either direction.
+ */
+static bool transfer_byte(uint8_t* byte) {
+    if(device.host_baud != device.baud) {
+        *byte = soak_random();
+    } else if(soak_chance(faults.drop_per_byte)) {
+        stats.bytes_dropped++;
+        return false;
+    } else if(soak_chance(faults.corrupt_per_byte)) {
+        stats.bytes_corrupted++;
+        *byte ^= 1 << (soak_random() % 8);
+    }
+    return true;
+}
+
+static void process_line() {
+    const char* line = device.line;
+    if(!strcmp(line, "GN")) {
+        respond(device.name);
+    } else if(!strcmp(line, "GB")) {
+        respond(SOAK_DEVICE_ID);
+    } else if(!strcmp(line, "V")) {
+        respond(SOAK_VERSION);
+    } else if(!strncmp(line, "SN,", 3)) {
+        strcpy(device.name, line + 3);
+        respond("AOK");
+    } else if(!strncmp(line, "S-,", 3)) {
+        // Leave room for the "-" and the last 4 digits of the address
+        snprintf(device.name, sizeof(device.name), "%.*s-%s",
+                (int)sizeof(device.name) - 6, line + 3, SOAK_DEVICE_ID + 8);
+        respond("AOK");
+    } else if(!strncmp(line, "ST,", 3) || !strncmp(line, "SU,", 3)) {
+        respond("AOK");
+    } else if(!strcmp(line, "---")) {
+        device.command_mode = false;
+        respond("END");
+    } else if(!strcmp(line, "R,1")) {
+        respond("Reboot!");
+        device.command_mode = false;
+        device.booted_us = now_us + SOAK_BOOT_MS * 1000ULL;
+    } else {
+        respond("?");
+    }
+}
+
+static void soak_write(void* unused, uint8_t byte) {
+    now_us += byte_time_us(device.host_baud);
+    inject_faults();
+    if(now_us < device.booted_us || !transfer_byte(&byte)) {
+        return;
+    }
+
+    if(device.command_mode && now_us - device.command_mode_since_us >=
+            SOAK_COMMAND_MODE_TIMEOUT_S * 1000000ULL) {
+        device.command_mode = false;
+    }
+
+    if(!device.command_mode) {
+        if(byte != '$') {
+            device.escapes = 0;
+        } else if(++device.escapes == 3) {
+            device.escapes = 0;
+            device.command_mode = true;
+            device.command_mode_since_us = now_us;
+            device.line_length = 0;
+            respond("CMD");
+        }
+    } else if(byte == '\r') {
+        device.line[device.line_length] = '\0';
+        process_line();
+        device.line_length = 0;
+    } else if(byte != '\n' && device.line_length < SOAK_MAX_LINE_LENGTH - 1) {
+        device.line[device.line_length++] = byte;
+    }
+}
+
+static int soak_read(void* unused) {
+    inject_faults();
+    while(device.queue_count > 0 &&
+            device.queue[device.queue_head].ready_us <= now_us) {
+        uint8_t byte = device.queue[device.queue_head].byte;
+        device.queue_head = (device.queue_head + 1) % SOAK_QUEUE_SIZE;
+        device.queue_count--;
+        if(transfer_byte(&byte)) {
+            return byte;
+        }
+    }
+    return -1;
+}
+
+static void soak_baud_rate_initializer(void* unused, int baud) {
+    device.host_baud = baud;
+}
+
+static void soak_delay(unsigned long ms) {
+    now_us += ms * 1000ULL;
+}
+
+static unsigned long soak_millis() {
+    return now_us / 1000;
+}
+
+static void grow_stats() {
+    if(stats.operations < stats.capacity) {
+        return;
+    }
+    stats.capacity = stats.capacity == 0 ? 4096 : stats.capacity * 2;
+    stats.latencies_ms = (double*) realloc(stats.latencies_ms,
+            stats.capacity * sizeof(double));
+    stats.recoveries_ms = (double*) realloc(stats.recoveries_ms,
+            stats.capacity * sizeof(double));
+    if(stats.latencies_ms == NULL || stats.recoveries_ms == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+}
+
+/* Run one randomly chosen API call, and check its answer against the device.
+ *
+ * Returns true if it succeeded with the right answer.
+ */
+static bool run_operation(AtCommanderConfig* config) {
+    char buffer[SOAK_MAX_LINE_LENGTH];
+    int choice = soak_random() % 100;
+    int length;
+    if(choice < 35) {
+        length = at_commander_get_name(config, buffer, sizeof(buffer));
+        if(length > 0 && strcmp(buffer, device.name)) {
+            stats.wrong_answers++;
+            return false;
+        }
+        return length > 0;
+    } else if(choice < 60) {
+        length = at_commander_get_device_id(config, buffer, sizeof(buffer));
+        if(length > 0 && strcmp(buffer, SOAK_DEVICE_ID)) {
+            stats.wrong_answers++;
+            return false;
+        }
+        return length > 0;
+    } else if(choice < 75) {
+        char name[16];
+        snprintf(name, sizeof(name), "soak-%04x",
+                (unsigned int)(soak_random() & 0xffff));
+        if(!at_commander_set_name(config, name, false)) {
+            return false;
+        } else if(strcmp(device.name, name)) {
+            stats.wrong_answers++;
+            return false;
+        }
+        return true;
+    } else if(choice < 85) {
+        length = at_commander_get_version(config, buffer, sizeof(buffer));
+        if(length > 0 && strcmp(buffer, SOAK_VERSION)) {
+            stats.wrong_answers++;
+            return false;
+        }
+        return length > 0;
+    } else if(choice < 95) {
+        return at_commander_exit_command_mode(config);
+    }
+    return at_commander_reboot(config);
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double difference = *(const double*) a - *(const double*) b;
+    return difference < 0 ? -1 : difference > 0;
+}
+
+static double percentile(double* samples, unsigned long count,
+        double fraction) {
+    if(count == 0) {
+        return 0;
+    }
+    qsort(samples, count, sizeof(double), compare_doubles);
+    unsigned long index = (unsigned long) ceil(fraction * count);
+    return samples[index > 0 ? index - 1 : 0];
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  --hours H                  simulated time to run (24)\n"
+            "  --seed N                   random seed (1)\n"
+            "  --gap-ms MS                mean idle time between calls (2000)\n"
+            "  --drop P                   chance each byte is lost (0.0005)\n"
+            "  --corrupt P                chance each byte is changed (0.0005)\n"
+            "  --spike P                  chance a response is delayed (0.01)\n"
+            "  --spike-ms MS              mean response delay (1500)\n"
+            "  --unsolicited N            unsolicited lines per hour (20)\n"
+            "  --resets N                 spontaneous resets per hour (4)\n"
+            "  --brownouts N              resets to a random baud per hour (1)\n"
+            "  --retries N                attempts per get, set and scan (1)\n"
+            "  --json                     print the results as JSON\n"
+            "  --max-recovery-p99-ms MS   fail if recovery p99 is longer\n"
+            "  --min-success-rate PCT     fail if fewer calls succeed\n",
+            program);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    double hours = 24;
+    unsigned long long seed = 1;
+    double gap_ms = 2000;
+    int retries = 1;
+    bool json = false;
+    double max_recovery_p99_ms = -1;
+    double min_success_rate = -1;
+    faults.drop_per_byte = 0.0005;
+    faults.corrupt_per_byte = 0.0005;
+    faults.spike_per_response = 0.01;
+    faults.spike_ms = 1500;
+    faults.unsolicited_per_hour = 20;
+    faults.resets_per_hour = 4;
+    faults.brownouts_per_hour = 1;
+
+    int i;
+    for(i = 1; i < argc; i++) {
+        const char* option = argv[i];
+        if(!strcmp(option, "--json")) {
+            json = true;
+            continue;
+        } else if(i + 1 == argc) {
+            usage(argv[0]);
+        }
+        const char* value = argv[++i];
+        if(!strcmp(option, "--hours")) {
+            hours = atof(value);
+        } else if(!strcmp(option, "--seed")) {
+            seed = strtoull(value, NULL, 0);
+        } else if(!strcmp(option, "--gap-ms")) {
+            gap_ms = atof(value);
+        } else if(!strcmp(option, "--drop")) {
+            faults.drop_per_byte = atof(value);
+        } else if(!strcmp(option, "--corrupt")) {
+            faults.corrupt_per_byte = atof(value);
+        } else if(!strcmp(option, "--spike")) {
+            faults.spike_per_response = atof(value);
+        } else if(!strcmp(option, "--spike-ms")) {
+            faults.spike_ms = atol(value);
+        } else if(!strcmp(option, "--unsolicited")) {
+            faults.unsolicited_per_hour = atof(value);
+        } else if(!strcmp(option, "--resets")) {
+            faults.resets_per_hour = atof(value);
+        } else if(!strcmp(option, "--brownouts")) {
+            faults.brownouts_per_hour = atof(value);
+        } else if(!strcmp(option, "--retries")) {
+            retries = atoi(value);
+        } else if(!strcmp(option, "--max-recovery-p99-ms")) {
+            max_recovery_p99_ms = atof(value);
+        } else if(!strcmp(option, "--min-success-rate")) {
+            min_success_rate = atof(value);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    random_state = seed != 0 ? seed : 1;
+
+    device.baud = 115200;
+    device.host_baud = 115200;
+    strcpy(device.name, "FOO");
+    next_unsolicited_us = soak_next_event(faults.unsolicited_per_hour);
+    next_reset_us = soak_next_event(faults.resets_per_hour);
+    next_brownout_us = soak_next_event(faults.brownouts_per_hour);
+
+    AtCommanderConfig config;
+    memset(&config, 0, sizeof(config));
+    config.platform = AT_PLATFORM_RN42;
+    config.baud = 115200;
+    config.device_baud = 115200;
+    config.baud_rate_initializer = soak_baud_rate_initializer;
+    config.write_function = soak_write;
+    config.read_function = soak_read;
+    config.delay_function = soak_delay;
+    config.millis_function = soak_millis;
+    config.retry_seed = seed;
+    for(i = 0; i < AT_COMMANDER_RETRY_CLASS_COUNT; i++) {
+        config.retry_policies[i].max_attempts = retries;
+        config.retry_policies[i].initial_backoff_ms = 100;
+        config.retry_policies[i].max_backoff_ms = 1000;
+        config.retry_policies[i].jitter_percent = 20;
+    }
+
+    unsigned long long end_us = (unsigned long long)(hours * 3600e6);
+    while(now_us < end_us) {
+        grow_stats();
+        unsigned long long started_us = now_us;
+        bool success = run_operation(&config);
+        stats.latencies_ms[stats.operations++] =
+                (now_us - started_us) / 1000.0;
+        if(success) {
+            stats.successes++;
+            if(recovering) {
+                stats.recoveries_ms[stats.recovery_count++] =
+                        (now_us - fault_us) / 1000.0;
+                recovering = false;
+            }
+        }
+        now_us += (unsigned long long)(gap_ms * 2 * soak_uniform() * 1000);
+    }
+    stats.unrecovered = recovering ? 1 : 0;
+
+    double success_rate = stats.operations == 0 ? 0 :
+            100.0 * stats.successes / stats.operations;
+    double latency_p50 = percentile(stats.latencies_ms, stats.operations, 0.5);
+    double latency_p99 = percentile(stats.latencies_ms, stats.operations,
+            0.99);
+    double latency_max = percentile(stats.latencies_ms, stats.operations, 1);
+    double recovery_p50 = percentile(stats.recoveries_ms,
+            stats.recovery_count, 0.5);
+    double recovery_p99 = percentile(stats.recoveries_ms,
+            stats.recovery_count, 0.99);
+    double recovery_max = percentile(stats.recoveries_ms,
+            stats.recovery_count, 1);
+
+    if(json) {
+        printf("{\n  \"suite\": \"soak\",\n  \"seed\": %llu,\n"
+                "  \"hours\": %.2f,\n  \"operations\": %lu,\n"
+                "  \"success_rate\": %.3f,\n  \"wrong_answers\": %lu,\n"
+                "  \"faults\": {\"resets\": %lu, \"brownouts\": %lu, "
+                "\"unsolicited\": %lu, \"spikes\": %lu, "
+                "\"bytes_dropped\": %lu, \"bytes_corrupted\": %lu},\n"
+                "  \"recovery_ms\": {\"count\": %lu, \"p50\": %.1f, "
+                "\"p99\": %.1f, \"max\": %.1f, \"unrecovered\": %lu},\n"
+                "  \"latency_ms\": {\"p50\": %.1f, \"p99\": %.1f, "
+                "\"max\": %.1f}\n}\n", seed, hours, stats.operations,
+                success_rate, stats.wrong_answers, stats.resets,
+                stats.brownouts, stats.unsolicited, stats.spikes,
+                stats.bytes_dropped, stats.bytes_corrupted,
+                stats.recovery_count, recovery_p50, recovery_p99,
+                recovery_max, stats.unrecovered, latency_p50, latency_p99,
+                latency_max);
+    } else {
+        printf("simulated:      %.1f h (seed %llu)\n", hours, seed);
+        printf("operations:     %lu, %.2f%% succeeded, %lu wrong answers\n",
+                stats.operations, success_rate, stats.wrong_answers);
+        printf("faults:         %lu resets, %lu brownouts, %lu unsolicited "
+                "lines, %lu delay spikes,\n"
+                "                %lu bytes dropped, %lu corrupted\n",
+                stats.resets, stats.brownouts, stats.unsolicited,
+                stats.spikes, stats.bytes_dropped, stats.bytes_corrupted);
+        printf("recovery:       p50 %.0f ms, p99 %.0f ms, max %.0f ms "
+                "(%lu recovered, %lu not)\n", recovery_p50, recovery_p99,
+                recovery_max, stats.recovery_count, stats.unrecovered);
+        printf("latency:        p50 %.0f ms, p99 %.0f ms, max %.0f ms\n",
+                latency_p50, latency_p99, latency_max);
+    }
+
+    int status = 0;
+    if(max_recovery_p99_ms >= 0 && recovery_p99 > max_recovery_p99_ms) {
+        fprintf(stderr, "Recovery p99 of %.0f ms is over %.0f ms\n",
+                recovery_p99, max_recovery_p99_ms);
+        status = 1;
+    }
+    if(min_success_rate >= 0 && success_rate < min_success_rate) {
+        fprintf(stderr, "Success rate of %.2f%% is under %.2f%%\n",
+                success_rate, min_success_rate);
+        status = 1;
+    }
+    free(stats.latencies_ms);
+    free(stats.recoveries_ms);
+    return status;
+}
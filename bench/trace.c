@@ -0,0 +1,58 @@
+/* Measure the cost of recording a session trace, by timing the same queries
+ * against a simulated RN-42 with and without a recorder attached.
+ */
+#include "atcommander.h"
+#include "attrace.h"
+#include "simulated_rn42.h"
+
+#include <stdio.h>
+
+#define ITERATIONS 50000
+
+static unsigned long trace_length;
+
+// Stands in for appending to a file or flash - only counts the bytes.
+static void counting_sink(void* context, const uint8_t* bytes, int length) {
+    trace_length += length;
+}
+
+static double time_queries(AtCommanderConfig* config) {
+    struct timespec start;
+    char name[24];
+    int i;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < ITERATIONS; i++) {
+        config->connected = false;
+        if(at_commander_get_name(config, name, sizeof(name)) != 3) {
+            fprintf(stderr, "Query failed\n");
+            return -1;
+        }
+    }
+    return elapsed_ns(&start) / ITERATIONS;
+}
+
+int main() {
+    AtCommanderConfig config;
+    AtCommanderTraceRecorder recorder;
+
+    simulated_rn42_config(&config);
+    double plain_ns = time_queries(&config);
+
+    at_commander_trace_start(&config, &recorder, counting_sink, NULL);
+    double recorded_ns = time_queries(&config);
+    at_commander_trace_stop(&config, &recorder);
+
+    if(plain_ns < 0 || recorded_ns < 0) {
+        return 1;
+    }
+    printf("trace:          %.1f bytes/query\n",
+            (double)trace_length / ITERATIONS);
+    printf("not recorded:   %.0f ns/query\n", plain_ns);
+    printf("recorded:       %.0f ns/query\n", recorded_ns);
+    printf("overhead:       %.0f ns/query (%.1f%%)\n", recorded_ns - plain_ns,
+            (recorded_ns - plain_ns) * 100 / plain_ns);
+    // For scale - each query puts 16 bytes (at 10 bits each) on the wire.
+    printf("wire time:      %.0f ns/query at 115200 baud\n",
+            16 * 10 * 1e9 / 115200);
+    return 0;
+}
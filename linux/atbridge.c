@@ -0,0 +1,261 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "atbridge.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+// Reads of what the module already sent, before giving up and escaping anyway.
+#define AT_BRIDGE_MAX_DRAIN_PASSES 8
+
+static void set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if(flags >= 0) {
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+}
+
+static void channel_init(AtCommanderBridgeChannel* channel, int from, int to) {
+    channel->from = from;
+    channel->to = to;
+    channel->pending = 0;
+    channel->offset = 0;
+    channel->bytes = 0;
+    if(pipe2(channel->pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        channel->pipe[0] = channel->pipe[1] = -1;
+    }
+}
+
+/** Private: Stop splicing, e.g. because one of the fds doesn't support it,
+ * moving anything still in the pipe to the buffer.
+ */
+static void channel_stop_splicing(AtCommanderBridgeChannel* channel) {
+    if(channel->pending > 0) {
+        channel->pending = read(channel->pipe[0], channel->buffer,
+                channel->pending);
+        if(channel->pending < 0) {
+            channel->pending = 0;
+        }
+    }
+    channel->offset = 0;
+    close(channel->pipe[0]);
+    close(channel->pipe[1]);
+    channel->pipe[0] = channel->pipe[1] = -1;
+}
+
+/** Private: Read what's available from the channel's source, if everything
+ * read before has been written.
+ *
+ * Returns the number of bytes read, 0 if nothing was available, or -1 if the
+ * source was closed or failed.
+ */
+static int channel_fill(AtCommanderBridgeChannel* channel) {
+    ssize_t bytes;
+    if(channel->pending > 0) {
+        return 0;
+    }
+
+    if(channel->pipe[0] >= 0) {
+        bytes = splice(channel->from, NULL, channel->pipe[1], NULL,
+                AT_BRIDGE_BUFFER_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(bytes < 0 && errno == EINVAL) {
+            channel_stop_splicing(channel);
+        }
+    }
+
+    if(channel->pipe[0] < 0) {
+        bytes = read(channel->from, channel->buffer, AT_BRIDGE_BUFFER_SIZE);
+        channel->offset = 0;
+    }
+
+    if(bytes == 0) {
+        return -1;
+    } else if(bytes < 0) {
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    }
+    channel->pending = bytes;
+    return bytes;
+}
+
+/** Private: Write as much of the pending data as possible to the channel's
+ * destination.
+ *
+ * Returns the number of bytes written, or -1 if the destination failed.
+ */
+static int channel_drain(AtCommanderBridgeChannel* channel) {
+    int written = 0;
+    while(channel->pending > 0) {
+        ssize_t bytes;
+        if(channel->pipe[0] >= 0) {
+            bytes = splice(channel->pipe[0], NULL, channel->to, NULL,
+                    channel->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(bytes < 0 && errno == EINVAL) {
+                channel_stop_splicing(channel);
+                continue;
+            }
+        } else {
+            bytes = write(channel->to, channel->buffer + channel->offset,
+                    channel->pending);
+        }
+
+        if(bytes < 0) {
+            if(errno == EAGAIN || errno == EINTR) {
+                break;
+            }
+            return -1;
+        }
+        channel->pending -= bytes;
+        channel->offset += bytes;
+        channel->bytes += bytes;
+        written += bytes;
+    }
+    return written;
+}
+
+/** Private: Record when data was last sent to the module, so the guard time
+ * before an escape sequence is measured from it.
+ */
+static void bridge_transmitted(AtCommanderBridge* bridge) {
+    if(bridge->config->millis_function != NULL) {
+        bridge->config->last_transmit_ms = bridge->config->millis_function();
+    }
+}
+
+void at_commander_bridge_init(AtCommanderBridge* bridge,
+        AtCommanderConfig* config, int host_fd, int device_fd) {
+    bridge->config = config;
+    bridge->paused = false;
+    set_nonblocking(host_fd);
+    set_nonblocking(device_fd);
+    channel_init(&bridge->to_device, host_fd, device_fd);
+    channel_init(&bridge->to_host, device_fd, host_fd);
+}
+
+int at_commander_bridge_poll(AtCommanderBridge* bridge, int timeout_ms) {
+    AtCommanderBridgeChannel* to_device = &bridge->to_device;
+    AtCommanderBridgeChannel* to_host = &bridge->to_host;
+    struct pollfd fds[2];
+    fds[0].fd = to_device->from;
+    fds[0].events = to_host->pending > 0 ? POLLOUT : 0;
+    fds[1].fd = to_device->to;
+    fds[1].events = to_device->pending > 0 ? POLLOUT : 0;
+    if(!bridge->paused) {
+        fds[0].events |= to_device->pending == 0 ? POLLIN : 0;
+        fds[1].events |= to_host->pending == 0 ? POLLIN : 0;
+    }
+
+    if(poll(fds, 2, timeout_ms) < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    if((fds[0].revents | fds[1].revents) & POLLNVAL) {
+        return -1;
+    }
+
+    int moved = 0;
+    int result;
+    if(!bridge->paused && channel_fill(to_device) < 0) {
+        return -1;
+    }
+    if((result = channel_drain(to_device)) < 0) {
+        return -1;
+    } else if(result > 0) {
+        bridge_transmitted(bridge);
+    }
+    moved += result;
+
+    if(!bridge->paused && channel_fill(to_host) < 0) {
+        return -1;
+    }
+    if((result = channel_drain(to_host)) < 0) {
+        return -1;
+    }
+    return moved + result;
+}
+
+/** Private: Write all of a channel's pending data, waiting for the
+ * destination as needed.
+ *
+ * Returns false if the destination failed.
+ */
+static bool channel_flush(AtCommanderBridgeChannel* channel) {
+    while(channel->pending > 0) {
+        struct pollfd fd = { channel->to, POLLOUT, 0 };
+        if((poll(&fd, 1, -1) < 0 && errno != EINTR) ||
+                channel_drain(channel) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Private: Drop the line ending left over from the last command mode
+ * response (e.g. after "END"), so it isn't forwarded to the host as data.
+ *
+ * Anything else is kept, to be forwarded.
+ */
+static void discard_line_ending(AtCommanderBridge* bridge) {
+    AtCommanderBridgeChannel* channel = &bridge->to_host;
+    uint8_t byte;
+    while(channel->pending == 0 && read(channel->from, &byte, 1) == 1) {
+        if(byte == '\r' || byte == '\n') {
+            continue;
+        }
+
+        if(channel->pipe[1] >= 0) {
+            if(write(channel->pipe[1], &byte, 1) != 1) {
+                break;
+            }
+        } else {
+            channel->buffer[0] = byte;
+            channel->offset = 0;
+        }
+        channel->pending = 1;
+    }
+}
+
+bool at_commander_bridge_command(AtCommanderBridge* bridge,
+        void (*command)(AtCommanderConfig* config, void* context),
+        void* context) {
+    AtCommanderConfig* config = bridge->config;
+    bridge->paused = true;
+
+    unsigned long long transmitted = bridge->to_device.bytes;
+    bool flushed = channel_flush(&bridge->to_device);
+    if(bridge->to_device.bytes != transmitted) {
+        bridge_transmitted(bridge);
+    }
+
+    // Bounded, in case the module never stops sending
+    int passes;
+    for(passes = 0; flushed && passes < AT_BRIDGE_MAX_DRAIN_PASSES &&
+            channel_fill(&bridge->to_host) > 0; passes++) {
+        flushed = channel_flush(&bridge->to_host);
+    }
+
+    at_commander_lock(config);
+    command(config, context);
+    bool resumed = !config->connected ||
+            at_commander_exit_command_mode(config);
+    discard_line_ending(bridge);
+    at_commander_unlock(config);
+
+    bridge->paused = false;
+    return flushed && resumed;
+}
+
+void at_commander_bridge_close(AtCommanderBridge* bridge) {
+    AtCommanderBridgeChannel* channels[] = { &bridge->to_device,
+        &bridge->to_host };
+    int i;
+    for(i = 0; i < 2; i++) {
+        if(channels[i]->pipe[0] >= 0) {
+            close(channels[i]->pipe[0]);
+            close(channels[i]->pipe[1]);
+            channels[i]->pipe[0] = channels[i]->pipe[1] = -1;
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef _ATBRIDGE_H_
+#define _ATBRIDGE_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Data mode bridge
+ *
+ * Forwards data between a host fd (a socket, pipe or pty) and a module's tty
+ * once the module is in data mode, and can pause the stream to drop into
+ * command mode for a query without tearing it down.
+ *
+ * Where the kernel supports it, data is moved with splice() through a pipe and
+ * never copied into user space. Otherwise it falls back to batched reads and
+ * writes through a buffer, up to AT_BRIDGE_BUFFER_SIZE bytes per system call.
+ */
+
+#ifndef AT_BRIDGE_BUFFER_SIZE
+#define AT_BRIDGE_BUFFER_SIZE 4096
+#endif
+
+/** Public: One direction of a bridge.
+ *
+ * pipe - the pipe used to splice data, or -1 if splicing isn't supported.
+ * pending - bytes read but not yet written, in the pipe or the buffer.
+ * bytes - the total number of bytes delivered.
+ */
+typedef struct {
+    int from;
+    int to;
+    int pipe[2];
+    int pending;
+    uint8_t buffer[AT_BRIDGE_BUFFER_SIZE];
+    int offset;
+    unsigned long long bytes;
+} AtCommanderBridgeChannel;
+
+/** Public: A data mode bridge between a host fd and a module.
+ *
+ * The config's transport must use the same device fd, e.g. set up with
+ * at_commander_tty_config.
+ */
+typedef struct {
+    AtCommanderConfig* config;
+    AtCommanderBridgeChannel to_device;
+    AtCommanderBridgeChannel to_host;
+    bool paused;
+} AtCommanderBridge;
+
+/** Public: Set up a bridge. Both fds are switched to non-blocking.
+ *
+ *  config - the module's config, which must be in data mode.
+ *  host_fd - the fd to forward the module's data to and from.
+ *  device_fd - the module's fd.
+ */
+void at_commander_bridge_init(AtCommanderBridge* bridge,
+        AtCommanderConfig* config, int host_fd, int device_fd);
+
+/** Public: Wait up to timeout_ms for data in either direction, and forward
+ * as much as can be without blocking. Call it in a loop.
+ *
+ *  Returns the number of bytes forwarded, or -1 if the host closed its end or
+ *  either fd failed.
+ */
+int at_commander_bridge_poll(AtCommanderBridge* bridge, int timeout_ms);
+
+/** Public: Pause the data stream, switch to command mode and back, and resume.
+ *
+ * Data already taken from the host is written to the module, and anything the
+ * module has already sent is delivered to the host, before the escape
+ * sequence - the guard time is measured from the last data byte sent. Data the
+ * host sends meanwhile waits in its fd until the stream resumes.
+ *
+ *  command - called with the config locked, to send any commands (entering
+ *      command mode as needed).
+ *  context - passed to the command.
+ *
+ *  Returns true if the module is back in data mode.
+ */
+bool at_commander_bridge_command(AtCommanderBridge* bridge,
+        void (*command)(AtCommanderConfig* config, void* context),
+        void* context);
+
+/** Public: Release the bridge's pipes. The host and device fds are left open.
+ */
+void at_commander_bridge_close(AtCommanderBridge* bridge);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATBRIDGE_H_
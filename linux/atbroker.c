@@ -0,0 +1,631 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "atbroker.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Leaves room in a batch for the store command.
+#define AT_BROKER_MAX_BATCHED_SETS (AT_COMMANDER_MAX_BATCH_SIZE - 1)
+
+static unsigned long long broker_micros() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void broker_put_u32(uint8_t* buffer, uint32_t value) {
+    buffer[0] = value;
+    buffer[1] = value >> 8;
+    buffer[2] = value >> 16;
+    buffer[3] = value >> 24;
+}
+
+static uint32_t broker_get_u32(const uint8_t* buffer) {
+    return buffer[0] | buffer[1] << 8 | buffer[2] << 16 |
+            (uint32_t)buffer[3] << 24;
+}
+
+/** Private: Send a response to a client. A client that has gone away is
+ * dropped when its socket reports the hang up, not here.
+ */
+static void broker_send(int client, int status, uint32_t id,
+        const uint8_t* value, int value_length) {
+    uint8_t message[AT_BROKER_MAX_MESSAGE_LENGTH];
+    message[0] = AT_BROKER_PROTOCOL_VERSION;
+    message[1] = status;
+    broker_put_u32(message + 2, id);
+    if(value_length > 0) {
+        memcpy(message + AT_BROKER_RESPONSE_HEADER_LENGTH, value,
+                value_length);
+    }
+    send(client, message, AT_BROKER_RESPONSE_HEADER_LENGTH + value_length,
+            MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+/** Private: Answer one waiting client, and count the request in the stats.
+ */
+static void broker_answer(AtCommanderBroker* broker,
+        AtCommanderBrokerWaiter* waiter, int status, const uint8_t* value,
+        int value_length) {
+    broker_send(waiter->client, status, waiter->id, value, value_length);
+
+    unsigned long latency_us = broker_micros() - waiter->submitted_us;
+    broker->stats.requests++;
+    if(status != AT_BROKER_OK) {
+        broker->stats.failures++;
+    }
+    broker->total_latency_us += latency_us;
+    broker->stats.average_latency_us = broker->total_latency_us /
+            broker->stats.requests;
+    if(latency_us > broker->stats.max_latency_us) {
+        broker->stats.max_latency_us = latency_us;
+    }
+}
+
+static void broker_answer_all(AtCommanderBroker* broker,
+        AtCommanderBrokerRequest* request, int status, const uint8_t* value,
+        int value_length) {
+    int i;
+    for(i = 0; i < request->waiter_count; i++) {
+        broker_answer(broker, &request->waiters[i], status, value,
+                value_length);
+    }
+}
+
+static void broker_send_stats(AtCommanderBroker* broker, int client,
+        uint32_t id) {
+    AtCommanderBrokerStats stats;
+    at_commander_broker_stats(broker, &stats);
+    unsigned long fields[AT_BROKER_STAT_COUNT] = { stats.queue_depth,
+        stats.max_queue_depth, stats.requests, stats.round_trips,
+        stats.coalesced, stats.batched, stats.failures,
+        stats.average_latency_us, stats.max_latency_us };
+
+    uint8_t value[AT_BROKER_STAT_COUNT * 4];
+    int i;
+    for(i = 0; i < AT_BROKER_STAT_COUNT; i++) {
+        broker_put_u32(value + i * 4, fields[i]);
+    }
+    broker_send(client, AT_BROKER_OK, id, value, sizeof(value));
+}
+
+/** Private: Returns true if the request is well formed - a get or set of a
+ * setting that supports it, with a value of the right type.
+ */
+static bool broker_request_valid(int operation, int setting, int value_length) {
+    if(operation == AT_BROKER_GET) {
+        return value_length == 0 && (setting == AT_BROKER_NAME ||
+                setting == AT_BROKER_DEVICE_ID ||
+                setting == AT_BROKER_VERSION);
+    } else if(operation == AT_BROKER_SET) {
+        if(setting == AT_BROKER_NAME || setting == AT_BROKER_SERIALIZED_NAME) {
+            return value_length > 0 &&
+                    value_length <= AT_BROKER_MAX_VALUE_LENGTH;
+        }
+        return value_length == 4 && (setting == AT_BROKER_BAUD ||
+                setting == AT_BROKER_CONFIGURATION_TIMER);
+    }
+    return false;
+}
+
+/** Private: Find a get of the setting that's in flight or queued, and still
+ * has room for another client to wait on it.
+ */
+static AtCommanderBrokerRequest* broker_find_get(AtCommanderBroker* broker,
+        int setting) {
+    AtCommanderBrokerRequest* in_flight = broker->in_flight;
+    if(in_flight != NULL && in_flight->operation == AT_BROKER_GET &&
+            in_flight->setting == setting &&
+            in_flight->waiter_count < AT_BROKER_MAX_WAITERS) {
+        return in_flight;
+    }
+
+    int i;
+    for(i = 0; i < broker->queue_length; i++) {
+        AtCommanderBrokerRequest* request = &broker->queue[i];
+        if(request->operation == AT_BROKER_GET && request->setting == setting
+                && request->waiter_count < AT_BROKER_MAX_WAITERS) {
+            return request;
+        }
+    }
+    return NULL;
+}
+
+/** Private: Parse a request from a client and queue it, or join it to an
+ * identical get. Stats requests, and requests that can't be queued, are
+ * answered straight away.
+ */
+static void broker_submit(AtCommanderBroker* broker, int client,
+        const uint8_t* message, int length) {
+    AtCommanderBrokerWaiter waiter;
+    waiter.client = client;
+    waiter.id = length >= AT_BROKER_REQUEST_HEADER_LENGTH ?
+            broker_get_u32(message + 4) : 0;
+    waiter.submitted_us = broker_micros();
+
+    if(length < AT_BROKER_REQUEST_HEADER_LENGTH ||
+            message[0] != AT_BROKER_PROTOCOL_VERSION) {
+        broker_answer(broker, &waiter, AT_BROKER_INVALID, NULL, 0);
+        return;
+    }
+
+    int operation = message[1];
+    int setting = message[2];
+    const uint8_t* value = message + AT_BROKER_REQUEST_HEADER_LENGTH;
+    int value_length = length - AT_BROKER_REQUEST_HEADER_LENGTH;
+    if(operation == AT_BROKER_STATS) {
+        broker_send_stats(broker, client, waiter.id);
+        return;
+    } else if(!broker_request_valid(operation, setting, value_length)) {
+        broker_answer(broker, &waiter, AT_BROKER_INVALID, NULL, 0);
+        return;
+    }
+
+    AtCommanderBrokerRequest* request = NULL;
+    if(operation == AT_BROKER_GET) {
+        request = broker_find_get(broker, setting);
+    }
+
+    if(request != NULL) {
+        broker->stats.coalesced++;
+        if(message[3] > request->priority) {
+            request->priority = message[3];
+        }
+    } else if(broker->queue_length == AT_BROKER_MAX_QUEUE_LENGTH) {
+        broker_answer(broker, &waiter, AT_BROKER_BUSY, NULL, 0);
+        return;
+    } else {
+        request = &broker->queue[broker->queue_length++];
+        request->operation = operation;
+        request->setting = setting;
+        request->priority = message[3];
+        request->sequence = broker->next_sequence++;
+        request->number = 0;
+        request->value[0] = '\0';
+        if(setting == AT_BROKER_BAUD ||
+                setting == AT_BROKER_CONFIGURATION_TIMER) {
+            request->number = (int32_t) broker_get_u32(value);
+        } else {
+            memcpy(request->value, value, value_length);
+            request->value[value_length] = '\0';
+        }
+        request->waiter_count = 0;
+
+        if((unsigned long)broker->queue_length >
+                broker->stats.max_queue_depth) {
+            broker->stats.max_queue_depth = broker->queue_length;
+        }
+    }
+    request->waiters[request->waiter_count++] = waiter;
+}
+
+/** Private: Forget a client that hung up, including any requests it's
+ * waiting on.
+ */
+static void broker_remove_client(AtCommanderBroker* broker, int index) {
+    int client = broker->clients[index];
+    close(client);
+    broker->clients[index] = broker->clients[--broker->client_count];
+
+    int i = 0;
+    while(i < broker->queue_length + 1) {
+        AtCommanderBrokerRequest* request = i < broker->queue_length ?
+                &broker->queue[i] : broker->in_flight;
+        if(request == NULL) {
+            break;
+        }
+
+        int waiter = 0;
+        while(waiter < request->waiter_count) {
+            if(request->waiters[waiter].client == client) {
+                request->waiters[waiter] =
+                        request->waiters[--request->waiter_count];
+            } else {
+                waiter++;
+            }
+        }
+
+        if(request->waiter_count == 0 && request != broker->in_flight) {
+            *request = broker->queue[--broker->queue_length];
+        } else {
+            i++;
+        }
+    }
+}
+
+/** Private: Read every request waiting on the clients' sockets, without
+ * blocking, and close any clients that hung up.
+ */
+static void broker_receive(AtCommanderBroker* broker) {
+    int i = 0;
+    int received = 0;
+    while(i < broker->client_count) {
+        uint8_t message[AT_BROKER_MAX_MESSAGE_LENGTH];
+        ssize_t length = recv(broker->clients[i], message, sizeof(message),
+                MSG_DONTWAIT);
+        if(length > 0) {
+            broker_submit(broker, broker->clients[i], message, length);
+            // Don't let one busy client hold up the others
+            if(++received < AT_BROKER_MAX_QUEUE_LENGTH) {
+                continue;
+            }
+        } else if(length == 0 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+                    errno != EINTR)) {
+            broker_remove_client(broker, i);
+            continue;
+        }
+        received = 0;
+        i++;
+    }
+}
+
+/** Private: Returns true for the sets that can be chained with others - a
+ * baud rate change is sent on its own.
+ */
+static bool broker_batchable(AtCommanderBrokerRequest* request) {
+    return request->operation == AT_BROKER_SET &&
+            request->setting != AT_BROKER_BAUD;
+}
+
+/** Private: Find the next request to send - the highest priority, and the
+ * oldest within that priority.
+ *
+ *  sets_only - if true, only consider sets that can be batched.
+ *
+ *  Returns the index of the request in the queue, or -1 if there isn't one.
+ */
+static int broker_next(AtCommanderBroker* broker, bool sets_only) {
+    int next = -1;
+    int i;
+    for(i = 0; i < broker->queue_length; i++) {
+        AtCommanderBrokerRequest* request = &broker->queue[i];
+        if(sets_only && !broker_batchable(request)) {
+            continue;
+        }
+        if(next < 0 || request->priority > broker->queue[next].priority ||
+                (request->priority == broker->queue[next].priority &&
+                 request->sequence < broker->queue[next].sequence)) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+/** Private: Remove a request from the queue, returning a copy of it.
+ */
+static AtCommanderBrokerRequest broker_take(AtCommanderBroker* broker,
+        int index) {
+    AtCommanderBrokerRequest request = broker->queue[index];
+    broker->queue[index] = broker->queue[--broker->queue_length];
+    return request;
+}
+
+/** Private: Add a set to a batch, if it fits with room left for the store
+ * command. The batch is unchanged if it doesn't.
+ */
+static bool broker_batch_add(AtCommanderConfig* config, AtCommanderBatch* batch,
+        AtCommanderBrokerRequest* request) {
+    AtCommanderBatch added = *batch;
+    bool fits;
+    if(request->setting == AT_BROKER_NAME) {
+        fits = at_commander_batch_add(&added,
+                &config->platform.set_name_command, request->value);
+    } else if(request->setting == AT_BROKER_SERIALIZED_NAME) {
+        fits = at_commander_batch_add(&added,
+                &config->platform.set_serialized_name_command,
+                request->value);
+    } else {
+        fits = at_commander_batch_add(&added,
+                &config->platform.set_configuration_timer_command,
+                request->number);
+    }
+
+    if(fits && config->platform.store_settings_command.request_format
+            != NULL) {
+        AtCommanderBatch stored = added;
+        fits = at_commander_batch_add(&stored,
+                &config->platform.store_settings_command);
+    }
+
+    if(fits) {
+        *batch = added;
+    }
+    return fits;
+}
+
+/** Private: Send the queued set at the front along with as many other
+ * batchable sets as fit, in one command mode session with one store.
+ *
+ * Returns the number of requests answered.
+ */
+static int broker_process_sets(AtCommanderBroker* broker,
+        AtCommanderBrokerRequest* first) {
+    AtCommanderConfig* config = broker->config;
+    AtCommanderBrokerRequest sets[AT_BROKER_MAX_BATCHED_SETS];
+    AtCommanderBatch batch;
+    at_commander_batch_init(&batch);
+
+    if(!broker_batch_add(config, &batch, first)) {
+        broker_answer_all(broker, first, AT_BROKER_FAILED, NULL, 0);
+        return first->waiter_count;
+    }
+    sets[0] = *first;
+    int count = 1;
+
+    while(count < AT_BROKER_MAX_BATCHED_SETS) {
+        int next = broker_next(broker, true);
+        if(next < 0 || !broker_batch_add(config, &batch,
+                    &broker->queue[next])) {
+            break;
+        }
+        sets[count++] = broker_take(broker, next);
+    }
+
+    at_commander_batch_send(config, &batch, true, false);
+    broker->stats.round_trips++;
+    if(count > 1) {
+        broker->stats.batched += count;
+    }
+
+    int answered = 0;
+    int i;
+    for(i = 0; i < count; i++) {
+        bool success = batch.results[i];
+        if(success && sets[i].setting == AT_BROKER_CONFIGURATION_TIMER &&
+                sets[i].number > 0) {
+            config->command_mode_timeout_s = sets[i].number;
+        }
+        broker_answer_all(broker, &sets[i],
+                success ? AT_BROKER_OK : AT_BROKER_FAILED, NULL, 0);
+        answered += sets[i].waiter_count;
+    }
+    return answered;
+}
+
+/** Private: Send the next queued request to the module and answer everyone
+ * waiting on it.
+ *
+ * Returns the number of requests answered.
+ */
+static int broker_process(AtCommanderBroker* broker) {
+    AtCommanderConfig* config = broker->config;
+    AtCommanderBrokerRequest request = broker_take(broker,
+            broker_next(broker, false));
+    if(broker_batchable(&request)) {
+        return broker_process_sets(broker, &request);
+    }
+
+    char response[AT_BROKER_MAX_VALUE_LENGTH + 1];
+    int response_length = 0;
+    bool success;
+    broker->in_flight = &request;
+    if(request.operation == AT_BROKER_SET) {
+        success = at_commander_set_baud(config, request.number);
+    } else {
+        int length;
+        if(request.setting == AT_BROKER_NAME) {
+            length = at_commander_get_name(config, response,
+                    sizeof(response));
+        } else if(request.setting == AT_BROKER_DEVICE_ID) {
+            length = at_commander_get_device_id(config, response,
+                    sizeof(response));
+        } else {
+            length = at_commander_get_version(config, response,
+                    sizeof(response));
+        }
+        success = length > 0;
+        if(success) {
+            response_length = strlen(response);
+        }
+    }
+    broker->stats.round_trips++;
+
+    // Anyone who asked for the same thing while the module was answering can
+    // share the answer.
+    broker_receive(broker);
+    broker->in_flight = NULL;
+
+    broker_answer_all(broker, &request,
+            success ? AT_BROKER_OK : AT_BROKER_FAILED, (uint8_t*) response,
+            response_length);
+    return request.waiter_count;
+}
+
+void at_commander_broker_init(AtCommanderBroker* broker,
+        AtCommanderConfig* config) {
+    memset(broker, 0, sizeof(*broker));
+    broker->config = config;
+    broker->listen_fd = -1;
+}
+
+bool at_commander_broker_listen(AtCommanderBroker* broker, const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path) ||
+            strlen(path) >= sizeof(broker->path)) {
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return false;
+    }
+
+    unlink(path);
+    if(bind(fd, (struct sockaddr*) &address, sizeof(address)) < 0 ||
+            listen(fd, AT_BROKER_MAX_CLIENTS) < 0) {
+        close(fd);
+        return false;
+    }
+    broker->listen_fd = fd;
+    strcpy(broker->path, path);
+    return true;
+}
+
+bool at_commander_broker_add_client(AtCommanderBroker* broker, int fd) {
+    if(broker->client_count == AT_BROKER_MAX_CLIENTS) {
+        return false;
+    }
+    broker->clients[broker->client_count++] = fd;
+    return true;
+}
+
+int at_commander_broker_poll(AtCommanderBroker* broker, int timeout_ms) {
+    struct pollfd fds[AT_BROKER_MAX_CLIENTS + 1];
+    int count = 0;
+    int i;
+    if(broker->listen_fd >= 0) {
+        fds[count].fd = broker->listen_fd;
+        fds[count++].events = POLLIN;
+    }
+    for(i = 0; i < broker->client_count; i++) {
+        fds[count].fd = broker->clients[i];
+        fds[count++].events = POLLIN;
+    }
+
+    if(poll(fds, count, timeout_ms) < 0 && errno != EINTR) {
+        return -1;
+    }
+
+    if(broker->listen_fd >= 0 && (fds[0].revents & POLLIN)) {
+        int client;
+        while((client = accept4(broker->listen_fd, NULL, NULL,
+                        SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            if(!at_commander_broker_add_client(broker, client)) {
+                close(client);
+            }
+        }
+    }
+
+    unsigned long answered = broker->stats.requests;
+    broker_receive(broker);
+    while(broker->queue_length > 0) {
+        broker_process(broker);
+    }
+    return broker->stats.requests - answered;
+}
+
+void at_commander_broker_stats(AtCommanderBroker* broker,
+        AtCommanderBrokerStats* stats) {
+    *stats = broker->stats;
+    stats->queue_depth = broker->queue_length;
+}
+
+void at_commander_broker_close(AtCommanderBroker* broker) {
+    while(broker->client_count > 0) {
+        broker_remove_client(broker, 0);
+    }
+    if(broker->listen_fd >= 0) {
+        close(broker->listen_fd);
+        unlink(broker->path);
+        broker->listen_fd = -1;
+    }
+}
+
+int at_commander_broker_connect(const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(fd >= 0 && connect(fd, (struct sockaddr*) &address,
+                sizeof(address)) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/** Private: Send a request and wait for its response.
+ *
+ * Returns the length of the response, or -1 if the connection failed.
+ */
+static int broker_call(int fd, uint8_t* message, int length) {
+    if(send(fd, message, length, MSG_NOSIGNAL) != length) {
+        return -1;
+    }
+    length = recv(fd, message, AT_BROKER_MAX_MESSAGE_LENGTH, 0);
+    if(length < AT_BROKER_RESPONSE_HEADER_LENGTH ||
+            message[0] != AT_BROKER_PROTOCOL_VERSION) {
+        return -1;
+    }
+    return length;
+}
+
+static void broker_request_header(uint8_t* message, int operation, int setting,
+        int priority) {
+    message[0] = AT_BROKER_PROTOCOL_VERSION;
+    message[1] = operation;
+    message[2] = setting;
+    message[3] = priority;
+    broker_put_u32(message + 4, 0);
+}
+
+int at_commander_broker_request(int fd, AtCommanderBrokerOperation operation,
+        AtCommanderBrokerSetting setting, int priority, const char* value,
+        int number, char* response, int response_length) {
+    uint8_t message[AT_BROKER_MAX_MESSAGE_LENGTH];
+    broker_request_header(message, operation, setting, priority);
+    int length = AT_BROKER_REQUEST_HEADER_LENGTH;
+    if(value != NULL) {
+        int value_length = strlen(value);
+        if(value_length > AT_BROKER_MAX_VALUE_LENGTH) {
+            return AT_BROKER_INVALID;
+        }
+        memcpy(message + length, value, value_length);
+        length += value_length;
+    } else if(operation == AT_BROKER_SET) {
+        broker_put_u32(message + length, number);
+        length += 4;
+    }
+
+    length = broker_call(fd, message, length);
+    if(length < 0) {
+        return -1;
+    }
+
+    if(response != NULL && response_length > 0) {
+        int value_length = length - AT_BROKER_RESPONSE_HEADER_LENGTH;
+        if(value_length >= response_length) {
+            value_length = response_length - 1;
+        }
+        memcpy(response, message + AT_BROKER_RESPONSE_HEADER_LENGTH,
+                value_length);
+        response[value_length] = '\0';
+    }
+    return message[1];
+}
+
+bool at_commander_broker_get_stats(int fd, AtCommanderBrokerStats* stats) {
+    uint8_t message[AT_BROKER_MAX_MESSAGE_LENGTH];
+    broker_request_header(message, AT_BROKER_STATS, 0, 0);
+    if(broker_call(fd, message, AT_BROKER_REQUEST_HEADER_LENGTH) !=
+            AT_BROKER_STATS_LENGTH) {
+        return false;
+    }
+
+    unsigned long* fields[AT_BROKER_STAT_COUNT] = { &stats->queue_depth,
+        &stats->max_queue_depth, &stats->requests, &stats->round_trips,
+        &stats->coalesced, &stats->batched, &stats->failures,
+        &stats->average_latency_us, &stats->max_latency_us };
+    int i;
+    for(i = 0; i < AT_BROKER_STAT_COUNT; i++) {
+        *fields[i] = broker_get_u32(message +
+                AT_BROKER_RESPONSE_HEADER_LENGTH + i * 4);
+    }
+    return true;
+}
@@ -0,0 +1,225 @@
+#ifndef _ATBROKER_H_
+#define _ATBROKER_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Broker
+ *
+ * Lets several processes share one module. The broker owns the module's
+ * config, and clients send it requests over a Unix domain socket
+ * (SOCK_SEQPACKET, so each request and response is one message).
+ *
+ * Requests are queued by priority, first come first served within a priority.
+ * A get for the same setting as one already queued or in flight is answered
+ * by the same round trip - N concurrent name queries are one query on the
+ * wire. Sets that can be chained (the name and configuration timer) are sent
+ * together in one command mode session, with a single store.
+ *
+ * Messages start with AT_BROKER_PROTOCOL_VERSION, and integers are 4 bytes,
+ * little endian:
+ *
+ *      request:  version, operation, setting, priority, id, value
+ *      response: version, status, id, value
+ *
+ * The id is chosen by the client and echoed back. The value is the string
+ * itself (unterminated, to the end of the message) for names, ids and
+ * versions, an integer for the baud rate and configuration timer, or
+ * AT_BROKER_STAT_COUNT integers in the order of AtCommanderBrokerStats for a
+ * stats request. Requests for a get have no value.
+ */
+
+#define AT_BROKER_PROTOCOL_VERSION 1
+#define AT_BROKER_REQUEST_HEADER_LENGTH 8
+#define AT_BROKER_RESPONSE_HEADER_LENGTH 6
+
+#ifndef AT_BROKER_MAX_VALUE_LENGTH
+#define AT_BROKER_MAX_VALUE_LENGTH 32
+#endif
+
+#define AT_BROKER_STAT_COUNT 9
+#define AT_BROKER_STATS_LENGTH (AT_BROKER_RESPONSE_HEADER_LENGTH + \
+        AT_BROKER_STAT_COUNT * 4)
+
+/* The longest message either way: a request or response carrying the longest
+ * value, or the stats reply - whichever is larger for the value length built.
+ */
+#define AT_BROKER_MAX(a, b) ((a) > (b) ? (a) : (b))
+#define AT_BROKER_MAX_MESSAGE_LENGTH AT_BROKER_MAX(AT_BROKER_MAX( \
+        AT_BROKER_REQUEST_HEADER_LENGTH + AT_BROKER_MAX_VALUE_LENGTH, \
+        AT_BROKER_RESPONSE_HEADER_LENGTH + AT_BROKER_MAX_VALUE_LENGTH), \
+        AT_BROKER_STATS_LENGTH)
+
+#ifndef AT_BROKER_MAX_QUEUE_LENGTH
+#define AT_BROKER_MAX_QUEUE_LENGTH 32
+#endif
+
+// Clients that can share the answer to one get.
+#ifndef AT_BROKER_MAX_WAITERS
+#define AT_BROKER_MAX_WAITERS 8
+#endif
+
+#ifndef AT_BROKER_MAX_CLIENTS
+#define AT_BROKER_MAX_CLIENTS 16
+#endif
+
+typedef enum {
+    AT_BROKER_GET = 1,
+    AT_BROKER_SET = 2,
+    AT_BROKER_STATS = 3
+} AtCommanderBrokerOperation;
+
+typedef enum {
+    AT_BROKER_NAME = 1,
+    AT_BROKER_SERIALIZED_NAME = 2,
+    AT_BROKER_DEVICE_ID = 3,
+    AT_BROKER_VERSION = 4,
+    AT_BROKER_BAUD = 5,
+    AT_BROKER_CONFIGURATION_TIMER = 6
+} AtCommanderBrokerSetting;
+
+typedef enum {
+    AT_BROKER_OK = 0,
+    AT_BROKER_FAILED = 1,
+    AT_BROKER_INVALID = 2,
+    AT_BROKER_BUSY = 3
+} AtCommanderBrokerStatus;
+
+/** Public: A client waiting for the answer to a request.
+ *
+ * submitted_us - when the request arrived, for the latency stats.
+ */
+typedef struct {
+    int client;
+    uint32_t id;
+    unsigned long long submitted_us;
+} AtCommanderBrokerWaiter;
+
+/** Public: A queued request, and every client waiting on it.
+ *
+ * sequence - the order the request arrived in, to break priority ties.
+ */
+typedef struct {
+    int operation;
+    int setting;
+    int priority;
+    unsigned long sequence;
+    char value[AT_BROKER_MAX_VALUE_LENGTH + 1];
+    int number;
+    AtCommanderBrokerWaiter waiters[AT_BROKER_MAX_WAITERS];
+    int waiter_count;
+} AtCommanderBrokerRequest;
+
+/** Public: The broker's counters, as reported to a stats request.
+ *
+ * queue_depth - requests waiting right now.
+ * max_queue_depth - the most requests ever waiting at once.
+ * requests - requests answered (not counting stats requests).
+ * round_trips - gets and batches of sets sent to the module.
+ * coalesced - requests answered by another request's round trip.
+ * batched - sets sent in the same session as another set.
+ * failures - requests answered with anything other than AT_BROKER_OK.
+ * average_latency_us, max_latency_us - from a request arriving to its answer.
+ */
+typedef struct {
+    unsigned long queue_depth;
+    unsigned long max_queue_depth;
+    unsigned long requests;
+    unsigned long round_trips;
+    unsigned long coalesced;
+    unsigned long batched;
+    unsigned long failures;
+    unsigned long average_latency_us;
+    unsigned long max_latency_us;
+} AtCommanderBrokerStats;
+
+/** Public: A broker for one module. Initialize with at_commander_broker_init.
+ *
+ * in_flight - the request being sent to the module, if any.
+ * path - the socket path, if listening, to remove when closed.
+ */
+typedef struct {
+    AtCommanderConfig* config;
+    AtCommanderBrokerRequest queue[AT_BROKER_MAX_QUEUE_LENGTH];
+    int queue_length;
+    unsigned long next_sequence;
+    AtCommanderBrokerRequest* in_flight;
+    AtCommanderBrokerStats stats;
+    unsigned long long total_latency_us;
+    int listen_fd;
+    char path[108];
+    int clients[AT_BROKER_MAX_CLIENTS];
+    int client_count;
+} AtCommanderBroker;
+
+/** Public: Set up a broker for a module.
+ *
+ *  config - the module's config, owned by the broker from here on.
+ */
+void at_commander_broker_init(AtCommanderBroker* broker,
+        AtCommanderConfig* config);
+
+/** Public: Accept clients on a Unix domain socket, replacing any stale socket
+ * at the path.
+ *
+ *  Returns false if the socket couldn't be created.
+ */
+bool at_commander_broker_listen(AtCommanderBroker* broker, const char* path);
+
+/** Public: Serve an already connected client, e.g. one end of a socketpair.
+ * The broker closes it when the client disconnects.
+ *
+ *  Returns false if the broker already has AT_BROKER_MAX_CLIENTS clients.
+ */
+bool at_commander_broker_add_client(AtCommanderBroker* broker, int fd);
+
+/** Public: Wait up to timeout_ms for requests, then answer everything queued.
+ * Call it in a loop.
+ *
+ *  Returns the number of requests answered, or -1 if waiting failed.
+ */
+int at_commander_broker_poll(AtCommanderBroker* broker, int timeout_ms);
+
+/** Public: Copy the broker's current stats.
+ */
+void at_commander_broker_stats(AtCommanderBroker* broker,
+        AtCommanderBrokerStats* stats);
+
+/** Public: Disconnect every client and stop listening.
+ */
+void at_commander_broker_close(AtCommanderBroker* broker);
+
+/** Public: Connect to a broker's socket.
+ *
+ *  Returns the connected fd, or -1 if the broker isn't listening.
+ */
+int at_commander_broker_connect(const char* path);
+
+/** Public: Send a request to a broker and wait for the answer.
+ *
+ *  value - the string to set, or NULL.
+ *  number - the number to set, if value is NULL.
+ *  response - a buffer for the string the module answered a get with, or
+ *      NULL.
+ *  response_length - the length of the buffer.
+ *
+ *  Returns the AtCommanderBrokerStatus, or -1 if the connection failed.
+ */
+int at_commander_broker_request(int fd, AtCommanderBrokerOperation operation,
+        AtCommanderBrokerSetting setting, int priority, const char* value,
+        int number, char* response, int response_length);
+
+/** Public: Ask a broker for its stats.
+ *
+ *  Returns false if the connection failed.
+ */
+bool at_commander_broker_get_stats(int fd, AtCommanderBrokerStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATBROKER_H_
@@ -0,0 +1,286 @@
+#include "atpublish.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Private: Copy the config's state into the owner's copy and, if anything
+ * changed, write it to the region under the seqlock.
+ */
+static void publish_state(AtCommanderPublisher* publisher) {
+    AtCommanderConfig* config = publisher->config;
+    AtCommanderPublishedRegion* region = publisher->region;
+    AtCommanderPublishedState* state = &publisher->state;
+    state->baud = config->baud;
+    state->device_baud = config->device_baud;
+    state->connected = config->connected;
+    state->circuit_open = config->breaker_open;
+    state->consecutive_failures = config->breaker_failures;
+
+    // The time alone isn't a change worth publishing
+    if(!memcmp(state, &region->state,
+                offsetof(AtCommanderPublishedState, updated_ms))) {
+        return;
+    }
+    if(config->millis_function != NULL) {
+        state->updated_ms = config->millis_function();
+    }
+
+    uint32_t sequence = region->sequence;
+    __atomic_store_n(&region->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&region->state, state, sizeof(*state));
+    __atomic_store_n(&region->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/** Private: Take the original lock to change the state.
+ */
+static void publish_begin(AtCommanderPublisher* publisher) {
+    if(publisher->lock_function != NULL) {
+        publisher->lock_function(publisher->device);
+    }
+    publisher->lock_depth++;
+}
+
+/** Private: Publish the state if this is the outermost lock, and release it.
+ */
+static void publish_end(AtCommanderPublisher* publisher) {
+    if(--publisher->lock_depth == 0) {
+        publish_state(publisher);
+    }
+    if(publisher->unlock_function != NULL) {
+        publisher->unlock_function(publisher->device);
+    }
+}
+
+static void publish_lock(void* device) {
+    AtCommanderPublisher* publisher = (AtCommanderPublisher*) device;
+    publish_begin(publisher);
+    if(publisher->lock_depth == 1) {
+        publisher->state.operations++;
+    }
+}
+
+static void publish_unlock(void* device) {
+    publish_end((AtCommanderPublisher*) device);
+}
+
+static void publish_write(void* device, uint8_t byte) {
+    AtCommanderPublisher* publisher = (AtCommanderPublisher*) device;
+    publisher->state.bytes_written++;
+    publisher->write_function(publisher->device, byte);
+}
+
+static int publish_read(void* device) {
+    AtCommanderPublisher* publisher = (AtCommanderPublisher*) device;
+    int byte = publisher->read_function(publisher->device);
+    if(byte != -1) {
+        publisher->state.bytes_read++;
+    }
+    return byte;
+}
+
+static const uint8_t* publish_peek(void* device, int* length) {
+    AtCommanderPublisher* publisher = (AtCommanderPublisher*) device;
+    return publisher->peek_function(publisher->device, length);
+}
+
+static void publish_consume(void* device, int count) {
+    AtCommanderPublisher* publisher = (AtCommanderPublisher*) device;
+    publisher->state.bytes_read += count;
+    publisher->consume_function(publisher->device, count);
+}
+
+static void publish_wait(void* device, unsigned long ms) {
+    AtCommanderPublisher* publisher = (AtCommanderPublisher*) device;
+    publisher->wait_function(publisher->device, ms);
+}
+
+static void publish_baud_rate_initializer(void* device, int baud) {
+    AtCommanderPublisher* publisher = (AtCommanderPublisher*) device;
+    publisher->state.baud_changes++;
+    if(publisher->baud_rate_initializer != NULL) {
+        publisher->baud_rate_initializer(publisher->device, baud);
+    }
+}
+
+bool at_commander_publish_start(AtCommanderConfig* config,
+        AtCommanderPublisher* publisher, const char* path) {
+    // Written beside the path and moved into place, so readers never see a
+    // half initialized file and any still mapping an old one keep it.
+    char temporary[PATH_MAX];
+    if(snprintf(temporary, sizeof(temporary), "%s.tmp", path) >=
+            (int)sizeof(temporary)) {
+        return false;
+    }
+
+    int fd = open(temporary, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        return false;
+    }
+    void* region = MAP_FAILED;
+    if(ftruncate(fd, sizeof(AtCommanderPublishedRegion)) == 0) {
+        region = mmap(NULL, sizeof(AtCommanderPublishedRegion),
+                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(region == MAP_FAILED) {
+        unlink(temporary);
+        return false;
+    }
+
+    at_commander_lock(config);
+    memset(publisher, 0, sizeof(*publisher));
+    publisher->config = config;
+    publisher->device = config->device;
+    publisher->baud_rate_initializer = config->baud_rate_initializer;
+    publisher->write_function = config->write_function;
+    publisher->read_function = config->read_function;
+    publisher->peek_function = config->peek_function;
+    publisher->consume_function = config->consume_function;
+    publisher->lock_function = config->lock_function;
+    publisher->unlock_function = config->unlock_function;
+    publisher->wait_function = config->wait_function;
+    publisher->region = (AtCommanderPublishedRegion*) region;
+    publisher->region->magic = AT_PUBLISH_MAGIC;
+    publisher->region->version = AT_PUBLISH_VERSION;
+    publisher->state.active = 1;
+    publish_state(publisher);
+
+    config->device = publisher;
+    config->baud_rate_initializer = publish_baud_rate_initializer;
+    config->write_function = publish_write;
+    config->read_function = publish_read;
+    if(config->peek_function != NULL) {
+        config->peek_function = publish_peek;
+        config->consume_function = publish_consume;
+    }
+    config->lock_function = publish_lock;
+    config->unlock_function = publish_unlock;
+    if(config->wait_function != NULL) {
+        config->wait_function = publish_wait;
+    }
+    // Locked through the original lock, so unlock the same way.
+    if(publisher->unlock_function != NULL) {
+        publisher->unlock_function(publisher->device);
+    }
+
+    if(rename(temporary, path) < 0) {
+        at_commander_publish_stop(publisher);
+        unlink(temporary);
+        return false;
+    }
+    return true;
+}
+
+void at_commander_publish_identity(AtCommanderPublisher* publisher,
+        const char* name, const char* device_id) {
+    publish_begin(publisher);
+    if(name != NULL) {
+        strncpy(publisher->state.name, name, sizeof(publisher->state.name));
+        publisher->state.name[sizeof(publisher->state.name) - 1] = '\0';
+    }
+    if(device_id != NULL) {
+        strncpy(publisher->state.device_id, device_id,
+                sizeof(publisher->state.device_id));
+        publisher->state.device_id[sizeof(publisher->state.device_id) - 1] =
+                '\0';
+    }
+    publish_end(publisher);
+}
+
+void at_commander_publish_error(AtCommanderPublisher* publisher,
+        const char* message) {
+    publish_begin(publisher);
+    AtCommanderPublishedState* state = &publisher->state;
+    strncpy(state->last_error, message, sizeof(state->last_error));
+    state->last_error[sizeof(state->last_error) - 1] = '\0';
+    state->errors++;
+    if(publisher->config->millis_function != NULL) {
+        state->last_error_ms = publisher->config->millis_function();
+    }
+    publish_end(publisher);
+}
+
+void at_commander_publish(AtCommanderPublisher* publisher) {
+    publish_begin(publisher);
+    publish_end(publisher);
+}
+
+void at_commander_publish_stop(AtCommanderPublisher* publisher) {
+    AtCommanderConfig* config = publisher->config;
+    publish_begin(publisher);
+    publisher->state.active = 0;
+    publish_state(publisher);
+    munmap(publisher->region, sizeof(AtCommanderPublishedRegion));
+
+    config->device = publisher->device;
+    config->baud_rate_initializer = publisher->baud_rate_initializer;
+    config->write_function = publisher->write_function;
+    config->read_function = publisher->read_function;
+    config->peek_function = publisher->peek_function;
+    config->consume_function = publisher->consume_function;
+    config->lock_function = publisher->lock_function;
+    config->unlock_function = publisher->unlock_function;
+    config->wait_function = publisher->wait_function;
+    at_commander_unlock(config);
+}
+
+const AtCommanderPublishedRegion* at_commander_published_open(
+        const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return NULL;
+    }
+
+    struct stat status;
+    void* region = MAP_FAILED;
+    if(fstat(fd, &status) == 0 &&
+            status.st_size >= (off_t)sizeof(AtCommanderPublishedRegion)) {
+        region = mmap(NULL, sizeof(AtCommanderPublishedRegion), PROT_READ,
+                MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(region == MAP_FAILED) {
+        return NULL;
+    }
+
+    const AtCommanderPublishedRegion* published =
+            (const AtCommanderPublishedRegion*) region;
+    if(published->magic != AT_PUBLISH_MAGIC ||
+            published->version != AT_PUBLISH_VERSION) {
+        at_commander_published_close(published);
+        return NULL;
+    }
+    return published;
+}
+
+bool at_commander_published_read(const AtCommanderPublishedRegion* region,
+        AtCommanderPublishedState* snapshot) {
+    int attempt;
+    for(attempt = 0; attempt < AT_PUBLISH_MAX_READ_ATTEMPTS; attempt++) {
+        uint32_t before = __atomic_load_n(&region->sequence, __ATOMIC_ACQUIRE);
+        if(before & 1) {
+            // Mid-update - let the writer finish if it's sharing our CPU
+            sched_yield();
+            continue;
+        }
+
+        memcpy(snapshot, (const void*) &region->state, sizeof(*snapshot));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&region->sequence, __ATOMIC_RELAXED) == before) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void at_commander_published_close(const AtCommanderPublishedRegion* region) {
+    munmap((void*) region, sizeof(AtCommanderPublishedRegion));
+}
@@ -0,0 +1,158 @@
+#ifndef _ATPUBLISH_H_
+#define _ATPUBLISH_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Published device state
+ *
+ * A publisher mirrors a config's state into a memory-mapped file, so
+ * monitoring tools in other processes can read it with plain loads - no
+ * UART traffic, no IPC and no system calls.
+ *
+ * Like a trace recorder, the publisher wraps the config's transport and lock
+ * callbacks. Whenever the outermost lock is released (i.e. after every public
+ * library call) the state is compared with what was last published, and
+ * written out only if it changed.
+ *
+ * Updates are guarded by a seqlock: the writer makes the sequence number odd,
+ * writes the state and makes it even again. Readers copy the state and retry
+ * if the sequence was odd or changed under them, so they always see a
+ * consistent snapshot and never block the writer.
+ */
+
+#define AT_PUBLISH_MAGIC 0x53505441 // "ATPS"
+#define AT_PUBLISH_VERSION 1
+
+// Reads of a snapshot before giving up on a writer that's stuck mid-update,
+// e.g. because it crashed.
+#ifndef AT_PUBLISH_MAX_READ_ATTEMPTS
+#define AT_PUBLISH_MAX_READ_ATTEMPTS 1000
+#endif
+
+/** Public: A snapshot of a device's state, as laid out in the file.
+ *
+ * active - 1 while the owner is publishing, 0 once it has stopped.
+ * name, device_id - the identity last given to at_commander_publish_identity.
+ * consecutive_failures, circuit_open - from the config's circuit breaker.
+ * last_error - the error last given to at_commander_publish_error, and when.
+ * operations - library calls made (outermost locks released).
+ * updated_ms - when the state was last published, from the config's clock.
+ */
+typedef struct {
+    int32_t baud;
+    int32_t device_baud;
+    uint8_t active;
+    uint8_t connected;
+    uint8_t circuit_open;
+    uint8_t reserved;
+    int32_t consecutive_failures;
+    char name[21];
+    char device_id[13];
+    char last_error[38];
+    uint64_t last_error_ms;
+    uint64_t errors;
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+    uint64_t baud_changes;
+    uint64_t operations;
+    uint64_t updated_ms;
+} AtCommanderPublishedState;
+
+/** Public: The whole memory-mapped file.
+ *
+ * sequence - odd while the state is being written.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;
+    uint32_t reserved;
+    AtCommanderPublishedState state;
+} AtCommanderPublishedRegion;
+
+/** Public: Publishes a config's state. Start with at_commander_publish_start.
+ *
+ * While publishing, the config's callbacks and device point at the publisher,
+ * which holds the originals. Stop publishers and trace recorders in the
+ * reverse order they were started.
+ *
+ * state - the owner's copy of the state, published when it differs from the
+ *      region.
+ */
+typedef struct {
+    AtCommanderConfig* config;
+    void* device;
+    void (*baud_rate_initializer)(void* device, int);
+    void (*write_function)(void* device, uint8_t);
+    int (*read_function)(void* device);
+    const uint8_t* (*peek_function)(void* device, int* length);
+    void (*consume_function)(void* device, int count);
+    void (*lock_function)(void* device);
+    void (*unlock_function)(void* device);
+    void (*wait_function)(void* device, unsigned long ms);
+
+    AtCommanderPublishedRegion* region;
+    AtCommanderPublishedState state;
+    int lock_depth;
+} AtCommanderPublisher;
+
+/** Public: Start mirroring a config's state to a file, creating or replacing
+ * it.
+ *
+ *  path - e.g. "/run/atcommander/ttyUSB0.state", or a file in /dev/shm.
+ *
+ *  Returns false if the file couldn't be created and mapped.
+ */
+bool at_commander_publish_start(AtCommanderConfig* config,
+        AtCommanderPublisher* publisher, const char* path);
+
+/** Public: Publish the device's identity, e.g. after reading it with
+ * at_commander_get_name and at_commander_get_device_id. Either may be NULL to
+ * leave it unchanged.
+ */
+void at_commander_publish_identity(AtCommanderPublisher* publisher,
+        const char* name, const char* device_id);
+
+/** Public: Publish an error the owner ran into, e.g. a failed set.
+ */
+void at_commander_publish_error(AtCommanderPublisher* publisher,
+        const char* message);
+
+/** Public: Publish the config's state now, e.g. after changing its fields
+ * directly. Library calls publish automatically.
+ */
+void at_commander_publish(AtCommanderPublisher* publisher);
+
+/** Public: Mark the state inactive, unmap the file and restore the config's
+ * original callbacks. The file is left for readers to see the final state.
+ */
+void at_commander_publish_stop(AtCommanderPublisher* publisher);
+
+/** Public: Map a published state file for reading.
+ *
+ *  Returns the region, or NULL if the file isn't a published state.
+ */
+const AtCommanderPublishedRegion* at_commander_published_open(
+        const char* path);
+
+/** Public: Take a consistent snapshot of a published state.
+ *
+ *  Returns false if the writer stayed mid-update for
+ *  AT_PUBLISH_MAX_READ_ATTEMPTS reads.
+ */
+bool at_commander_published_read(const AtCommanderPublishedRegion* region,
+        AtCommanderPublishedState* snapshot);
+
+/** Public: Unmap a published state file.
+ */
+void at_commander_published_close(const AtCommanderPublishedRegion* region);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATPUBLISH_H_
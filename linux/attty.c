@@ -0,0 +1,130 @@
+#include "attty.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Private: Map a baud rate to its termios speed.
+ *
+ * Returns the speed, or B0 if the rate isn't supported.
+ */
+speed_t tty_speed(int baud) {
+    switch(baud) {
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+#ifdef B460800
+        case 460800: return B460800;
+#endif
+#ifdef B921600
+        case 921600: return B921600;
+#endif
+    }
+    return B0;
+}
+
+/** Private: Set the tty's baud rate. Silently does nothing for an fd that
+ * isn't a tty (e.g. a socket in a test).
+ */
+void tty_baud_rate_initializer(void* device, int baud) {
+    AtCommanderTty* tty = (AtCommanderTty*) device;
+    struct termios attributes;
+    speed_t speed = tty_speed(baud);
+    if(speed != B0 && tcgetattr(tty->fd, &attributes) == 0) {
+        cfsetispeed(&attributes, speed);
+        cfsetospeed(&attributes, speed);
+        tcsetattr(tty->fd, TCSADRAIN, &attributes);
+    }
+}
+
+void tty_write(void* device, uint8_t byte) {
+    AtCommanderTty* tty = (AtCommanderTty*) device;
+    while(write(tty->fd, &byte, 1) < 0 &&
+            (errno == EINTR || errno == EAGAIN)) {
+        if(errno == EAGAIN) {
+            usleep(100);
+        }
+    }
+}
+
+int tty_read(void* device) {
+    AtCommanderTty* tty = (AtCommanderTty*) device;
+    uint8_t byte;
+    if(read(tty->fd, &byte, 1) == 1) {
+        return byte;
+    }
+    return -1;
+}
+
+void tty_delay(unsigned long ms) {
+    usleep(ms * 1000);
+}
+
+/** Private: Sleep until the tty has data to read, or the time is up.
+ */
+void tty_wait(void* device, unsigned long ms) {
+    AtCommanderTty* tty = (AtCommanderTty*) device;
+    struct pollfd fd = { tty->fd, POLLIN, 0 };
+    poll(&fd, 1, (int) ms);
+}
+
+unsigned long at_commander_tty_millis(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+}
+
+bool at_commander_tty_open(AtCommanderTty* tty, const char* path) {
+    struct termios attributes;
+    tty->fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(tty->fd < 0) {
+        return false;
+    }
+
+    if(tcgetattr(tty->fd, &attributes) == 0) {
+        cfmakeraw(&attributes);
+        attributes.c_cflag |= CLOCAL | CREAD;
+        tcsetattr(tty->fd, TCSANOW, &attributes);
+    }
+    return true;
+}
+
+void at_commander_tty_config(AtCommanderConfig* config, AtCommanderTty* tty) {
+    config->device = tty;
+    config->baud_rate_initializer = tty_baud_rate_initializer;
+    config->write_function = tty_write;
+    config->read_function = tty_read;
+    config->delay_function = tty_delay;
+    config->wait_function = tty_wait;
+    config->millis_function = at_commander_tty_millis;
+}
+
+bool at_commander_tty_set_flow_control(AtCommanderTty* tty, bool enabled) {
+    struct termios attributes;
+    if(tcgetattr(tty->fd, &attributes) < 0) {
+        return false;
+    }
+
+    if(enabled) {
+        attributes.c_cflag |= CRTSCTS;
+    } else {
+        attributes.c_cflag &= ~CRTSCTS;
+    }
+    return tcsetattr(tty->fd, TCSADRAIN, &attributes) == 0;
+}
+
+void at_commander_tty_close(AtCommanderTty* tty) {
+    if(tty->fd >= 0) {
+        close(tty->fd);
+        tty->fd = -1;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef _ATTTY_H_
+#define _ATTTY_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Public: A module attached to a Linux tty (or any other fd).
+ *
+ * fd - the open, non-blocking file descriptor for the module.
+ */
+typedef struct {
+    int fd;
+} AtCommanderTty;
+
+/** Public: Open a tty for a module, in raw mode and non-blocking.
+ *
+ *  path - e.g. "/dev/ttyUSB0".
+ *
+ *  Returns false if the tty couldn't be opened.
+ */
+bool at_commander_tty_open(AtCommanderTty* tty, const char* path);
+
+/** Public: Point a config's transport, delay and clock callbacks at a tty.
+ *
+ * Waits for a reply sleep in poll() until the tty has data, rather than for a
+ * fixed delay.
+ *
+ * The tty must already be open (or tty->fd set), and outlive the config.
+ */
+void at_commander_tty_config(AtCommanderConfig* config, AtCommanderTty* tty);
+
+/** Public: Turn RTS/CTS hardware flow control on or off.
+ *
+ *  Returns false if the fd isn't a tty or the setting couldn't be changed.
+ */
+bool at_commander_tty_set_flow_control(AtCommanderTty* tty, bool enabled);
+
+/** Public: Close the tty.
+ */
+void at_commander_tty_close(AtCommanderTty* tty);
+
+/** Public: Returns a monotonic clock in ms, for a config's millis_function.
+ */
+unsigned long at_commander_tty_millis(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATTTY_H_
@@ -0,0 +1,48 @@
+#include "atwakeup.h"
+
+#include <errno.h>
+#include <time.h>
+
+void at_commander_wakeup_init(AtCommanderWakeup* wakeup) {
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&wakeup->arrived, &attributes);
+    pthread_condattr_destroy(&attributes);
+    pthread_mutex_init(&wakeup->mutex, NULL);
+    wakeup->pending = false;
+}
+
+void at_commander_wakeup_notify(AtCommanderWakeup* wakeup) {
+    pthread_mutex_lock(&wakeup->mutex);
+    wakeup->pending = true;
+    pthread_cond_signal(&wakeup->arrived);
+    pthread_mutex_unlock(&wakeup->mutex);
+}
+
+bool at_commander_wakeup_wait(AtCommanderWakeup* wakeup, unsigned long ms) {
+    struct timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += ms / 1000;
+    until.tv_nsec += (ms % 1000) * 1000000L;
+    if(until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&wakeup->mutex);
+    int result = 0;
+    while(!wakeup->pending && result != ETIMEDOUT) {
+        result = pthread_cond_timedwait(&wakeup->arrived, &wakeup->mutex,
+                &until);
+    }
+    bool notified = wakeup->pending;
+    wakeup->pending = false;
+    pthread_mutex_unlock(&wakeup->mutex);
+    return notified;
+}
+
+void at_commander_wakeup_destroy(AtCommanderWakeup* wakeup) {
+    pthread_cond_destroy(&wakeup->arrived);
+    pthread_mutex_destroy(&wakeup->mutex);
+}
@@ -0,0 +1,63 @@
+#ifndef _ATWAKEUP_H_
+#define _ATWAKEUP_H_
+
+#include "atcommander.h"
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Receive wakeups
+ *
+ * For transports fed by another thread (e.g. a reader thread, or a simulated
+ * device), a condition variable that the feeding thread notifies as bytes
+ * arrive, and a config's wait_function sleeps on - so waiting for a reply
+ * costs no CPU and ends as soon as it arrives. Notifications latch, so one
+ * sent between a read finding nothing and the wait starting isn't lost.
+ *
+ * The wait_function is then a few lines for the transport's own device type:
+ *
+ *      void wait_for_data(void* device, unsigned long ms) {
+ *          MyDevice* my_device = (MyDevice*) device;
+ *          if(!my_device_has_data(my_device)) {
+ *              at_commander_wakeup_wait(&my_device->wakeup, ms);
+ *          }
+ *      }
+ */
+
+/** Public: A receive wakeup. Initialize with at_commander_wakeup_init.
+ *
+ * pending - a notification hasn't been waited for yet.
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t arrived;
+    bool pending;
+} AtCommanderWakeup;
+
+/** Public: Initialize a wakeup, timing waits with the monotonic clock.
+ */
+void at_commander_wakeup_init(AtCommanderWakeup* wakeup);
+
+/** Public: Wake the waiting thread (or the next to wait), e.g. after adding
+ * received bytes to the transport's buffer.
+ */
+void at_commander_wakeup_notify(AtCommanderWakeup* wakeup);
+
+/** Public: Sleep until notified or the time is up.
+ *
+ *  Returns true if notified.
+ */
+bool at_commander_wakeup_wait(AtCommanderWakeup* wakeup, unsigned long ms);
+
+/** Public: Release a wakeup's mutex and condition variable.
+ */
+void at_commander_wakeup_destroy(AtCommanderWakeup* wakeup);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATWAKEUP_H_
@@ -0,0 +1,117 @@
+/* Send one request to a running atbrokerd and print the answer.
+ *
+ *      atbrokerctl [-p priority] socket get name|id|version
+ *      atbrokerctl [-p priority] socket set name|serialized-name VALUE
+ *      atbrokerctl [-p priority] socket set baud|timer NUMBER
+ *      atbrokerctl socket stats
+ */
+#include "atbroker.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char* const SETTING_NAMES[] = { NULL, "name", "serialized-name",
+    "id", "version", "baud", "timer" };
+
+static const char* const STATUS_NAMES[] = { "ok", "failed", "invalid request",
+    "busy" };
+
+static void usage() {
+    fprintf(stderr, "usage: atbrokerctl [-p priority] socket "
+            "get|set|stats [setting] [value]\n");
+}
+
+static int find_setting(const char* name) {
+    int setting;
+    for(setting = AT_BROKER_NAME; setting <= AT_BROKER_CONFIGURATION_TIMER;
+            setting++) {
+        if(!strcmp(name, SETTING_NAMES[setting])) {
+            return setting;
+        }
+    }
+    return -1;
+}
+
+static int print_stats(int fd) {
+    AtCommanderBrokerStats stats;
+    if(!at_commander_broker_get_stats(fd, &stats)) {
+        fprintf(stderr, "atbrokerctl: no answer from the broker\n");
+        return 1;
+    }
+    printf("queue depth:     %lu (max %lu)\n", stats.queue_depth,
+            stats.max_queue_depth);
+    printf("requests:        %lu (%lu failed)\n", stats.requests,
+            stats.failures);
+    printf("round trips:     %lu\n", stats.round_trips);
+    printf("coalesced:       %lu\n", stats.coalesced);
+    printf("batched sets:    %lu\n", stats.batched);
+    printf("latency:         %lu us average, %lu us max\n",
+            stats.average_latency_us, stats.max_latency_us);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int priority = 0;
+    int argument = 1;
+    if(argc > 2 && !strcmp(argv[1], "-p")) {
+        priority = atoi(argv[2]);
+        argument = 3;
+    }
+    if(argc - argument < 2) {
+        usage();
+        return 2;
+    }
+
+    const char* operation = argv[argument + 1];
+    bool get = !strcmp(operation, "get");
+    bool set = !strcmp(operation, "set");
+    int setting = argc - argument > 2 ? find_setting(argv[argument + 2]) : -1;
+    if(!strcmp(operation, "stats") ? argc - argument != 2 :
+            setting < 0 || (get && argc - argument != 3) ||
+            (set && argc - argument != 4) || (!get && !set)) {
+        usage();
+        return 2;
+    }
+
+    int fd = at_commander_broker_connect(argv[argument]);
+    if(fd < 0) {
+        perror(argv[argument]);
+        return 1;
+    }
+    if(!get && !set) {
+        int status = print_stats(fd);
+        close(fd);
+        return status;
+    }
+
+    const char* value = NULL;
+    int number = 0;
+    if(set && (setting == AT_BROKER_BAUD ||
+                setting == AT_BROKER_CONFIGURATION_TIMER)) {
+        number = atoi(argv[argument + 3]);
+    } else if(set) {
+        value = argv[argument + 3];
+    }
+
+    char response[AT_BROKER_MAX_VALUE_LENGTH + 1];
+    int status = at_commander_broker_request(fd,
+            get ? AT_BROKER_GET : AT_BROKER_SET,
+            (AtCommanderBrokerSetting) setting, priority, value, number,
+            response, sizeof(response));
+    close(fd);
+    if(status < 0) {
+        fprintf(stderr, "atbrokerctl: no answer from the broker\n");
+        return 1;
+    } else if(status != AT_BROKER_OK) {
+        fprintf(stderr, "atbrokerctl: %s\n", status <= AT_BROKER_BUSY ?
+                STATUS_NAMES[status] : "unknown error");
+        return 1;
+    }
+
+    if(get) {
+        printf("%s\n", response);
+    }
+    return 0;
+}
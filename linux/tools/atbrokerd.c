@@ -0,0 +1,121 @@
+/* Share a module between processes - own its tty and answer requests from
+ * clients (e.g. atbrokerctl) on a Unix domain socket until interrupted.
+ *
+ *      atbrokerd [-x] [-b baud] [-s state] [-v] /dev/ttyUSB0 \
+ *              /run/atcommander.sock
+ *
+ * -x - the module is an XBee rather than an RN-42.
+ * -b - the baud rate the module is expected to be at (default 9600).
+ * -s - also publish the module's state to this file, for atstate.
+ * -v - log the library's debug messages to stderr.
+ */
+#include "atbroker.h"
+#include "atpublish.h"
+#include "attty.h"
+
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int signal) {
+    running = 0;
+}
+
+static void log_to_stderr(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: atbrokerd [-x] [-b baud] [-s state] [-v] tty "
+            "socket\n");
+}
+
+int main(int argc, char** argv) {
+    AtCommanderConfig config;
+    memset(&config, 0, sizeof(config));
+    config.platform = AT_PLATFORM_RN42;
+    config.baud = 9600;
+
+    const char* state_path = NULL;
+    int argument = 1;
+    for(; argument < argc && argv[argument][0] == '-'; argument++) {
+        if(!strcmp(argv[argument], "-x")) {
+            config.platform = AT_PLATFORM_XBEE;
+        } else if(!strcmp(argv[argument], "-v")) {
+            config.log_function = log_to_stderr;
+        } else if(!strcmp(argv[argument], "-b") && argument + 1 < argc) {
+            config.baud = atoi(argv[++argument]);
+        } else if(!strcmp(argv[argument], "-s") && argument + 1 < argc) {
+            state_path = argv[++argument];
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if(argc - argument != 2) {
+        usage();
+        return 2;
+    }
+    config.device_baud = config.baud;
+
+    AtCommanderTty tty;
+    if(!at_commander_tty_open(&tty, argv[argument])) {
+        perror(argv[argument]);
+        return 1;
+    }
+    at_commander_tty_config(&config, &tty);
+
+    AtCommanderPublisher publisher;
+    if(state_path != NULL &&
+            !at_commander_publish_start(&config, &publisher, state_path)) {
+        perror(state_path);
+        at_commander_tty_close(&tty);
+        return 1;
+    }
+
+    AtCommanderBroker broker;
+    at_commander_broker_init(&broker, &config);
+    if(!at_commander_broker_listen(&broker, argv[argument + 1])) {
+        perror(argv[argument + 1]);
+        if(state_path != NULL) {
+            at_commander_publish_stop(&publisher);
+        }
+        at_commander_tty_close(&tty);
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    int status = 0;
+    while(running) {
+        if(at_commander_broker_poll(&broker, 1000) < 0) {
+            perror("poll");
+            status = 1;
+            break;
+        }
+    }
+
+    AtCommanderBrokerStats stats;
+    at_commander_broker_stats(&broker, &stats);
+    fprintf(stderr, "%lu requests in %lu round trips, %lu us average "
+            "latency\n", stats.requests, stats.round_trips,
+            stats.average_latency_us);
+    at_commander_broker_close(&broker);
+    if(state_path != NULL) {
+        at_commander_publish_stop(&publisher);
+    }
+    at_commander_tty_close(&tty);
+    return status;
+}
@@ -0,0 +1,116 @@
+/* Move a module to a new baud rate and check the link holds at it, before
+ * putting a board into service - e.g. that 921600 actually works on it.
+ *
+ *      atlinkcheck [-x] [-b baud] [-n bytes] [-v] /dev/ttyUSB0 921600
+ *
+ * The module is switched to the new rate with at_commander_switch_baud, then a
+ * known pattern is pushed through the data mode link with and without RTS/CTS
+ * flow control. The far end of the link must echo what it receives (e.g. a
+ * loopback on the peer module's UART).
+ *
+ * -x - the module is an XBee rather than an RN-42.
+ * -b - the baud rate the module is expected to be at now (default 9600).
+ * -n - the number of bytes to send for each check (default 65536).
+ * -v - log the library's debug messages to stderr.
+ *
+ * Exits with 1 if the module couldn't be switched, or the link had errors
+ * both with and without flow control.
+ */
+#include "atcommander.h"
+#include "attty.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THROUGHPUT_TIMEOUT_MS 2000
+
+static void log_to_stderr(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: atlinkcheck [-x] [-b baud] [-n bytes] [-v] tty "
+            "baud\n");
+}
+
+/* Returns true if the link had no errors.
+ */
+static bool check_link(AtCommanderConfig* config, AtCommanderTty* tty,
+        bool flow_control, int length, int baud) {
+    AtCommanderThroughput result;
+    const char* mode = flow_control ? "with RTS/CTS" : "without RTS/CTS";
+    if(!at_commander_tty_set_flow_control(tty, flow_control)) {
+        printf("%-16s unable to set flow control\n", mode);
+        return false;
+    } else if(!at_commander_check_throughput(config, length,
+                THROUGHPUT_TIMEOUT_MS, &result)) {
+        printf("%-16s unable to run the check\n", mode);
+        return false;
+    }
+
+    // 10 bits on the wire per byte, with a start and stop bit
+    unsigned long line_rate = baud / 10;
+    printf("%-16s %lu bytes/s (%.0f%% of %lu), %d of %d bytes back, "
+            "error rate %.4f%%\n", mode, result.bytes_per_second,
+            100.0 * result.bytes_per_second / line_rate, line_rate,
+            result.bytes_received, result.bytes_sent,
+            100.0 * result.errors / result.bytes_sent);
+    return result.errors == 0;
+}
+
+int main(int argc, char** argv) {
+    AtCommanderConfig config;
+    memset(&config, 0, sizeof(config));
+    config.platform = AT_PLATFORM_RN42;
+    config.baud = 9600;
+
+    int length = 65536;
+    int argument = 1;
+    for(; argument < argc && argv[argument][0] == '-'; argument++) {
+        if(!strcmp(argv[argument], "-x")) {
+            config.platform = AT_PLATFORM_XBEE;
+        } else if(!strcmp(argv[argument], "-v")) {
+            config.log_function = log_to_stderr;
+        } else if(!strcmp(argv[argument], "-b") && argument + 1 < argc) {
+            config.baud = atoi(argv[++argument]);
+        } else if(!strcmp(argv[argument], "-n") && argument + 1 < argc) {
+            length = atoi(argv[++argument]);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if(argc - argument != 2 || length <= 0) {
+        usage();
+        return 2;
+    }
+    config.device_baud = config.baud;
+    int baud = atoi(argv[argument + 1]);
+
+    AtCommanderTty tty;
+    if(!at_commander_tty_open(&tty, argv[argument])) {
+        perror(argv[argument]);
+        return 1;
+    }
+    at_commander_tty_config(&config, &tty);
+
+    unsigned long started_ms = at_commander_tty_millis();
+    if(!at_commander_switch_baud(&config, baud)) {
+        fprintf(stderr, "Unable to switch the module to %d baud\n", baud);
+        at_commander_tty_close(&tty);
+        return 1;
+    }
+    printf("switched to %d baud in %lu ms\n", baud,
+            at_commander_tty_millis() - started_ms);
+
+    bool without = check_link(&config, &tty, false, length, baud);
+    bool with = check_link(&config, &tty, true, length, baud);
+    at_commander_tty_close(&tty);
+    return without || with ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+/* Print a module's state as published by its owner with
+ * at_commander_publish_start, without touching the module or the owner.
+ *
+ *      atstate /dev/shm/ttyUSB0.state
+ *      atstate -w 1000 /dev/shm/ttyUSB0.state
+ *
+ * -w - keep printing the state every this many ms.
+ */
+#include "atpublish.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage() {
+    fprintf(stderr, "usage: atstate [-w interval_ms] state_file\n");
+}
+
+static void print_state(const AtCommanderPublishedState* state) {
+    printf("owner:           %s\n", state->active ? "publishing" : "stopped");
+    printf("name:            %s\n", state->name);
+    printf("device id:       %s\n", state->device_id);
+    printf("baud:            %d (device %d)\n", state->baud,
+            state->device_baud);
+    printf("command mode:    %s\n", state->connected ? "yes" : "no");
+    printf("circuit:         %s (%d consecutive failures)\n",
+            state->circuit_open ? "open" : "closed",
+            state->consecutive_failures);
+    printf("errors:          %llu", (unsigned long long)state->errors);
+    if(state->errors > 0) {
+        printf(", last at %llu ms: %s", (unsigned long long)
+                state->last_error_ms, state->last_error);
+    }
+    printf("\noperations:      %llu\n", (unsigned long long)state->operations);
+    printf("bytes:           %llu written, %llu read\n",
+            (unsigned long long)state->bytes_written,
+            (unsigned long long)state->bytes_read);
+    printf("baud changes:    %llu\n", (unsigned long long)state->baud_changes);
+    printf("updated:         %llu ms\n", (unsigned long long)state->updated_ms);
+}
+
+int main(int argc, char** argv) {
+    int interval_ms = 0;
+    int argument = 1;
+    if(argc > 2 && !strcmp(argv[1], "-w")) {
+        interval_ms = atoi(argv[2]);
+        argument = 3;
+    }
+    if(argc - argument != 1) {
+        usage();
+        return 2;
+    }
+
+    const AtCommanderPublishedRegion* region =
+            at_commander_published_open(argv[argument]);
+    if(region == NULL) {
+        fprintf(stderr, "%s: not a published state file\n", argv[argument]);
+        return 1;
+    }
+
+    AtCommanderPublishedState state;
+    do {
+        if(!at_commander_published_read(region, &state)) {
+            fprintf(stderr, "%s: owner is stuck mid-update\n",
+                    argv[argument]);
+            at_commander_published_close(region);
+            return 1;
+        }
+        print_state(&state);
+        if(interval_ms > 0) {
+            printf("\n");
+            fflush(stdout);
+            usleep(interval_ms * 1000);
+        }
+    } while(interval_ms > 0);
+
+    at_commander_published_close(region);
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include "LPC17xx.h"
+#include "lpc17xx_uart.h"
+#include "lpc17xx_gpdma.h"
+#include "lpc_types.h"
+
+#include "uartdma.h"
+
+#define UART1_DEVICE (LPC_UART_TypeDef*)LPC_UART1
+
+#define TX_CHANNEL 0
+#define RX_CHANNEL 1
+#define RX_CHANNEL_REGISTERS LPC_GPDMACH1
+#define TRANSFER_SIZE_MASK 0xfff
+
+#define TICKS_PER_SECOND 1000
+#define IDLE_TICKS 2
+
+static AtCommanderDmaUart uart;
+static bool dmaStarted;
+static bool tickStarted;
+static volatile unsigned long tickCount;
+
+// Points back at itself, so the receive channel wraps around the buffer
+// without the CPU having to restart it.
+static GPDMA_LLI_Type receiveItem;
+
+/* The core's transmit and receive state is shared with the DMA and SysTick
+ * interrupts, so is only touched from the main loop with them held off.
+ */
+#define BEGIN_CRITICAL() __disable_irq()
+#define END_CRITICAL() __enable_irq()
+
+static void startTransmit(void* context, const uint8_t* data, int length) {
+    GPDMA_Channel_CFG_Type channelConfig;
+    channelConfig.ChannelNum = TX_CHANNEL;
+    channelConfig.TransferSize = length;
+    channelConfig.TransferWidth = 0;
+    channelConfig.SrcMemAddr = (uint32_t) data;
+    channelConfig.DstMemAddr = 0;
+    channelConfig.TransferType = GPDMA_TRANSFERTYPE_M2P;
+    channelConfig.SrcConn = 0;
+    channelConfig.DstConn = GPDMA_CONN_UART1_Tx;
+    channelConfig.DMALLI = 0;
+    GPDMA_Setup(&channelConfig);
+    GPDMA_ChannelCmd(TX_CHANNEL, ENABLE);
+}
+
+static int receiveRemaining(void* context) {
+    return RX_CHANNEL_REGISTERS->DMACCControl & TRANSFER_SIZE_MASK;
+}
+
+static void startReceive() {
+    receiveItem.SrcAddr = (uint32_t) &LPC_UART1->RBR;
+    receiveItem.DstAddr = (uint32_t) uart.rx_buffer;
+    receiveItem.NextLLI = (uint32_t) &receiveItem;
+    receiveItem.Control = GPDMA_DMACCxControl_TransferSize(
+            AT_DMA_RX_BUFFER_SIZE) | GPDMA_DMACCxControl_DI;
+
+    GPDMA_Channel_CFG_Type channelConfig;
+    channelConfig.ChannelNum = RX_CHANNEL;
+    channelConfig.TransferSize = AT_DMA_RX_BUFFER_SIZE;
+    channelConfig.TransferWidth = 0;
+    channelConfig.SrcMemAddr = 0;
+    channelConfig.DstMemAddr = (uint32_t) uart.rx_buffer;
+    channelConfig.TransferType = GPDMA_TRANSFERTYPE_P2M;
+    channelConfig.SrcConn = GPDMA_CONN_UART1_Rx;
+    channelConfig.DstConn = 0;
+    channelConfig.DMALLI = (uint32_t) &receiveItem;
+    GPDMA_Setup(&channelConfig);
+    GPDMA_ChannelCmd(RX_CHANNEL, ENABLE);
+}
+
+void DMA_IRQHandler() {
+    if(GPDMA_IntGetStatus(GPDMA_STAT_INTTC, TX_CHANNEL)) {
+        GPDMA_ClearIntPending(GPDMA_STATCLR_INTTC, TX_CHANNEL);
+        at_commander_dma_transmit_complete(&uart);
+    }
+    if(GPDMA_IntGetStatus(GPDMA_STAT_INTERR, TX_CHANNEL)) {
+        GPDMA_ClearIntPending(GPDMA_STATCLR_INTERR, TX_CHANNEL);
+        at_commander_dma_transmit_complete(&uart);
+    }
+
+    // Each lap of the receive buffer - the position is polled instead
+    if(GPDMA_IntGetStatus(GPDMA_STAT_INTTC, RX_CHANNEL)) {
+        GPDMA_ClearIntPending(GPDMA_STATCLR_INTTC, RX_CHANNEL);
+    }
+    if(GPDMA_IntGetStatus(GPDMA_STAT_INTERR, RX_CHANNEL)) {
+        GPDMA_ClearIntPending(GPDMA_STATCLR_INTERR, RX_CHANNEL);
+    }
+}
+
+void SysTick_Handler() {
+    tickCount++;
+    if(dmaStarted) {
+        at_commander_dma_poll(&uart);
+    }
+}
+
+void configureTick() {
+    if(!tickStarted) {
+        SysTick_Config(SystemCoreClock / TICKS_PER_SECOND);
+        tickStarted = true;
+    }
+}
+
+void configureUartDma(void* device, int baud) {
+    if(dmaStarted) {
+        // Let anything queued go out at the old baud rate first
+        while(true) {
+            BEGIN_CRITICAL();
+            bool idle = at_commander_dma_transmit_idle(&uart);
+            END_CRITICAL();
+            if(idle) {
+                break;
+            }
+        }
+    }
+
+    UART_CFG_Type UARTConfigStruct;
+    UART_ConfigStructInit(&UARTConfigStruct);
+    UARTConfigStruct.Baud_rate = baud;
+    UART_Init(UART1_DEVICE, &UARTConfigStruct);
+
+    // Request DMA for every byte, rather than interrupting to drain the FIFO
+    UART_FIFO_CFG_Type fifoConfig;
+    UART_FIFOConfigStructInit(&fifoConfig);
+    fifoConfig.FIFO_DMAMode = ENABLE;
+    fifoConfig.FIFO_Level = UART_FIFO_TRIGGER_LEV0;
+    UART_FIFOConfig(UART1_DEVICE, &fifoConfig);
+
+    UART_FullModemConfigMode(LPC_UART1, UART1_MODEM_MODE_AUTO_RTS, ENABLE);
+    UART_FullModemConfigMode(LPC_UART1, UART1_MODEM_MODE_AUTO_CTS, ENABLE);
+
+    UART_TxCmd(UART1_DEVICE, ENABLE);
+
+    if(!dmaStarted) {
+        at_commander_dma_uart_init(&uart, startTransmit, receiveRemaining,
+                NULL, IDLE_TICKS);
+        GPDMA_Init();
+        /* preemption = 1, sub-priority = 1 */
+        NVIC_SetPriority(DMA_IRQn, ((0x01<<3)|0x01));
+        NVIC_EnableIRQ(DMA_IRQn);
+        startReceive();
+        configureTick();
+        dmaStarted = true;
+    }
+}
+
+void writeByteDma(void* device, uint8_t byte) {
+    bool queued = false;
+    while(!queued) {
+        BEGIN_CRITICAL();
+        queued = at_commander_dma_write(&uart, byte);
+        END_CRITICAL();
+    }
+}
+
+int readByteDma(void* device) {
+    BEGIN_CRITICAL();
+    int byte = at_commander_dma_read(&uart);
+    END_CRITICAL();
+    return byte;
+}
+
+const uint8_t* peekDma(void* device, int* length) {
+    BEGIN_CRITICAL();
+    const uint8_t* bytes = at_commander_dma_peek(&uart, length);
+    END_CRITICAL();
+    return bytes;
+}
+
+void consumeDma(void* device, int count) {
+    BEGIN_CRITICAL();
+    at_commander_dma_consume(&uart, count);
+    END_CRITICAL();
+}
+
+unsigned long millisDma() {
+    return tickCount;
+}
+
+void sleepMs(unsigned long ms) {
+    unsigned long started = tickCount;
+    while(tickCount - started < ms) {
+        __WFI();
+    }
+}
+
+void waitForReceiveDma(void* device, unsigned long ms) {
+    if(!dmaStarted) {
+        sleepMs(ms);
+        return;
+    }
+
+    unsigned long started = tickCount;
+    while(tickCount - started < ms) {
+        BEGIN_CRITICAL();
+        int available = at_commander_dma_available(&uart);
+        END_CRITICAL();
+        if(available > 0) {
+            break;
+        }
+        // Bytes that land just before sleeping are seen on the next tick
+        __WFI();
+    }
+}
+
+bool receiveIdleDma() {
+    BEGIN_CRITICAL();
+    bool idle = at_commander_dma_take_idle(&uart);
+    END_CRITICAL();
+    return idle;
+}
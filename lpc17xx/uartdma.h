@@ -0,0 +1,47 @@
+#ifndef _UARTDMA_H_
+#define _UARTDMA_H_
+
+#include "atdma.h"
+
+/* A UART1 driver that moves data with the GPDMA controller - channel 0
+ * transmits from double buffers, channel 1 receives endlessly into a circular
+ * buffer - so the CPU is free during bulk transfers at 460800 or 921600 baud.
+ * The buffering itself is the host tested core in atdma.h.
+ *
+ * The functions match the AtCommanderConfig transport callbacks. SysTick is
+ * taken for a 1ms tick, polling the receive channel for idle lines, and the
+ * delay and wait callbacks sleep in WFI between ticks rather than spinning.
+ */
+
+/* Start the 1ms tick - configureUartDma does too, but delays before the UART
+ * is configured need it first.
+ */
+void configureTick(void);
+
+void configureUartDma(void* device, int baud);
+
+void writeByteDma(void* device, uint8_t byte);
+
+int readByteDma(void* device);
+
+const uint8_t* peekDma(void* device, int* length);
+
+void consumeDma(void* device, int count);
+
+unsigned long millisDma(void);
+
+/* Sleep for the time, waking only for interrupts - a config's delay_function.
+ */
+void sleepMs(unsigned long ms);
+
+/* Sleep until bytes have been received or the time is up - a config's
+ * wait_function. Received bytes are noticed within a tick.
+ */
+void waitForReceiveDma(void* device, unsigned long ms);
+
+/* Returns true once for each burst of received data, after the line has been
+ * idle for 2ms.
+ */
+bool receiveIdleDma(void);
+
+#endif // _UARTDMA_H_
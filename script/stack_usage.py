@@ -0,0 +1,76 @@
+#!/usr/bin/env python
+"""Report the worst-case stack use of the library from the call graph files
+GCC writes with -fcallgraph-info=su.
+
+Calls through function pointers (the transport, delay, clock and log
+callbacks) and into libc are counted as using no stack, so add the deepest
+of your own callbacks to the reported figure.
+"""
+
+import re
+import sys
+
+NODE = re.compile(r'node: \{ title: "([^"]+)" label: "[^"]*\\n(\d+) bytes \((\w+)\)')
+EDGE = re.compile(r'edge: \{ sourcename: "([^"]+)" targetname: "([^"]+)"')
+
+
+def parse(paths):
+    frames = {}
+    dynamic = set()
+    calls = {}
+    for path in paths:
+        with open(path) as graph:
+            for line in graph:
+                node = NODE.search(line)
+                if node:
+                    frames[node.group(1)] = int(node.group(2))
+                    if node.group(3) != "static":
+                        dynamic.add(node.group(1))
+                edge = EDGE.search(line)
+                if edge:
+                    calls.setdefault(edge.group(1), set()).add(edge.group(2))
+    return frames, dynamic, calls
+
+
+def deepest(function, frames, calls, memo, visiting):
+    if function in memo:
+        return memo[function]
+    if function in visiting:
+        raise RuntimeError("recursion through %s, stack use is unbounded" %
+                function)
+
+    visiting.add(function)
+    best = (0, [])
+    for callee in calls.get(function, ()):
+        depth, path = deepest(callee, frames, calls, memo, visiting)
+        if depth > best[0]:
+            best = (depth, path)
+    visiting.remove(function)
+
+    result = (frames.get(function, 0) + best[0], [function] + best[1])
+    memo[function] = result
+    return result
+
+
+def main(paths):
+    if not paths:
+        sys.exit("usage: %s <file.ci>..." % sys.argv[0])
+
+    frames, dynamic, calls = parse(paths)
+    memo = {}
+    public = sorted(f for f in frames if f.startswith("at_commander_"))
+    worst = (0, [])
+    for function in public:
+        depth, path = deepest(function, frames, calls, memo, set())
+        print("%6d  %s" % (depth, function))
+        if depth > worst[0]:
+            worst = (depth, path)
+
+    print("\nWorst-case stack: %d bytes" % worst[0])
+    print("  " + " -> ".join(f for f in worst[1] if f in frames))
+    for function in sorted(dynamic):
+        print("warning: %s has a dynamic stack frame" % function)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -1,9 +1,25 @@
 #include "atcommander.h"
+#include "atscript.h"
+#include "attrace.h"
+#include "atscan.h"
+#include "atdma.h"
+#ifdef __linux__
+#include "attty.h"
+#include "atbridge.h"
+#include "atbroker.h"
+#include "atpublish.h"
+#include "atwakeup.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <poll.h>
+#endif
 #include <check.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 AtCommanderConfig config;
 
@@ -14,37 +30,122 @@ void debug(const char* format, ...) {
     va_end(args);
 }
 
+static int initialized_bauds[16];
+static int initialized_baud_count;
+
 void baud_rate_initializer(void* device, int baud) {
+    if(initialized_baud_count < 16) {
+        initialized_bauds[initialized_baud_count++] = baud;
+    }
+}
+
+static unsigned long mock_time_ms;
+
+unsigned long mock_millis() {
+    return mock_time_ms;
+}
+
+static unsigned long total_delay_ms;
+
+void mock_delay(unsigned long ms) {
+    total_delay_ms += ms;
+    mock_time_ms += ms;
 }
 
+static int wait_count;
+static void* wait_device;
+
+// The next paced byte arrives within a ms of waiting for it
+void mock_wait(void* device, unsigned long ms) {
+    wait_count++;
+    wait_device = device;
+    mock_time_ms++;
+}
+
+static char write_buffer[256];
+static int write_index;
+
 void mock_write(void* device, uint8_t byte) {
+    if(write_index < (int)sizeof(write_buffer) - 1) {
+        write_buffer[write_index++] = byte;
+        write_buffer[write_index] = '\0';
+    }
 }
 
 static char* read_message;
 static int read_message_length;
 static int read_index;
 
+// A NULL byte in the message is a pause - nothing available to read
 int mock_read(void* device) {
     if(read_message != NULL && read_index < read_message_length) {
-        return read_message[read_index++];
+        char byte = read_message[read_index++];
+        return byte == '\0' ? -1 : byte;
     }
     return -1;
 }
 
+// Everything up to the next pause arrives as one chunk
+const uint8_t* mock_peek(void* device, int* length) {
+    *length = 0;
+    while(read_message != NULL && read_index + *length < read_message_length
+            && read_message[read_index + *length] != '\0') {
+        (*length)++;
+    }
+    if(*length == 0) {
+        mock_read(device);
+        return NULL;
+    }
+    return (const uint8_t*) read_message + read_index;
+}
+
+void mock_consume(void* device, int count) {
+    read_index += count;
+}
+
 void setup() {
     config.platform = AT_PLATFORM_RN42;
     config.connected = false;
     config.baud = 9600;
     config.device_baud = 9600;
+    config.device = NULL;
     config.baud_rate_initializer = baud_rate_initializer;
     config.write_function = mock_write;
     config.read_function = mock_read;
+    config.peek_function = NULL;
+    config.consume_function = NULL;
     config.delay_function = NULL;
+    config.wait_function = NULL;
     config.log_function = debug;
+    wait_count = 0;
+    wait_device = NULL;
 
     read_message = NULL;
     read_message_length = 0;
     read_index = 0;
+
+    write_buffer[0] = '\0';
+    write_index = 0;
+
+    config.millis_function = NULL;
+    config.command_mode_timeout_s = 0;
+    config.idle_exit_ms = 0;
+    mock_time_ms = 0;
+    total_delay_ms = 0;
+    config.last_transmit_ms = 0;
+    config.deadline_active = false;
+    initialized_baud_count = 0;
+    memset(config.retry_policies, 0, sizeof(config.retry_policies));
+    config.retry_seed = 0;
+    config.breaker_threshold = 0;
+    config.breaker_failures = 0;
+    config.breaker_open = false;
+    memset(&config.snapshot, 0, sizeof(config.snapshot));
+    config.restore_pending = false;
+    config.silent_responses = 0;
+    config.resets = 0;
+    config.last_restore_ms = 0;
+    config.max_restore_ms = 0;
 }
 
 
@@ -193,6 +294,606 @@ START_TEST (test_set_baud_no_response)
 }
 END_TEST
 
+START_TEST (test_switch_baud_success)
+{
+    char* response = "CMD\r\nAOK\r\nReboot!\r\nCMD\r\n";
+    read_message = response;
+    read_message_length = 22;
+    config.delay_function = mock_delay;
+
+    ck_assert(at_commander_switch_baud(&config, 115200));
+    ck_assert(config.connected);
+    ck_assert_int_eq(config.baud, 115200);
+    ck_assert_int_eq(config.device_baud, 115200);
+    ck_assert_str_eq(write_buffer, "$$$SU,11\rR,1\r$$$");
+    // Straight to the new rate, not a scan
+    ck_assert_int_eq(initialized_baud_count, 2);
+    ck_assert_int_eq(initialized_bauds[1], 115200);
+    ck_assert(total_delay_ms >= AT_COMMANDER_REBOOT_WINDOW_MS);
+}
+END_TEST
+
+START_TEST (test_switch_baud_no_answer)
+{
+    char* response = "CMD\r\nAOK\r\nReboot!\r\n";
+    read_message = response;
+    read_message_length = 17;
+
+    ck_assert(!at_commander_switch_baud(&config, 115200));
+    ck_assert(!config.connected);
+    ck_assert_int_eq(config.baud, 115200);
+    ck_assert_int_eq(config.device_baud, 115200);
+    ck_assert_int_eq(initialized_baud_count, 2);
+}
+END_TEST
+
+START_TEST (test_switch_baud_xbee_exits)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    char* response = "OK\r\nOK\r\nOK\r\nOK\r\nOK\r\n";
+    read_message = response;
+    read_message_length = 20;
+
+    ck_assert(at_commander_switch_baud(&config, 115200));
+    ck_assert(config.connected);
+    ck_assert_str_eq(write_buffer, "+++ATBD 7\r\nATWR\r\nATCN\r\n+++");
+}
+END_TEST
+
+START_TEST (test_switch_baud_unchanged)
+{
+    char* response = "CMD\r\n?\r\n";
+    read_message = response;
+    read_message_length = 8;
+
+    ck_assert(!at_commander_switch_baud(&config, 115200));
+    ck_assert_int_eq(config.baud, 9600);
+    ck_assert_str_eq(write_buffer, "$$$SU,11\r");
+}
+END_TEST
+
+#define LOOPBACK_SIZE 1024
+
+static uint8_t loopback[LOOPBACK_SIZE];
+static int loopback_head;
+static int loopback_count;
+static int loopback_written;
+static int loopback_drop_at;
+static int loopback_corrupt_at;
+
+// Echoes what's written, like a peer with its UART looped back
+void loopback_write(void* device, uint8_t byte) {
+    int index = loopback_written++;
+    if(index == loopback_drop_at) {
+        return;
+    } else if(index == loopback_corrupt_at) {
+        byte ^= 0x80;
+    }
+    loopback[(loopback_head + loopback_count++) % LOOPBACK_SIZE] = byte;
+}
+
+int loopback_read(void* device) {
+    if(loopback_count == 0) {
+        return -1;
+    }
+    uint8_t byte = loopback[loopback_head];
+    loopback_head = (loopback_head + 1) % LOOPBACK_SIZE;
+    loopback_count--;
+    return byte;
+}
+
+void loopback_setup() {
+    setup();
+    config.write_function = loopback_write;
+    config.read_function = loopback_read;
+    config.millis_function = mock_millis;
+    config.delay_function = mock_delay;
+    loopback_head = 0;
+    loopback_count = 0;
+    loopback_written = 0;
+    loopback_drop_at = -1;
+    loopback_corrupt_at = -1;
+}
+
+START_TEST (test_throughput_clean)
+{
+    AtCommanderThroughput result;
+    ck_assert(at_commander_check_throughput(&config, 600, 100, &result));
+    ck_assert_int_eq(result.bytes_sent, 600);
+    ck_assert_int_eq(result.bytes_received, 600);
+    ck_assert_int_eq(result.errors, 0);
+    ck_assert(result.bytes_per_second > 0);
+}
+END_TEST
+
+START_TEST (test_throughput_errors)
+{
+    loopback_drop_at = 100;
+    loopback_corrupt_at = 300;
+    AtCommanderThroughput result;
+    ck_assert(at_commander_check_throughput(&config, 600, 100, &result));
+    ck_assert_int_eq(result.bytes_received, 599);
+    // Resynchronized after the lost byte rather than counting the rest
+    ck_assert_int_eq(result.errors, 2);
+}
+END_TEST
+
+START_TEST (test_throughput_lost_tail)
+{
+    loopback_drop_at = 599;
+    AtCommanderThroughput result;
+    ck_assert(at_commander_check_throughput(&config, 600, 100, &result));
+    ck_assert_int_eq(result.bytes_received, 599);
+    ck_assert_int_eq(result.errors, 1);
+    ck_assert(mock_time_ms >= 100);
+}
+END_TEST
+
+START_TEST (test_throughput_needs_clock)
+{
+    config.millis_function = NULL;
+    AtCommanderThroughput result;
+    ck_assert(!at_commander_check_throughput(&config, 600, 100, &result));
+    ck_assert_int_eq(loopback_written, 0);
+}
+END_TEST
+
+START_TEST (test_inquiry_parse_lines)
+{
+    AtCommanderInquiryResult results[2];
+    AtCommanderInquiry inquiry;
+    at_commander_inquiry_init(&inquiry, results, 2, 0);
+
+    ck_assert(!at_commander_inquiry_parse_line(&inquiry, "Inquiry,T=5,COD=0"));
+    ck_assert(!at_commander_inquiry_parse_line(&inquiry, "Found 3"));
+    ck_assert(at_commander_inquiry_parse_line(&inquiry,
+                "0006664E0A7B,Phone,5A020C"));
+    ck_assert(at_commander_inquiry_parse_line(&inquiry,
+                "000666112233,3E0104,-71"));
+    ck_assert_int_eq(inquiry.count, 2);
+    ck_assert_str_eq(results[0].address, "0006664E0A7B");
+    ck_assert_str_eq(results[0].name, "Phone");
+    ck_assert_int_eq(results[0].class_of_device, 0x5A020C);
+    ck_assert_int_eq(results[0].rssi, 0);
+    ck_assert_str_eq(results[1].name, "");
+    ck_assert_int_eq(results[1].class_of_device, 0x3E0104);
+    ck_assert_int_eq(results[1].rssi, -71);
+
+    // Merged by address, keeping the strongest signal
+    ck_assert(at_commander_inquiry_parse_line(&inquiry,
+                "0006664E0A7B,5A020C,-48"));
+    ck_assert(at_commander_inquiry_parse_line(&inquiry,
+                "0006664E0A7B,5A020C,-80"));
+    ck_assert_int_eq(inquiry.count, 2);
+    ck_assert_str_eq(results[0].name, "Phone");
+    ck_assert_int_eq(results[0].rssi, -48);
+
+    // A third device doesn't fit
+    ck_assert(at_commander_inquiry_parse_line(&inquiry,
+                "00066600D2E3,Headset,240404"));
+    ck_assert_int_eq(inquiry.count, 2);
+    ck_assert_int_eq(inquiry.dropped, 1);
+
+    ck_assert(!at_commander_inquiry_parse_line(&inquiry, "0006664E0A7,X,1"));
+    ck_assert(!at_commander_inquiry_parse_line(&inquiry, "00066G4E0A7B,X,1"));
+    ck_assert(!inquiry.complete);
+    ck_assert(!at_commander_inquiry_parse_line(&inquiry, "Inquiry Done"));
+    ck_assert(inquiry.complete);
+}
+END_TEST
+
+START_TEST (test_inquiry_dropped_lines)
+{
+    AtCommanderInquiryResult results[1];
+    AtCommanderInquiry inquiry;
+    at_commander_inquiry_init(&inquiry, results, 1, 0);
+
+    ck_assert(at_commander_inquiry_parse_line(&inquiry,
+                "0006664E0A7B,Phone,5A020C"));
+    // The same device that doesn't fit, reported again with its signal
+    ck_assert(at_commander_inquiry_parse_line(&inquiry,
+                "00066600D2E3,Headset,240404"));
+    ck_assert(at_commander_inquiry_parse_line(&inquiry,
+                "00066600D2E3,240404,-60"));
+    ck_assert_int_eq(inquiry.count, 1);
+    ck_assert_int_eq(inquiry.dropped, 2);
+
+    // Repeats of a device that did fit are merged, not dropped
+    ck_assert(at_commander_inquiry_parse_line(&inquiry,
+                "0006664E0A7B,5A020C,-48"));
+    ck_assert_int_eq(inquiry.dropped, 2);
+    ck_assert_int_eq(results[0].rssi, -48);
+}
+END_TEST
+
+START_TEST (test_inquiry_streamed)
+{
+    char response[] = "CMD\r\nInquiry,T=5,COD=0\r\n\0\0\0Found 3\r\n"
+            "0006664E0A7B,Phone,5A020C\r\n\0" "000666112233,Laptop,3E0104\r\n"
+            "0006664E0A7B,Phone,5A020C\r\nInquiry Done\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+
+    AtCommanderInquiryResult results[4];
+    AtCommanderInquiry inquiry;
+    at_commander_inquiry_init(&inquiry, results, 4, 0);
+    ck_assert_int_eq(at_commander_inquiry(&config, 5, &inquiry), 2);
+    ck_assert_str_eq(write_buffer, "$$$IN,5\r");
+    ck_assert(inquiry.complete);
+    ck_assert_str_eq(results[0].name, "Phone");
+    ck_assert_str_eq(results[1].name, "Laptop");
+}
+END_TEST
+
+START_TEST (test_inquiry_max_results)
+{
+    char* response = "CMD\r\nFound 2\r\n0006664E0A7B,Phone,5A020C\r\n"
+            "000666112233,Laptop,3E0104\r\nInquiry Done\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+    config.millis_function = mock_millis;
+    mock_time_ms = 1000;
+
+    AtCommanderInquiryResult results[4];
+    AtCommanderInquiry inquiry;
+    at_commander_inquiry_init(&inquiry, results, 4, 1);
+    ck_assert_int_eq(at_commander_inquiry(&config, 10, &inquiry), 1);
+    ck_assert(!inquiry.complete);
+    ck_assert_int_eq(inquiry.busy_until_ms, 11000);
+    ck_assert(read_index < read_message_length);
+}
+END_TEST
+
+START_TEST (test_inquiry_no_end_marker)
+{
+    char* response = "CMD\r\n0006664E0A7B,Phone,5A020C\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+    config.millis_function = mock_millis;
+    config.delay_function = mock_delay;
+
+    AtCommanderInquiryResult results[4];
+    AtCommanderInquiry inquiry;
+    at_commander_inquiry_init(&inquiry, results, 4, 0);
+    ck_assert_int_eq(at_commander_inquiry(&config, 1, &inquiry), 1);
+    ck_assert(!inquiry.complete);
+    // Waited out the scan and the margin for the end marker, then gave up
+    ck_assert(mock_time_ms >= 1000);
+    ck_assert(mock_time_ms < 5000);
+}
+END_TEST
+
+START_TEST (test_inquiry_unsupported)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    AtCommanderInquiryResult results[4];
+    AtCommanderInquiry inquiry;
+    at_commander_inquiry_init(&inquiry, results, 4, 0);
+    ck_assert_int_eq(at_commander_inquiry(&config, 1, &inquiry), -1);
+    ck_assert_int_eq(write_index, 0);
+}
+END_TEST
+
+void link_sampler_setup() {
+    setup();
+    config.platform = AT_PLATFORM_XBEE;
+    config.millis_function = mock_millis;
+    config.delay_function = mock_delay;
+    config.connected = true;
+    config.session_started_ms = 0;
+    config.last_activity_ms = 0;
+}
+
+START_TEST (test_link_sample_xbee)
+{
+    char response[] = "28\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+    mock_time_ms = 5000;
+    config.last_activity_ms = 5000;
+
+    AtCommanderLinkSample samples[4];
+    AtCommanderLinkSampler sampler;
+    at_commander_link_sampler_init(&sampler, samples, 4, 1000, 0);
+    ck_assert(at_commander_sample_link(&config, &sampler));
+    ck_assert_str_eq(write_buffer, "ATDB\r\n");
+    ck_assert_int_eq(sampler.count, 1);
+    ck_assert_int_eq(samples[0].value, 0x28);
+    ck_assert_int_eq(samples[0].time_s, 5);
+    ck_assert_int_eq(config.last_activity_ms, mock_time_ms);
+}
+END_TEST
+
+START_TEST (test_link_sample_needs_session)
+{
+    config.connected = false;
+    AtCommanderLinkSample samples[4];
+    AtCommanderLinkSampler sampler;
+    at_commander_link_sampler_init(&sampler, samples, 4, 1000, 0);
+    ck_assert(!at_commander_sample_link(&config, &sampler));
+    ck_assert_int_eq(write_index, 0);
+
+    // Or a session about to expire, which would need a new escape sequence
+    config.connected = true;
+    mock_time_ms = 9800;
+    ck_assert(!at_commander_sample_link(&config, &sampler));
+    ck_assert_int_eq(write_index, 0);
+}
+END_TEST
+
+START_TEST (test_link_sample_interval_and_budget)
+{
+    char response[] = "28\r\n\0" "30\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+
+    AtCommanderLinkSample samples[4];
+    AtCommanderLinkSampler sampler;
+    at_commander_link_sampler_init(&sampler, samples, 4, 1000, 5);
+    ck_assert(at_commander_sample_link(&config, &sampler));
+    ck_assert_int_eq(sampler.cost_ms, 100);
+
+    // Not due yet
+    mock_time_ms = 500;
+    write_index = 0;
+    ck_assert(!at_commander_sample_link(&config, &sampler));
+    // Due, but 5% of the time so far doesn't pay for a 100ms sample
+    mock_time_ms = 1100;
+    ck_assert(!at_commander_sample_link(&config, &sampler));
+    ck_assert_int_eq(write_index, 0);
+
+    mock_time_ms = 2000;
+    ck_assert(at_commander_sample_link(&config, &sampler));
+    ck_assert_int_eq(sampler.count, 2);
+    ck_assert_int_eq(samples[1].value, 0x30);
+}
+END_TEST
+
+START_TEST (test_link_sample_rn42_stops_reports)
+{
+    config.platform = AT_PLATFORM_RN42;
+    char response[] = "RSSI=ff,f0\r\n\0RSSI=fe,f0\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+
+    AtCommanderLinkSample samples[4];
+    AtCommanderLinkSampler sampler;
+    at_commander_link_sampler_init(&sampler, samples, 4, 1000, 0);
+    ck_assert(at_commander_sample_link(&config, &sampler));
+    ck_assert_str_eq(write_buffer, "L\rL\r");
+    ck_assert_int_eq(samples[0].value, 0xff);
+    ck_assert_int_eq(read_index, read_message_length);
+}
+END_TEST
+
+START_TEST (test_link_sample_rn42_paced)
+{
+    config.platform = AT_PLATFORM_RN42;
+    config.wait_function = mock_wait;
+    // The reply trickles in a byte at a time, as it does at low baud rates
+    char response[] = "R\0S\0S\0I\0=\0f\0f\0,\0f\0f\0\r\n\0"
+            "R\0S\0S\0I\0=\0f\0e\0,\0f\0f\0\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+
+    AtCommanderLinkSample samples[4];
+    AtCommanderLinkSampler sampler;
+    at_commander_link_sampler_init(&sampler, samples, 4, 1000, 0);
+    ck_assert(at_commander_sample_link(&config, &sampler));
+    ck_assert_str_eq(write_buffer, "L\rL\r");
+    ck_assert_int_eq(sampler.count, 1);
+    ck_assert_int_eq(samples[0].value, 0xff);
+    ck_assert_int_eq(read_index, read_message_length);
+    ck_assert(wait_count > 0);
+}
+END_TEST
+
+START_TEST (test_link_sample_rn42_drains_late_report)
+{
+    config.platform = AT_PLATFORM_RN42;
+    config.wait_function = mock_wait;
+    // A report already on its way when reports are stopped, after a gap
+    // longer than a read's retries but within the response delay
+    char response[12 + 60 + 12 + 1];
+    memset(response, 0, sizeof(response));
+    strcpy(response, "RSSI=ff,f0\r\n");
+    strcpy(response + 12 + 60, "RSSI=fe,f0\r\n");
+    read_message = response;
+    read_message_length = 12 + 60 + 12;
+
+    AtCommanderLinkSample samples[4];
+    AtCommanderLinkSampler sampler;
+    at_commander_link_sampler_init(&sampler, samples, 4, 1000, 0);
+    ck_assert(at_commander_sample_link(&config, &sampler));
+    ck_assert_int_eq(samples[0].value, 0xff);
+    ck_assert_int_eq(read_index, read_message_length);
+}
+END_TEST
+
+START_TEST (test_link_sample_error)
+{
+    char response[] = "ERROR\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+
+    AtCommanderLinkSample samples[4];
+    AtCommanderLinkSampler sampler;
+    at_commander_link_sampler_init(&sampler, samples, 4, 1000, 0);
+    ck_assert(!at_commander_sample_link(&config, &sampler));
+    ck_assert_int_eq(sampler.count, 0);
+    ck_assert_int_eq(sampler.failures, 1);
+}
+END_TEST
+
+START_TEST (test_link_stats)
+{
+    char response[] = "10\r\n20\r\n40\r\n30\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+
+    AtCommanderLinkSample samples[3];
+    AtCommanderLinkSampler sampler;
+    AtCommanderLinkStats stats;
+    at_commander_link_sampler_init(&sampler, samples, 3, 0, 0);
+    ck_assert(!at_commander_link_stats(&sampler, 0, &stats));
+    int i;
+    for(i = 0; i < 4; i++) {
+        ck_assert(at_commander_sample_link(&config, &sampler));
+    }
+    ck_assert_int_eq(sampler.count, 3);
+
+    ck_assert(at_commander_link_stats(&sampler, 0, &stats));
+    ck_assert_int_eq(stats.count, 3);
+    ck_assert_int_eq(stats.min, 0x20);
+    ck_assert_int_eq(stats.max, 0x40);
+    ck_assert_int_eq(stats.mean, 0x30);
+    ck_assert_int_eq(stats.latest, 0x30);
+
+    ck_assert(at_commander_link_stats(&sampler, 2, &stats));
+    ck_assert_int_eq(stats.count, 2);
+    ck_assert_int_eq(stats.min, 0x30);
+    ck_assert_int_eq(stats.mean, 0x38);
+}
+END_TEST
+
+START_TEST (test_reset_signature_in_response)
+{
+    char response[] = "%REBOOT\r\n\0CMD\r\nFOO\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+    config.connected = true;
+
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), -1);
+    ck_assert(!config.connected);
+    ck_assert(config.restore_pending);
+    ck_assert_int_eq(config.resets, 1);
+
+    // Back at the known baud rate, without a scan
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 3);
+    ck_assert_str_eq(name, "FOO");
+    ck_assert_str_eq(write_buffer, "GN\r$$$GN\r");
+    ck_assert_int_eq(initialized_baud_count, 1);
+    ck_assert_int_eq(initialized_bauds[0], 9600);
+    ck_assert(!config.restore_pending);
+}
+END_TEST
+
+START_TEST (test_reset_signature_in_set_response)
+{
+    char response[] = "%REBOOT\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+    config.connected = true;
+
+    ck_assert(!at_commander_set_name(&config, "FOO", false));
+    ck_assert(config.restore_pending);
+    ck_assert_int_eq(config.resets, 1);
+}
+END_TEST
+
+START_TEST (test_reset_garbled_response)
+{
+    char response[] = "\xf3\x81\x9c\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+    config.connected = true;
+
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), -1);
+    ck_assert(config.restore_pending);
+}
+END_TEST
+
+START_TEST (test_reset_silence)
+{
+    config.connected = true;
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 0);
+    // A single unanswered request may be a dropped byte
+    ck_assert(config.connected);
+    ck_assert_int_eq(config.resets, 0);
+
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), -1);
+    ck_assert(!config.connected);
+    ck_assert_int_eq(config.resets, 1);
+}
+END_TEST
+
+START_TEST (test_reset_detect_data_mode)
+{
+    ck_assert(!at_commander_detect_reset(&config, "%CONNECT,0006664E0A7B,0"));
+    ck_assert(at_commander_detect_reset(&config, "%REBOOT"));
+    ck_assert(at_commander_detect_reset(&config, "REBOOT"));
+    // Counted once until the session is restored
+    ck_assert_int_eq(config.resets, 1);
+    ck_assert(config.restore_pending);
+}
+END_TEST
+
+START_TEST (test_reset_signatures_follow_platform)
+{
+    ck_assert(at_commander_detect_reset(&config, "%REBOOT"));
+    config.platform = AT_PLATFORM_HAYES;
+    ck_assert(!at_commander_detect_reset(&config, "%REBOOT"));
+    ck_assert(at_commander_detect_reset(&config, "RDY"));
+    config.platform.reset_signatures = NULL;
+    ck_assert(!at_commander_detect_reset(&config, "RDY"));
+}
+END_TEST
+
+START_TEST (test_reset_snapshot_recorded)
+{
+    char response[] = "CMD\r\nAOK\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+
+    ck_assert(at_commander_set_name(&config, "FOO", true));
+    ck_assert_str_eq(config.snapshot.name, "FOO");
+    ck_assert(config.snapshot.name_serialized);
+    // The RN-42 stores settings as they're set
+    ck_assert_int_eq(config.snapshot.unstored, 0);
+}
+END_TEST
+
+START_TEST (test_reset_restores_unstored)
+{
+    char response[] = "CMD\r\nAOK\r\nAOK\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+    config.millis_function = mock_millis;
+    config.delay_function = mock_delay;
+
+    strcpy(config.snapshot.name, "FOO");
+    config.snapshot.configuration_timer_s = 255;
+    config.snapshot.unstored = AT_COMMANDER_SNAPSHOT_NAME |
+            AT_COMMANDER_SNAPSHOT_CONFIGURATION_TIMER;
+    ck_assert(at_commander_detect_reset(&config, "%REBOOT"));
+
+    ck_assert(at_commander_enter_command_mode(&config));
+    ck_assert_str_eq(write_buffer, "$$$SN,FOO\rST,255\r");
+    ck_assert(!config.restore_pending);
+    ck_assert_int_eq(config.last_restore_ms, mock_time_ms);
+    ck_assert_int_eq(config.max_restore_ms, mock_time_ms);
+}
+END_TEST
+
+START_TEST (test_reset_restores_baud)
+{
+    char response[] = "CMD\r\nAOK\r\nReboot!\r\nCMD\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+
+    // The device came back at 9600 rather than the 115200 it was set to
+    config.snapshot.baud = 115200;
+    ck_assert(at_commander_detect_reset(&config, "%REBOOT"));
+    ck_assert(at_commander_enter_command_mode(&config));
+    ck_assert_int_eq(config.baud, 115200);
+    ck_assert_int_eq(initialized_bauds[initialized_baud_count - 1], 115200);
+    ck_assert(!config.restore_pending);
+}
+END_TEST
+
 START_TEST (test_xbee_enter_command_mode_success)
 {
     config.platform = AT_PLATFORM_XBEE;
@@ -292,19 +993,2085 @@ START_TEST (test_get_name_no_response)
 }
 END_TEST
 
-Suite* suite(void) {
-    Suite* s = suite_create("atcommander");
-    TCase *tc_enter_command_mode = tcase_create("enter_command_mode");
-    tcase_add_checked_fixture(tc_enter_command_mode, setup, NULL);
-    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_success);
-    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_already_active);
-    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_fail_bad_response);
-    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_fail_no_response);
-    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_at_baud);
-    suite_add_tcase(s, tc_enter_command_mode);
+START_TEST (test_xbee_batch_chained)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    char* response = "OK\rOK\rOK\rOK\r";
+    read_message = response;
+    read_message_length = 12;
 
-    TCase *tc_exit_command_mode = tcase_create("exit_command_mode");
-    tcase_add_checked_fixture(tc_exit_command_mode, setup, NULL);
+    AtCommanderBatch batch;
+    at_commander_batch_init(&batch);
+    ck_assert(at_commander_batch_add(&batch,
+                &config.platform.set_baud_rate_command,
+                xbee_baud_rate_mapper(115200)));
+    ck_assert(at_commander_batch_send(&config, &batch, true, true));
+    ck_assert_str_eq(write_buffer, "+++ATBD 7,WR,CN\r");
+    // The store and exit commands aren't left in the batch
+    ck_assert_int_eq(batch.count, 1);
+    ck_assert(batch.results[0]);
+    ck_assert(batch.results[1]);
+    ck_assert(batch.results[2]);
+    ck_assert(!config.connected);
+}
+END_TEST
+
+START_TEST (test_xbee_batch_error)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    char* response = "OK\rOK\rERROR\r";
+    read_message = response;
+    read_message_length = 12;
+
+    AtCommanderBatch batch;
+    at_commander_batch_init(&batch);
+    ck_assert(at_commander_batch_add(&batch,
+                &config.platform.set_baud_rate_command, 7));
+    ck_assert(!at_commander_batch_send(&config, &batch, true, true));
+    ck_assert(batch.results[0]);
+    ck_assert(!batch.results[1]);
+    ck_assert(!batch.results[2]);
+    ck_assert(config.connected);
+}
+END_TEST
+
+START_TEST (test_xbee_batch_split_lines)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    config.platform.max_chained_line_length = 12;
+    config.connected = true;
+    char* response = "OK\rOK\rOK\r";
+    read_message = response;
+    read_message_length = 9;
+
+    AtCommanderBatch batch;
+    at_commander_batch_init(&batch);
+    ck_assert(at_commander_batch_add(&batch,
+                &config.platform.set_baud_rate_command, 7));
+    ck_assert(at_commander_batch_send(&config, &batch, true, true));
+    ck_assert_str_eq(write_buffer, "ATBD 7,WR\rATCN\r");
+    ck_assert(!config.connected);
+}
+END_TEST
+
+START_TEST (test_xbee_batch_sent_twice)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    char* response = "OK\rOK\rOK\rOK\r";
+    read_message = response;
+    read_message_length = 12;
+
+    AtCommanderBatch batch;
+    at_commander_batch_init(&batch);
+    ck_assert(at_commander_batch_add(&batch,
+                &config.platform.set_baud_rate_command, 7));
+    int length = batch.length;
+    // More times than the batch has room for the store and exit commands
+    int i;
+    for(i = 0; i < AT_COMMANDER_MAX_BATCH_SIZE; i++) {
+        read_index = 0;
+        write_index = 0;
+        ck_assert(at_commander_batch_send(&config, &batch, true, true));
+        ck_assert_str_eq(write_buffer, "+++ATBD 7,WR,CN\r");
+        ck_assert_int_eq(batch.count, 1);
+        ck_assert_int_eq(batch.length, length);
+        ck_assert(batch.results[0]);
+    }
+}
+END_TEST
+
+START_TEST (test_batch_unchained)
+{
+    char* response = "CMD\r\nAOK\r\nEND\r\n";
+    read_message = response;
+    read_message_length = 15;
+
+    AtCommanderBatch batch;
+    at_commander_batch_init(&batch);
+    ck_assert(at_commander_batch_add(&batch,
+                &config.platform.set_baud_rate_command, 11));
+    ck_assert(at_commander_batch_send(&config, &batch, true, true));
+    ck_assert_int_eq(batch.count, 1);
+    ck_assert_str_eq(write_buffer, "$$$SU,11\r---\r");
+    ck_assert(!config.connected);
+}
+END_TEST
+
+START_TEST (test_enter_command_mode_last_baud_first)
+{
+    char* response = "CMD\r\n";
+    read_message = response;
+    read_message_length = 5;
+
+    config.baud = 57600;
+    ck_assert(at_commander_enter_command_mode(&config));
+    ck_assert_int_eq(initialized_baud_count, 1);
+    ck_assert_int_eq(initialized_bauds[0], 57600);
+    ck_assert_int_eq(config.baud, 57600);
+}
+END_TEST
+
+START_TEST (test_session_expired)
+{
+    char* response = "CMD\r\nCMD\r\nFOO\r\n";
+    read_message = response;
+    read_message_length = 15;
+    config.millis_function = mock_millis;
+
+    ck_assert(at_commander_enter_command_mode(&config));
+    mock_time_ms = 61000;
+
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 3);
+    ck_assert_str_eq(name, "FOO");
+    ck_assert_str_eq(write_buffer, "$$$$$$GN\r");
+    ck_assert_int_eq(config.session_started_ms, 61000);
+}
+END_TEST
+
+START_TEST (test_session_about_to_expire)
+{
+    char* response = "CMD\r\nEND\r\nCMD\r\nFOO\r\n";
+    read_message = response;
+    read_message_length = 20;
+    config.millis_function = mock_millis;
+
+    ck_assert(at_commander_enter_command_mode(&config));
+    mock_time_ms = 59800;
+
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 3);
+    ck_assert_str_eq(write_buffer, "$$$---\r$$$GN\r");
+}
+END_TEST
+
+START_TEST (test_session_still_valid)
+{
+    char* response = "CMD\r\nFOO\r\n";
+    read_message = response;
+    read_message_length = 10;
+    config.millis_function = mock_millis;
+
+    ck_assert(at_commander_enter_command_mode(&config));
+    mock_time_ms = 30000;
+
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 3);
+    ck_assert_str_eq(write_buffer, "$$$GN\r");
+}
+END_TEST
+
+START_TEST (test_session_configuration_timer)
+{
+    char* response = "CMD\r\nAOK\r\n";
+    read_message = response;
+    read_message_length = 10;
+    config.millis_function = mock_millis;
+
+    ck_assert(at_commander_set_configuration_timer(&config, 120));
+    ck_assert_int_eq(config.command_mode_timeout_s, 120);
+    mock_time_ms = 90000;
+    ck_assert(at_commander_check_session(&config));
+    mock_time_ms = 120000;
+    ck_assert(!at_commander_check_session(&config));
+}
+END_TEST
+
+START_TEST (test_session_idle_exit)
+{
+    char* response = "CMD\r\nEND\r\n";
+    read_message = response;
+    read_message_length = 10;
+    config.millis_function = mock_millis;
+    config.idle_exit_ms = 1000;
+
+    ck_assert(at_commander_enter_command_mode(&config));
+    mock_time_ms = 500;
+    ck_assert(at_commander_check_session(&config));
+    mock_time_ms = 1500;
+    ck_assert(!at_commander_check_session(&config));
+    ck_assert_str_eq(write_buffer, "$$$---\r");
+}
+END_TEST
+
+START_TEST (test_xbee_guard_time_partially_idle)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    config.millis_function = mock_millis;
+    config.delay_function = mock_delay;
+    char* response = "OK";
+    read_message = response;
+    read_message_length = 2;
+
+    mock_time_ms = 5000;
+    uint8_t data[] = {'h', 'i'};
+    at_commander_write_data(&config, data, sizeof(data));
+    mock_time_ms = 5600;
+    ck_assert_int_eq(at_commander_guard_time_remaining_ms(&config), 400);
+
+    ck_assert(at_commander_enter_command_mode(&config));
+    ck_assert_str_eq(write_buffer, "hi+++");
+    ck_assert_int_eq(total_delay_ms, 1400);
+}
+END_TEST
+
+START_TEST (test_xbee_guard_time_already_idle)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    config.millis_function = mock_millis;
+    config.delay_function = mock_delay;
+    char* response = "OK";
+    read_message = response;
+    read_message_length = 2;
+
+    mock_time_ms = 10000;
+    ck_assert_int_eq(at_commander_guard_time_remaining_ms(&config), 0);
+    ck_assert(at_commander_enter_command_mode(&config));
+    ck_assert_int_eq(total_delay_ms, 1000);
+}
+END_TEST
+
+START_TEST (test_xbee_guard_time_no_clock)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    config.delay_function = mock_delay;
+    char* response = "OK";
+    read_message = response;
+    read_message_length = 2;
+
+    ck_assert(at_commander_enter_command_mode(&config));
+    ck_assert_int_eq(total_delay_ms, 2000);
+}
+END_TEST
+
+START_TEST (test_deadline_limits_baud_scan)
+{
+    config.millis_function = mock_millis;
+    config.delay_function = mock_delay;
+
+    at_commander_set_deadline(&config, 500);
+    ck_assert(!at_commander_set_baud(&config, 115200));
+    ck_assert_int_eq(mock_time_ms, 500);
+    ck_assert(initialized_baud_count < 4);
+    at_commander_clear_deadline(&config);
+}
+END_TEST
+
+START_TEST (test_deadline_met)
+{
+    char* response = "CMD\r\nAOK\r\n";
+    read_message = response;
+    read_message_length = 10;
+    config.millis_function = mock_millis;
+    config.delay_function = mock_delay;
+
+    at_commander_set_deadline(&config, 500);
+    ck_assert(at_commander_set_baud(&config, 115200));
+    ck_assert(mock_time_ms < 500);
+    at_commander_clear_deadline(&config);
+}
+END_TEST
+
+START_TEST (test_read_timeout_measured_by_clock)
+{
+    char* response = "CMD\r\n";
+    read_message = response;
+    read_message_length = 5;
+    config.millis_function = mock_millis;
+    config.delay_function = mock_delay;
+    config.connected = true;
+
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 3);
+    mock_time_ms = 0;
+    total_delay_ms = 0;
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 0);
+    // response delay, then reads until 3 * 50ms have passed
+    ck_assert_int_eq(total_delay_ms, 250);
+}
+END_TEST
+
+START_TEST (test_deadline_passed_before_request)
+{
+    config.millis_function = mock_millis;
+    config.connected = true;
+
+    at_commander_set_deadline(&config, 100);
+    mock_time_ms = 200;
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), -1);
+    ck_assert_str_eq(write_buffer, "");
+}
+END_TEST
+
+static char dump_response[] = "CMD\r\n***Settings***\r\n"
+        "BTA=00066646C2AF\r\nBTName=FOO-C2AF\r\nBaudrt(SW4)=115K\r\n"
+        "Mode  =Slav\r\nAuthen=1\r\n\0\0\0\0"
+        "***ADVANCED Settings***\r\nCfgTimr=120\r\n";
+
+START_TEST (test_get_settings)
+{
+    read_message = dump_response;
+    read_message_length = sizeof(dump_response) - 1;
+
+    AtCommanderSettings settings;
+    ck_assert(at_commander_get_settings(&config, &settings));
+    ck_assert_str_eq(write_buffer, "$$$D\rE\r");
+    ck_assert_str_eq(settings.device_id, "00066646C2AF");
+    ck_assert_str_eq(settings.name, "FOO-C2AF");
+    ck_assert_int_eq(settings.baud, 115200);
+    ck_assert_str_eq(settings.mode, "Slav");
+    ck_assert_int_eq(settings.authentication, 1);
+    ck_assert_int_eq(settings.configuration_timer_s, 120);
+}
+END_TEST
+
+START_TEST (test_get_settings_error)
+{
+    char* response = "CMD\r\nERR\r\n";
+    read_message = response;
+    read_message_length = 10;
+
+    AtCommanderSettings settings;
+    ck_assert(!at_commander_get_settings(&config, &settings));
+}
+END_TEST
+
+START_TEST (test_get_settings_unsupported)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    AtCommanderSettings settings;
+    ck_assert(!at_commander_get_settings(&config, &settings));
+    ck_assert_str_eq(write_buffer, "");
+}
+END_TEST
+
+START_TEST (test_scan_every_position)
+{
+    AtCommanderScanner scanner;
+    at_commander_scanner_init(&scanner);
+    uint8_t chunk[100];
+    int length, position;
+    for(length = 0; length <= (int)sizeof(chunk); length++) {
+        memset(chunk, 'a', sizeof(chunk));
+        ck_assert_int_eq(at_commander_scan(&scanner, chunk, length), length);
+        for(position = 0; position < length; position++) {
+            memset(chunk, 'a', sizeof(chunk));
+            chunk[position] = position % 2 ? '\r' : '\n';
+            // A later match mustn't win
+            chunk[length - 1] = '\n';
+            ck_assert_int_eq(at_commander_scan(&scanner, chunk, length),
+                    position);
+            ck_assert_int_eq(at_commander_scan_portable(&scanner, chunk,
+                        length), position);
+        }
+    }
+}
+END_TEST
+
+START_TEST (test_scan_copy_every_position)
+{
+    AtCommanderScanner scanner;
+    at_commander_scanner_init(&scanner);
+    uint8_t chunk[100];
+    char buffer[sizeof(chunk) + 1];
+    int length, position, size;
+    for(length = 0; length <= (int)sizeof(chunk); length++) {
+        for(position = 0; position <= length; position++) {
+            int i;
+            for(i = 0; i < (int)sizeof(chunk); i++) {
+                chunk[i] = 'A' + i % 26;
+            }
+            if(position < length) {
+                chunk[position] = '\r';
+                chunk[length - 1] = '\n';
+            }
+            // Room for all of it, and for only some of it
+            for(size = position; size >= position - 10 && size >= 0;
+                    size -= 10) {
+                memset(buffer, '#', sizeof(buffer));
+                ck_assert_int_eq(at_commander_scan_copy(&scanner, chunk,
+                            length, buffer, size), position);
+                ck_assert(!memcmp(buffer, chunk, size));
+                ck_assert_int_eq(buffer[size], '#');
+            }
+        }
+    }
+}
+END_TEST
+
+START_TEST (test_scan_command_first_bytes)
+{
+    AtCommanderScanner scanner;
+    at_commander_scanner_init(&scanner);
+    ck_assert(at_commander_scanner_add_command(&scanner,
+                &AT_PLATFORM_RN42.get_name_command));
+    // '\r', '\n', 'E' for "ERR" and "ERR*", and '?'
+    ck_assert_int_eq(scanner.count, 4);
+    const char* chunk = "FOO-BAR-BAZ-QUUX-1234567890-?-ERR";
+    ck_assert_int_eq(at_commander_scan(&scanner, (const uint8_t*) chunk,
+                strlen(chunk)), 28);
+
+    static const char* const anything[] = { "*OK", NULL };
+    AtCommand wildcard = { "X\r", NULL, NULL, anything };
+    ck_assert(!at_commander_scanner_add_command(&scanner, &wildcard));
+
+    uint8_t byte;
+    for(byte = 'a'; scanner.count < AT_SCAN_MAX_BYTES; byte++) {
+        ck_assert(at_commander_scanner_add(&scanner, byte));
+    }
+    ck_assert(at_commander_scanner_add(&scanner, 'a'));
+    ck_assert(!at_commander_scanner_add(&scanner, 'z'));
+}
+END_TEST
+
+START_TEST (test_read_chunked)
+{
+    config.peek_function = mock_peek;
+    config.consume_function = mock_consume;
+    read_message = dump_response;
+    read_message_length = sizeof(dump_response) - 1;
+
+    AtCommanderSettings settings;
+    ck_assert(at_commander_get_settings(&config, &settings));
+    ck_assert_str_eq(write_buffer, "$$$D\rE\r");
+    ck_assert_str_eq(settings.device_id, "00066646C2AF");
+    ck_assert_str_eq(settings.name, "FOO-C2AF");
+    ck_assert_int_eq(settings.baud, 115200);
+    ck_assert_int_eq(settings.configuration_timer_s, 120);
+}
+END_TEST
+
+START_TEST (test_read_chunked_fills_buffer)
+{
+    config.peek_function = mock_peek;
+    config.consume_function = mock_consume;
+    config.platform = AT_PLATFORM_XBEE;
+    char* response = "OK\r\n10A5-A-LONG-VERSION\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    char version[8];
+    ck_assert_int_eq(at_commander_get_version(&config, version,
+                sizeof(version)), 7);
+    ck_assert_str_eq(version, "10A5-A-");
+}
+END_TEST
+
+static int line_count;
+
+void count_line(const char* line, int length, void* context) {
+    ck_assert_int_eq(strlen(line), length);
+    line_count++;
+}
+
+START_TEST (test_get_lines_end_marker)
+{
+    char* response = "CMD\r\nONE\r\nTWO\r\nDONE\r\nEXTRA\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+    line_count = 0;
+
+    AtCommand command = { "X\r", "DONE", "ERR" };
+    ck_assert_int_eq(at_commander_get_lines(&config, &command, count_line,
+                NULL), 2);
+    ck_assert_int_eq(line_count, 2);
+}
+END_TEST
+
+START_TEST (test_hayes_enter_command_mode_disables_echo)
+{
+    config.platform = AT_PLATFORM_HAYES;
+    char* response = "AT\r\r\nOK\r\nATE0\r\r\nOK\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    ck_assert(at_commander_enter_command_mode(&config));
+    ck_assert(config.connected);
+    ck_assert_str_eq(write_buffer, "AT\rATE0\r");
+}
+END_TEST
+
+START_TEST (test_hayes_get_skips_echo)
+{
+    config.platform = AT_PLATFORM_HAYES;
+    config.connected = true;
+    config.delay_function = mock_delay;
+    char* response = "AT+CGSN\r\r\n860000000000001\r\n\r\nOK\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    char device_id[20];
+    ck_assert_int_eq(at_commander_get_device_id(&config, device_id,
+                sizeof(device_id)), 15);
+    ck_assert_str_eq(device_id, "860000000000001");
+    // Complete as soon as the final result code arrived
+    ck_assert_int_eq(total_delay_ms, 0);
+}
+END_TEST
+
+START_TEST (test_hayes_get_error_result_code)
+{
+    config.platform = AT_PLATFORM_HAYES;
+    config.connected = true;
+    char* response = "\r\n+CME ERROR: 10\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    char device_id[20];
+    ck_assert_int_eq(at_commander_get_device_id(&config, device_id,
+                sizeof(device_id)), -1);
+}
+END_TEST
+
+START_TEST (test_hayes_get_lines)
+{
+    config.platform = AT_PLATFORM_HAYES;
+    config.connected = true;
+    char* response = "\r\nSIM800 R14.18\r\nLINE 2\r\nLINE 3\r\n\r\nOK\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+    line_count = 0;
+
+    ck_assert_int_eq(at_commander_get_lines(&config,
+                &config.platform.get_version_command, count_line, NULL), 3);
+    ck_assert_int_eq(line_count, 3);
+}
+END_TEST
+
+START_TEST (test_hayes_slow_final_result)
+{
+    config.platform = AT_PLATFORM_HAYES;
+    config.connected = true;
+    config.delay_function = mock_delay;
+    // Longer than the usual retries between the lines of the reply
+    char response[] = "\r\nR14.18\r\n\0\0\0\0\0\0\0\0\r\nOK\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+
+    char version[20];
+    ck_assert_int_eq(at_commander_get_version(&config, version,
+                sizeof(version)), 6);
+    ck_assert_str_eq(version, "R14.18");
+}
+END_TEST
+
+START_TEST (test_hayes_set_baud)
+{
+    config.platform = AT_PLATFORM_HAYES;
+    config.connected = true;
+    char* response = "\r\nOK\r\n\r\nOK\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    ck_assert(at_commander_set_baud(&config, 115200));
+    ck_assert_str_eq(write_buffer, "AT+IPR=115200\rAT&W\r");
+    ck_assert_int_eq(config.device_baud, 115200);
+}
+END_TEST
+
+START_TEST (test_hayes_exit_command_mode)
+{
+    config.platform = AT_PLATFORM_HAYES;
+    config.connected = true;
+
+    ck_assert(at_commander_exit_command_mode(&config));
+    ck_assert(!config.connected);
+    ck_assert_str_eq(write_buffer, "");
+}
+END_TEST
+
+static AtCommanderDmaUart dma_uart;
+static int dma_remaining;
+static char dma_sent[512];
+static int dma_sent_length;
+static int dma_transfers[8];
+static int dma_transfer_count;
+
+// Records each transfer as if the bytes went out at once
+void fake_dma_start_transmit(void* context, const uint8_t* data, int length) {
+    memcpy(dma_sent + dma_sent_length, data, length);
+    dma_sent_length += length;
+    dma_sent[dma_sent_length] = '\0';
+    if(dma_transfer_count < 8) {
+        dma_transfers[dma_transfer_count] = length;
+    }
+    dma_transfer_count++;
+}
+
+int fake_dma_remaining(void* context) {
+    return dma_remaining;
+}
+
+// Writes to the circular buffer like the receive channel, reloading at the end
+void fake_dma_receive(const char* bytes, int length) {
+    int i;
+    for(i = 0; i < length; i++) {
+        dma_uart.rx_buffer[AT_DMA_RX_BUFFER_SIZE - dma_remaining] = bytes[i];
+        if(--dma_remaining == 0) {
+            dma_remaining = AT_DMA_RX_BUFFER_SIZE;
+        }
+    }
+}
+
+void fake_dma_receive_count(int count) {
+    static char bytes[AT_DMA_RX_BUFFER_SIZE];
+    int i;
+    for(i = 0; i < count; i++) {
+        bytes[i] = i;
+    }
+    fake_dma_receive(bytes, count);
+}
+
+void dma_uart_write(void* device, uint8_t byte) {
+    ck_assert(at_commander_dma_write((AtCommanderDmaUart*) device, byte));
+}
+
+int dma_uart_read(void* device) {
+    return at_commander_dma_read((AtCommanderDmaUart*) device);
+}
+
+const uint8_t* dma_uart_peek(void* device, int* length) {
+    return at_commander_dma_peek((AtCommanderDmaUart*) device, length);
+}
+
+void dma_uart_consume(void* device, int count) {
+    at_commander_dma_consume((AtCommanderDmaUart*) device, count);
+}
+
+void dma_setup() {
+    setup();
+    dma_remaining = AT_DMA_RX_BUFFER_SIZE;
+    dma_sent[0] = '\0';
+    dma_sent_length = 0;
+    dma_transfer_count = 0;
+    at_commander_dma_uart_init(&dma_uart, fake_dma_start_transmit,
+            fake_dma_remaining, NULL, 2);
+}
+
+START_TEST (test_dma_transmit_double_buffered)
+{
+    // An idle transmitter starts on the first byte, the rest wait for it
+    ck_assert(at_commander_dma_write(&dma_uart, 'A'));
+    ck_assert(at_commander_dma_write(&dma_uart, 'B'));
+    ck_assert(at_commander_dma_write(&dma_uart, 'C'));
+    ck_assert_int_eq(dma_transfer_count, 1);
+    ck_assert_str_eq(dma_sent, "A");
+
+    at_commander_dma_transmit_complete(&dma_uart);
+    ck_assert_int_eq(dma_transfer_count, 2);
+    ck_assert_int_eq(dma_transfers[1], 2);
+    ck_assert_str_eq(dma_sent, "ABC");
+    ck_assert(!at_commander_dma_transmit_idle(&dma_uart));
+
+    at_commander_dma_transmit_complete(&dma_uart);
+    ck_assert_int_eq(dma_transfer_count, 2);
+    ck_assert(at_commander_dma_transmit_idle(&dma_uart));
+}
+END_TEST
+
+START_TEST (test_dma_transmit_full)
+{
+    uint8_t data[AT_DMA_TX_BUFFER_SIZE * 3];
+    memset(data, 'x', sizeof(data));
+    ck_assert_int_eq(at_commander_dma_write_data(&dma_uart, data,
+                sizeof(data)), AT_DMA_TX_BUFFER_SIZE * 2);
+    ck_assert(!at_commander_dma_write(&dma_uart, 'y'));
+    ck_assert_int_eq(dma_transfers[0], AT_DMA_TX_BUFFER_SIZE);
+
+    at_commander_dma_transmit_complete(&dma_uart);
+    ck_assert_int_eq(dma_transfers[1], AT_DMA_TX_BUFFER_SIZE);
+    ck_assert_int_eq(at_commander_dma_write_data(&dma_uart, data,
+                AT_DMA_TX_BUFFER_SIZE), AT_DMA_TX_BUFFER_SIZE);
+    ck_assert_int_eq(dma_transfer_count, 2);
+}
+END_TEST
+
+START_TEST (test_dma_receive_wraps)
+{
+    fake_dma_receive_count(AT_DMA_RX_BUFFER_SIZE - 2);
+    int length;
+    ck_assert(at_commander_dma_peek(&dma_uart, &length) != NULL);
+    ck_assert_int_eq(length, AT_DMA_RX_BUFFER_SIZE - 2);
+    at_commander_dma_consume(&dma_uart, length);
+    ck_assert(at_commander_dma_peek(&dma_uart, &length) == NULL);
+
+    fake_dma_receive("ABCDE", 5);
+    ck_assert_int_eq(at_commander_dma_available(&dma_uart), 5);
+    const uint8_t* bytes = at_commander_dma_peek(&dma_uart, &length);
+    ck_assert_int_eq(length, 2);
+    ck_assert(!memcmp(bytes, "AB", 2));
+    at_commander_dma_consume(&dma_uart, 2);
+    bytes = at_commander_dma_peek(&dma_uart, &length);
+    ck_assert_int_eq(length, 3);
+    ck_assert(!memcmp(bytes, "CDE", 3));
+    ck_assert_int_eq(at_commander_dma_read(&dma_uart), 'C');
+    ck_assert_int_eq(dma_uart.rx_overruns, 0);
+}
+END_TEST
+
+START_TEST (test_dma_receive_overrun)
+{
+    fake_dma_receive_count(AT_DMA_RX_BUFFER_SIZE - 1);
+    at_commander_dma_poll(&dma_uart);
+    fake_dma_receive_count(11);
+
+    // The oldest bytes were overwritten
+    ck_assert_int_eq(at_commander_dma_available(&dma_uart),
+            AT_DMA_RX_BUFFER_SIZE);
+    ck_assert_int_eq(dma_uart.rx_overruns, 1);
+    ck_assert_int_eq(at_commander_dma_read(&dma_uart), 10);
+}
+END_TEST
+
+START_TEST (test_dma_idle_line)
+{
+    at_commander_dma_poll(&dma_uart);
+    at_commander_dma_poll(&dma_uart);
+    ck_assert(!at_commander_dma_take_idle(&dma_uart));
+
+    fake_dma_receive("DATA", 4);
+    at_commander_dma_poll(&dma_uart);
+    fake_dma_receive("MORE", 4);
+    at_commander_dma_poll(&dma_uart);
+    at_commander_dma_poll(&dma_uart);
+    ck_assert(!at_commander_dma_take_idle(&dma_uart));
+    at_commander_dma_poll(&dma_uart);
+    ck_assert(at_commander_dma_take_idle(&dma_uart));
+    ck_assert(!at_commander_dma_take_idle(&dma_uart));
+
+    // Still idle, not another burst
+    at_commander_dma_poll(&dma_uart);
+    at_commander_dma_poll(&dma_uart);
+    ck_assert(!at_commander_dma_take_idle(&dma_uart));
+    ck_assert_int_eq(at_commander_dma_available(&dma_uart), 8);
+}
+END_TEST
+
+START_TEST (test_dma_library_transport)
+{
+    config.device = &dma_uart;
+    config.write_function = dma_uart_write;
+    config.read_function = dma_uart_read;
+    config.peek_function = dma_uart_peek;
+    config.consume_function = dma_uart_consume;
+    const char* response = "CMD\r\n00066646C2AF\r\n";
+    fake_dma_receive(response, strlen(response));
+
+    char device_id[20];
+    ck_assert_int_eq(at_commander_get_device_id(&config, device_id,
+                sizeof(device_id)), 12);
+    ck_assert_str_eq(device_id, "00066646C2AF");
+    while(!at_commander_dma_transmit_idle(&dma_uart)) {
+        at_commander_dma_transmit_complete(&dma_uart);
+    }
+    ck_assert_str_eq(dma_sent, "$$$GB\r");
+}
+END_TEST
+
+#define STRESS_DEVICE_COUNT 16
+#define STRESS_THREAD_COUNT 8
+#define STRESS_ITERATIONS 500
+
+/* A simulated RN-42 that answers requests as they're written, and checks that
+ * it's only ever accessed by the thread holding its lock.
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_t owner;
+    int lock_depth;
+    char name[16];
+    char line[32];
+    int line_length;
+    char pending[32];
+    int pending_length;
+    int pending_index;
+    bool command_mode;
+    int violations;
+} SimulatedDevice;
+
+static SimulatedDevice devices[STRESS_DEVICE_COUNT];
+static AtCommanderConfig device_configs[STRESS_DEVICE_COUNT];
+static int stress_failures;
+
+void simulated_check_owner(SimulatedDevice* device) {
+    if(device->lock_depth == 0 ||
+            !pthread_equal(device->owner, pthread_self())) {
+        __sync_fetch_and_add(&device->violations, 1);
+    }
+}
+
+void simulated_reply(SimulatedDevice* device, const char* reply) {
+    strcpy(device->pending, reply);
+    device->pending_length = strlen(reply);
+    device->pending_index = 0;
+}
+
+void simulated_write(void* device_pointer, uint8_t byte) {
+    SimulatedDevice* device = (SimulatedDevice*) device_pointer;
+    simulated_check_owner(device);
+    if(device->line_length < (int)sizeof(device->line) - 1) {
+        device->line[device->line_length++] = byte;
+        device->line[device->line_length] = '\0';
+    }
+
+    if(!device->command_mode) {
+        if(device->line_length >= 3 && !strcmp(
+                    &device->line[device->line_length - 3], "$$$")) {
+            device->command_mode = true;
+            device->line_length = 0;
+            simulated_reply(device, "CMD\r\n");
+        }
+    } else if(byte == '\r') {
+        char reply[32];
+        if(!strcmp(device->line, "GN\r")) {
+            sprintf(reply, "%s\r\n", device->name);
+        } else if(!strncmp(device->line, "SU,", 3)) {
+            strcpy(reply, "AOK\r\n");
+        } else if(!strcmp(device->line, "---\r")) {
+            device->command_mode = false;
+            strcpy(reply, "END\r\n");
+        } else {
+            strcpy(reply, "?\r\n");
+        }
+        device->line_length = 0;
+        simulated_reply(device, reply);
+    }
+}
+
+int simulated_read(void* device_pointer) {
+    SimulatedDevice* device = (SimulatedDevice*) device_pointer;
+    simulated_check_owner(device);
+    if(device->pending_index < device->pending_length) {
+        return device->pending[device->pending_index++];
+    }
+    return -1;
+}
+
+void simulated_baud_rate_initializer(void* device_pointer, int baud) {
+    simulated_check_owner((SimulatedDevice*) device_pointer);
+}
+
+void simulated_lock(void* device_pointer) {
+    SimulatedDevice* device = (SimulatedDevice*) device_pointer;
+    pthread_mutex_lock(&device->mutex);
+    device->owner = pthread_self();
+    device->lock_depth++;
+}
+
+void simulated_unlock(void* device_pointer) {
+    SimulatedDevice* device = (SimulatedDevice*) device_pointer;
+    device->lock_depth--;
+    pthread_mutex_unlock(&device->mutex);
+}
+
+void* stress_worker(void* argument) {
+    unsigned int seed = (unsigned int)(uintptr_t) argument;
+    int i;
+    for(i = 0; i < STRESS_ITERATIONS; i++) {
+        int index = rand_r(&seed) % STRESS_DEVICE_COUNT;
+        AtCommanderConfig* device_config = &device_configs[index];
+        char name[20];
+        switch(rand_r(&seed) % 3) {
+            case 0:
+                if(at_commander_get_name(device_config, name,
+                            sizeof(name)) <= 0 ||
+                        strcmp(name, devices[index].name)) {
+                    __sync_fetch_and_add(&stress_failures, 1);
+                }
+                break;
+            case 1:
+                if(!at_commander_set_baud(device_config, 115200)) {
+                    __sync_fetch_and_add(&stress_failures, 1);
+                }
+                break;
+            case 2:
+                if(!at_commander_exit_command_mode(device_config)) {
+                    __sync_fetch_and_add(&stress_failures, 1);
+                }
+                break;
+        }
+    }
+    return NULL;
+}
+
+START_TEST (test_stress_shared_devices)
+{
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+
+    int i;
+    for(i = 0; i < STRESS_DEVICE_COUNT; i++) {
+        SimulatedDevice* device = &devices[i];
+        memset(device, 0, sizeof(SimulatedDevice));
+        pthread_mutex_init(&device->mutex, &attributes);
+        sprintf(device->name, "DEVICE-%d", i);
+
+        AtCommanderConfig* device_config = &device_configs[i];
+        memset(device_config, 0, sizeof(AtCommanderConfig));
+        device_config->platform = AT_PLATFORM_RN42;
+        device_config->device = device;
+        device_config->baud_rate_initializer = simulated_baud_rate_initializer;
+        device_config->write_function = simulated_write;
+        device_config->read_function = simulated_read;
+        device_config->lock_function = simulated_lock;
+        device_config->unlock_function = simulated_unlock;
+    }
+    stress_failures = 0;
+
+    pthread_t threads[STRESS_THREAD_COUNT];
+    for(i = 0; i < STRESS_THREAD_COUNT; i++) {
+        pthread_create(&threads[i], NULL, stress_worker,
+                (void*)(uintptr_t)(i + 1));
+    }
+    for(i = 0; i < STRESS_THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    ck_assert_int_eq(stress_failures, 0);
+    for(i = 0; i < STRESS_DEVICE_COUNT; i++) {
+        ck_assert_int_eq(devices[i].violations, 0);
+        pthread_mutex_destroy(&devices[i].mutex);
+    }
+    pthread_mutexattr_destroy(&attributes);
+}
+END_TEST
+
+int match_string(AtCommanderMatcher* matcher, const char* line) {
+    at_commander_reset_matcher(matcher);
+    int verdict = AT_COMMANDER_MATCH_PENDING;
+    for(; *line != '\0' && verdict == AT_COMMANDER_MATCH_PENDING; line++) {
+        verdict = at_commander_matcher_feed(matcher, *line);
+    }
+    return verdict == AT_COMMANDER_MATCH_PENDING ?
+            at_commander_matcher_finish(matcher) : verdict;
+}
+
+static const char* const success_patterns[] = { "AOK", "OK", "V?.??", NULL };
+static const char* const error_patterns[] = { "ERR*", "?", "*rror*", NULL };
+
+START_TEST (test_matcher_patterns)
+{
+    AtCommand command = { "X\r", NULL, NULL, success_patterns,
+        error_patterns };
+    AtCommanderMatcher matcher;
+    ck_assert(at_commander_compile_matcher(&matcher, &command));
+
+    ck_assert_int_eq(match_string(&matcher, "AOK"), AT_COMMANDER_MATCH_SUCCESS);
+    ck_assert_int_eq(match_string(&matcher, "OK"), AT_COMMANDER_MATCH_SUCCESS);
+    ck_assert_int_eq(match_string(&matcher, "OKAY"), AT_COMMANDER_MATCH_NONE);
+    ck_assert_int_eq(match_string(&matcher, "V6.15"),
+            AT_COMMANDER_MATCH_SUCCESS);
+    ck_assert_int_eq(match_string(&matcher, "ERR"), AT_COMMANDER_MATCH_ERROR);
+    ck_assert_int_eq(match_string(&matcher, "ERROR"),
+            AT_COMMANDER_MATCH_ERROR);
+    ck_assert_int_eq(match_string(&matcher, "?"), AT_COMMANDER_MATCH_ERROR);
+    ck_assert_int_eq(match_string(&matcher, "Syntax error here"),
+            AT_COMMANDER_MATCH_ERROR);
+    ck_assert_int_eq(match_string(&matcher, "??"), AT_COMMANDER_MATCH_NONE);
+}
+END_TEST
+
+START_TEST (test_matcher_early_verdict)
+{
+    AtCommand command = { "X\r", NULL, NULL, success_patterns,
+        error_patterns };
+    AtCommanderMatcher matcher;
+    ck_assert(at_commander_compile_matcher(&matcher, &command));
+
+    ck_assert_int_eq(at_commander_matcher_feed(&matcher, 'E'),
+            AT_COMMANDER_MATCH_PENDING);
+    ck_assert_int_eq(at_commander_matcher_feed(&matcher, 'R'),
+            AT_COMMANDER_MATCH_PENDING);
+    ck_assert_int_eq(at_commander_matcher_feed(&matcher, 'R'),
+            AT_COMMANDER_MATCH_ERROR);
+
+    at_commander_reset_matcher(&matcher);
+    ck_assert_int_eq(at_commander_matcher_feed(&matcher, 'Z'),
+            AT_COMMANDER_MATCH_PENDING);
+    at_commander_reset_matcher(&matcher);
+    ck_assert_int_eq(at_commander_matcher_feed(&matcher, 'A'),
+            AT_COMMANDER_MATCH_PENDING);
+    ck_assert_int_eq(at_commander_matcher_feed(&matcher, 'X'),
+            AT_COMMANDER_MATCH_PENDING);
+}
+END_TEST
+
+START_TEST (test_matcher_too_many_patterns)
+{
+    static const char* const patterns[] = { "1", "2", "3", "4", "5", "6",
+        "7", "8", "9", NULL };
+    AtCommand command = { "X\r", NULL, NULL, patterns, NULL };
+    AtCommanderMatcher matcher;
+    ck_assert(!at_commander_compile_matcher(&matcher, &command));
+}
+END_TEST
+
+START_TEST (test_set_alternative_success)
+{
+    char* response = "CMD\r\nOK\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    AtCommand command = { "SX,%d\r", NULL, NULL, success_patterns,
+        error_patterns };
+    ck_assert(at_commander_set(&config, &command, 1));
+}
+END_TEST
+
+START_TEST (test_set_error_stops_early)
+{
+    char* response = "CMD\r\nERR: bad argument\r\nNEXT\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    AtCommand command = { "SX,%d\r", NULL, NULL, success_patterns,
+        error_patterns };
+    ck_assert(!at_commander_set(&config, &command, 1));
+    // The rest of the error line was drained, but nothing more
+    ck_assert_int_eq(read_message[read_index], '\n');
+}
+END_TEST
+
+START_TEST (test_get_name_alternative_error)
+{
+    char* response = "CMD\r\n?\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), -1);
+}
+END_TEST
+
+START_TEST (test_matcher_escape)
+{
+    static const char* const literal_patterns[] = { "A\\*", NULL };
+    static const char* const literal_errors[] = { "\\?", NULL };
+    AtCommand command = { "X\r", NULL, NULL, literal_patterns,
+        literal_errors };
+    AtCommanderMatcher matcher;
+    ck_assert(at_commander_compile_matcher(&matcher, &command));
+
+    ck_assert_int_eq(match_string(&matcher, "?"), AT_COMMANDER_MATCH_ERROR);
+    ck_assert_int_eq(match_string(&matcher, "X"), AT_COMMANDER_MATCH_NONE);
+    ck_assert_int_eq(match_string(&matcher, "A*"),
+            AT_COMMANDER_MATCH_SUCCESS);
+    ck_assert_int_eq(match_string(&matcher, "AB"), AT_COMMANDER_MATCH_NONE);
+    ck_assert_int_eq(match_string(&matcher, "A*B"), AT_COMMANDER_MATCH_NONE);
+}
+END_TEST
+
+START_TEST (test_get_name_one_character)
+{
+    char* response = "CMD\r\nX\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 1);
+    ck_assert_str_eq(name, "X");
+}
+END_TEST
+
+START_TEST (test_get_name_paced)
+{
+    // One byte at a time, as from a device still sending when the wait for
+    // the reply ends with its first byte
+    char response[] = "CMD\r\nF\0I\0R\0E\0F\0L\0Y\0-\0C\0" "2\0A\0F\0\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+    config.millis_function = mock_millis;
+    config.wait_function = mock_wait;
+
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 12);
+    ck_assert_str_eq(name, "FIREFLY-C2AF");
+    // Nothing of the reply left behind for the next command
+    ck_assert_int_eq(read_message[read_index], '\n');
+}
+END_TEST
+
+START_TEST (test_get_without_error_response)
+{
+    char* response = "CMD\r\nFOO\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    AtCommand command = { "GX\r", NULL, NULL };
+    char value[20];
+    ck_assert_int_eq(at_commander_get(&config, &command, value,
+                sizeof(value)), 3);
+    ck_assert_str_eq(value, "FOO");
+}
+END_TEST
+
+static const char provisioning_script[] =
+    "# Name the device after the first boot\n"
+    "enter\n"
+    "get_id $id\n"
+    "try get_name $name\n"
+    "ifeq $name \"AT-Commander\" goto named\n"
+    "set_name \"AT-Commander\" serialized\n"
+    "named:\n"
+    "reboot\n";
+
+START_TEST (test_script_provisioning)
+{
+    char* response = "CMD\r\n00066646C2AF\r\nFOO\r\nAOK\r\nReboot!\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    uint8_t bytecode[64];
+    AtCommanderScriptContext context;
+    int length = at_commander_compile_script(provisioning_script, bytecode,
+            sizeof(bytecode), NULL);
+    ck_assert(length > 0);
+    ck_assert(at_commander_run_script(&config, bytecode, length, &context));
+    ck_assert_str_eq(context.variables[0], "00066646C2AF");
+    ck_assert_str_eq(context.variables[1], "FOO");
+    ck_assert_int_eq(context.failed_at, -1);
+    ck_assert(strstr(write_buffer, "S-,AT-Commander\r") != NULL);
+    ck_assert(strstr(write_buffer, "R,1\r") != NULL);
+}
+END_TEST
+
+START_TEST (test_script_conditional_jump)
+{
+    char* response = "CMD\r\n00066646C2AF\r\nAT-Commander\r\nReboot!\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    uint8_t bytecode[64];
+    AtCommanderScriptContext context;
+    int length = at_commander_compile_script(provisioning_script, bytecode,
+            sizeof(bytecode), NULL);
+    ck_assert(at_commander_run_script(&config, bytecode, length, &context));
+    ck_assert(strstr(write_buffer, "S-,") == NULL);
+    ck_assert(strstr(write_buffer, "R,1\r") != NULL);
+}
+END_TEST
+
+START_TEST (test_script_retry)
+{
+    char* response = "CMD\r\nERR\r\nAOK\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    uint8_t bytecode[16];
+    AtCommanderScriptContext context;
+    int length = at_commander_compile_script("retry 3 set_baud 115200\n",
+            bytecode, sizeof(bytecode), NULL);
+    // Header, opcode, retry count and a 3 byte varint
+    ck_assert_int_eq(length, 9);
+    ck_assert(at_commander_run_script(&config, bytecode, length, &context));
+    ck_assert_int_eq(config.device_baud, 115200);
+    char* first = strstr(write_buffer, "SU,");
+    ck_assert(first != NULL);
+    ck_assert(strstr(first + 1, "SU,") != NULL);
+}
+END_TEST
+
+START_TEST (test_script_failure_stops)
+{
+    char* response = "CMD\r\nERR\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    uint8_t bytecode[16];
+    AtCommanderScriptContext context;
+    int length = at_commander_compile_script(
+            "enter\nset_baud 115200\nreboot\n", bytecode, sizeof(bytecode),
+            NULL);
+    ck_assert(!at_commander_run_script(&config, bytecode, length, &context));
+    // The set_baud, right after the header and the enter
+    ck_assert_int_eq(context.failed_at, 5);
+    ck_assert(strstr(write_buffer, "R,1\r") == NULL);
+}
+END_TEST
+
+START_TEST (test_script_compile_errors)
+{
+    uint8_t bytecode[8];
+    AtCommanderScriptError error;
+    ck_assert_int_eq(at_commander_compile_script("enter\nfly\n", bytecode,
+                sizeof(bytecode), &error), -1);
+    ck_assert_int_eq(error.line, 2);
+
+    ck_assert_int_eq(at_commander_compile_script("goto nowhere\n", bytecode,
+                sizeof(bytecode), &error), -1);
+    ck_assert_str_eq(error.message, "Jump to an undefined label");
+
+    ck_assert_int_eq(at_commander_compile_script(
+                "set_name \"A much too long name\"\n", bytecode,
+                sizeof(bytecode), &error), -1);
+    ck_assert_str_eq(error.message, "Bytecode buffer is too small");
+
+    ck_assert_int_eq(at_commander_compile_script("try delay 5\n", bytecode,
+                sizeof(bytecode), &error), -1);
+}
+END_TEST
+
+START_TEST (test_script_corrupt_bytecode)
+{
+    uint8_t bytecode[16];
+    AtCommanderScriptContext context;
+    int length = at_commander_compile_script("set_baud 115200\n", bytecode,
+            sizeof(bytecode), NULL);
+    ck_assert(!at_commander_run_script(&config, bytecode, length - 1,
+                &context));
+    ck_assert(!at_commander_run_script(&config, bytecode, 3, &context));
+    ck_assert_int_eq(write_index, 0);
+}
+END_TEST
+
+static uint8_t trace_buffer[256];
+static int trace_length;
+
+void trace_sink(void* context, const uint8_t* bytes, int length) {
+    ck_assert(trace_length + length <= (int)sizeof(trace_buffer));
+    memcpy(trace_buffer + trace_length, bytes, length);
+    trace_length += length;
+}
+
+START_TEST (test_trace_records_session)
+{
+    char* response = "CMD\r\nFOO\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+    trace_length = 0;
+
+    AtCommanderTraceRecorder recorder;
+    at_commander_trace_start(&config, &recorder, trace_sink, NULL);
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 3);
+    at_commander_trace_stop(&config, &recorder);
+    ck_assert(config.write_function == mock_write);
+
+    static const uint8_t expected[] = { 'A', 'T', 'T', AT_TRACE_VERSION,
+        AT_TRACE_BAUD, 0, 0x80, 0x4b,
+        AT_TRACE_TX, 0, 3, '$', '$', '$',
+        AT_TRACE_RX, 0, 3, 'C', 'M', 'D',
+        AT_TRACE_TX, 0, 3, 'G', 'N', '\r',
+        // Bytes are recorded as the library reads them, not as they arrive
+        AT_TRACE_RX, 0, 6, '\r', '\n', 'F', 'O', 'O', '\r' };
+    ck_assert_int_eq(trace_length, sizeof(expected));
+    ck_assert(!memcmp(trace_buffer, expected, sizeof(expected)));
+}
+END_TEST
+
+START_TEST (test_trace_replay)
+{
+    char* response = "CMD\r\nFOO\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+    trace_length = 0;
+
+    AtCommanderTraceRecorder recorder;
+    char name[20];
+    at_commander_trace_start(&config, &recorder, trace_sink, NULL);
+    at_commander_get_name(&config, name, sizeof(name));
+    at_commander_trace_stop(&config, &recorder);
+
+    AtCommanderTraceReplay replay;
+    setup();
+    ck_assert(at_commander_replay_start(&config, &replay, trace_buffer,
+                trace_length));
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 3);
+    ck_assert_str_eq(name, "FOO");
+    ck_assert(at_commander_replay_complete(&replay));
+}
+END_TEST
+
+START_TEST (test_trace_replay_diverges)
+{
+    char* response = "CMD\r\nFOO\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+    trace_length = 0;
+
+    AtCommanderTraceRecorder recorder;
+    char name[20];
+    at_commander_trace_start(&config, &recorder, trace_sink, NULL);
+    at_commander_get_name(&config, name, sizeof(name));
+    at_commander_trace_stop(&config, &recorder);
+
+    AtCommanderTraceReplay replay;
+    setup();
+    ck_assert(at_commander_replay_start(&config, &replay, trace_buffer,
+                trace_length));
+    // Sending a different request than the one recorded is caught
+    at_commander_get_device_id(&config, name, sizeof(name));
+    ck_assert(!at_commander_replay_complete(&replay));
+    ck_assert_int_eq(replay.mismatches, 1);
+}
+END_TEST
+
+START_TEST (test_trace_forwards_wait)
+{
+    static int device;
+    config.device = &device;
+    config.millis_function = mock_millis;
+    config.wait_function = mock_wait;
+    char response[] = "CMD\r\nF\0O\0O\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+    trace_length = 0;
+
+    AtCommanderTraceRecorder recorder;
+    char name[20];
+    at_commander_trace_start(&config, &recorder, trace_sink, NULL);
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 3);
+    // Waits go to the device the recorder wraps, not the recorder itself
+    ck_assert(wait_count > 0);
+    ck_assert(wait_device == &device);
+    at_commander_trace_stop(&config, &recorder);
+    ck_assert(config.wait_function == mock_wait);
+
+    AtCommanderTraceReplay replay;
+    ck_assert(at_commander_replay_start(&config, &replay, trace_buffer,
+                trace_length));
+    ck_assert(config.wait_function == NULL);
+}
+END_TEST
+
+START_TEST (test_trace_replay_bad_header)
+{
+    static const uint8_t trace[] = { 'A', 'T', 'S', AT_TRACE_VERSION };
+    AtCommanderTraceReplay replay;
+    ck_assert(!at_commander_replay_start(&config, &replay, trace,
+                sizeof(trace)));
+    ck_assert(config.write_function == mock_write);
+}
+END_TEST
+
+START_TEST (test_detect_rn42)
+{
+    char* response = "CMD\r\nVer 6.15 04/26/2013\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    char version[32];
+    config.platform = AT_PLATFORM_XBEE;
+    ck_assert(at_commander_detect_platform(&config, NULL, 0, version,
+                sizeof(version)));
+    ck_assert(config.connected);
+    ck_assert_str_eq(config.platform.enter_command_mode_command.request_format,
+            "$$$");
+    ck_assert_str_eq(version, "Ver 6.15 04/26/2013");
+    ck_assert_int_eq(initialized_baud_count, 1);
+}
+END_TEST
+
+START_TEST (test_detect_xbee_same_baud)
+{
+    // Nothing in reply to "$$$", then "OK" to "+++"
+    char response[] = "\0\0\0\0OK\r";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+
+    ck_assert(at_commander_detect_platform(&config, NULL, 0, NULL, 0));
+    ck_assert_str_eq(config.platform.enter_command_mode_command.request_format,
+            "+++");
+    ck_assert_int_eq(config.baud, 9600);
+    // Both escape sequences were tried without re-initializing the UART
+    ck_assert_int_eq(initialized_baud_count, 1);
+    ck_assert_str_eq(write_buffer, "$$$+++");
+}
+END_TEST
+
+START_TEST (test_detect_hayes_disables_echo)
+{
+    char* response = "AT\r\r\nOK\r\nATE0\r\r\nOK\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    config.silent_responses = 3;
+    static const AtCommanderPlatform* const candidates[] = {
+        &AT_PLATFORM_HAYES };
+    ck_assert(at_commander_detect_platform(&config, candidates, 1, NULL, 0));
+    ck_assert(config.connected);
+    ck_assert_int_eq(config.silent_responses, 0);
+    ck_assert_str_eq(write_buffer, "AT\rATE0\r");
+}
+END_TEST
+
+START_TEST (test_detect_nothing)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    static const AtCommanderPlatform* const candidates[] = {
+        &AT_PLATFORM_RN42 };
+    ck_assert(!at_commander_detect_platform(&config, candidates, 1, NULL, 0));
+    ck_assert(!config.connected);
+    ck_assert_str_eq(config.platform.enter_command_mode_command.request_format,
+            "+++");
+    ck_assert_int_eq(initialized_baud_count, VALID_BAUD_RATE_COUNT);
+}
+END_TEST
+
+#ifdef __linux__
+
+/** A module on the other end of a socket - in data mode it collects what it's
+ * sent, and answers the escape sequence and commands like an RN-42.
+ */
+typedef struct {
+    int fd;
+    char received[128];
+    int received_length;
+    volatile bool stop;
+} BridgedModule;
+
+void* run_bridged_module(void* argument) {
+    BridgedModule* module = (BridgedModule*) argument;
+    char line[32];
+    int line_length = 0;
+    while(!module->stop) {
+        struct pollfd fd = { module->fd, POLLIN, 0 };
+        char byte;
+        if(poll(&fd, 1, 10) <= 0 || read(module->fd, &byte, 1) != 1) {
+            continue;
+        }
+
+        module->received[module->received_length++] = byte;
+        line[line_length++] = byte;
+        line[line_length] = '\0';
+        const char* response = NULL;
+        if(line_length >= 3 && !strcmp(line + line_length - 3, "$$$")) {
+            response = "CMD\r\n";
+        } else if(!strcmp(line, "GN\r")) {
+            response = "FOO\r\n";
+        } else if(!strcmp(line, "---\r")) {
+            response = "END\r\n";
+        }
+
+        if(response != NULL) {
+            ck_assert(write(module->fd, response, strlen(response)) > 0);
+            line_length = 0;
+        } else if(byte == '\r' || line_length == sizeof(line) - 1) {
+            line_length = 0;
+        }
+    }
+    return NULL;
+}
+
+void bridged_get_name(AtCommanderConfig* config, void* context) {
+    ck_assert_int_eq(at_commander_get_name(config, (char*)context, 20), 3);
+}
+
+START_TEST (test_bridge_command_keeps_stream)
+{
+    int host[2], device[2];
+    ck_assert(!socketpair(AF_UNIX, SOCK_STREAM, 0, host));
+    ck_assert(!socketpair(AF_UNIX, SOCK_STREAM, 0, device));
+
+    AtCommanderTty tty = { device[0] };
+    at_commander_tty_config(&config, &tty);
+    config.platform.response_delay_ms = 10;
+
+    BridgedModule module;
+    memset(&module, 0, sizeof(module));
+    module.fd = device[1];
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_bridged_module, &module);
+
+    AtCommanderBridge bridge;
+    at_commander_bridge_init(&bridge, &config, host[1], device[0]);
+
+    ck_assert_int_eq(write(host[0], "abc", 3), 3);
+    while(bridge.to_device.bytes < 3) {
+        ck_assert(at_commander_bridge_poll(&bridge, 100) >= 0);
+    }
+
+    // Sent by the host while the stream is paused for a query
+    ck_assert_int_eq(write(host[0], "def", 3), 3);
+    char name[20];
+    ck_assert(at_commander_bridge_command(&bridge, bridged_get_name, name));
+    ck_assert_str_eq(name, "FOO");
+    ck_assert(!config.connected);
+
+    while(bridge.to_device.bytes < 6) {
+        ck_assert(at_commander_bridge_poll(&bridge, 100) >= 0);
+    }
+    usleep(20000);
+    module.stop = true;
+    pthread_join(thread, NULL);
+    module.received[module.received_length] = '\0';
+    ck_assert_str_eq(module.received, "abc$$$GN\r---\rdef");
+
+    // Data from the module reaches the host
+    ck_assert_int_eq(write(device[1], "xyz", 3), 3);
+    while(bridge.to_host.bytes < 3) {
+        ck_assert(at_commander_bridge_poll(&bridge, 100) >= 0);
+    }
+    char received[4] = { 0 };
+    ck_assert_int_eq(read(host[0], received, 3), 3);
+    ck_assert_str_eq(received, "xyz");
+
+    at_commander_bridge_close(&bridge);
+    close(host[0]);
+    ck_assert_int_eq(at_commander_bridge_poll(&bridge, 100), -1);
+    close(host[1]);
+    close(device[0]);
+    close(device[1]);
+}
+END_TEST
+
+// A device fed by another thread, that the library sleeps on for replies
+typedef struct {
+    pthread_mutex_t mutex;
+    AtCommanderWakeup wakeup;
+    char received[64];
+    int length;
+    int index;
+    int waits;
+} ThreadFedDevice;
+
+int thread_fed_read(void* device) {
+    ThreadFedDevice* fed = (ThreadFedDevice*) device;
+    pthread_mutex_lock(&fed->mutex);
+    int byte = fed->index < fed->length ? fed->received[fed->index++] : -1;
+    pthread_mutex_unlock(&fed->mutex);
+    return byte;
+}
+
+void thread_fed_wait(void* device, unsigned long ms) {
+    ThreadFedDevice* fed = (ThreadFedDevice*) device;
+    fed->waits++;
+    pthread_mutex_lock(&fed->mutex);
+    bool waiting = fed->index < fed->length;
+    pthread_mutex_unlock(&fed->mutex);
+    if(!waiting) {
+        at_commander_wakeup_wait(&fed->wakeup, ms);
+    }
+}
+
+void* feed_thread(void* argument) {
+    ThreadFedDevice* fed = (ThreadFedDevice*) argument;
+    const char* const replies[] = { "CMD\r\n", "00066646C2AF\r\n" };
+    int i;
+    for(i = 0; i < 2; i++) {
+        usleep(20000);
+        pthread_mutex_lock(&fed->mutex);
+        memcpy(fed->received + fed->length, replies[i], strlen(replies[i]));
+        fed->length += strlen(replies[i]);
+        pthread_mutex_unlock(&fed->mutex);
+        at_commander_wakeup_notify(&fed->wakeup);
+    }
+    return NULL;
+}
+
+START_TEST (test_wait_wakes_on_reply)
+{
+    ThreadFedDevice fed;
+    memset(&fed, 0, sizeof(fed));
+    pthread_mutex_init(&fed.mutex, NULL);
+    at_commander_wakeup_init(&fed.wakeup);
+    config.device = &fed;
+    config.read_function = thread_fed_read;
+    config.wait_function = thread_fed_wait;
+    config.millis_function = at_commander_tty_millis;
+    config.platform.response_delay_ms = 500;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, feed_thread, &fed);
+    unsigned long started_ms = at_commander_tty_millis();
+    char device_id[20];
+    ck_assert_int_eq(at_commander_get_device_id(&config, device_id,
+                sizeof(device_id)), 12);
+    // Not two whole response delays, and sleeping rather than polling
+    ck_assert(at_commander_tty_millis() - started_ms < 400);
+    ck_assert(fed.waits < 10);
+    pthread_join(thread, NULL);
+    at_commander_wakeup_destroy(&fed.wakeup);
+}
+END_TEST
+
+START_TEST (test_wait_timeout)
+{
+    AtCommanderWakeup wakeup;
+    at_commander_wakeup_init(&wakeup);
+    unsigned long started_ms = at_commander_tty_millis();
+    ck_assert(!at_commander_wakeup_wait(&wakeup, 30));
+    ck_assert(at_commander_tty_millis() - started_ms >= 29);
+
+    // Notified before waiting isn't lost
+    at_commander_wakeup_notify(&wakeup);
+    ck_assert(at_commander_wakeup_wait(&wakeup, 1000));
+    at_commander_wakeup_destroy(&wakeup);
+}
+END_TEST
+
+START_TEST (test_wait_tty_reply_ready)
+{
+    int device[2];
+    ck_assert(!socketpair(AF_UNIX, SOCK_STREAM, 0, device));
+    AtCommanderTty tty = { device[0] };
+    at_commander_tty_config(&config, &tty);
+    config.platform.response_delay_ms = 500;
+
+    const char* response = "CMD\r\n00066646C2AF\r\n";
+    ck_assert_int_eq(write(device[1], response, strlen(response)),
+            (int) strlen(response));
+    unsigned long started_ms = at_commander_tty_millis();
+    char device_id[20];
+    ck_assert_int_eq(at_commander_get_device_id(&config, device_id,
+                sizeof(device_id)), 12);
+    ck_assert(at_commander_tty_millis() - started_ms < 400);
+    close(device[0]);
+    close(device[1]);
+}
+END_TEST
+
+#endif
+
+// A read with no response gives up after 3 retries, 50ms apart
+#define READ_TIMEOUT_MS 150
+
+int count_occurrences(const char* haystack, const char* needle) {
+    int count = 0;
+    while((haystack = strstr(haystack, needle)) != NULL) {
+        count++;
+        haystack++;
+    }
+    return count;
+}
+
+START_TEST (test_retry_set)
+{
+    char* response = "CMD\r\nERR\r\nAOK\r\n";
+    read_message = response;
+    read_message_length = strlen(response);
+
+    config.retry_policies[AT_COMMANDER_RETRY_SET].max_attempts = 3;
+    ck_assert(at_commander_set_baud(&config, 115200));
+    ck_assert_int_eq(count_occurrences(write_buffer, "SU,"), 2);
+}
+END_TEST
+
+START_TEST (test_retry_get_backoff)
+{
+    char response[] = "CMD\r\n\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+
+    AtCommanderRetryPolicy policy = { 4, 10, 25, 0 };
+    config.retry_policies[AT_COMMANDER_RETRY_GET] = policy;
+    config.delay_function = mock_delay;
+    config.platform.response_delay_ms = 0;
+
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 0);
+    ck_assert_int_eq(count_occurrences(write_buffer, "GN\r"), 4);
+    // Backoffs of 10, 20 and 25 (capped) ms, on top of the read timeouts
+    ck_assert_int_eq(total_delay_ms, 10 + 20 + 25 +
+            4 * READ_TIMEOUT_MS);
+}
+END_TEST
+
+START_TEST (test_retry_jitter)
+{
+    AtCommanderRetryPolicy policy = { 2, 100, 0, 50 };
+    config.retry_policies[AT_COMMANDER_RETRY_GET] = policy;
+    config.delay_function = mock_delay;
+    config.platform.response_delay_ms = 0;
+    config.retry_seed = 12345;
+
+    char name[20];
+    read_message = "CMD\r\n";
+    read_message_length = 5;
+    at_commander_get_name(&config, name, sizeof(name));
+    unsigned long backoff = total_delay_ms - 2 * READ_TIMEOUT_MS;
+    ck_assert(backoff >= 50 && backoff <= 100);
+}
+END_TEST
+
+START_TEST (test_circuit_breaker)
+{
+    config.millis_function = mock_millis;
+    config.breaker_threshold = 2;
+    config.breaker_cool_down_ms = 1000;
+
+    ck_assert(!at_commander_enter_command_mode(&config));
+    ck_assert(!at_commander_circuit_open(&config));
+    ck_assert(!at_commander_enter_command_mode(&config));
+    ck_assert(at_commander_circuit_open(&config));
+
+    // Fails fast without touching the device
+    initialized_baud_count = 0;
+    write_index = 0;
+    ck_assert(!at_commander_enter_command_mode(&config));
+    ck_assert_int_eq(initialized_baud_count, 0);
+    ck_assert_int_eq(write_index, 0);
+
+    // After the cool down, a single probe at the last baud rate
+    mock_time_ms += 1000;
+    ck_assert(!at_commander_enter_command_mode(&config));
+    ck_assert_int_eq(initialized_baud_count, 1);
+    ck_assert(at_commander_circuit_open(&config));
+
+    mock_time_ms += 1000;
+    read_message = "CMD\r\n";
+    read_message_length = 5;
+    read_index = 0;
+    ck_assert(at_commander_enter_command_mode(&config));
+    ck_assert(!at_commander_circuit_open(&config));
+    ck_assert_int_eq(config.breaker_failures, 0);
+}
+END_TEST
+
+#ifdef __linux__
+
+void send_broker_request(int fd, int operation, int setting, int priority,
+        uint32_t id, const void* value, int value_length) {
+    uint8_t message[AT_BROKER_MAX_MESSAGE_LENGTH] = { AT_BROKER_PROTOCOL_VERSION,
+        (uint8_t) operation, (uint8_t) setting, (uint8_t) priority,
+        (uint8_t) id, (uint8_t)(id >> 8), (uint8_t)(id >> 16),
+        (uint8_t)(id >> 24) };
+    if(value_length > 0) {
+        memcpy(message + AT_BROKER_REQUEST_HEADER_LENGTH, value, value_length);
+    }
+    int length = AT_BROKER_REQUEST_HEADER_LENGTH + value_length;
+    ck_assert_int_eq(send(fd, message, length, 0), length);
+}
+
+/** Returns the status of the next response on the fd, after checking its id.
+ */
+int read_broker_response(int fd, uint32_t id, char* value) {
+    uint8_t message[AT_BROKER_MAX_MESSAGE_LENGTH];
+    int length = recv(fd, message, sizeof(message), MSG_DONTWAIT);
+    ck_assert(length >= AT_BROKER_RESPONSE_HEADER_LENGTH);
+    ck_assert_int_eq(message[0], AT_BROKER_PROTOCOL_VERSION);
+    ck_assert_int_eq(message[2] | message[3] << 8 | message[4] << 16 |
+            message[5] << 24, id);
+    if(value != NULL) {
+        memcpy(value, message + AT_BROKER_RESPONSE_HEADER_LENGTH,
+                length - AT_BROKER_RESPONSE_HEADER_LENGTH);
+        value[length - AT_BROKER_RESPONSE_HEADER_LENGTH] = '\0';
+    }
+    return message[1];
+}
+
+START_TEST (test_broker_coalesces_gets)
+{
+    read_message = "CMD\r\nFOO\r\n";
+    read_message_length = 10;
+
+    AtCommanderBroker broker;
+    at_commander_broker_init(&broker, &config);
+    int clients[3][2];
+    int i;
+    for(i = 0; i < 3; i++) {
+        ck_assert(!socketpair(AF_UNIX, SOCK_SEQPACKET, 0, clients[i]));
+        ck_assert(at_commander_broker_add_client(&broker, clients[i][1]));
+        send_broker_request(clients[i][0], AT_BROKER_GET, AT_BROKER_NAME, 0,
+                10 + i, NULL, 0);
+    }
+
+    ck_assert_int_eq(at_commander_broker_poll(&broker, 0), 3);
+    ck_assert_str_eq(write_buffer, "$$$GN\r");
+    for(i = 0; i < 3; i++) {
+        char name[AT_BROKER_MAX_VALUE_LENGTH + 1];
+        ck_assert_int_eq(read_broker_response(clients[i][0], 10 + i, name),
+                AT_BROKER_OK);
+        ck_assert_str_eq(name, "FOO");
+    }
+
+    AtCommanderBrokerStats stats;
+    at_commander_broker_stats(&broker, &stats);
+    ck_assert_int_eq(stats.requests, 3);
+    ck_assert_int_eq(stats.round_trips, 1);
+    ck_assert_int_eq(stats.coalesced, 2);
+    ck_assert_int_eq(stats.max_queue_depth, 1);
+    ck_assert_int_eq(stats.queue_depth, 0);
+    ck_assert_int_eq(stats.failures, 0);
+
+    at_commander_broker_close(&broker);
+    for(i = 0; i < 3; i++) {
+        close(clients[i][0]);
+    }
+}
+END_TEST
+
+START_TEST (test_broker_priority_and_batching)
+{
+    read_message = "CMD\r\nAOK\r\nAOK\r\nAOK\r\n";
+    read_message_length = 20;
+
+    AtCommanderBroker broker;
+    at_commander_broker_init(&broker, &config);
+    int client[2];
+    ck_assert(!socketpair(AF_UNIX, SOCK_SEQPACKET, 0, client));
+    ck_assert(at_commander_broker_add_client(&broker, client[1]));
+
+    const uint8_t baud[] = { 0x00, 0xc2, 0x01, 0x00 };
+    const uint8_t timer[] = { 30, 0, 0, 0 };
+    send_broker_request(client[0], AT_BROKER_SET, AT_BROKER_BAUD, 2, 1, baud,
+            sizeof(baud));
+    send_broker_request(client[0], AT_BROKER_SET, AT_BROKER_NAME, 1, 2, "BAR",
+            3);
+    send_broker_request(client[0], AT_BROKER_SET,
+            AT_BROKER_CONFIGURATION_TIMER, 0, 3, timer, sizeof(timer));
+    // There's no command to get the baud rate
+    send_broker_request(client[0], AT_BROKER_GET, AT_BROKER_BAUD, 0, 4, NULL,
+            0);
+
+    ck_assert_int_eq(at_commander_broker_poll(&broker, 0), 4);
+    // The name and timer are set in one session, after the more urgent baud
+    ck_assert_str_eq(write_buffer, "$$$SU,11\rSN,BAR\rST,30\r");
+    ck_assert_int_eq(config.device_baud, 115200);
+    ck_assert_int_eq(config.command_mode_timeout_s, 30);
+
+    ck_assert_int_eq(read_broker_response(client[0], 4, NULL),
+            AT_BROKER_INVALID);
+    ck_assert_int_eq(read_broker_response(client[0], 1, NULL), AT_BROKER_OK);
+    ck_assert_int_eq(read_broker_response(client[0], 2, NULL), AT_BROKER_OK);
+    ck_assert_int_eq(read_broker_response(client[0], 3, NULL), AT_BROKER_OK);
+
+    AtCommanderBrokerStats stats;
+    at_commander_broker_stats(&broker, &stats);
+    ck_assert_int_eq(stats.round_trips, 2);
+    ck_assert_int_eq(stats.batched, 2);
+    ck_assert_int_eq(stats.max_queue_depth, 3);
+    ck_assert_int_eq(stats.failures, 1);
+
+    at_commander_broker_close(&broker);
+    close(client[0]);
+}
+END_TEST
+
+static int late_client;
+
+// Another client asks for the name while the module is answering the first
+int read_with_late_request(void* device) {
+    if(late_client >= 0) {
+        send_broker_request(late_client, AT_BROKER_GET, AT_BROKER_NAME, 0, 2,
+                NULL, 0);
+        late_client = -1;
+    }
+    return mock_read(device);
+}
+
+START_TEST (test_broker_coalesces_in_flight)
+{
+    read_message = "CMD\r\nFOO\r\n";
+    read_message_length = 10;
+    config.read_function = read_with_late_request;
+
+    AtCommanderBroker broker;
+    at_commander_broker_init(&broker, &config);
+    int first[2], second[2];
+    ck_assert(!socketpair(AF_UNIX, SOCK_SEQPACKET, 0, first));
+    ck_assert(!socketpair(AF_UNIX, SOCK_SEQPACKET, 0, second));
+    ck_assert(at_commander_broker_add_client(&broker, first[1]));
+    ck_assert(at_commander_broker_add_client(&broker, second[1]));
+
+    late_client = second[0];
+    send_broker_request(first[0], AT_BROKER_GET, AT_BROKER_NAME, 0, 1, NULL,
+            0);
+    ck_assert_int_eq(at_commander_broker_poll(&broker, 0), 2);
+    ck_assert_int_eq(count_occurrences(write_buffer, "GN\r"), 1);
+
+    char name[AT_BROKER_MAX_VALUE_LENGTH + 1];
+    ck_assert_int_eq(read_broker_response(first[0], 1, name), AT_BROKER_OK);
+    ck_assert_str_eq(name, "FOO");
+    ck_assert_int_eq(read_broker_response(second[0], 2, name), AT_BROKER_OK);
+    ck_assert_str_eq(name, "FOO");
+
+    at_commander_broker_close(&broker);
+    close(first[0]);
+    close(second[0]);
+}
+END_TEST
+
+typedef struct {
+    AtCommanderBroker broker;
+    volatile bool stop;
+} RunningBroker;
+
+void* run_broker(void* argument) {
+    RunningBroker* running = (RunningBroker*) argument;
+    while(!running->stop) {
+        ck_assert(at_commander_broker_poll(&running->broker, 10) >= 0);
+    }
+    return NULL;
+}
+
+START_TEST (test_broker_socket_clients)
+{
+    read_message = "CMD\r\nFOO\r\nAOK\r\n";
+    read_message_length = 15;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/atcommander-test-%d.sock", getpid());
+    RunningBroker running;
+    running.stop = false;
+    at_commander_broker_init(&running.broker, &config);
+    ck_assert(at_commander_broker_listen(&running.broker, path));
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_broker, &running);
+
+    int fd = at_commander_broker_connect(path);
+    ck_assert(fd >= 0);
+    char name[AT_BROKER_MAX_VALUE_LENGTH + 1];
+    ck_assert_int_eq(at_commander_broker_request(fd, AT_BROKER_GET,
+                AT_BROKER_NAME, 0, NULL, 0, name, sizeof(name)),
+            AT_BROKER_OK);
+    ck_assert_str_eq(name, "FOO");
+    ck_assert_int_eq(at_commander_broker_request(fd, AT_BROKER_SET,
+                AT_BROKER_NAME, 0, "BAR", 0, NULL, 0), AT_BROKER_OK);
+
+    AtCommanderBrokerStats stats;
+    ck_assert(at_commander_broker_get_stats(fd, &stats));
+    ck_assert_int_eq(stats.requests, 2);
+    ck_assert_int_eq(stats.round_trips, 2);
+    ck_assert_int_eq(stats.queue_depth, 0);
+
+    running.stop = true;
+    pthread_join(thread, NULL);
+    close(fd);
+    at_commander_broker_close(&running.broker);
+    ck_assert(access(path, F_OK) != 0);
+}
+END_TEST
+
+START_TEST (test_publish_state)
+{
+    read_message = "CMD\r\nFOO\r\n";
+    read_message_length = 10;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/atcommander-test-%d.state", getpid());
+    AtCommanderPublisher publisher;
+    ck_assert(at_commander_publish_start(&config, &publisher, path));
+    const AtCommanderPublishedRegion* region =
+            at_commander_published_open(path);
+    ck_assert(region != NULL);
+
+    AtCommanderPublishedState state;
+    ck_assert(at_commander_published_read(region, &state));
+    ck_assert(state.active);
+    ck_assert(!state.connected);
+    ck_assert_int_eq(state.baud, 9600);
+    ck_assert_int_eq(state.operations, 0);
+
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 3);
+    at_commander_publish_identity(&publisher, name, NULL);
+    ck_assert(at_commander_published_read(region, &state));
+    ck_assert(state.connected);
+    ck_assert_str_eq(state.name, "FOO");
+    ck_assert_str_eq(state.device_id, "");
+    ck_assert_int_eq(state.bytes_written, 6);
+    ck_assert_int_eq(state.bytes_read, read_index);
+    ck_assert_int_eq(state.operations, 1);
+
+    at_commander_publish_error(&publisher, "Unable to change name");
+    ck_assert(at_commander_published_read(region, &state));
+    ck_assert_str_eq(state.last_error, "Unable to change name");
+    ck_assert_int_eq(state.errors, 1);
+
+    at_commander_publish_stop(&publisher);
+    ck_assert(config.write_function == mock_write);
+    ck_assert(at_commander_published_read(region, &state));
+    ck_assert(!state.active);
+    at_commander_published_close(region);
+    unlink(path);
+}
+END_TEST
+
+START_TEST (test_publish_forwards_wait)
+{
+    static int device;
+    config.device = &device;
+    config.millis_function = mock_millis;
+    config.wait_function = mock_wait;
+    char response[] = "CMD\r\nF\0O\0O\r\n";
+    read_message = response;
+    read_message_length = sizeof(response) - 1;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/atcommander-test-%d.state", getpid());
+    AtCommanderPublisher publisher;
+    ck_assert(at_commander_publish_start(&config, &publisher, path));
+    char name[20];
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 3);
+    ck_assert(wait_count > 0);
+    ck_assert(wait_device == &device);
+    at_commander_publish_stop(&publisher);
+    ck_assert(config.wait_function == mock_wait);
+    unlink(path);
+}
+END_TEST
+
+typedef struct {
+    AtCommanderPublisher publisher;
+    volatile bool stop;
+} PublishingWriter;
+
+void* publish_identities(void* argument) {
+    PublishingWriter* writer = (PublishingWriter*) argument;
+    int i;
+    for(i = 0; !writer->stop; i++) {
+        if(i % 2) {
+            at_commander_publish_identity(&writer->publisher, "AAAAAAAA",
+                    "1111");
+        } else {
+            at_commander_publish_identity(&writer->publisher, "BBBB",
+                    "22222222");
+        }
+    }
+    return NULL;
+}
+
+START_TEST (test_publish_snapshots_consistent)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/atcommander-test-%d.state", getpid());
+    PublishingWriter writer;
+    writer.stop = false;
+    ck_assert(at_commander_publish_start(&config, &writer.publisher, path));
+    const AtCommanderPublishedRegion* region =
+            at_commander_published_open(path);
+    ck_assert(region != NULL);
+    pthread_t thread;
+    pthread_create(&thread, NULL, publish_identities, &writer);
+
+    int i;
+    for(i = 0; i < 100000; i++) {
+        AtCommanderPublishedState state;
+        ck_assert(at_commander_published_read(region, &state));
+        if(state.name[0] == 'A') {
+            ck_assert_str_eq(state.device_id, "1111");
+        } else if(state.name[0] == 'B') {
+            ck_assert_str_eq(state.device_id, "22222222");
+        }
+    }
+
+    writer.stop = true;
+    pthread_join(thread, NULL);
+    at_commander_publish_stop(&writer.publisher);
+    at_commander_published_close(region);
+    unlink(path);
+}
+END_TEST
+
+
+#endif
+
+Suite* suite(void) {
+    Suite* s = suite_create("atcommander");
+    TCase *tc_enter_command_mode = tcase_create("enter_command_mode");
+    tcase_add_checked_fixture(tc_enter_command_mode, setup, NULL);
+    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_success);
+    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_already_active);
+    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_fail_bad_response);
+    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_fail_no_response);
+    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_at_baud);
+    suite_add_tcase(s, tc_enter_command_mode);
+
+    TCase *tc_exit_command_mode = tcase_create("exit_command_mode");
+    tcase_add_checked_fixture(tc_exit_command_mode, setup, NULL);
     tcase_add_test(tc_exit_command_mode, test_exit_command_mode_success);
     tcase_add_test(tc_exit_command_mode, test_exit_command_mode_fail_bad_response);
     tcase_add_test(tc_exit_command_mode, test_exit_command_mode_fail_no_response);
@@ -318,6 +3085,78 @@ Suite* suite(void) {
     tcase_add_test(tc_set_baud, test_set_baud_no_response);
     suite_add_tcase(s, tc_set_baud);
 
+    TCase *tc_switch_baud = tcase_create("switch_baud");
+    tcase_add_checked_fixture(tc_switch_baud, setup, NULL);
+    tcase_add_test(tc_switch_baud, test_switch_baud_success);
+    tcase_add_test(tc_switch_baud, test_switch_baud_no_answer);
+    tcase_add_test(tc_switch_baud, test_switch_baud_xbee_exits);
+    tcase_add_test(tc_switch_baud, test_switch_baud_unchanged);
+    suite_add_tcase(s, tc_switch_baud);
+
+    TCase *tc_inquiry = tcase_create("inquiry");
+    tcase_add_checked_fixture(tc_inquiry, setup, NULL);
+    tcase_add_test(tc_inquiry, test_inquiry_parse_lines);
+    tcase_add_test(tc_inquiry, test_inquiry_dropped_lines);
+    tcase_add_test(tc_inquiry, test_inquiry_streamed);
+    tcase_add_test(tc_inquiry, test_inquiry_max_results);
+    tcase_add_test(tc_inquiry, test_inquiry_no_end_marker);
+    tcase_add_test(tc_inquiry, test_inquiry_unsupported);
+    suite_add_tcase(s, tc_inquiry);
+
+    TCase *tc_link_sampler = tcase_create("link_sampler");
+    tcase_add_checked_fixture(tc_link_sampler, link_sampler_setup, NULL);
+    tcase_add_test(tc_link_sampler, test_link_sample_xbee);
+    tcase_add_test(tc_link_sampler, test_link_sample_needs_session);
+    tcase_add_test(tc_link_sampler, test_link_sample_interval_and_budget);
+    tcase_add_test(tc_link_sampler, test_link_sample_rn42_stops_reports);
+    tcase_add_test(tc_link_sampler, test_link_sample_rn42_paced);
+    tcase_add_test(tc_link_sampler, test_link_sample_rn42_drains_late_report);
+    tcase_add_test(tc_link_sampler, test_link_sample_error);
+    tcase_add_test(tc_link_sampler, test_link_stats);
+    suite_add_tcase(s, tc_link_sampler);
+
+    TCase *tc_reset = tcase_create("reset");
+    tcase_add_checked_fixture(tc_reset, setup, NULL);
+    tcase_add_test(tc_reset, test_reset_signature_in_response);
+    tcase_add_test(tc_reset, test_reset_signature_in_set_response);
+    tcase_add_test(tc_reset, test_reset_garbled_response);
+    tcase_add_test(tc_reset, test_reset_silence);
+    tcase_add_test(tc_reset, test_reset_detect_data_mode);
+    tcase_add_test(tc_reset, test_reset_signatures_follow_platform);
+    tcase_add_test(tc_reset, test_reset_snapshot_recorded);
+    tcase_add_test(tc_reset, test_reset_restores_unstored);
+    tcase_add_test(tc_reset, test_reset_restores_baud);
+    suite_add_tcase(s, tc_reset);
+
+    TCase *tc_hayes = tcase_create("hayes");
+    tcase_add_checked_fixture(tc_hayes, setup, NULL);
+    tcase_add_test(tc_hayes, test_hayes_enter_command_mode_disables_echo);
+    tcase_add_test(tc_hayes, test_hayes_get_skips_echo);
+    tcase_add_test(tc_hayes, test_hayes_get_error_result_code);
+    tcase_add_test(tc_hayes, test_hayes_get_lines);
+    tcase_add_test(tc_hayes, test_hayes_slow_final_result);
+    tcase_add_test(tc_hayes, test_hayes_set_baud);
+    tcase_add_test(tc_hayes, test_hayes_exit_command_mode);
+    suite_add_tcase(s, tc_hayes);
+
+    TCase *tc_dma = tcase_create("dma_uart");
+    tcase_add_checked_fixture(tc_dma, dma_setup, NULL);
+    tcase_add_test(tc_dma, test_dma_transmit_double_buffered);
+    tcase_add_test(tc_dma, test_dma_transmit_full);
+    tcase_add_test(tc_dma, test_dma_receive_wraps);
+    tcase_add_test(tc_dma, test_dma_receive_overrun);
+    tcase_add_test(tc_dma, test_dma_idle_line);
+    tcase_add_test(tc_dma, test_dma_library_transport);
+    suite_add_tcase(s, tc_dma);
+
+    TCase *tc_throughput = tcase_create("throughput");
+    tcase_add_checked_fixture(tc_throughput, loopback_setup, NULL);
+    tcase_add_test(tc_throughput, test_throughput_clean);
+    tcase_add_test(tc_throughput, test_throughput_errors);
+    tcase_add_test(tc_throughput, test_throughput_lost_tail);
+    tcase_add_test(tc_throughput, test_throughput_needs_clock);
+    suite_add_tcase(s, tc_throughput);
+
     TCase *tc_get_device_id = tcase_create("get_device_id");
     tcase_add_checked_fixture(tc_get_device_id, setup, NULL);
     tcase_add_test(tc_get_device_id, test_get_device_id_success);
@@ -335,7 +3174,138 @@ Suite* suite(void) {
     TCase *tc_xbee = tcase_create("xbee");
     tcase_add_checked_fixture(tc_xbee, setup, NULL);
     tcase_add_test(tc_xbee, test_xbee_enter_command_mode_success);
+    tcase_add_test(tc_xbee, test_xbee_guard_time_partially_idle);
+    tcase_add_test(tc_xbee, test_xbee_guard_time_already_idle);
+    tcase_add_test(tc_xbee, test_xbee_guard_time_no_clock);
     suite_add_tcase(s, tc_xbee);
+
+    TCase *tc_batch = tcase_create("batch");
+    tcase_add_checked_fixture(tc_batch, setup, NULL);
+    tcase_add_test(tc_batch, test_xbee_batch_chained);
+    tcase_add_test(tc_batch, test_xbee_batch_error);
+    tcase_add_test(tc_batch, test_xbee_batch_split_lines);
+    tcase_add_test(tc_batch, test_xbee_batch_sent_twice);
+    tcase_add_test(tc_batch, test_batch_unchained);
+    suite_add_tcase(s, tc_batch);
+
+    TCase *tc_session = tcase_create("session");
+    tcase_add_checked_fixture(tc_session, setup, NULL);
+    tcase_add_test(tc_session, test_enter_command_mode_last_baud_first);
+    tcase_add_test(tc_session, test_session_expired);
+    tcase_add_test(tc_session, test_session_about_to_expire);
+    tcase_add_test(tc_session, test_session_still_valid);
+    tcase_add_test(tc_session, test_session_configuration_timer);
+    tcase_add_test(tc_session, test_session_idle_exit);
+    suite_add_tcase(s, tc_session);
+
+    TCase *tc_deadline = tcase_create("deadline");
+    tcase_add_checked_fixture(tc_deadline, setup, NULL);
+    tcase_add_test(tc_deadline, test_deadline_limits_baud_scan);
+    tcase_add_test(tc_deadline, test_deadline_met);
+    tcase_add_test(tc_deadline, test_read_timeout_measured_by_clock);
+    tcase_add_test(tc_deadline, test_deadline_passed_before_request);
+    suite_add_tcase(s, tc_deadline);
+
+    TCase *tc_settings = tcase_create("settings");
+    tcase_add_checked_fixture(tc_settings, setup, NULL);
+    tcase_add_test(tc_settings, test_get_settings);
+    tcase_add_test(tc_settings, test_get_settings_error);
+    tcase_add_test(tc_settings, test_get_settings_unsupported);
+    tcase_add_test(tc_settings, test_get_lines_end_marker);
+    suite_add_tcase(s, tc_settings);
+
+    TCase *tc_matcher = tcase_create("matcher");
+    tcase_add_checked_fixture(tc_matcher, setup, NULL);
+    tcase_add_test(tc_matcher, test_matcher_patterns);
+    tcase_add_test(tc_matcher, test_matcher_early_verdict);
+    tcase_add_test(tc_matcher, test_matcher_too_many_patterns);
+    tcase_add_test(tc_matcher, test_set_alternative_success);
+    tcase_add_test(tc_matcher, test_set_error_stops_early);
+    tcase_add_test(tc_matcher, test_get_name_alternative_error);
+    tcase_add_test(tc_matcher, test_matcher_escape);
+    tcase_add_test(tc_matcher, test_get_name_one_character);
+    tcase_add_test(tc_matcher, test_get_name_paced);
+    tcase_add_test(tc_matcher, test_get_without_error_response);
+    suite_add_tcase(s, tc_matcher);
+
+    TCase *tc_script = tcase_create("script");
+    tcase_add_checked_fixture(tc_script, setup, NULL);
+    tcase_add_test(tc_script, test_script_provisioning);
+    tcase_add_test(tc_script, test_script_conditional_jump);
+    tcase_add_test(tc_script, test_script_retry);
+    tcase_add_test(tc_script, test_script_failure_stops);
+    tcase_add_test(tc_script, test_script_compile_errors);
+    tcase_add_test(tc_script, test_script_corrupt_bytecode);
+    suite_add_tcase(s, tc_script);
+
+    TCase *tc_scan = tcase_create("scan");
+    tcase_add_checked_fixture(tc_scan, setup, NULL);
+    tcase_add_test(tc_scan, test_scan_every_position);
+    tcase_add_test(tc_scan, test_scan_copy_every_position);
+    tcase_add_test(tc_scan, test_scan_command_first_bytes);
+    tcase_add_test(tc_scan, test_read_chunked);
+    tcase_add_test(tc_scan, test_read_chunked_fills_buffer);
+    suite_add_tcase(s, tc_scan);
+
+    TCase *tc_trace = tcase_create("trace");
+    tcase_add_checked_fixture(tc_trace, setup, NULL);
+    tcase_add_test(tc_trace, test_trace_records_session);
+    tcase_add_test(tc_trace, test_trace_replay);
+    tcase_add_test(tc_trace, test_trace_replay_diverges);
+    tcase_add_test(tc_trace, test_trace_replay_bad_header);
+    tcase_add_test(tc_trace, test_trace_forwards_wait);
+    suite_add_tcase(s, tc_trace);
+
+    TCase *tc_detect = tcase_create("detect");
+    tcase_add_checked_fixture(tc_detect, setup, NULL);
+    tcase_add_test(tc_detect, test_detect_rn42);
+    tcase_add_test(tc_detect, test_detect_xbee_same_baud);
+    tcase_add_test(tc_detect, test_detect_hayes_disables_echo);
+    tcase_add_test(tc_detect, test_detect_nothing);
+    suite_add_tcase(s, tc_detect);
+
+#ifdef __linux__
+    TCase *tc_bridge = tcase_create("bridge");
+    tcase_add_checked_fixture(tc_bridge, setup, NULL);
+    tcase_add_test(tc_bridge, test_bridge_command_keeps_stream);
+    suite_add_tcase(s, tc_bridge);
+
+    TCase *tc_wait = tcase_create("wait");
+    tcase_add_checked_fixture(tc_wait, setup, NULL);
+    tcase_add_test(tc_wait, test_wait_wakes_on_reply);
+    tcase_add_test(tc_wait, test_wait_timeout);
+    tcase_add_test(tc_wait, test_wait_tty_reply_ready);
+    suite_add_tcase(s, tc_wait);
+#endif
+
+    TCase *tc_retry = tcase_create("retry");
+    tcase_add_checked_fixture(tc_retry, setup, NULL);
+    tcase_add_test(tc_retry, test_retry_set);
+    tcase_add_test(tc_retry, test_retry_get_backoff);
+    tcase_add_test(tc_retry, test_retry_jitter);
+    tcase_add_test(tc_retry, test_circuit_breaker);
+    suite_add_tcase(s, tc_retry);
+
+#ifdef __linux__
+    TCase *tc_broker = tcase_create("broker");
+    tcase_add_checked_fixture(tc_broker, setup, NULL);
+    tcase_add_test(tc_broker, test_broker_coalesces_gets);
+    tcase_add_test(tc_broker, test_broker_priority_and_batching);
+    tcase_add_test(tc_broker, test_broker_coalesces_in_flight);
+    tcase_add_test(tc_broker, test_broker_socket_clients);
+    suite_add_tcase(s, tc_broker);
+
+    TCase *tc_publish = tcase_create("publish");
+    tcase_add_checked_fixture(tc_publish, setup, NULL);
+    tcase_add_test(tc_publish, test_publish_state);
+    tcase_add_test(tc_publish, test_publish_forwards_wait);
+    tcase_add_test(tc_publish, test_publish_snapshots_consistent);
+    suite_add_tcase(s, tc_publish);
+#endif
+
+    TCase *tc_threads = tcase_create("threads");
+    tcase_add_test(tc_threads, test_stress_shared_devices);
+    suite_add_tcase(s, tc_threads);
     return s;
 }
 
@@ -0,0 +1,82 @@
+/* Compile a provisioning script to bytecode, either as a binary file for
+ * at_commander_run_script to load at runtime, or as a C array to build into
+ * firmware (flash).
+ *
+ *      atscriptc provision.ats provision.atb
+ *      atscriptc -c PROVISIONING_SCRIPT provision.ats provision.h
+ */
+#include "atscript.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_SOURCE_LENGTH 16384
+#define MAX_BYTECODE_LENGTH 4096
+
+static char source[MAX_SOURCE_LENGTH];
+static uint8_t bytecode[MAX_BYTECODE_LENGTH];
+
+static void usage() {
+    fprintf(stderr, "usage: atscriptc [-c array_name] script output\n");
+}
+
+static bool write_array(FILE* output, const char* name, int length) {
+    int i;
+    fprintf(output, "// Generated by atscriptc - do not edit.\n");
+    fprintf(output, "static const uint8_t %s[%d] = {", name, length);
+    for(i = 0; i < length; i++) {
+        fprintf(output, "%s0x%02x,", i % 12 == 0 ? "\n    " : " ",
+                bytecode[i]);
+    }
+    return fprintf(output, "\n};\n") > 0;
+}
+
+int main(int argc, char** argv) {
+    const char* array_name = NULL;
+    int argument = 1;
+    if(argc > 2 && !strcmp(argv[1], "-c")) {
+        array_name = argv[2];
+        argument = 3;
+    }
+    if(argc - argument != 2) {
+        usage();
+        return 2;
+    }
+
+    FILE* input = fopen(argv[argument], "r");
+    if(input == NULL) {
+        perror(argv[argument]);
+        return 1;
+    }
+    size_t source_length = fread(source, 1, sizeof(source) - 1, input);
+    bool truncated = !feof(input);
+    fclose(input);
+    if(truncated) {
+        fprintf(stderr, "%s: script is too long\n", argv[argument]);
+        return 1;
+    }
+    source[source_length] = '\0';
+
+    AtCommanderScriptError error;
+    int length = at_commander_compile_script(source, bytecode,
+            sizeof(bytecode), &error);
+    if(length < 0) {
+        fprintf(stderr, "%s:%d: %s\n", argv[argument], error.line,
+                error.message);
+        return 1;
+    }
+
+    FILE* output = fopen(argv[argument + 1], array_name != NULL ? "w" : "wb");
+    if(output == NULL) {
+        perror(argv[argument + 1]);
+        return 1;
+    }
+    bool written = array_name != NULL ? write_array(output, array_name, length)
+            : fwrite(bytecode, 1, length, output) == (size_t)length;
+    if(fclose(output) != 0 || !written) {
+        fprintf(stderr, "%s: unable to write bytecode\n", argv[argument + 1]);
+        return 1;
+    }
+    printf("%s: %d bytes of bytecode\n", argv[argument + 1], length);
+    return 0;
+}
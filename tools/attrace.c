@@ -0,0 +1,98 @@
+/* Print a session trace recorded with at_commander_trace_start as text, one
+ * record per line:
+ *
+ *      attrace session.att
+ *      +0ms baud 9600
+ *      +0ms tx "$$$"
+ *      +12ms rx "CMD\r\n"
+ */
+#include "attrace.h"
+
+#include <stdio.h>
+
+#define MAX_TRACE_LENGTH (1024 * 1024)
+
+static uint8_t trace[MAX_TRACE_LENGTH];
+
+static int read_varint(int length, int offset, unsigned long* value) {
+    int shift = 0;
+    *value = 0;
+    while(offset < length && shift < 35) {
+        uint8_t byte = trace[offset++];
+        *value |= (unsigned long)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) {
+            return offset;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+static void print_bytes(const uint8_t* bytes, unsigned long length) {
+    unsigned long i;
+    putchar('"');
+    for(i = 0; i < length; i++) {
+        if(bytes[i] == '\r') {
+            printf("\\r");
+        } else if(bytes[i] == '\n') {
+            printf("\\n");
+        } else if(bytes[i] == '"' || bytes[i] == '\\') {
+            printf("\\%c", bytes[i]);
+        } else if(bytes[i] < 0x20 || bytes[i] > 0x7e) {
+            printf("\\x%02x", bytes[i]);
+        } else {
+            putchar(bytes[i]);
+        }
+    }
+    printf("\"\n");
+}
+
+int main(int argc, char** argv) {
+    if(argc != 2) {
+        fprintf(stderr, "usage: attrace trace\n");
+        return 2;
+    }
+
+    FILE* input = fopen(argv[1], "rb");
+    if(input == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    int length = fread(trace, 1, sizeof(trace), input);
+    fclose(input);
+
+    if(length < AT_TRACE_HEADER_LENGTH || trace[0] != 'A' || trace[1] != 'T'
+            || trace[2] != 'T' || trace[3] != AT_TRACE_VERSION) {
+        fprintf(stderr, "%s: not a version %d trace\n", argv[1],
+                AT_TRACE_VERSION);
+        return 1;
+    }
+
+    int offset = AT_TRACE_HEADER_LENGTH;
+    unsigned long time_ms = 0;
+    while(offset < length) {
+        unsigned long delta_ms, value;
+        int type = trace[offset];
+        offset = read_varint(length, offset + 1, &delta_ms);
+        if(offset < 0 || (offset = read_varint(length, offset, &value)) < 0
+                || ((type == AT_TRACE_TX || type == AT_TRACE_RX) &&
+                    value > (unsigned long)(length - offset))) {
+            fprintf(stderr, "%s: truncated record\n", argv[1]);
+            return 1;
+        }
+
+        time_ms += delta_ms;
+        printf("+%lums ", time_ms);
+        if(type == AT_TRACE_BAUD) {
+            printf("baud %lu\n", value);
+        } else if(type == AT_TRACE_TX || type == AT_TRACE_RX) {
+            printf(type == AT_TRACE_TX ? "tx " : "rx ");
+            print_bytes(trace + offset, value);
+            offset += value;
+        } else {
+            fprintf(stderr, "%s: unknown record type %d\n", argv[1], type);
+            return 1;
+        }
+    }
+    return 0;
+}